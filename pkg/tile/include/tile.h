@@ -9,16 +9,23 @@
 #include "tile/screen.h"
 #include "tile/brush.h"
 #include "tile/view.h"
+#include "tile/vertex.h"
 #include "tile/surface.h"
+#include "tile/mesh.h"
 #include "tile/light.h"
+#include "tile/transform.h"
 #include "tile/entity.h"
+#include "tile/scene.h"
+#include "tile/stream.h"
 #include "tile/event.h"
 #include "tile/camera.h"
 #include "tile/shapes.h"
 #include "tile/net.h"
 #include "tile/window.h"
 #include "tile/system.h"
+#include "tile/job.h"
 #include "tile/engine.h"
+#include "tile/console.h"
 
 #endif
 
@@ -73,10 +73,24 @@ typedef enum {
  */
 typedef struct TL_CACHELINE_ALIGNED TlBrush_s {
 	int refCnt;
+	/* small number unique among live brushes (used by the render queue's sort keys) */
+	TlU32 id;
 
+	/* set by tlInternBrush() */
 	struct {
-		GLuint vert, frag;
+		TlBool isInterned:1;
+		TlU32 hash;
+		struct TlBrush_s *next;
+	} intern;
+
+	struct {
+		/* which stages the program was given source for */
+		TlBool hasVert:1;
+		TlBool hasFrag:1;
+		/* shared by every brush with the same source (see tlR_AcquireProgram) */
 		GLuint prog;
+		/* constant blocks the program reads (see tlR_GetProgramBlocks) */
+		TlU32 blocks;
 	} shader;
 
 	struct {
@@ -89,6 +103,9 @@ typedef struct TL_CACHELINE_ALIGNED TlBrush_s {
 		TlBool useAmbient:1;
 		TlBool useEmissive:1;
 		TlBool useSpecular:1;
+
+		/* the material has changed since the render queue last uploaded it */
+		TlBool isDirty:1;
 	} lighting;
 
 	struct {
@@ -119,6 +136,26 @@ TlBrush *tlDeleteBrush(TlBrush *brush);
 /* Increment the reference count of a brush. This prevents delete from immediately destroying it. */
 void tlRetainBrush(TlBrush *brush);
 
+/*
+ * Retrieve the one brush kept for the given brush's settings (its shader,
+ * lighting and drawing state), so that identical brushes become one brush. If
+ * an interned brush already has those settings, the given brush is deleted and
+ * that one is returned; otherwise the given brush is interned and returned.
+ * Intern a brush before adding it to any surface. An interned brush is shared,
+ * so changing it changes everything drawn with it (and it's no longer found by
+ * its old settings).
+ */
+TlBrush *tlInternBrush(TlBrush *brush);
+/* Retrieve the brush's id, a small number no other live brush has. */
+TlU32 tlGetBrushId(const TlBrush *brush);
+
+/* Retrieve a handle to a brush, which resolves to NULL once the brush is deleted. */
+TlHandle tlGetBrushHandle(const TlBrush *brush);
+/* Retrieve the brush a handle refers to, or NULL if it's been deleted. */
+TlBrush *tlBrushFromHandle(TlHandle h);
+/* Retrieve the live and peak brush counts (and other stats of the brush pool). */
+void tlGetBrushPoolStats(TlPoolStats *stats);
+
 /* Set the vertex and fragment shaders of a brush. */
 void tlSetBrushShader(TlBrush *brush, const char *vertSrc, const char *fragSrc);
 /* Check whether a vertex shader is attached to a given brush. */
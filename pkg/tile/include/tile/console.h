@@ -3,6 +3,7 @@
 
 #include "const.h"
 #include "math.h"
+#include "system.h"
 
 TILE_EXTRNC_ENTER
 
@@ -21,34 +22,71 @@ enum {
 	kTlNumConColors
 };
 
+/*
+ * Scrollback is a ring of fixed-size line records, allocated once for the
+ * capacity given to tlCon_SetScrollback() (TL_DEVCON_DEFAULT_LINES to start).
+ * Once it's full, each new line takes the place of the oldest, so printing
+ * never allocates or moves text around, however much is printed.
+ */
 #define TL_DEVCON_COLUMNS				80
-#define TL_DEVCON_ROWS					0x4000
-#define TL_DEVCON_TEXT					(TL_DEVCON_COLUMNS*TL_DEVCON_ROWS)
+#define TL_DEVCON_DEFAULT_LINES			0x1000
+#define TL_DEVCON_MAX_SPANS				8		/*color changes kept per line*/
+#define TL_DEVCON_PRINT					0x400	/*longest single print; the rest is cut*/
 #define TL_DEVCON_COMMAND				0x100
 #define TL_DEVCON_PROMPT				0x20
 
+typedef struct TlDevconSpan_s {
+	TlU8 start;						/*column the color starts at*/
+	TlU8 color;						/*palette index*/
+} TlDevconSpan;
+
+typedef struct TlDevconLine_s {
+	char text[TL_DEVCON_COLUMNS];
+	TlU8 length;					/*columns written*/
+	TlU8 numSpans;					/*color runs; the last runs to the end of the line*/
+	TlDevconSpan spans[TL_DEVCON_MAX_SPANS];
+} TlDevconLine;
+
+typedef struct TlDevconStats_s {
+	/*lines the ring holds, and how many of them are in use*/
+	TlU32 capacity;
+	TlU32 numLines;
+	/*lines started since tlCon_Init(), and how many of those have been overwritten*/
+	TlU64 numLinesTotal;
+	TlU64 numLinesDropped;
+	/*prints cut to TL_DEVCON_PRINT characters*/
+	TlU64 numTruncated;
+	/*bytes held by the scrollback; fixed by the capacity*/
+	size_t numBytes;
+} TlDevconStats;
+
 typedef struct TlDevcon_s {
 	TlColor palette[kTlNumConColors];
 	int curPalette;					/*current palette color index*/
 
 	int visible;					/*is the console visible at all?*/
-	int height;						/*height of the console in pixels*/
+	int height;						/*height of the console in pixels (0 = half the window)*/
 
-	int curRow;						/*which row are we currently viewing? (bottom)*/
+	int curRow;						/*how many lines back from the newest we're viewing (bottom)*/
 	int visRows;					/*how many rows are visible?*/
-	int numRows;					/*how many rows have been written?*/
 
-	int curText;					/*index into the text buffer*/
+	TlDevconLine *lines;			/*scrollback ring*/
+	TlU32 capacity;					/*lines in the ring*/
+	TlU32 head;						/*newest line (the one being written)*/
+	TlU32 numLines;					/*lines in use, up to capacity*/
+	TlBool lineBreak;				/*start a new line before the next character*/
 
-	unsigned short text[TL_DEVCON_TEXT]; /*text buffer*/
+	TlU64 numLinesTotal;
+	TlU64 numLinesDropped;
+	TlU64 numTruncated;
+
+	TlMutex lock;					/*guards the scrollback; prints can come from any thread*/
 
 	char prompt[TL_DEVCON_PROMPT];		/*prompt*/
 	char command[TL_DEVCON_COMMAND];	/*command buffer*/
 	char autocomplete[TL_DEVCON_COMMAND]; /*autocomplete*/
 
 	int curCommand;					/*current index in the command buffer*/
-
-	GLuint fontImage;				/*built-in font*/
 } TlDevcon;
 
 extern int tl__g_devconAlive;
@@ -69,6 +107,13 @@ void tlCon_Init();
  */
 void tlCon_Fini();
 
+/*
+ * Set how many lines of scrollback to keep (0 = TL_DEVCON_DEFAULT_LINES). This
+ * is the only place the scrollback is allocated; the newest lines are kept if
+ * it shrinks.
+ */
+void tlCon_SetScrollback(TlU32 numLines);
+
 /*
  * Determine whether the developer console has been initialized.
  *
@@ -94,9 +139,11 @@ void tlCon_Hide();
 TlBool tlCon_IsVisible();
 
 /*
- * Render the developer console using OpenGL.
+ * Render the developer console over the top of a `w` by `h` pixel window, if
+ * it's visible. Only the rows that fit on screen are drawn, as text queued for
+ * the end of the frame (see tlR_DrawGlyphs()); tlR_Frame() calls this.
  */
-void tlCon_Render();
+void tlCon_Render(TlU32 w, TlU32 h);
 
 /*
  * Print to the developer console using printf style formatting. Special
@@ -116,6 +163,10 @@ void tlCon_Render();
  * "^4" = Edit Field
  * "^5" = Autocomplete
  * "^6" = Cursor
+ *
+ * Lines wrap at TL_DEVCON_COLUMNS. Printing is safe from any thread, doesn't
+ * allocate, and costs the same however full the scrollback is. Prints before
+ * tlCon_Init() are dropped.
  */
 void tlCon_PrintV(const char *format, va_list args);
 
@@ -125,17 +176,23 @@ void tlCon_PrintV(const char *format, va_list args);
  */
 void tlCon_Print(const char *format, ...);
 
+void tlCon_GetStats(TlDevconStats *stats);
+
 /*
  * Key handling
  *
- * Uses the current event. (see event.h)
+ * Uses the current event. (see event.h) TL_DEVCON_KEY shows and hides the
+ * console; while it's visible, page up/down, home and end scroll, and typed
+ * lines are echoed to the scrollback. tlR_Frame() passes on the events nothing
+ * else took.
  */
 void tlCon_KeyEvent();
 
 /*
  * Mouse event handling
  *
- * Uses the current event. (see event.h)
+ * Uses the current event. (see event.h) The wheel scrolls while the console is
+ * visible.
  */
 void tlCon_MouseEvent();
 
@@ -242,6 +242,144 @@ void *tlReallocArrayZero(void *p, size_t oldnmemb, size_t nmemb, size_t size);
 void *tlFree(void *p);
 
 void *tlMemory(void *p, size_t n);
+/* Calls made into the C heap (allocations, reallocations and frees) so far */
+TlU32 tlGetHeapCallCount(void);
+
+/*
+ * Arena
+ * -----
+ * Linear (bump pointer) allocator. Allocations are never freed one at a time;
+ * the whole arena is reset at once. Requests that don't fit go to the heap
+ * until the next reset, which then grows the arena to the largest amount ever
+ * used between two resets. Once it has grown to fit, it makes no heap calls.
+ */
+#define TL_ARENA_ALIGNMENT 16
+
+struct TlArenaBlock_s;
+typedef struct TlArena_s {
+	unsigned char *base;
+	size_t capacity;
+	size_t used;
+
+	/* bytes handed out from overflow blocks since the last reset */
+	size_t overflowUsed;
+	struct TlArenaBlock_s *overflow;
+
+	/* the most used (overflow included) between any two resets */
+	size_t highWater;
+	/* bytes used when last reset */
+	size_t lastUsed;
+
+	/* heap calls made by the arena in total, and before the last reset */
+	TlU32 numHeapCalls;
+	TlU32 lastHeapCalls;
+	TlU32 curHeapCalls;
+} TlArena;
+
+typedef struct TlArenaStats_s {
+	size_t capacity;
+	size_t used;
+	size_t lastUsed;
+	size_t highWater;
+	TlU32 numHeapCalls;
+	TlU32 lastHeapCalls;
+} TlArenaStats;
+
+void tlInitArena(TlArena *arena, size_t capacity);
+void tlFiniArena(TlArena *arena);
+/* Allocate `n` bytes aligned to TL_ARENA_ALIGNMENT; uninitialized */
+void *tlArenaAlloc(TlArena *arena, size_t n);
+/* Release everything allocated from the arena */
+void tlResetArena(TlArena *arena);
+void tlGetArenaStats(const TlArena *arena, TlArenaStats *stats);
+
+/*
+ * Frame arenas. Memory from tlFrameAlloc() is valid until the end of the
+ * current frame; memory from tlFrameAllocLong() stays valid through the end
+ * of the next frame as well (it comes from one of two arenas used on
+ * alternate frames). The renderer calls tlResetFrameArenas() at the end of
+ * each tlR_Frame().
+ */
+void *tlFrameAlloc(size_t n);
+void *tlFrameAllocLong(size_t n);
+void tlResetFrameArenas(void);
+void tlGetFrameArenaStats(TlArenaStats *frame, TlArenaStats *longFrame);
+
+/*
+ * Pool
+ * ----
+ * Allocator for many objects of one type. Objects are carved out of slabs
+ * (aligned to the cache line, as is each object) and freed objects go on a
+ * free list, so allocating and freeing are O(1) and only a new slab calls the
+ * heap. Slabs are never returned to the heap until tlFiniPool().
+ *
+ * Each object also gets a handle, pairing its slot with a generation count
+ * that changes whenever the slot is freed or reused. A handle to a freed
+ * object resolves to null instead of to whatever took its place.
+ *
+ * Pools aren't thread safe.
+ */
+typedef TlU64 TlHandle;
+
+#define TL_HANDLE_NONE ((TlHandle)0)
+
+struct TlPoolSlab_s;
+typedef struct TlPool_s {
+	const char *name;
+	size_t objectSize;
+
+	/* set up by the first allocation */
+	size_t stride;
+	TlU32 objectsPerSlab;
+
+	struct TlPoolSlab_s *slabs;
+	void *freeList;
+
+	/* every object ever carved out, by slot; for resolving handles */
+	void **objects;
+	TlU32 numObjects;
+
+	TlU32 numLive;
+	TlU32 peakLive;
+	TlU32 numSlabs;
+	TlU32 numHeapCalls;
+} TlPool;
+
+/* Static initializer for a pool of `type_` objects; lists every field of TlPool */
+#define TL_POOL_INITIALIZER(name_, type_) { \
+	(name_), sizeof(type_), \
+	0, 0, \
+	(struct TlPoolSlab_s *)0, (void *)0, \
+	(void **)0, 0, \
+	0, 0, 0, 0 \
+}
+
+typedef struct TlPoolStats_s {
+	const char *name;
+	size_t objectSize;
+	/* bytes between objects: the object plus bookkeeping, rounded up */
+	size_t stride;
+
+	TlU32 numLive;
+	TlU32 peakLive;
+	/* objects the slabs can hold */
+	TlU32 capacity;
+	TlU32 numSlabs;
+	TlU32 numHeapCalls;
+} TlPoolStats;
+
+void tlInitPool(TlPool *pool, const char *name, size_t objectSize);
+/* Release the slabs; every object must already be freed */
+void tlFiniPool(TlPool *pool);
+/* Allocate one object aligned to the cache line; uninitialized */
+void *tlPoolAlloc(TlPool *pool);
+/* Free an object (null is fine); always returns null */
+void *tlPoolFree(TlPool *pool, void *p);
+/* Handle of a live object, or TL_HANDLE_NONE for null */
+TlHandle tlPoolHandle(const TlPool *pool, const void *p);
+/* The object a handle refers to, or null if it's been freed */
+void *tlPoolLookup(const TlPool *pool, TlHandle h);
+void tlGetPoolStats(const TlPool *pool, TlPoolStats *stats);
 
 char *tlDuplicateN(const char *src, size_t srcn);
 char *tlDuplicate(const char *src);
@@ -3,6 +3,7 @@
 
 #include "const.h"
 #include "math.h"
+#include "transform.h"
 
 TILE_EXTRNC_ENTER
 
@@ -13,6 +14,20 @@ struct TlView_s;
 
 typedef void(*TlThinkFn_t)(struct TlEntity_s *ent);
 
+/*
+ * How an entity's Think may be run when parallel thinking is enabled (see
+ * tlEnableParallelThink())
+ */
+typedef enum {
+	/* on the main thread, after the phase's parallel thinks, in hierarchy order */
+	kTlThink_MainThread,
+	/* on any thread, at the same time as other entities' parallel thinks */
+	kTlThink_Parallel
+} TlThinkMode_t;
+
+/* Think phases run in order; every think in one finishes before the next starts */
+#define TL_MAX_THINK_PHASES 8
+
 /*
  * ------
  * Entity
@@ -53,21 +68,14 @@ typedef void(*TlThinkFn_t)(struct TlEntity_s *ent);
  *          camera entities.
  */
 typedef struct TL_CACHELINE_ALIGNED TlEntity_s {
-	/* local transformation */
-	TlMat4 l_model;
-	/* global transformation */
-	TlMat4 g_model;
-	/* final model-view-projection transformation */
-	TlMat4 MVP;
-
-	/* which fields are out-of-date */
-	struct {
-		/* if set, g_model needs to be updated */
-		TlBool gModel:1;
-	} recalc;
+	/* local, global, and model-view transformations (in the transform store) */
+	TlXform xform;
 
 	/* if valid, called each frame to process the entity */
 	TlThinkFn_t Think;
+	/* when (phase) and where (TlThinkMode_t) Think runs in parallel processing */
+	TlU8 thinkPhase;
+	TlU8 thinkMode;
 
 	/* List of surface components */
 	struct TlSurface_s *s_head, *s_tail;
@@ -88,16 +96,46 @@ TlEntity *tlNewEntity(TlEntity *prnt);
 TlEntity *tlDeleteEntity(TlEntity *ent);
 void tlDeleteAllEntities();
 
+/* Handles resolve to NULL once the entity is deleted */
+TlHandle tlGetEntityHandle(const TlEntity *ent);
+TlEntity *tlEntityFromHandle(TlHandle h);
+/* Live and peak entity counts (and other stats of the entity pool) */
+void tlGetEntityPoolStats(TlPoolStats *stats);
+
 void tlResetEntityTransform(TlEntity *ent);
 void tlInvalidateEntityBranch(const TlEntity *ent);
 void tlInvalidateEntity(TlEntity *ent);
 const TlMat4 *tlGetEntityLocalMatrix(TlEntity *ent);
 const TlMat4 *tlGetEntityGlobalMatrix(TlEntity *ent);
+/* Model-view matrix computed while queueing the most recently drawn view */
+const TlMat4 *tlGetEntityModelViewMatrix(TlEntity *ent);
 
 void tlProcessEntity(TlEntity *ent);
 void tlProcessEntityChildren(const TlEntity *ent);
 void tlProcessAllEntities();
 
+/*
+ * Set an entity's Think along with the phase (below TL_MAX_THINK_PHASES) and
+ * mode it runs in when parallel thinking is enabled.
+ *
+ * A kTlThink_Parallel think may only touch its own entity: read and change its
+ * local transform (position, rotation, and so on) and its own data. It must not
+ * create, delete, or reparent entities, nor read global matrices, which may be
+ * out of date until the phase ends.
+ */
+void tlSetEntityThink(TlEntity *ent, TlThinkFn_t fn, TlU32 phase, TlThinkMode_t mode);
+
+/*
+ * With parallel thinking enabled, tlProcessAllEntities() runs the thinks one
+ * phase at a time: first the phase's parallel thinks spread across the job
+ * threads, then its main-thread thinks in hierarchy order. Disabled (the
+ * default), every think runs on the calling thread in hierarchy order, as if
+ * there were no phases.
+ */
+void tlEnableParallelThink(void);
+void tlDisableParallelThink(void);
+TlBool tlIsParallelThinkEnabled(void);
+
 void tlSetEntityPosition(TlEntity *ent, float x, float y, float z);
 void tlSetEntityPositionVec(TlEntity *ent, const TlVec3 *pos);
 void tlSetEntityRotation(TlEntity *ent, float x, float y, float z);
@@ -0,0 +1,58 @@
+#ifndef TILE_JOB_H
+#define TILE_JOB_H
+
+#include "const.h"
+
+TILE_EXTRNC_ENTER
+
+/*
+ * ----------
+ * Job System
+ * ----------
+ * A fixed set of worker threads, each with its own deque of jobs. A thread
+ * pushes and pops jobs at the bottom of its own deque and, when that runs dry,
+ * steals from the top of the others'. The thread that called tlJob_Init() has
+ * a deque too and runs jobs whenever it waits on them.
+ *
+ * Every job works on a range [first, last) of whatever `parm` describes; jobs
+ * that aren't about ranges can ignore it. A job counts itself against a
+ * TlJobCounter (if given) until it finishes, and waiting on the counter is how
+ * one piece of work depends on another. Jobs may submit and wait on jobs of
+ * their own; a waiting thread keeps running other jobs rather than blocking.
+ *
+ * Only the job threads (the workers and the thread that called tlJob_Init())
+ * have deques. Anything submitted from another thread, or before tlJob_Init(),
+ * runs immediately on the submitting thread.
+ */
+typedef void( *TlJobFn_t )( void *parm, TlU32 first, TlU32 last );
+
+typedef struct TlJobCounter_s {
+	volatile TlU32 pending;
+} TlJobCounter;
+
+/* Start the workers; `numThreads` counts the calling thread (0 = one per processor) */
+void tlJob_Init( TlU32 numThreads );
+/* Stop the workers; every job must be finished */
+void tlJob_Fini( void );
+/* Threads that can run jobs, the calling thread included (1 before tlJob_Init()) */
+TlU32 tlJob_NumThreads( void );
+
+/* Zero a counter */
+void tlJob_InitCounter( TlJobCounter *counter );
+/* Queue `fn( parm, first, last )`; `counter` (optional) counts it until it's done */
+void tlJob_Run( TlJobFn_t fn, void *parm, TlU32 first, TlU32 last, TlJobCounter *counter );
+/* Whether every job counted by `counter` has finished */
+TlBool tlJob_IsDone( const TlJobCounter *counter );
+/* Run jobs until every job counted by `counter` has finished */
+void tlJob_Wait( TlJobCounter *counter );
+
+/*
+ * Run `fn` over [0, n) in ranges of at least `grain` items spread across the
+ * job threads, and wait for all of them. The calling thread does the first
+ * range itself.
+ */
+void tlJob_ParallelFor( TlJobFn_t fn, void *parm, TlU32 n, TlU32 grain );
+
+TILE_EXTRNC_LEAVE
+
+#endif
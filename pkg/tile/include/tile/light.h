@@ -17,6 +17,7 @@ typedef enum {
 	kTlLT_Spot
 } TlLightType_t;
 typedef struct TL_CACHELINE_ALIGNED TlLight_s {
+	TlLightType_t type;
 	TlVec3 xyz;
 	TlVec3 dir;
 	float radius, intensity;
@@ -27,6 +28,16 @@ typedef struct TL_CACHELINE_ALIGNED TlLight_s {
 	struct TlLight_s *prev, *next;
 } TlLight;
 
+/* Light */
+TlLight *tlNewLight(struct TlEntity_s *ent, TlLightType_t type);
+TlLight *tlDeleteLight(TlLight *light);
+
+/* Handles resolve to NULL once the light is deleted */
+TlHandle tlGetLightHandle(const TlLight *light);
+TlLight *tlLightFromHandle(TlHandle h);
+/* Live and peak light counts (and other stats of the light pool) */
+void tlGetLightPoolStats(TlPoolStats *stats);
+
 TILE_EXTRNC_LEAVE
 
 #endif
@@ -64,6 +64,35 @@ typedef struct TlMat4_s
 	float xw, yw, zw, ww;
 } TlMat4;
 
+/* Plane as x*px + y*py + z*pz + d = 0; the normal points to the "inside" */
+typedef struct TlPlane_s
+{
+	float x, y, z, d;
+} TlPlane;
+
+/* Six planes (left, right, bottom, top, near, far) bounding a view volume */
+typedef struct TlFrustum_s
+{
+	TlPlane planes[ 6 ];
+} TlFrustum;
+
+/* Axis-aligned box plus the sphere enclosing it, in some local space */
+typedef struct TlBounds_s
+{
+	TlVec3 mins, maxs;
+	TlVec3 center;
+	/* negative when there's nothing to bound */
+	float radius;
+} TlBounds;
+
+/* Result of testing a volume against a frustum */
+typedef enum
+{
+	kTlCull_Outside,
+	kTlCull_Intersect,
+	kTlCull_Inside
+} TlCullResult_t;
+
 TlVec3 *tlVec3( float x, float y, float z );
 TlVec3 *tlTempVec3( void );
 TlVec3 *tlAddVec3( const TlVec3 *pInP, const TlVec3 *pInQ );
@@ -98,11 +127,29 @@ TlMat4 *tlLoadAffineInverse( TlMat4 *pOutM, const TlMat4 *pInM );
 TlMat4 *tlAffineMultiply( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ );
 TlMat4 *tlMultiply3( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ );
 TlMat4 *tlMultiply4( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ );
+/* pOutM[i] = pInP*pInQ[i] for each of the `n` matrices */
+void tlAffineMultiplyArray( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ, size_t n );
 
 TlVec3 *tlPointLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoint );
 TlVec3 *tlPointGlobalToLocal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoint );
 TlVec3 *tlVectorLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVector );
 TlVec3 *tlVectorGlobalToLocal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVector );
+/* Transform `n` points (or vectors); pOutV may be the same array as the input */
+void tlPointsLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoints, size_t n );
+void tlVectorsLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVectors, size_t n );
+
+/*
+ * The scalar reference versions of the vectorized functions above, built in
+ * every configuration for testing. Results match the vector code bit for bit.
+ * tlMathKernelName() says which code the functions above use ("SSE" or
+ * "scalar").
+ */
+const char *tlMathKernelName( void );
+TlMat4 *tlLoadAffineInverseRef( TlMat4 *pOutM, const TlMat4 *pInM );
+TlMat4 *tlAffineMultiplyRef( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ );
+TlMat4 *tlMultiply4Ref( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ );
+void tlPointsLocalToGlobalRef( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoints, size_t n );
+void tlVectorsLocalToGlobalRef( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVectors, size_t n );
 
 float tlDot( const TlVec3 *pInP, const TlVec3 *pInQ );
 TlVec3 *tlCross( TlVec3 *pOutV, const TlVec3 *pInP, const TlVec3 *pInQ );
@@ -112,6 +159,18 @@ float tlDeterminant4( const TlMat4 *pInM );
 
 void tlScreenToProj( float *x, float *y, float w, float h );
 
+/* Largest scale applied along any of the matrix's axes */
+float tlMaxAxisScale( const TlMat4 *pInM );
+
+/*
+ * Extract the frustum planes of a clip (projection*view) matrix. The planes are
+ * in whatever space the matrix transforms from; normalized, pointing inward.
+ */
+TlFrustum *tlExtractFrustum( TlFrustum *pOutF, const TlMat4 *pInClip );
+TlCullResult_t tlCullSphere( const TlFrustum *pInF, const TlVec3 *pInCenter, float fRadius );
+/* Test an axis-aligned box given in the local space of pInObjectXf */
+TlCullResult_t tlCullBox( const TlFrustum *pInF, const TlMat4 *pInObjectXf, const TlVec3 *pInMins, const TlVec3 *pInMaxs );
+
 TILE_EXTRNC_LEAVE
 
 #endif
@@ -0,0 +1,103 @@
+#ifndef TILE_MESH_H
+#define TILE_MESH_H
+
+#include "const.h"
+#include "vertex.h"
+
+TILE_EXTRNC_ENTER
+
+struct TlSurface_s;
+
+/*
+ * -----------------
+ * Mesh Optimization
+ * -----------------
+ * Passes that reorder (and weld) a surface's geometry so the GPU does less
+ * work drawing it. None of them change what's drawn, only the order it's
+ * drawn in and how many vertices it takes. Each pass can also be run on plain
+ * arrays. Simplification is the exception: it builds coarser levels of detail
+ * for drawing at a distance.
+ */
+
+/* Merge vertices that are identical in every attribute */
+#define TL_OPTIMIZE_WELD         0x01
+/* Reorder triangles so recently transformed vertices are reused (Forsyth) */
+#define TL_OPTIMIZE_VERTEX_CACHE 0x02
+/* Reorder clusters of triangles so outward-facing ones are drawn first */
+#define TL_OPTIMIZE_OVERDRAW     0x04
+/* Reorder vertices into the order the triangles first use them */
+#define TL_OPTIMIZE_VERTEX_FETCH 0x08
+#define TL_OPTIMIZE_ALL          0x0F
+
+/* Cache size the statistics assume when given 0 */
+#define TL_MESH_DEFAULT_CACHE_SIZE 16
+/*
+ * How much worse than its cluster's average vertex cache efficiency a
+ * triangle sequence may get before the overdraw pass cuts it into a new
+ * cluster. Higher allows more (smaller) clusters, trading cache for overdraw.
+ */
+#define TL_MESH_OVERDRAW_THRESHOLD 1.05f
+/* Fraction of its finer level's triangles each generated level aims for */
+#define TL_MESH_DEFAULT_LOD_RATIO 0.5f
+
+typedef struct TlMeshStats_s {
+	TlU32 numVerts;
+	TlU32 numTris;
+
+	/* vertices transformed (cache misses) with a FIFO cache of `cacheSize` */
+	TlU32 numTransformed;
+	TlU32 cacheSize;
+
+	/* average cache miss ratio: transformed vertices per triangle (0.5 - 3) */
+	float acmr;
+	/* average transform to vertex ratio: transformed per used vertex (1 is ideal) */
+	float atvr;
+} TlMeshStats;
+
+/* Run the given TL_OPTIMIZE_* passes over the geometry `surf` draws with */
+void tlOptimizeSurface(struct TlSurface_s *surf, TlU32 passes);
+/* Simulate drawing the geometry `surf` draws with (cacheSize 0 = default) */
+void tlGetSurfaceMeshStats(const struct TlSurface_s *surf, TlU32 cacheSize, TlMeshStats *stats);
+
+/*
+ * Generate up to `maxLods` levels of detail (0 = TL_SURFACE_MAX_LODS, counting
+ * the full surface) for the geometry `surf` draws with, each with about
+ * `ratio` times the triangles of the one before it (0 = default). Stops early
+ * once simplifying stops paying off. Returns the number of levels; 1 means
+ * none were made. The render queue picks between them by distance.
+ */
+unsigned int tlGenerateSurfaceLods(struct TlSurface_s *surf, unsigned int maxLods, float ratio);
+
+/*
+ * Map every vertex to the first one identical to it, numbering the distinct
+ * vertices in the order they first appear. Returns how many there are.
+ */
+TlU32 tlWeldVertices(TlU32 *remap, const TlVertex *verts, TlU32 numVerts);
+/* Write `inds` reordered for the vertex cache to `dst` (which can't be `inds`) */
+void tlOptimizeVertexCache(TlU32 *dst, const TlU32 *inds, TlU32 numInds, TlU32 numVerts);
+/* Reorder `inds` in place to reduce overdraw, mostly keeping cache order */
+void tlOptimizeOverdraw(TlU32 *inds, TlU32 numInds, const TlVertex *verts, TlU32 numVerts,
+	float threshold);
+/*
+ * Copy the vertices `inds` uses into `dst` in the order they're first used and
+ * renumber `inds` to match. Returns the number of vertices written; unused ones
+ * are dropped.
+ */
+TlU32 tlOptimizeVertexFetch(TlVertex *dst, TlU32 *inds, TlU32 numInds, const TlVertex *verts,
+	TlU32 numVerts);
+/*
+ * Write a simplified copy of `inds` with about `targetInds` indices to `dst`
+ * (which may be `inds`), collapsing edges onto existing vertices so the vertex
+ * array is unchanged. Open borders and seams are kept. Returns the number of
+ * indices written, and the simplification's error as a distance in `*error`
+ * if given. May stop short of the target if nothing more can be collapsed.
+ */
+TlU32 tlSimplifyMesh(TlU32 *dst, const TlU32 *inds, TlU32 numInds, const TlVertex *verts,
+	TlU32 numVerts, TlU32 targetInds, float *error);
+/* Simulate drawing `inds` through a FIFO vertex cache (cacheSize 0 = default) */
+void tlGetMeshStats(const TlU32 *inds, TlU32 numInds, TlU32 numVerts, TlU32 cacheSize,
+	TlMeshStats *stats);
+
+TILE_EXTRNC_LEAVE
+
+#endif
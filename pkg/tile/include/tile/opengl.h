@@ -10,6 +10,7 @@ TlBool tlGL_IsExtensionSupported(const char *extension);
 void tlGL_RequireExtension(const char *extension);
 
 TlFn_t tlGL_Proc(const char *proc);
+TlFn_t tlGL_TryProc(const char *proc);
 
 void tlGL__CheckErrorImpl_(const char *file, int line);
 #if defined(DEBUG)||defined(_DEBUG)||defined(__debug__)
@@ -16,6 +16,7 @@ struct TlMat4_s;
 struct TlBrush_s;
 struct TlSurface_s;
 struct TlEntity_s;
+struct TlView_s;
 
 typedef enum {
 	/* Sort back-to-front */
@@ -24,29 +25,173 @@ typedef enum {
 	kTlRQMode_FrontToBack,
 	/* Sort by least expensive to most expensive states */
 	kTlRQMode_StateSorted,
-	/* Render depth-only back-to-front first, then state sorted depth-equal */
-	kTlRQMode_DepthPrepass
+	/* Render depth-only first, then state sorted depth-equal */
+	kTlRQMode_DepthPrepass,
+
+	kTlNumRQModes
 } TlRenderQueueMode_t;
 
+/* Frustum culling results (see tlRQ_GetViewCullStats) */
+typedef struct TlRQCullStats_s {
+	/* entities whose bounds (with their descendants') were entirely outside */
+	TlU32 numEntitiesCulled;
+	/* surfaces that passed culling and were queued */
+	TlU32 numSurfacesVisible;
+	/* surfaces skipped, including those of culled entities */
+	TlU32 numSurfacesCulled;
+} TlRQCullStats;
+
+/*
+ * Statistics gathered by tlRQ_Draw() since the last tlRQ_ResetStats(). The
+ * renderer resets these at the start of each frame, so after tlLoop() they
+ * describe the most recent frame.
+ */
+typedef struct TlRQStats_s {
+	/* mode used by the most recent tlRQ_Draw() */
+	TlRenderQueueMode_t mode;
+
+	/* draw items submitted to tlRQ_Draw() */
+	TlU32 numItems;
+	/* draw calls issued, including those of the depth prepass */
+	TlU32 numDraws;
+	/* draw calls issued by the depth prepass alone */
+	TlU32 numPrepassDraws;
+	/* times a draw needed different render state than the draw before it */
+	TlU32 numStateChanges;
+	/* individual GL state calls issued (matrices and pointers included) */
+	TlU32 numStateCalls;
+	/* GL state calls skipped because the state was already current */
+	TlU32 numStateCallsFiltered;
+	/* instanced draw calls issued (included in numDraws) */
+	TlU32 numInstancedDraws;
+	/* draw items covered by those instanced draw calls */
+	TlU32 numInstances;
+	/* draw items drawn with a coarser level of detail than the full surface */
+	TlU32 numLodItems;
+	/* brush materials written to the material constant buffer */
+	TlU32 numMaterialUploads;
+	/* model-view matrices written to the draw constant buffer */
+	TlU32 numDrawConstants;
+	/* views queued with tlRQ_BeginView() */
+	TlU32 numViews;
+	/* culling results summed over those views */
+	TlRQCullStats cull;
+	/* most threads used to build any one view's queue */
+	TlU32 numBuildThreads;
+} TlRQStats;
+
+/*
+ * Sort Keys
+ * ---------
+ * Each draw item carries a packed 64-bit key, built when the item is added to
+ * the queue. Sorting only ever looks at the key, so no pointers are followed
+ * while sorting. From the most significant bit to the least:
+ *
+ *   [63:60] render target      [59:54] pass/order      [53]    translucent
+ *   [52:37] quantized depth    [36:22] brush id        [21: 0] surface id
+ *
+ * Translucent items store their depth inverted so that they sort back-to-front.
+ * Whether opaque items store a depth at all depends on the queue's mode. Items
+ * drawn with the same brush sort together, so interning brushes (see
+ * tlInternBrush) puts everything with the same state in one run.
+ */
+#define TL_RQKEY_TARGET_SHIFT  60
+#define TL_RQKEY_TARGET_BITS   4
+#define TL_RQKEY_PASS_SHIFT    54
+#define TL_RQKEY_PASS_BITS     6
+#define TL_RQKEY_XLUCENT_SHIFT 53
+#define TL_RQKEY_XLUCENT_BITS  1
+#define TL_RQKEY_DEPTH_SHIFT   37
+#define TL_RQKEY_DEPTH_BITS    16
+#define TL_RQKEY_BRUSH_SHIFT   22
+#define TL_RQKEY_BRUSH_BITS    15
+#define TL_RQKEY_SURFACE_SHIFT 0
+#define TL_RQKEY_SURFACE_BITS  22
+
+#define TL_RQKEY_FIELD(Value_,Field_) \
+	( ( ( TlU64 )( Value_ ) & ( ( ( TlU64 )1 << TL_RQKEY_##Field_##_BITS ) - 1 ) ) << TL_RQKEY_##Field_##_SHIFT )
+#define TL_RQKEY_GET(Key_,Field_) \
+	( ( ( Key_ ) >> TL_RQKEY_##Field_##_SHIFT ) & ( ( ( TlU64 )1 << TL_RQKEY_##Field_##_BITS ) - 1 ) )
+
 #pragma pack(push, 1)
 typedef struct TlDrawItem_s {
+	TlU64 key;   /* see "Sort Keys" above */
 	TlU32 order; /* ( RenderTarget<<24 ) | ( Pass<<16 ) | ( Order ) */
 	struct TlMat4_s *M;
 	struct TlBrush_s *brush;
 	struct TlSurface_s *surf;
+	TlU32 lod;   /* level of detail of surf's geometry to draw */
 } TlDrawItem;
 #pragma pack(pop)
 
 /* Render Queue */
 void tlRQ_SetMode(TlRenderQueueMode_t mode);
 TlRenderQueueMode_t tlRQ_GetMode(void);
+const char *tlRQ_GetModeName(TlRenderQueueMode_t mode);
+
+/*
+ * Runs of consecutive draw items that share a surface's geometry and a brush
+ * are drawn with one instanced draw call when the hardware supports it and the
+ * brush is unlit without a program of its own. Enabled by default.
+ */
+void tlRQ_EnableInstancing(void);
+void tlRQ_DisableInstancing(void);
+TlBool tlRQ_IsInstancingEnabled(void);
+
+/*
+ * Surfaces outside the view frustum aren't queued. Enabled by default; disable
+ * to compare, or when the view matrices don't describe what's drawn.
+ */
+void tlRQ_EnableCulling(void);
+void tlRQ_DisableCulling(void);
+TlBool tlRQ_IsCullingEnabled(void);
+
+/*
+ * Surfaces with levels of detail (see tlGenerateSurfaceLods) are drawn with the
+ * coarsest level whose error would cover no more than the tolerance, in
+ * pixels, on screen. Enabled by default with a tolerance of one pixel; with it
+ * disabled every surface is drawn in full.
+ */
+void tlRQ_EnableLod(void);
+void tlRQ_DisableLod(void);
+TlBool tlRQ_IsLodEnabled(void);
+void tlRQ_SetLodTolerance(float pixels);
+float tlRQ_GetLodTolerance(void);
+
+/*
+ * tlRQ_AddAllEntities() splits its work across up to this many job threads
+ * (the calling thread included) when there are enough entities to go around.
+ * Zero, the default, means all of them; one keeps it all on the calling
+ * thread. Drawing always happens on the calling thread.
+ */
+void tlRQ_SetNumThreads(TlU32 n);
+TlU32 tlRQ_GetNumThreads(void);
+/* Release the memory kept between frames for building the queue */
+void tlRQ_Fini(void);
+
+/*
+ * Prepare to queue a view: `V` is the inverse of the camera's global matrix.
+ * The frustum used for culling comes from it and the view's projection.
+ */
+void tlRQ_BeginView(struct TlView_s *view, const struct TlMat4_s *V);
 TlDrawItem *tlRQ_AddDrawItems(size_t numItems);
 void tlRQ_AddEntities(struct TlEntity_s *ent, const struct TlMat4_s *V);
+/*
+ * Queue every entity with one linear sweep over the transform store. Whole
+ * subtrees are culled at once by bounds spanning their descendants.
+ */
+void tlRQ_AddAllEntities(const struct TlMat4_s *V);
 int tlRQ_CmpFunc(const TlDrawItem *a, const TlDrawItem *b);
 void tlRQ_Sort();
 size_t tlRQ_Count();
 size_t tlRQ_Capacity();
+/* The queued items (tlRQ_Count() of them), in order once sorted; valid until the queue is drawn */
+TlDrawItem *tlRQ_Items();
 void tlRQ_Draw();
+void tlRQ_ResetStats(void);
+void tlRQ_GetStats(TlRQStats *stats);
+/* Culling results for the most recent view alone */
+void tlRQ_GetViewCullStats(TlRQCullStats *stats);
 
 TILE_EXTRNC_LEAVE
 
@@ -2,6 +2,7 @@
 #define TILE_RENDERER_H
 
 #include "const.h"
+#include "math.h"
 
 TILE_EXTRNC_ENTER
 
@@ -13,6 +14,13 @@ TILE_EXTRNC_ENTER
 struct TlView_s;
 struct TlEntity_s;
 
+/*
+ * The staging ring is split into one segment per frame in flight, each fenced
+ * once the frame's copies out of it are issued, and waited on before reuse.
+ */
+#define TL_R_STAGING_SEGMENTS     3
+#define TL_R_STAGING_SEGMENT_SIZE (8*1024*1024)
+
 typedef struct TL_CACHELINE_ALIGNED TlRenderer_s {
 	/*
 	 * FUNCTIONS
@@ -101,6 +109,31 @@ typedef struct TL_CACHELINE_ALIGNED TlRenderer_s {
 	void(APIENTRY *ValidateProgram)(GLuint program);
 	void(APIENTRY *VertexAttribPointer)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer);
 
+	/* instancing (3.3, ARB_draw_instanced + ARB_instanced_arrays); may be NULL */
+	void(APIENTRY *DrawElementsInstanced)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
+	void(APIENTRY *VertexAttribDivisor)(GLuint index, GLuint divisor);
+
+	/*
+	 * persistent mapping (4.4, ARB_buffer_storage + ARB_copy_buffer + ARB_sync);
+	 * may be NULL. Sync objects are passed around as pointers (GLsync).
+	 */
+	void(APIENTRY *BufferStorage)(GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags);
+	GLvoid*(APIENTRY *MapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+	void(APIENTRY *CopyBufferSubData)(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+	void*(APIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+	GLenum(APIENTRY *ClientWaitSync)(void *sync, GLbitfield flags, TlU64 timeout);
+	void(APIENTRY *DeleteSync)(void *sync);
+
+	/* program binaries (4.1, ARB_get_program_binary); may be NULL */
+	void(APIENTRY *GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary);
+	void(APIENTRY *ProgramBinary)(GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length);
+	void(APIENTRY *ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+	/* uniform buffers (3.1, ARB_uniform_buffer_object); may be NULL */
+	GLuint(APIENTRY *GetUniformBlockIndex)(GLuint program, const GLchar *uniformBlockName);
+	void(APIENTRY *UniformBlockBinding)(GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding);
+	void(APIENTRY *BindBufferRange)(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
 	/*
 	 * VARIABLES
 	 */
@@ -112,12 +145,29 @@ typedef struct TL_CACHELINE_ALIGNED TlRenderer_s {
 	unsigned int conFontResX;
 	unsigned int conFontResY;
 
-	/* shaders */
-	GLuint tileMap_vert;
-	GLuint tileMap_frag;
+	/* shaders (from the shader cache) */
 	GLuint tileMap_prog;
+	GLuint instanced_prog;
+
+	/* offsets into uniform buffers must be multiples of this; 0 without them */
+	TlU32 constantAlignment;
+
+	/* staging ring for tlR_UploadBufferData(); 0 without persistent mapping */
+	GLuint staging;
+	TlU8 *stagingMem;
+	TlU32 stagingSegment;
+	size_t stagingUsed;
+	void *stagingFences[TL_R_STAGING_SEGMENTS];
 } TlRenderer;
 
+/*
+ * Attribute locations used by the built-in instancing program. The per-instance
+ * model-view matrix takes four consecutive locations, one per column.
+ */
+#define TL_INSTANCED_ATTRIB_POSITION  0
+#define TL_INSTANCED_ATTRIB_COLOR     1
+#define TL_INSTANCED_ATTRIB_MODELVIEW 2
+
 /* Renderer */
 void tlR_Init( void );
 void tlR_Fini( void );
@@ -126,17 +176,144 @@ struct TlEntity_s *tlR_DefaultCamera( void );
 void tlR_DrawView(struct TlView_s *view);
 void tlR_Frame(double time);
 
+/*
+ * Text in the built-in font, in pixels from the top-left of the window. Glyphs
+ * are queued as they're drawn and all of a frame's text is drawn at the end of
+ * tlR_Frame(), over everything else, in one draw call. Text wraps at `w` pixels
+ * and stops `h` pixels down.
+ */
 void tlR_DrawText(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32 h);
+void tlR_DrawTextColor(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32 h,
+	const TlColor *color);
+/* A row of glyphs, one cell each; no wrapping and no control characters */
+void tlR_DrawGlyphs(const char *chars, TlU32 numChars, TlS32 x, TlS32 y, const TlColor *color);
+/* A solid rectangle, queued in order with the text (e.g., as a backdrop for it) */
+void tlR_DrawRect(TlS32 x, TlS32 y, TlU32 w, TlU32 h, const TlColor *color);
+/* Size of a glyph's cell in pixels */
+void tlR_GetGlyphSize(TlU32 *w, TlU32 *h);
 
 GLuint tlR_LoadGLSL( GLuint shaderType, const char *pszSourceCode );
 GLuint tlR_LinkGLSL( GLuint vertShader, GLuint fragShader );
 
+/*
+ * ------------
+ * Shader Cache
+ * ------------
+ * Programs are looked up by a hash of their sources and attribute bindings, so
+ * everything built from the same sources shares one program, counted by
+ * reference. With a cache directory set and ARB_get_program_binary available,
+ * linked programs are also saved there, named by that hash and the GL's vendor,
+ * renderer and version strings, and loaded from there instead of compiled the
+ * next time. The sources and bindings are kept alongside the hash (and in each
+ * binary) and compared too, so programs whose hashes collide stay apart.
+ * Binaries the driver refuses (after an update, say) are compiled from source
+ * again and replaced.
+ */
+typedef struct TlShaderAttrib_s {
+	GLuint index;
+	const char *name;
+} TlShaderAttrib;
+
+typedef struct TlShaderCacheStats_s {
+	/* programs alive now */
+	TlU32 numPrograms;
+	/* requests answered by a program already alive */
+	TlU32 numShared;
+	/* programs compiled from source, and loaded from binaries on disk */
+	TlU32 numCompiled;
+	TlU32 numLoaded;
+	/* binaries on disk the driver refused */
+	TlU32 numRejected;
+	/* time spent compiling and loading, in microseconds */
+	TlU64 compileMicrosecs;
+	TlU64 loadMicrosecs;
+} TlShaderCacheStats;
+
+/*
+ * Set the directory program binaries are kept in, which must exist; NULL (the
+ * default) keeps nothing on disk. Set it before tlInit() for the renderer's own
+ * programs to be cached too.
+ */
+void tlR_SetShaderCacheDir(const char *dir);
+/*
+ * Retrieve a program of the given sources (either of which may be NULL) with
+ * `attribs` bound, compiling it if it isn't alive or cached already. Returns 0,
+ * having reported why, if it doesn't compile or link. Each program acquired
+ * must be released.
+ */
+GLuint tlR_AcquireProgram(const char *vertSrc, const char *fragSrc,
+	const TlShaderAttrib *attribs, TlU32 numAttribs);
+void tlR_ReleaseProgram(GLuint program);
+void tlR_GetShaderCacheStats(TlShaderCacheStats *stats);
+
+/*
+ * ---------
+ * Constants
+ * ---------
+ * A program can read its per-view, per-material and per-draw constants from
+ * uniform blocks instead of the fixed-function state, by declaring any of:
+ *
+ *   layout(std140) uniform TlViewBlock {
+ *       mat4 tl_Projection;
+ *   };
+ *   layout(std140) uniform TlMaterialBlock {
+ *       vec4 tl_Diffuse, tl_Ambient, tl_Emissive, tl_Specular;
+ *       float tl_Shininess, tl_IsLit;
+ *   };
+ *   layout(std140) uniform TlDrawBlock {
+ *       mat4 tl_ModelView;
+ *   };
+ *
+ * The program cache binds each block it finds to its TL_R_BLOCK_* binding
+ * point. The render queue keeps every brush's material in one buffer, written
+ * only when the brush changes, and writes the model-view matrices of all of a
+ * frame's draws into one buffer, binding a range of it per draw. Programs
+ * without TlDrawBlock get their matrices through glLoadMatrixf() as before.
+ * Materials not in use (see tlDisableBrushDiffuseLighting and the like) are
+ * zero.
+ */
+#define TL_R_BLOCK_VIEW     0
+#define TL_R_BLOCK_MATERIAL 1
+#define TL_R_BLOCK_DRAW     2
+
+/* Bits of tlR_GetProgramBlocks() */
+#define TL_R_BLOCK_BIT(Block_) ( 1U << ( Block_ ) )
+
+#ifndef GL_UNIFORM_BUFFER
+# define GL_UNIFORM_BUFFER 0x8A11
+#endif
+
+/* The blocks' std140 layouts */
+typedef struct TlViewConstants_s {
+	TlMat4 projection;
+} TlViewConstants;
+typedef struct TlMaterialConstants_s {
+	TlColor diffuse, ambient, emissive, specular;
+	float shininess;
+	float isLit;
+	float reserved[2];
+} TlMaterialConstants;
+typedef struct TlDrawConstants_s {
+	TlMat4 modelView;
+} TlDrawConstants;
+
+/* Which blocks (TL_R_BLOCK_BIT) a program from the shader cache reads */
+TlU32 tlR_GetProgramBlocks(GLuint program);
+/*
+ * Size of a block rounded up to the alignment of uniform buffer offsets, for
+ * arrays of blocks bound a range at a time; 0 if there are no uniform buffers.
+ */
+size_t tlR_ConstantStride(size_t size);
+/* Bind `size` bytes of `buffer` from `offset` to the TL_R_BLOCK_* binding point */
+void tlR_BindConstants(TlU32 block, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
 GLuint tlR_CreateShader(GLenum shaderType);
 void tlR_ShaderSource(GLuint shader, int numStrings, const char **strings,
 	int *stringLengths);
 void tlR_CompileShader(GLuint shader);
 GLuint tlR_CreateProgram();
 void tlR_AttachObject(GLuint program, GLuint shader);
+void tlR_BindAttribLocation(GLuint program, GLuint index, const char *name);
 void tlR_LinkProgram(GLuint program);
 void tlR_UseProgram(GLuint program);
 
@@ -148,6 +325,42 @@ void tlR_GetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei *length,
 void tlR_DeleteShader(GLuint shader);
 void tlR_DeleteProgram(GLuint program);
 
+void tlR_GenBuffers(GLsizei n, GLuint *buffers);
+void tlR_DeleteBuffers(GLsizei n, const GLuint *buffers);
+void tlR_BindBuffer(GLenum target, GLuint buffer);
+void tlR_BufferData(GLenum target, GLsizeiptr size, const void *data,
+	GLenum usage);
+void tlR_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+	const void *data);
+void *tlR_MapBuffer(GLenum target, GLenum access);
+GLboolean tlR_UnmapBuffer(GLenum target);
+
+/*
+ * Write `size` bytes of `data` at `offset` into the buffer bound to `target`,
+ * as BufferSubData does. With persistent mapping, `data` is copied into a
+ * mapped staging buffer and the GPU copies it from there, so the driver
+ * doesn't have to stage it again; otherwise (or when the frame's segment of the
+ * staging ring is full) this is BufferSubData.
+ */
+void tlR_UploadBufferData(GLenum target, GLintptr offset, GLsizeiptr size,
+	const void *data);
+/* Whether tlR_UploadBufferData() goes through a persistently mapped buffer */
+TlBool tlR_IsStagingPersistent(void);
+
+void tlR_EnableVertexAttribArray(GLuint index);
+void tlR_DisableVertexAttribArray(GLuint index);
+void tlR_VertexAttribPointer(GLuint index, GLint size, GLenum type,
+	GLboolean normalized, GLsizei stride, const void *pointer);
+
+/*
+ * Instancing; only valid if tlR_InstancingProgram() is nonzero. That program
+ * draws unlit, vertex-colored geometry with a per-instance model-view matrix.
+ */
+GLuint tlR_InstancingProgram(void);
+void tlR_VertexAttribDivisor(GLuint index, GLuint divisor);
+void tlR_DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+	const void *indices, GLsizei primcount);
+
 TILE_EXTRNC_LEAVE
 
 #endif
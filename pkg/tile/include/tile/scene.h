@@ -0,0 +1,178 @@
+#ifndef TILE_SCENE_H
+#define TILE_SCENE_H
+
+#include "const.h"
+#include "math.h"
+#include "surface.h"
+
+TILE_EXTRNC_ENTER
+
+struct TlEntity_s;
+
+/* A mapped scene file (private to scene.c) */
+typedef struct TlSceneFile_s TlSceneFile;
+
+/*
+ * -----
+ * Scene
+ * -----
+ * Scene files hold a hierarchy of entities, their surfaces, the brushes those
+ * draw with, and each surface's geometry packed exactly as it's uploaded to the
+ * GPU. Loading maps the file into memory and uploads straight from the mapping,
+ * so nothing is parsed or copied per vertex. A surface only decodes its own
+ * copy of the geometry if something reads or writes it (see tlUnmapSurface).
+ * Opening a file does check it all, down to each index, before anything is
+ * created from it.
+ *
+ * Lights, views, thinks and brush shaders aren't stored.
+ *
+ * Layout
+ * ------
+ * Everything is in the byte order of the machine that wrote it (the magic
+ * number tells), with every table and blob starting on a TL_SCENE_ALIGNMENT
+ * boundary. Offsets count from the start of the file.
+ *
+ *   TlSceneHeader
+ *   TlSceneEntity[numEntities]      parents before their children
+ *   TlSceneSurface[numSurfaces]     grouped by entity, in order
+ *   TlSceneGeometry[numGeometries]
+ *   TlSceneBrush[numBrushes]
+ *   TlU32[numPasses]                brush of each surface pass, in order
+ *   vertex and index blobs          (see TlSceneGeometry)
+ */
+#define TL_SCENE_MAGIC     0x43534C54 /* "TLSC" */
+#define TL_SCENE_VERSION   1
+#define TL_SCENE_ALIGNMENT 16
+
+/* No parent entity; or, as a pass's brush, the default brush (tlFirstBrush()) */
+#define TL_SCENE_NONE 0xFFFFFFFF
+
+typedef struct TlSceneHeader_s {
+	TlU32 magic;
+	TlU32 version;
+	/* size of this header as written; later versions may only grow it */
+	TlU32 headerSize;
+	TlU32 reserved;
+	TlU64 fileSize;
+
+	TlU32 numEntities;
+	TlU32 numSurfaces;
+	TlU32 numGeometries;
+	TlU32 numBrushes;
+	TlU32 numPasses;
+	TlU32 reserved2;
+
+	/* offsets of the tables */
+	TlU64 entities;
+	TlU64 surfaces;
+	TlU64 geometries;
+	TlU64 brushes;
+	TlU64 passes;
+} TlSceneHeader;
+
+typedef struct TlSceneEntity_s {
+	TlMat4 local;
+	/* index of the parent entity (always lower), or TL_SCENE_NONE for a root */
+	TlU32 parent;
+	TlU32 firstSurface;
+	TlU32 numSurfaces;
+	TlU32 reserved;
+} TlSceneEntity;
+
+typedef struct TlSceneSurface_s {
+	/* surfaces with the same geometry share it (see tlShareSurfaceGeometry) */
+	TlU32 geometry;
+	TlU32 firstPass;
+	TlU32 numPasses;
+	/* TlBufferUsage_t */
+	TlU32 usage;
+} TlSceneSurface;
+
+/* TlSceneGeometry flags */
+#define TL_SCENE_GEOMETRY_QUANTIZED      0x01
+#define TL_SCENE_GEOMETRY_HALF_TEXCOORDS 0x02
+#define TL_SCENE_GEOMETRY_32BIT_INDICES  0x04
+
+typedef struct TlSceneGeometry_s {
+	TlBounds bounds;
+
+	TlU32 numVerts;
+	TlU32 numInds;
+	/* indices of the levels of detail, stored after the full ones */
+	TlU32 numLodInds;
+	TlU32 numLods;
+	TlSurfaceLod lods[TL_SURFACE_MAX_LODS];
+
+	/* how the vertices are packed (see TlVertexLayout) */
+	TlU32 attribs;
+	TlU32 flags;
+	TlU32 stride;
+	TlU32 position, normal, texCoord, binormal, tangent, color;
+	TlVec3 scale;
+	TlVec3 bias;
+	TlU32 reserved;
+
+	/* numVerts*stride bytes of vertices */
+	TlU64 vertices;
+	/* numInds + numLodInds indices, 16- or 32-bit as the flags say */
+	TlU64 indices;
+} TlSceneGeometry;
+
+/* TlSceneBrush flags */
+#define TL_SCENE_BRUSH_LIT           0x0001
+#define TL_SCENE_BRUSH_USE_DIFFUSE   0x0002
+#define TL_SCENE_BRUSH_USE_AMBIENT   0x0004
+#define TL_SCENE_BRUSH_USE_EMISSIVE  0x0008
+#define TL_SCENE_BRUSH_USE_SPECULAR  0x0010
+#define TL_SCENE_BRUSH_VISIBLE       0x0020
+#define TL_SCENE_BRUSH_BINORMAL      0x0040
+#define TL_SCENE_BRUSH_TANGENT       0x0080
+#define TL_SCENE_BRUSH_Z_TEST        0x0100
+#define TL_SCENE_BRUSH_Z_WRITE       0x0200
+#define TL_SCENE_BRUSH_Z_SORT        0x0400
+
+typedef struct TlSceneBrush_s {
+	TlColor diffuse, ambient, emissive, specular;
+	float shininess;
+	TlU32 flags;
+	/* TlCullMode_t and TlCmpFunc_t */
+	TlU32 cullMode;
+	TlU32 zFunc;
+} TlSceneBrush;
+
+/*
+ * Write `ent` and its descendants (or every entity, if `ent` is NULL) to a
+ * scene file; `ent` keeps its global position as a root of the file. Each
+ * surface's vertices hold the attributes its passes use. Returns FALSE, having
+ * reported why, if the file couldn't be written.
+ */
+TlBool tlSaveScene(const char *filename, struct TlEntity_s *ent);
+/*
+ * Load a scene file, adding its root entities as children of `prnt` (or as
+ * root entities if NULL). The file's brushes are interned (see tlInternBrush),
+ * so loading the same file twice doesn't duplicate them. Returns the first of
+ * the new root entities (the rest follow it), or NULL, having reported why, if
+ * the file couldn't be loaded or holds no entities.
+ */
+struct TlEntity_s *tlLoadScene(const char *filename, struct TlEntity_s *prnt);
+
+/*
+ * tlLoadScene() in two steps, for loading in the background (see stream.h).
+ * tlOpenSceneFile() maps and checks the file and is safe to call from any
+ * thread; it returns NULL, having reported why, if the file can't be loaded.
+ * tlInstantiateScene() creates the entities as tlLoadScene() does (on the main
+ * thread), returning NULL if there are none. The caller's hold on the file
+ * must be released either way.
+ */
+TlSceneFile *tlOpenSceneFile(const char *filename);
+struct TlEntity_s *tlInstantiateScene(TlSceneFile *file, struct TlEntity_s *prnt);
+/* Read the whole file into memory now, rather than as it's first touched */
+void tlPrefetchSceneFile(const TlSceneFile *file);
+size_t tlGetSceneFileSize(const TlSceneFile *file);
+
+/* Let go of a hold on the mapped file; unmaps it after the last */
+void tlReleaseSceneFile(TlSceneFile *file);
+
+TILE_EXTRNC_LEAVE
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef TILE_STREAM_H
+#define TILE_STREAM_H
+
+#include "const.h"
+
+TILE_EXTRNC_ENTER
+
+struct TlEntity_s;
+
+/*
+ * ---------
+ * Streaming
+ * ---------
+ * Loads scene files (see scene.h) without stalling the frame. Loader threads
+ * map, check and read in each file while the main thread keeps drawing. Then,
+ * from tlStream_Update() (which tlLoop() calls each frame), the main thread
+ * creates the file's entities and uploads their geometry a piece at a time,
+ * never more in one frame than the byte and time budgets allow. Each surface
+ * is drawn once its geometry is uploaded; the request's callback runs once all
+ * of the file's geometry is.
+ *
+ * Before tlStream_Init() (or with no loader threads), files are read on the
+ * requesting thread, but their uploads are still spread over frames.
+ */
+
+/*
+ * Called on the main thread when a request finishes, with the first of the new
+ * root entities (the rest follow it), or NULL if the file couldn't be loaded,
+ * held no entities, or the parent or new entities were deleted in the meantime.
+ */
+typedef void( *TlStreamFn_t )( void *parm, struct TlEntity_s *ent );
+
+#define TL_STREAM_DEFAULT_THREADS      2
+#define TL_STREAM_DEFAULT_BYTE_BUDGET  ( 4*1024*1024 )
+#define TL_STREAM_DEFAULT_TIME_BUDGET  2000
+
+typedef struct TlStreamStats_s {
+	/* requests not finished yet: loading, waiting or uploading */
+	TlU32 numPending;
+	/* bytes uploaded by the last tlStream_Update(), and in all */
+	size_t numBytesLastUpdate;
+	TlU64 numBytesTotal;
+	/* microseconds the last tlStream_Update() took */
+	TlU32 lastUpdateMicrosecs;
+} TlStreamStats;
+
+/* Start the loader threads (0 = TL_STREAM_DEFAULT_THREADS) */
+void tlStream_Init( TlU32 numThreads );
+/*
+ * Stop the loader threads. Files already loaded finish uploading (and run
+ * their callbacks) first; the rest are dropped without their callbacks.
+ */
+void tlStream_Fini( void );
+
+/*
+ * Load a scene file in the background, adding its root entities as children
+ * of `prnt` (or as root entities if NULL) once it's read. `fn` (optional) is
+ * called with `parm` when the request finishes.
+ */
+void tlStreamScene( const char *filename, struct TlEntity_s *prnt, TlStreamFn_t fn, void *parm );
+
+/*
+ * Take the files the loaders have finished and upload what the budgets allow;
+ * main thread only. Uploads stop for the frame once `numBytes` have been
+ * written or `microsecs` have passed since the update began, whichever comes
+ * first (0 = the TL_STREAM_DEFAULT_* budget). Time is checked between pieces,
+ * so the time budget can be overrun by the piece in progress.
+ */
+void tlStream_Update( void );
+void tlStream_SetBudget( size_t numBytes, TlU32 microsecs );
+
+void tlStream_GetStats( TlStreamStats *stats );
+
+TILE_EXTRNC_LEAVE
+
+#endif
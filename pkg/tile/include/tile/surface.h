@@ -2,6 +2,8 @@
 #define TILE_SURFACE_H
 
 #include "const.h"
+#include "math.h"
+#include "vertex.h"
 
 TILE_EXTRNC_ENTER
 
@@ -15,25 +17,126 @@ TILE_EXTRNC_ENTER
 struct TlEntity_s;
 struct TlBrush_s;
 struct TlSurface_s;
+struct TlSceneFile_s;
+
+/*
+ * How often a surface's geometry is expected to change. This decides how it's
+ * uploaded to its GPU buffers.
+ */
+typedef enum {
+	/* Written once (or rarely); uploaded only when modified */
+	kTlBU_Static,
+	/* Modified often; the buffer's storage is orphaned on each upload */
+	kTlBU_Dynamic,
+	/* Modified nearly every frame; uploads rotate through several buffers */
+	kTlBU_Stream
+} TlBufferUsage_t;
+
+/* Number of buffers a kTlBU_Stream surface rotates through */
+#define TL_SURFACE_MAX_BUFFERS 3
+
+/*
+ * Most vertices a surface can have and still be drawn with 16-bit indices.
+ * Larger surfaces are drawn with 32-bit indices instead (or can be split with
+ * tlSplitSurface).
+ */
+#define TL_SURFACE_MAX_SHORT_VERTS 65536
+
+/* Most levels of detail a surface can have, including the full one */
+#define TL_SURFACE_MAX_LODS 8
+
+/*
+ * A level of detail: a range of the surface's index buffer drawing a
+ * simplified version of it with the same vertices (see tlGenerateSurfaceLods).
+ */
+typedef struct TlSurfaceLod_s {
+	TlU32 firstInd;
+	TlU32 numInds;
+	/* how far (in local units) this level strays from the full surface */
+	float error;
+} TlSurfaceLod;
 
-typedef struct TlVertex_s {
-	float xyz[3];
-	float norm[3];
-	float st[2];
-	float binorm[3];
-	float tangent[3];
-	unsigned char color[4];
-} TlVertex;
 typedef struct TL_CACHELINE_ALIGNED TlSurface_s {
-	unsigned short numVerts, maxVerts;
+	/* unique identifier (used by the render queue's sort keys) */
+	TlU32 id;
+
+	unsigned int numVerts, maxVerts;
 	TlVertex *verts;
 
-	int numInds, maxInds;
-	unsigned short *inds;
+	unsigned int numInds, maxInds;
+	TlU32 *inds;
+
+	/*
+	 * Levels of detail, finest first; none if numLods is 0. Level 0 is always
+	 * the full index list. The other levels' indices are kept in lodInds and
+	 * uploaded after inds, so firstInd counts from the start of inds.
+	 */
+	unsigned int numLods;
+	TlSurfaceLod lods[TL_SURFACE_MAX_LODS];
+	TlU32 *lodInds;
+	unsigned int numLodInds;
+	/* level the render queue last picked for this surface in the first view */
+	unsigned int lodCurrent;
 
 	int numPasses;
 	struct TlBrush_s **passes;
 
+	/*
+	 * Surface whose vertices/indices this one draws with instead of its own
+	 * (see tlShareSurfaceGeometry), and how many surfaces draw with this one's
+	 */
+	struct TlSurface_s *geomSrc;
+	int geomRefs;
+	/* deleted while still shared; freed when the last sharer lets go */
+	TlBool isOrphaned;
+
+	/* local-space bounds of the vertices; recomputed lazily once dirty */
+	TlBounds bounds;
+	TlBool boundsDirty;
+	/* position in the list of surfaces with dirty bounds */
+	size_t boundsIndex;
+
+	/* GPU copies of verts and inds (see tlUploadSurface) */
+	struct {
+		unsigned usage:2;
+		TlBool vertsDirty:1;
+		TlBool indsDirty:1;
+		unsigned vboCurrent:2;
+		unsigned iboCurrent:2;
+		TlBool quantize:1;
+		/* being uploaded in pieces (see tlDeferSurfaceUpload); not drawn until done */
+		TlBool isDeferred:1;
+
+		/* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as of the last upload */
+		GLenum indexType;
+
+		/* attributes the surface's passes need; grows as they're seen */
+		TlU32 attribs;
+		/* how the vertices were packed at the last upload */
+		TlVertexLayout layout;
+
+		GLuint vbo[TL_SURFACE_MAX_BUFFERS];
+		GLuint ibo[TL_SURFACE_MAX_BUFFERS];
+		size_t vboSize[TL_SURFACE_MAX_BUFFERS];
+		size_t iboSize[TL_SURFACE_MAX_BUFFERS];
+		/* bytes of the vertices then indices tlUploadSurfacePart() has written */
+		size_t partOffset;
+	} gpu;
+
+	/*
+	 * Geometry still in a memory-mapped scene file (see tlLoadScene). While
+	 * `file` is set, verts, inds and lodInds are null and the GPU buffers are
+	 * filled straight from the file's packed vertices and indices (inds then
+	 * lodInds, with the counts above).
+	 */
+	struct {
+		struct TlSceneFile_s *file;
+		const void *verts;
+		const void *inds;
+		TlVertexLayout layout;
+		GLenum indexType;
+	} mapped;
+
 	struct TlEntity_s *ent;
 	struct TlSurface_s *s_prev, *s_next;
 } TlSurface;
@@ -42,23 +145,125 @@ typedef struct TL_CACHELINE_ALIGNED TlSurface_s {
 struct TlSurface_s *tlNewSurface(struct TlEntity_s *ent);
 struct TlSurface_s *tlDeleteSurface(struct TlSurface_s *surf);
 
-TlVertex *tlAddSurfaceVertices(struct TlSurface_s *surf, unsigned short numVerts);
-unsigned short *tlAddSurfaceTriangles(struct TlSurface_s *surf, unsigned int numTris);
+/* Handles resolve to NULL once the surface is deleted */
+TlHandle tlGetSurfaceHandle(const struct TlSurface_s *surf);
+struct TlSurface_s *tlSurfaceFromHandle(TlHandle h);
+/* Live and peak surface counts (and other stats of the surface pool) */
+void tlGetSurfacePoolStats(TlPoolStats *stats);
+
+/* New vertices start out zeroed */
+TlVertex *tlAddSurfaceVertices(struct TlSurface_s *surf, unsigned int numVerts);
+TlU32 *tlAddSurfaceTriangles(struct TlSurface_s *surf, unsigned int numTris);
 
 void tlAddSurfacePass(struct TlSurface_s *surf, struct TlBrush_s *brush);
 
+/*
+ * Draw `surf` with the vertices and indices of `src` rather than its own. Its
+ * own geometry is released. Surfaces sharing geometry are drawn together as one
+ * instanced draw where possible. Adding to or fetching vertices/triangles of
+ * `surf` for writing gives it a private copy again.
+ */
+void tlShareSurfaceGeometry(struct TlSurface_s *surf, struct TlSurface_s *src);
+/* Retrieve the surface whose vertices and indices `surf` draws with */
+struct TlSurface_s *tlGetSurfaceGeometry(const struct TlSurface_s *surf);
+
+void tlSetSurfaceUsage(struct TlSurface_s *surf, TlBufferUsage_t usage);
+TlBufferUsage_t tlGetSurfaceUsage(const struct TlSurface_s *surf);
+
+/*
+ * Mark the vertices or indices as modified so they're uploaded again before the
+ * surface is next drawn. Adding vertices/triangles or fetching a vertex or
+ * triangle for writing does this automatically; call these if you've kept a
+ * pointer from earlier and written through it since.
+ */
+void tlInvalidateSurfaceVertices(struct TlSurface_s *surf);
+void tlInvalidateSurfaceTriangles(struct TlSurface_s *surf);
+
+/*
+ * Store the surface's positions as shorts relative to its bounds rather than
+ * as floats, saving four bytes per vertex. Precision is the size of the bounds
+ * over 65534 along each axis. Quantized geometry isn't drawn instanced.
+ */
+void tlSetSurfaceVertexQuantization(struct TlSurface_s *surf, TlBool quantize);
+TlBool tlIsSurfaceVertexQuantized(const struct TlSurface_s *surf);
+
+/*
+ * Make sure the uploaded vertices hold `attribs` (TL_VERTEX_* flags) from now
+ * on. Adding a pass does this for the pass's brush; the render queue does it
+ * again at draw time in case the brush has changed since.
+ */
+void tlRequireSurfaceVertexAttribs(struct TlSurface_s *surf, TlU32 attribs);
+/* Retrieve how the vertices were packed for the GPU at the last upload */
+const TlVertexLayout *tlGetSurfaceVertexLayout(const struct TlSurface_s *surf);
+
+/*
+ * Split the surface so no piece uses more than `maxVerts` vertices (0 means
+ * TL_SURFACE_MAX_SHORT_VERTS, so every piece draws with 16-bit indices).
+ * Triangles are kept in order; `surf` keeps the first piece and the rest are
+ * new surfaces of the same entity, with the same passes and settings. Returns
+ * the number of pieces, including `surf`. Surfaces whose geometry is shared
+ * can't be split. Vertices no triangle uses are dropped.
+ */
+unsigned int tlSplitSurface(struct TlSurface_s *surf, unsigned int maxVerts);
+
+/*
+ * Levels of detail of the geometry `surf` draws with. Changing its triangles
+ * throws them away (as does tlClearSurfaceLods); generate them last. A surface
+ * without levels reports one, the full surface.
+ */
+void tlClearSurfaceLods(struct TlSurface_s *surf);
+unsigned int tlGetSurfaceLodCount(const struct TlSurface_s *surf);
+const TlSurfaceLod *tlGetSurfaceLod(const struct TlSurface_s *surf, unsigned int i);
+
+/*
+ * Give a surface loaded from a scene file its own copy of its vertices and
+ * indices, decoded from the file. Anything that reads or writes them does this
+ * first; the file stays mapped until no surface draws from it.
+ */
+void tlUnmapSurface(struct TlSurface_s *surf);
+
+/* Upload any modified geometry to the surface's GPU buffers and bind them */
+void tlUploadSurface(struct TlSurface_s *surf);
+/*
+ * Keep the render queue from drawing (and so uploading) the geometry `surf`
+ * draws with until tlUploadSurfacePart() has uploaded all of it, so a large
+ * upload can be spread over several frames.
+ */
+void tlDeferSurfaceUpload(struct TlSurface_s *surf);
+/*
+ * Upload up to `maxBytes` more of a deferred surface's geometry, vertices then
+ * indices, continuing from the last call. Returns the number of bytes written;
+ * once that's 0 the surface is uploaded and drawn again. Only geometry straight
+ * from a scene file can go in pieces; anything else goes in one
+ * tlUploadSurface() call, whatever its size.
+ */
+size_t tlUploadSurfacePart(struct TlSurface_s *surf, size_t maxBytes);
+
+/*
+ * Retrieve the local-space bounds of the vertices the surface draws with. These
+ * are recomputed whenever the vertices have been invalidated (as above). The
+ * radius is negative if there are no vertices.
+ */
+const TlBounds *tlGetSurfaceBounds(struct TlSurface_s *surf);
+/*
+ * Recompute the bounds of every surface modified since they were last read.
+ * Afterward, tlGetSurfaceBounds() doesn't write to any surface until the
+ * vertices change again, so it's safe to call from several threads at once.
+ */
+void tlUpdateSurfaceBounds(void);
+
 struct TlSurface_s *tlSurfaceBefore(const struct TlSurface_s *surf);
 struct TlSurface_s *tlSurfaceAfter(const struct TlSurface_s *surf);
 struct TlSurface_s *tlFirstSurface(const struct TlEntity_s *ent);
 struct TlSurface_s *tlLastSurface(const struct TlEntity_s *ent);
 
-unsigned short tlGetSurfaceVertexCount(const struct TlSurface_s *surf);
-unsigned short tlGetSurfaceVertexCapacity(const struct TlSurface_s *surf);
-TlVertex *tlGetSurfaceVertex(const struct TlSurface_s *surf, unsigned short i);
+unsigned int tlGetSurfaceVertexCount(const struct TlSurface_s *surf);
+unsigned int tlGetSurfaceVertexCapacity(const struct TlSurface_s *surf);
+TlVertex *tlGetSurfaceVertex(struct TlSurface_s *surf, unsigned int i);
 
 unsigned int tlGetSurfaceTriangleCount(const struct TlSurface_s *surf);
 unsigned int tlGetSurfaceTriangleCapacity(const struct TlSurface_s *surf);
-unsigned short *tlGetSurfaceTriangle(const struct TlSurface_s *surf, unsigned int i);
+TlU32 *tlGetSurfaceTriangle(struct TlSurface_s *surf, unsigned int i);
 
 unsigned int tlGetSurfacePassCount(const struct TlSurface_s *surf);
 struct TlBrush_s *tlGetSurfacePass(const struct TlSurface_s *surf, unsigned int i);
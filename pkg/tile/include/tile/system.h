@@ -3,10 +3,104 @@
 
 #include "const.h"
 
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+#endif
+
 TILE_EXTRNC_ENTER
 
 TlU64 tlSys_Microtime( void );
 
+/* Number of processors available to run threads on (at least 1) */
+TlU32 tlSys_NumCPUs( void );
+
+/*
+ * -------
+ * Threads
+ * -------
+ */
+typedef void( *TlThreadFn_t )( void *parm );
+
+struct TlThread_s;
+typedef struct TlThread_s TlThread;
+
+/* Start a thread running `fn( parm )`; exits the program on failure */
+TlThread *tlSys_NewThread( TlThreadFn_t fn, void *parm );
+/* Wait for the thread to return, then release it */
+void tlSys_JoinThread( TlThread *thread );
+
+typedef struct TlMutex_s {
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+} TlMutex;
+
+void tlSys_InitMutex( TlMutex *mutex );
+void tlSys_FiniMutex( TlMutex *mutex );
+void tlSys_LockMutex( TlMutex *mutex );
+void tlSys_UnlockMutex( TlMutex *mutex );
+
+typedef struct TlSemaphore_s {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	/* unnamed POSIX semaphores aren't available everywhere (Mac OS X) */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	TlU32 count;
+#endif
+} TlSemaphore;
+
+void tlSys_InitSemaphore( TlSemaphore *sem, TlU32 count );
+void tlSys_FiniSemaphore( TlSemaphore *sem );
+/* Wait for the count to be nonzero, then decrement it */
+void tlSys_WaitSemaphore( TlSemaphore *sem );
+/* Increment the count by `n`, waking up to `n` waiting threads */
+void tlSys_SignalSemaphore( TlSemaphore *sem, TlU32 n );
+
+/* Give up the rest of the calling thread's time slice */
+void tlSys_Yield( void );
+
+/*
+ * -------
+ * Atomics
+ * -------
+ * Read-modify-write operations and fences are sequentially consistent. Loads
+ * acquire and stores release, except for the "Relaxed" pointer versions, which
+ * only promise not to tear.
+ */
+TlU32 tlSys_AtomicLoad( volatile TlU32 *p );
+void tlSys_AtomicStore( volatile TlU32 *p, TlU32 v );
+/* Add (or subtract) `n`, returning the new value */
+TlU32 tlSys_AtomicAdd( volatile TlU32 *p, TlU32 n );
+TlU32 tlSys_AtomicSub( volatile TlU32 *p, TlU32 n );
+/* Set to `desired` if currently `expected`; returns whether it was */
+TlBool tlSys_AtomicCompareSwap( volatile TlU32 *p, TlU32 expected, TlU32 desired );
+
+void *tlSys_AtomicLoadPtrRelaxed( void *volatile *p );
+void tlSys_AtomicStorePtrRelaxed( void *volatile *p, void *v );
+
+void tlSys_MemoryFence( void );
+
+/*
+ * ------------
+ * Mapped Files
+ * ------------
+ */
+
+/*
+ * Map a whole file into memory, read-only, storing its size in `*size`.
+ * Returns NULL if it can't be opened or mapped, or is empty.
+ */
+const void *tlSys_MapFile( const char *filename, size_t *size );
+void tlSys_UnmapFile( const void *p, size_t size );
+/* Read a mapped range in now, blocking on the disk, so touching it later won't */
+void tlSys_PrefetchFile( const void *p, size_t size );
+
 TILE_EXTRNC_LEAVE
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef TILE_TRANSFORM_H
+#define TILE_TRANSFORM_H
+
+#include "const.h"
+#include "math.h"
+
+TILE_EXTRNC_ENTER
+
+struct TlEntity_s;
+
+/*
+ * ---------------
+ * Transform Store
+ * ---------------
+ * Holds the local, global, and model-view matrices of every entity in
+ * contiguous arrays rather than in each entity. The arrays are kept sorted by
+ * hierarchy depth (every parent before its children) so that updating the
+ * global matrices is a single linear sweep.
+ *
+ * Entities refer to their transforms through a handle, which stays the same
+ * for the entity's lifetime. Handles map to array indices; the indices change
+ * whenever the store is re-sorted, so they're only good until the next call to
+ * tlXf_Update() (or the next new/delete/reparent).
+ *
+ * Dirty flags follow the same rule as before: if a transform is dirty, so are
+ * all of its descendants. Entity code is responsible for marking subtrees.
+ */
+typedef TlU32 TlXform;
+
+#define TL_XFORM_NONE ((TlXform)0xFFFFFFFF)
+
+/* Allocate a transform (identity, dirty) for `owner` under parent `prnt` */
+TlXform tlXf_New(struct TlEntity_s *owner, TlXform prnt);
+/* Release a transform; its children must already be gone or reparented */
+void tlXf_Delete(TlXform xf);
+/* Change the parent of a transform */
+void tlXf_SetParent(TlXform xf, TlXform prnt);
+
+TlMat4 *tlXf_Local(TlXform xf);
+/* Retrieve the global matrix, computing it (and any dirty ancestors) if needed */
+const TlMat4 *tlXf_Global(TlXform xf);
+TlMat4 *tlXf_ModelView(TlXform xf);
+
+TlBool tlXf_IsDirty(TlXform xf);
+void tlXf_MarkDirty(TlXform xf);
+/*
+ * Mark only this transform dirty without telling tlXf_Update(); safe to call
+ * from several threads on different transforms. Whoever calls it must follow up
+ * with tlXf_MarkDirty() (and mark the descendants) from one thread.
+ */
+void tlXf_MarkDirtyQuiet(TlXform xf);
+
+/*
+ * Re-sort the store if the hierarchy changed, then recompute every dirty global
+ * matrix in one sweep. The renderer calls this once per frame before queueing.
+ */
+void tlXf_Update(void);
+
+/* Direct access by index for linear sweeps; valid until the next change */
+TlU32 tlXf_Count(void);
+struct TlEntity_s *tlXf_OwnerAt(TlU32 i);
+const TlMat4 *tlXf_GlobalAt(TlU32 i);
+/* Index of the parent (always less than i), or TL_XFORM_NONE for a root */
+TlU32 tlXf_ParentAt(TlU32 i);
+TlMat4 *tlXf_ModelViewAt(TlU32 i);
+
+TILE_EXTRNC_LEAVE
+
+#endif
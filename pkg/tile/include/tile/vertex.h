@@ -0,0 +1,95 @@
+#ifndef TILE_VERTEX_H
+#define TILE_VERTEX_H
+
+#include "const.h"
+#include "math.h"
+
+TILE_EXTRNC_ENTER
+
+struct TlBrush_s;
+
+/*
+ * ------
+ * Vertex
+ * ------
+ * TlVertex is how vertices are written and kept on the CPU. What goes to the
+ * GPU is a packed copy holding only the attributes the surface's brushes use,
+ * in smaller types, as described by a TlVertexLayout.
+ */
+typedef struct TlVertex_s {
+	float xyz[3];
+	float norm[3];
+	float st[2];
+	float binorm[3];
+	float tangent[3];
+	unsigned char color[4];
+} TlVertex;
+
+/* Attributes a vertex layout can hold */
+#define TL_VERTEX_POSITION 0x01
+#define TL_VERTEX_NORMAL   0x02
+#define TL_VERTEX_TEXCOORD 0x04
+#define TL_VERTEX_BINORMAL 0x08
+#define TL_VERTEX_TANGENT  0x10
+#define TL_VERTEX_COLOR    0x20
+
+/*
+ * Generic attribute locations for the binormal and tangent, which have no
+ * fixed-function arrays. Brush shaders read them as "tl_Binormal" and
+ * "tl_Tangent".
+ */
+#define TL_VERTEX_ATTRIB_BINORMAL 6
+#define TL_VERTEX_ATTRIB_TANGENT  7
+
+/*
+ * Packed types:
+ *   position  3 floats (12 bytes), or 3 shorts plus padding (8 bytes) when
+ *             quantized to the surface's bounds
+ *   normal    3 signed bytes plus padding (4 bytes)
+ *   texcoord  2 half floats (4 bytes) where supported, else 2 floats
+ *   binormal  3 signed bytes plus padding (4 bytes)
+ *   tangent   3 signed bytes plus padding (4 bytes)
+ *   color     4 unsigned bytes
+ */
+typedef struct TlVertexLayout_s {
+	TlU32 attribs;
+	TlBool quantized;
+	TlBool halfTexCoords;
+
+	TlU32 stride;
+	TlU32 position, normal, texCoord, binormal, tangent, color;
+
+	/* quantized positions decode as bias + q*scale, per axis */
+	TlVec3 scale;
+	TlVec3 bias;
+} TlVertexLayout;
+
+/* Attributes drawing with `brush` needs (position and color always) */
+TlU32 tlGetBrushVertexAttribs(const struct TlBrush_s *brush);
+
+/*
+ * Lay out `attribs`. Quantized positions need the bounds of the positions to
+ * be packed; `bounds` is ignored otherwise.
+ */
+void tlInitVertexLayout(TlVertexLayout *layout, TlU32 attribs, TlBool quantize, const TlBounds *bounds);
+/* Convert `n` vertices into `dst`, which must hold n*layout->stride bytes */
+void tlPackVertices(const TlVertexLayout *layout, void *dst, const TlVertex *src, size_t n);
+/* Convert `n` packed vertices back (to the precision they were packed with) */
+void tlUnpackVertices(const TlVertexLayout *layout, TlVertex *dst, const void *src, size_t n);
+/* Matrix taking quantized positions back to the surface's local space */
+TlMat4 *tlLoadVertexDequantize(TlMat4 *pOutM, const TlVertexLayout *layout);
+
+/*
+ * Point the GL vertex arrays at the bound buffer's vertices in `layout`,
+ * enabling the arrays it has and disabling the rest. tlResetVertexArrays()
+ * disables everything but the position and color arrays.
+ */
+void tlBindVertexLayout(const TlVertexLayout *layout);
+void tlResetVertexArrays(void);
+
+TlU16 tlFloatToHalf(float f);
+float tlHalfToFloat(TlU16 h);
+
+TILE_EXTRNC_LEAVE
+
+#endif
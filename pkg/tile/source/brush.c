@@ -1,5 +1,6 @@
 #include <tile/brush.h>
 #include <tile/renderer.h>
+#include <tile/vertex.h>
 
 /*
  * ==========================================================================
@@ -11,16 +12,125 @@
 static TlBrush *g_brush_head = (TlBrush *)0;
 static TlBrush *g_brush_tail = (TlBrush *)0;
 
+static TlPool g_brush_pool = TL_POOL_INITIALIZER("brush", TlBrush);
+
+/* ids of deleted brushes, handed out again before new ones */
+static TlU32 *g_brush_freeIds = (TlU32 *)0;
+static TlU32 g_brush_numFreeIds = 0;
+static TlU32 g_brush_maxFreeIds = 0;
+static TlU32 g_brush_nextId = 0;
+
+/* interned brushes, chained by the hash of their settings */
+#define BRUSH_INTERN_BUCKETS 256
+static TlBrush *g_brush_interned[BRUSH_INTERN_BUCKETS];
+
+static TlU32 tlBrush_AllocId() {
+	if (g_brush_numFreeIds > 0)
+		return g_brush_freeIds[--g_brush_numFreeIds];
+
+	return g_brush_nextId++;
+}
+static void tlBrush_FreeId(TlU32 id) {
+	if (g_brush_numFreeIds == g_brush_maxFreeIds) {
+		g_brush_maxFreeIds = g_brush_maxFreeIds ? g_brush_maxFreeIds*2 : 64;
+		g_brush_freeIds = (TlU32 *)tlMemory((void *)g_brush_freeIds,
+			g_brush_maxFreeIds*sizeof(TlU32));
+	}
+
+	g_brush_freeIds[g_brush_numFreeIds++] = id;
+}
+
+/* The brush's flags and modes in one word */
+static TlU32 tlBrush_PackState(const TlBrush *brush) {
+	TlU32 bits;
+
+	bits  = brush->lighting.isLit       ? 0x0001 : 0;
+	bits |= brush->lighting.useDiffuse  ? 0x0002 : 0;
+	bits |= brush->lighting.useAmbient  ? 0x0004 : 0;
+	bits |= brush->lighting.useEmissive ? 0x0008 : 0;
+	bits |= brush->lighting.useSpecular ? 0x0010 : 0;
+	bits |= brush->drawing.isVisible    ? 0x0020 : 0;
+	bits |= brush->drawing.usesBinorm   ? 0x0040 : 0;
+	bits |= brush->drawing.usesTangent  ? 0x0080 : 0;
+	bits |= brush->drawing.zTest        ? 0x0100 : 0;
+	bits |= brush->drawing.zWrite       ? 0x0200 : 0;
+	bits |= brush->drawing.zSort        ? 0x0400 : 0;
+	bits |= brush->shader.hasVert       ? 0x0800 : 0;
+	bits |= brush->shader.hasFrag       ? 0x1000 : 0;
+	bits |= (TlU32)brush->drawing.cullMode << 16;
+	bits |= (TlU32)brush->drawing.zCmpFunc << 20;
+
+	return bits;
+}
+/* 32-bit FNV-1a, continuing from `h` */
+static TlU32 tlBrush_HashBytes(TlU32 h, const void *p, size_t n) {
+	const TlU8 *bytes;
+	size_t i;
+
+	bytes = (const TlU8 *)p;
+	for(i=0; i<n; i++) {
+		h ^= bytes[i];
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+static TlU32 tlBrush_Hash(const TlBrush *brush) {
+	TlU32 h, bits;
+
+	bits = tlBrush_PackState(brush);
+
+	h = 0x811C9DC5;
+	h = tlBrush_HashBytes(h, (const void *)&bits, sizeof(bits));
+	h = tlBrush_HashBytes(h, (const void *)&brush->shader.prog, sizeof(brush->shader.prog));
+	h = tlBrush_HashBytes(h, (const void *)&brush->lighting.diffuse, sizeof(TlColor));
+	h = tlBrush_HashBytes(h, (const void *)&brush->lighting.ambient, sizeof(TlColor));
+	h = tlBrush_HashBytes(h, (const void *)&brush->lighting.emissive, sizeof(TlColor));
+	h = tlBrush_HashBytes(h, (const void *)&brush->lighting.specular, sizeof(TlColor));
+	h = tlBrush_HashBytes(h, (const void *)&brush->lighting.shininess, sizeof(float));
+
+	return h;
+}
+/* Whether two brushes would draw the same; compared bitwise, as hashed */
+static TlBool tlBrush_SameState(const TlBrush *a, const TlBrush *b) {
+	if (a->shader.prog != b->shader.prog || tlBrush_PackState(a) != tlBrush_PackState(b))
+		return FALSE;
+
+	return memcmp((const void *)&a->lighting.diffuse, (const void *)&b->lighting.diffuse, sizeof(TlColor))==0 &&
+		memcmp((const void *)&a->lighting.ambient, (const void *)&b->lighting.ambient, sizeof(TlColor))==0 &&
+		memcmp((const void *)&a->lighting.emissive, (const void *)&b->lighting.emissive, sizeof(TlColor))==0 &&
+		memcmp((const void *)&a->lighting.specular, (const void *)&b->lighting.specular, sizeof(TlColor))==0 &&
+		memcmp((const void *)&a->lighting.shininess, (const void *)&b->lighting.shininess, sizeof(float))==0;
+}
+static void tlBrush_Unintern(TlBrush *brush) {
+	TlBrush **link;
+
+	link = &g_brush_interned[brush->intern.hash % BRUSH_INTERN_BUCKETS];
+	while(*link != brush)
+		link = &(*link)->intern.next;
+
+	*link = brush->intern.next;
+
+	brush->intern.isInterned = FALSE;
+	brush->intern.next = (TlBrush *)0;
+}
+
 TlBrush *tlNewBrush() {
 	TlBrush *brush;
 
-	brush = tlAllocStruct(TlBrush);
+	brush = (TlBrush *)tlPoolAlloc(&g_brush_pool);
 
 	brush->refCnt = 0;
+	brush->id = tlBrush_AllocId();
 
-	brush->shader.vert = 0;
-	brush->shader.frag = 0;
+	brush->intern.isInterned = FALSE;
+	brush->intern.hash = 0;
+	brush->intern.next = (TlBrush *)0;
+
+	brush->shader.hasVert = FALSE;
+	brush->shader.hasFrag = FALSE;
 	brush->shader.prog = 0;
+	brush->shader.blocks = 0;
 
 	brush->lighting.diffuse.r = 1.0f;
 	brush->lighting.diffuse.g = 1.0f;
@@ -47,6 +157,8 @@ TlBrush *tlNewBrush() {
 	brush->lighting.useEmissive = TRUE;
 	brush->lighting.useSpecular = TRUE;
 
+	brush->lighting.isDirty = TRUE;
+
 	brush->drawing.isVisible = TRUE;
 	brush->drawing.usesBinorm = FALSE;
 	brush->drawing.usesTangent = FALSE;
@@ -70,9 +182,10 @@ TlBrush *tlCopyBrush(const TlBrush *copyFrom) {
 
 	brush = tlNewBrush();
 
-	brush->shader.vert = 0;
-	brush->shader.frag = 0;
+	brush->shader.hasVert = FALSE;
+	brush->shader.hasFrag = FALSE;
 	brush->shader.prog = 0;
+	brush->shader.blocks = 0;
 
 	brush->lighting.diffuse.r = copyFrom->lighting.diffuse.r;
 	brush->lighting.diffuse.g = copyFrom->lighting.diffuse.g;
@@ -117,18 +230,12 @@ TlBrush *tlDeleteBrush(TlBrush *brush) {
 	if (--brush->refCnt > 0)
 		return (TlBrush *)0;
 
-	if (brush->shader.prog) {
-		tlR_DeleteProgram(brush->shader.prog);
-		brush->shader.prog = 0;
-	}
-	if (brush->shader.frag) {
-		tlR_DeleteShader(brush->shader.frag);
-		brush->shader.frag = 0;
-	}
-	if (brush->shader.vert) {
-		tlR_DeleteShader(brush->shader.vert);
-		brush->shader.vert = 0;
-	}
+	tlR_ReleaseProgram(brush->shader.prog);
+	brush->shader.prog = 0;
+
+	if (brush->intern.isInterned)
+		tlBrush_Unintern(brush);
+	tlBrush_FreeId(brush->id);
 
 	if (brush->prev)
 		brush->prev->next = brush->next;
@@ -140,71 +247,81 @@ TlBrush *tlDeleteBrush(TlBrush *brush) {
 	if (g_brush_tail==brush)
 		g_brush_tail = brush->prev;
 
-	return (TlBrush *)tlMemory((void *)brush, 0);
+	return (TlBrush *)tlPoolFree(&g_brush_pool, (void *)brush);
+}
+
+TlHandle tlGetBrushHandle(const TlBrush *brush) {
+	return tlPoolHandle(&g_brush_pool, (const void *)brush);
+}
+TlBrush *tlBrushFromHandle(TlHandle h) {
+	return (TlBrush *)tlPoolLookup(&g_brush_pool, h);
+}
+void tlGetBrushPoolStats(TlPoolStats *stats) {
+	tlGetPoolStats(&g_brush_pool, stats);
 }
 
 void tlRetainBrush(TlBrush *brush) {
 	brush->refCnt++;
 }
 
-void tlSetBrushShader(TlBrush *brush, const char *vertSrc, const char *fragSrc) {
-	char infoLog[8192];
+TlBrush *tlInternBrush(TlBrush *brush) {
+	TlBrush *other;
+	TlU32 hash;
 
-	if (brush->shader.prog) {
-		tlR_DeleteProgram(brush->shader.prog);
-		brush->shader.prog = 0;
-	}
-	if (brush->shader.frag) {
-		tlR_DeleteShader(brush->shader.frag);
-		brush->shader.frag = 0;
-	}
-	if (brush->shader.vert) {
-		tlR_DeleteShader(brush->shader.vert);
-		brush->shader.vert = 0;
-	}
-
-	if (vertSrc) brush->shader.vert = tlR_CreateShader(GL_VERTEX_SHADER_ARB);
-	if (fragSrc) brush->shader.frag = tlR_CreateShader(GL_FRAGMENT_SHADER_ARB);
-
-	if (!vertSrc && !fragSrc)
-		return;
+	if (!brush)
+		return (TlBrush *)0;
 
-	/*
-	 * TODO: Better error reporting...
-	 */
+	hash = tlBrush_Hash(brush);
 
-	brush->shader.prog = tlR_CreateProgram();
+	for(other=g_brush_interned[hash % BRUSH_INTERN_BUCKETS]; other; other=other->intern.next) {
+		if (other==brush || other->intern.hash!=hash || !tlBrush_SameState(other, brush))
+			continue;
 
-	if (vertSrc) {
-		tlR_ShaderSource(brush->shader.vert, 1, &vertSrc, (int *)0);
-		tlR_CompileShader(brush->shader.vert);
+		tlDeleteBrush(brush);
+		return other;
+	}
 
-		tlR_GetShaderInfoLog(brush->shader.vert, sizeof(infoLog), 0, infoLog);
-		fprintf(stderr, "%s\n", infoLog);
+	/* changed since it was interned; file it under its new settings */
+	if (brush->intern.isInterned) {
+		if (brush->intern.hash==hash)
+			return brush;
 
-		tlR_AttachObject(brush->shader.prog, brush->shader.vert);
+		tlBrush_Unintern(brush);
 	}
 
-	if (fragSrc) {
-		tlR_ShaderSource(brush->shader.frag, 1, &fragSrc, (int *)0);
-		tlR_CompileShader(brush->shader.frag);
+	brush->intern.isInterned = TRUE;
+	brush->intern.hash = hash;
+	brush->intern.next = g_brush_interned[hash % BRUSH_INTERN_BUCKETS];
+	g_brush_interned[hash % BRUSH_INTERN_BUCKETS] = brush;
 
-		tlR_GetShaderInfoLog(brush->shader.frag, sizeof(infoLog), 0, infoLog);
-		fprintf(stderr, "%s\n", infoLog);
+	return brush;
+}
+TlU32 tlGetBrushId(const TlBrush *brush) {
+	return brush->id;
+}
 
-		tlR_AttachObject(brush->shader.prog, brush->shader.frag);
-	}
+void tlSetBrushShader(TlBrush *brush, const char *vertSrc, const char *fragSrc) {
+	/* these have no fixed-function arrays (see vertex.h) */
+	static const TlShaderAttrib attribs[] = {
+		{ TL_VERTEX_ATTRIB_BINORMAL, "tl_Binormal" },
+		{ TL_VERTEX_ATTRIB_TANGENT, "tl_Tangent" }
+	};
+
+	tlR_ReleaseProgram(brush->shader.prog);
 
-	tlR_LinkProgram(brush->shader.prog);
+	/* brushes with the same sources share one program */
+	brush->shader.prog = tlR_AcquireProgram(vertSrc, fragSrc, attribs,
+		sizeof(attribs)/sizeof(attribs[0]));
 
-	tlR_GetProgramInfoLog(brush->shader.prog, sizeof(infoLog), 0, infoLog);
-	fprintf(stderr, "%s\n", infoLog);
+	brush->shader.hasVert = vertSrc && brush->shader.prog ? TRUE : FALSE;
+	brush->shader.hasFrag = fragSrc && brush->shader.prog ? TRUE : FALSE;
+	brush->shader.blocks = tlR_GetProgramBlocks(brush->shader.prog);
 }
 TlBool tlIsBrushVertexShaderAttached(const TlBrush *brush) {
-	return brush->shader.vert ? TRUE : FALSE;
+	return brush->shader.hasVert;
 }
 TlBool tlIsBrushFragmentShaderAttached(const TlBrush *brush) {
-	return brush->shader.frag ? TRUE : FALSE;
+	return brush->shader.hasFrag;
 }
 TlBool tlIsBrushShaderAttached(const TlBrush *brush) {
 	return brush->shader.prog ? TRUE : FALSE;
@@ -215,6 +332,7 @@ void tlSetBrushDiffuse(TlBrush *brush, float r, float g, float b, float a) {
 	brush->lighting.diffuse.g = g;
 	brush->lighting.diffuse.b = b;
 	brush->lighting.diffuse.a = a;
+	brush->lighting.isDirty = TRUE;
 }
 float tlGetBrushDiffuseR(const TlBrush *brush) {
 	return brush->lighting.diffuse.r;
@@ -234,6 +352,7 @@ void tlSetBrushAmbient(TlBrush *brush, float r, float g, float b, float a) {
 	brush->lighting.ambient.g = g;
 	brush->lighting.ambient.b = b;
 	brush->lighting.ambient.a = a;
+	brush->lighting.isDirty = TRUE;
 }
 float tlGetBrushAmbientR(const TlBrush *brush) {
 	return brush->lighting.ambient.r;
@@ -253,6 +372,7 @@ void tlSetBrushEmissive(TlBrush *brush, float r, float g, float b, float a) {
 	brush->lighting.emissive.g = g;
 	brush->lighting.emissive.b = b;
 	brush->lighting.emissive.a = a;
+	brush->lighting.isDirty = TRUE;
 }
 float tlGetBrushEmissiveR(const TlBrush *brush) {
 	return brush->lighting.emissive.r;
@@ -272,6 +392,7 @@ void tlSetBrushSpecular(TlBrush *brush, float r, float g, float b, float a) {
 	brush->lighting.specular.g = g;
 	brush->lighting.specular.b = b;
 	brush->lighting.specular.a = a;
+	brush->lighting.isDirty = TRUE;
 }
 float tlGetBrushSpecularR(const TlBrush *brush) {
 	return brush->lighting.specular.r;
@@ -288,6 +409,7 @@ float tlGetBrushSpecularA(const TlBrush *brush) {
 
 void tlSetBrushShininess(TlBrush *brush, float shininess) {
 	brush->lighting.shininess = shininess;
+	brush->lighting.isDirty = TRUE;
 }
 float tlGetBrushShininess(const TlBrush *brush) {
 	return brush->lighting.shininess;
@@ -295,9 +417,11 @@ float tlGetBrushShininess(const TlBrush *brush) {
 
 void tlEnableBrushLighting(TlBrush *brush) {
 	brush->lighting.isLit = TRUE;
+	brush->lighting.isDirty = TRUE;
 }
 void tlDisableBrushLighting(TlBrush *brush) {
 	brush->lighting.isLit = FALSE;
+	brush->lighting.isDirty = TRUE;
 }
 TlBool tlIsBrushLightingEnabled(const TlBrush *brush) {
 	return brush->lighting.isLit;
@@ -305,9 +429,11 @@ TlBool tlIsBrushLightingEnabled(const TlBrush *brush) {
 
 void tlEnableBrushDiffuseLighting(TlBrush *brush) {
 	brush->lighting.useDiffuse = TRUE;
+	brush->lighting.isDirty = TRUE;
 }
 void tlDisableBrushDiffuseLighting(TlBrush *brush) {
 	brush->lighting.useDiffuse = FALSE;
+	brush->lighting.isDirty = TRUE;
 }
 TlBool tlIsBrushDiffuseLightingEnabled(const TlBrush *brush) {
 	return brush->lighting.useDiffuse;
@@ -315,9 +441,11 @@ TlBool tlIsBrushDiffuseLightingEnabled(const TlBrush *brush) {
 
 void tlEnableBrushAmbientLighting(TlBrush *brush) {
 	brush->lighting.useAmbient = TRUE;
+	brush->lighting.isDirty = TRUE;
 }
 void tlDisableBrushAmbientLighting(TlBrush *brush) {
 	brush->lighting.useAmbient = FALSE;
+	brush->lighting.isDirty = TRUE;
 }
 TlBool tlIsBrushAmbientLightingEnabled(const TlBrush *brush) {
 	return brush->lighting.useAmbient;
@@ -325,9 +453,11 @@ TlBool tlIsBrushAmbientLightingEnabled(const TlBrush *brush) {
 
 void tlEnableBrushEmissiveLighting(TlBrush *brush) {
 	brush->lighting.useEmissive = TRUE;
+	brush->lighting.isDirty = TRUE;
 }
 void tlDisableBrushEmissiveLighting(TlBrush *brush) {
 	brush->lighting.useEmissive = FALSE;
+	brush->lighting.isDirty = TRUE;
 }
 TlBool tlIsBrushEmissiveLightingEnabled(const TlBrush *brush) {
 	return brush->lighting.useEmissive;
@@ -335,9 +465,11 @@ TlBool tlIsBrushEmissiveLightingEnabled(const TlBrush *brush) {
 
 void tlEnableBrushSpecularLighting(TlBrush *brush) {
 	brush->lighting.useSpecular = TRUE;
+	brush->lighting.isDirty = TRUE;
 }
 void tlDisableBrushSpecularLighting(TlBrush *brush) {
 	brush->lighting.useSpecular = FALSE;
+	brush->lighting.isDirty = TRUE;
 }
 TlBool tlIsBrushSpecularLightingEnabled(const TlBrush *brush) {
 	return brush->lighting.useSpecular;
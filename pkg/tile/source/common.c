@@ -1,4 +1,5 @@
 #include <tile/const.h>
+#include <tile/system.h>
 
 /*
  * ==========================================================================
@@ -129,12 +130,16 @@ void tlErrorExit(const char *message, ...) {
  *
  * ==========================================================================
  */
+/* calls into malloc() and friends, for tlGetHeapCallCount() */
+static volatile TlU32 g_heapCalls = 0;
+
 void *tlAlloc(size_t n) {
 	void *p;
 
 	if (!n)
 		return (void *)0;
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	p = malloc(n);
 	if (!p) {
 		TL_BREAKPOINT();
@@ -146,6 +151,7 @@ void *tlAlloc(size_t n) {
 void *tlAllocZero(size_t n) {
 	void *p;
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	p = calloc(1, n);
 	if (!p) {
 		TL_BREAKPOINT();
@@ -188,6 +194,7 @@ void *tlReallocArray(void *p, size_t nmemb, size_t size) {
 #ifdef __OpenBSD__
 	void *q;
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	if( !( q = reallocarray(p, nmemb, size) ) ) {
 		TL_BREAKPOINT();
 		tlErrorExit("Failed to reallocate memory");
@@ -206,6 +213,7 @@ void *tlReallocArray(void *p, size_t nmemb, size_t size) {
 		return tlAlloc( nmemb*size );
 	}
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	if( !( q = realloc(p, nmemb*size) ) ) {
 		TL_BREAKPOINT();
 		tlErrorExit("Failed to reallocate memory");
@@ -218,6 +226,7 @@ void *tlReallocArrayZero(void *p, size_t oldnmemb, size_t nmemb, size_t size) {
 #ifdef __OpenBSD__
 	void *q;
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	if( !( q = recallocarray(p, oldnmemb, nmemb, size) ) ) {
 		TL_BREAKPOINT();
 		tlErrorExit("Failed to reallocate memory");
@@ -236,6 +245,7 @@ void *tlReallocArrayZero(void *p, size_t oldnmemb, size_t nmemb, size_t size) {
 		tlErrorExit("Requested too much memory");
 	}
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	if( !( q = realloc(p, nmemb*size) ) ) {
 		TL_BREAKPOINT();
 		tlErrorExit("Failed to reallocate memory");
@@ -255,10 +265,15 @@ void *tlFree(void *p) {
 	if (!p)
 		return (void *)0;
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	free(p);
 	return (void *)0;
 }
 
+TlU32 tlGetHeapCallCount(void) {
+	return tlSys_AtomicLoad(&g_heapCalls);
+}
+
 void *tlMemory(void *p, size_t n) {
 	void *q;
 
@@ -268,6 +283,7 @@ void *tlMemory(void *p, size_t n) {
 	if (!n)
 		return tlFree(p);
 
+	tlSys_AtomicAdd(&g_heapCalls, 1);
 	q = realloc(p, n);
 	if (!q)
 		tlErrorExit("Failed to reallocate memory");
@@ -275,6 +291,344 @@ void *tlMemory(void *p, size_t n) {
 	return q;
 }
 
+/*
+ * ==========================================================================
+ *
+ *	ARENA
+ *
+ * ==========================================================================
+ */
+typedef struct TlArenaBlock_s {
+	struct TlArenaBlock_s *next;
+} TlArenaBlock;
+
+#define ARENA_ALIGN(x) (((x) + (TL_ARENA_ALIGNMENT - 1)) & ~(size_t)(TL_ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_HEADER ARENA_ALIGN(sizeof(TlArenaBlock))
+#define ARENA_GRAN 4096
+
+void tlInitArena(TlArena *arena, size_t capacity) {
+	TL_ASSERT( arena != (TlArena *)0 );
+
+	memset((void *)arena, 0, sizeof(*arena));
+
+	if (capacity) {
+		arena->capacity = ARENA_ALIGN(capacity);
+		arena->base = (unsigned char *)tlAlloc(arena->capacity);
+		arena->numHeapCalls++;
+	}
+}
+static void tlArena_FreeOverflow(TlArena *arena) {
+	TlArenaBlock *next;
+
+	while (arena->overflow) {
+		next = arena->overflow->next;
+		tlFree((void *)arena->overflow);
+		arena->overflow = next;
+	}
+
+	arena->overflowUsed = 0;
+}
+void tlFiniArena(TlArena *arena) {
+	tlArena_FreeOverflow(arena);
+	tlFree((void *)arena->base);
+
+	memset((void *)arena, 0, sizeof(*arena));
+}
+void *tlArenaAlloc(TlArena *arena, size_t n) {
+	TlArenaBlock *block;
+	size_t total;
+	void *p;
+
+	n = ARENA_ALIGN(n);
+
+	if (arena->used + n <= arena->capacity) {
+		p = (void *)&arena->base[arena->used];
+		arena->used += n;
+	} else {
+		/* doesn't fit; borrow from the heap until the next reset */
+		block = (TlArenaBlock *)tlAlloc(ARENA_BLOCK_HEADER + n);
+		block->next = arena->overflow;
+		arena->overflow = block;
+
+		arena->overflowUsed += n;
+		arena->numHeapCalls++;
+		arena->curHeapCalls++;
+
+		p = (void *)((unsigned char *)block + ARENA_BLOCK_HEADER);
+	}
+
+	total = arena->used + arena->overflowUsed;
+	if (total > arena->highWater)
+		arena->highWater = total;
+
+	return p;
+}
+void tlResetArena(TlArena *arena) {
+	size_t capacity;
+
+	arena->lastUsed = arena->used + arena->overflowUsed;
+
+	tlArena_FreeOverflow(arena);
+
+	/* grow to fit the most ever used, so the next cycle stays in the block */
+	if (arena->highWater > arena->capacity) {
+		capacity = arena->highWater + arena->highWater/4;
+		capacity += ARENA_GRAN - capacity%ARENA_GRAN;
+
+		tlFree((void *)arena->base);
+		arena->base = (unsigned char *)tlAlloc(capacity);
+		arena->capacity = capacity;
+
+		arena->numHeapCalls++;
+		arena->curHeapCalls++;
+	}
+
+	arena->used = 0;
+
+	arena->lastHeapCalls = arena->curHeapCalls;
+	arena->curHeapCalls = 0;
+}
+void tlGetArenaStats(const TlArena *arena, TlArenaStats *stats) {
+	TL_ASSERT( stats != (TlArenaStats *)0 );
+
+	stats->capacity = arena->capacity;
+	stats->used = arena->used + arena->overflowUsed;
+	stats->lastUsed = arena->lastUsed;
+	stats->highWater = arena->highWater;
+	stats->numHeapCalls = arena->numHeapCalls;
+	stats->lastHeapCalls = arena->lastHeapCalls;
+}
+
+#undef ARENA_GRAN
+#undef ARENA_BLOCK_HEADER
+#undef ARENA_ALIGN
+
+#ifndef TL_FRAME_ARENA_SIZE
+# define TL_FRAME_ARENA_SIZE (256*1024)
+#endif
+
+static TlBool g_frameArenasInit = FALSE;
+static TlArena g_frameArena;
+static TlArena g_frameArenaLong[2];
+static unsigned int g_frameParity = 0;
+
+static void tlFrame_Init(void) {
+	if (g_frameArenasInit)
+		return;
+
+	tlInitArena(&g_frameArena, TL_FRAME_ARENA_SIZE);
+	tlInitArena(&g_frameArenaLong[0], TL_FRAME_ARENA_SIZE/4);
+	tlInitArena(&g_frameArenaLong[1], TL_FRAME_ARENA_SIZE/4);
+
+	g_frameArenasInit = TRUE;
+}
+void *tlFrameAlloc(size_t n) {
+	tlFrame_Init();
+	return tlArenaAlloc(&g_frameArena, n);
+}
+void *tlFrameAllocLong(size_t n) {
+	tlFrame_Init();
+	return tlArenaAlloc(&g_frameArenaLong[g_frameParity], n);
+}
+void tlResetFrameArenas(void) {
+	tlFrame_Init();
+
+	tlResetArena(&g_frameArena);
+
+	/* the other arena's allocations were made two frames ago; they're done */
+	g_frameParity ^= 1;
+	tlResetArena(&g_frameArenaLong[g_frameParity]);
+}
+void tlGetFrameArenaStats(TlArenaStats *frame, TlArenaStats *longFrame) {
+	tlFrame_Init();
+
+	if (frame)
+		tlGetArenaStats(&g_frameArena, frame);
+	if (longFrame)
+		tlGetArenaStats(&g_frameArenaLong[g_frameParity], longFrame);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	POOL
+ *
+ * ==========================================================================
+ */
+
+/*
+ * Slab layout: the header, then the objects starting at the first cache line
+ * boundary. Each object is followed by its tag and padded out to the stride.
+ */
+typedef struct TlPoolSlab_s {
+	struct TlPoolSlab_s *next;
+} TlPoolSlab;
+typedef struct TlPoolTag_s {
+	TlU32 slot;
+	/* odd while the object is live */
+	TlU32 generation;
+} TlPoolTag;
+
+#define POOL_ALIGN(x) (((x) + (TL_CACHELINE_SIZE - 1)) & ~(size_t)(TL_CACHELINE_SIZE - 1))
+#define POOL_TAG_OFFSET(pool) (((pool)->objectSize + sizeof(TlU32) - 1) & ~(sizeof(TlU32) - 1))
+#define POOL_TAG(pool, p) ((TlPoolTag *)((unsigned char *)(p) + POOL_TAG_OFFSET(pool)))
+/* slabs hold at least this many objects, or about this many bytes */
+#define POOL_SLAB_MIN_OBJECTS 16
+#define POOL_SLAB_BYTES 16384
+
+void tlInitPool(TlPool *pool, const char *name, size_t objectSize) {
+	TL_ASSERT( pool != (TlPool *)0 );
+	TL_ASSERT( objectSize > 0 );
+
+	memset((void *)pool, 0, sizeof(*pool));
+
+	pool->name = name;
+	pool->objectSize = objectSize;
+}
+void tlFiniPool(TlPool *pool) {
+	TlPoolSlab *next;
+
+	TL_ASSERT( pool->numLive == 0 );
+
+	while (pool->slabs) {
+		next = pool->slabs->next;
+		tlFree((void *)pool->slabs);
+		pool->slabs = next;
+	}
+
+	tlFree((void *)pool->objects);
+
+	tlInitPool(pool, pool->name, pool->objectSize);
+}
+static void tlPool_AddSlab(TlPool *pool) {
+	unsigned char *objects;
+	TlPoolSlab *slab;
+	TlPoolTag *tag;
+	TlU32 i, slot;
+	void *p;
+
+	if (!pool->stride) {
+		pool->stride = POOL_ALIGN(POOL_TAG_OFFSET(pool) + sizeof(TlPoolTag));
+
+		pool->objectsPerSlab = (TlU32)(POOL_SLAB_BYTES/pool->stride);
+		if (pool->objectsPerSlab < POOL_SLAB_MIN_OBJECTS)
+			pool->objectsPerSlab = POOL_SLAB_MIN_OBJECTS;
+	}
+
+	/* room to align the objects, wherever the heap puts the slab */
+	slab = (TlPoolSlab *)tlAlloc(sizeof(TlPoolSlab) + TL_CACHELINE_SIZE + pool->objectsPerSlab*pool->stride);
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	pool->objects = (void **)tlReallocArray((void *)pool->objects, pool->numObjects + pool->objectsPerSlab, sizeof(void *));
+
+	pool->numSlabs++;
+	pool->numHeapCalls += 2;
+
+	objects = (unsigned char *)POOL_ALIGN((size_t)((unsigned char *)slab + sizeof(TlPoolSlab)));
+
+	/* push in reverse so the free list hands them out in address order */
+	for (i=pool->objectsPerSlab; i-->0;) {
+		p = (void *)&objects[i*pool->stride];
+		slot = pool->numObjects + i;
+
+		tag = POOL_TAG(pool, p);
+		tag->slot = slot;
+		tag->generation = 0;
+
+		pool->objects[slot] = p;
+
+		*(void **)p = pool->freeList;
+		pool->freeList = p;
+	}
+
+	pool->numObjects += pool->objectsPerSlab;
+}
+void *tlPoolAlloc(TlPool *pool) {
+	void *p;
+
+	TL_ASSERT( pool != (TlPool *)0 );
+
+	if (!pool->freeList)
+		tlPool_AddSlab(pool);
+
+	p = pool->freeList;
+	pool->freeList = *(void **)p;
+
+	POOL_TAG(pool, p)->generation++;
+
+	if (++pool->numLive > pool->peakLive)
+		pool->peakLive = pool->numLive;
+
+	return p;
+}
+void *tlPoolFree(TlPool *pool, void *p) {
+	TlPoolTag *tag;
+
+	TL_ASSERT( pool != (TlPool *)0 );
+
+	if (!p)
+		return (void *)0;
+
+	tag = POOL_TAG(pool, p);
+	TL_ASSERT( tag->generation & 1 );
+	TL_ASSERT( pool->objects[tag->slot] == p );
+
+	/* skip zero when wrapping around; handles are never TL_HANDLE_NONE */
+	if (++tag->generation == 0)
+		tag->generation = 2;
+
+	*(void **)p = pool->freeList;
+	pool->freeList = p;
+
+	pool->numLive--;
+
+	return (void *)0;
+}
+TlHandle tlPoolHandle(const TlPool *pool, const void *p) {
+	const TlPoolTag *tag;
+
+	if (!p)
+		return TL_HANDLE_NONE;
+
+	tag = POOL_TAG(pool, p);
+	TL_ASSERT( tag->generation & 1 );
+
+	return ((TlHandle)tag->generation << 32) | (TlHandle)tag->slot;
+}
+void *tlPoolLookup(const TlPool *pool, TlHandle h) {
+	TlU32 slot;
+	void *p;
+
+	slot = (TlU32)(h & 0xFFFFFFFF);
+	if (h == TL_HANDLE_NONE || slot >= pool->numObjects)
+		return (void *)0;
+
+	p = pool->objects[slot];
+	if (POOL_TAG(pool, p)->generation != (TlU32)(h >> 32))
+		return (void *)0;
+
+	return p;
+}
+void tlGetPoolStats(const TlPool *pool, TlPoolStats *stats) {
+	TL_ASSERT( stats != (TlPoolStats *)0 );
+
+	stats->name = pool->name;
+	stats->objectSize = pool->objectSize;
+	stats->stride = pool->stride;
+	stats->numLive = pool->numLive;
+	stats->peakLive = pool->peakLive;
+	stats->capacity = pool->numObjects;
+	stats->numSlabs = pool->numSlabs;
+	stats->numHeapCalls = pool->numHeapCalls;
+}
+
+#undef POOL_SLAB_BYTES
+#undef POOL_SLAB_MIN_OBJECTS
+#undef POOL_TAG
+#undef POOL_TAG_OFFSET
+#undef POOL_ALIGN
+
 char *tlDuplicateN(const char *src, size_t srcn) {
 	size_t l;
 	char *p;
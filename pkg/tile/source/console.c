@@ -1 +1,472 @@
 #include <tile/console.h>
+#include <tile/renderer.h>
+#include <tile/event.h>
+
+int tl__g_devconAlive = 0;
+TlDevcon tl__g_devcon;
+
+/* lines the wheel scrolls per notch */
+#define CON_WHEEL_LINES 3
+
+static void tlCon_SetColor( TlDevcon *con, int index, float r, float g, float b, float a )
+{
+	con->palette[ index ].r = r;
+	con->palette[ index ].g = g;
+	con->palette[ index ].b = b;
+	con->palette[ index ].a = a;
+}
+
+void tlCon_Init()
+{
+	TlDevcon *con;
+
+	if( tl__g_devconAlive ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+	memset( ( void * )con, 0, sizeof( *con ) );
+
+	tlCon_SetColor( con, kTlConColor_Background,   0.00f, 0.00f, 0.00f, 0.75f );
+	tlCon_SetColor( con, kTlConColor_Foreground,   0.85f, 0.85f, 0.85f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_Error,        1.00f, 0.30f, 0.30f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_Warning,      1.00f, 0.85f, 0.30f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_Prompt,       0.40f, 0.80f, 1.00f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_EditField,    1.00f, 1.00f, 1.00f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_Autocomplete, 0.50f, 0.50f, 0.50f, 1.00f );
+	tlCon_SetColor( con, kTlConColor_Cursor,       1.00f, 1.00f, 1.00f, 1.00f );
+	con->curPalette = kTlConColor_Foreground;
+
+	strcpy( con->prompt, "] " );
+	con->lineBreak = TRUE;
+
+	tlSys_InitMutex( &con->lock );
+	tl__g_devconAlive = 1;
+
+	tlCon_SetScrollback( 0 );
+}
+void tlCon_Fini()
+{
+	TlDevcon *con;
+
+	if( !tl__g_devconAlive ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+	tl__g_devconAlive = 0;
+
+	con->lines = ( TlDevconLine * )tlMemory( ( void * )con->lines, 0 );
+	con->capacity = 0;
+	con->numLines = 0;
+
+	tlSys_FiniMutex( &con->lock );
+}
+int tlCon_IsAlive()
+{
+	return tl__g_devconAlive;
+}
+
+void tlCon_SetScrollback(TlU32 numLines)
+{
+	TlDevconLine *lines, *oldLines;
+	TlDevcon *con;
+	TlU32 keep, first, i;
+
+	if( !tl__g_devconAlive ) {
+		return;
+	}
+
+	if( !numLines ) {
+		numLines = TL_DEVCON_DEFAULT_LINES;
+	}
+
+	con = &tl__g_devcon;
+
+	/* allocated outside of the lock so prints don't wait on the heap */
+	lines = ( TlDevconLine * )tlMemory( ( void * )0, numLines*sizeof( TlDevconLine ) );
+
+	tlSys_LockMutex( &con->lock );
+
+	/* move the newest lines over, oldest first */
+	keep = con->numLines < numLines ? con->numLines : numLines;
+	first = keep ? ( con->head + con->capacity - ( keep - 1 ) )%con->capacity : 0;
+	for( i = 0; i < keep; ++i ) {
+		lines[ i ] = con->lines[ ( first + i )%con->capacity ];
+	}
+
+	con->numLinesDropped += con->numLines - keep;
+
+	oldLines = con->lines;
+	con->lines = lines;
+	con->capacity = numLines;
+	con->numLines = keep;
+	con->head = keep ? keep - 1 : numLines - 1;
+	if( !keep ) {
+		con->lineBreak = TRUE;
+	}
+	if( con->curRow >= ( int )keep ) {
+		con->curRow = keep ? ( int )keep - 1 : 0;
+	}
+
+	tlSys_UnlockMutex( &con->lock );
+
+	tlMemory( ( void * )oldLines, 0 );
+}
+
+void tlCon_Show()
+{
+	tl__g_devcon.visible = 1;
+}
+void tlCon_Hide()
+{
+	tl__g_devcon.visible = 0;
+}
+TlBool tlCon_IsVisible()
+{
+	return tl__g_devconAlive && tl__g_devcon.visible ? TRUE : FALSE;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	SCROLLBACK
+ *
+ * ==========================================================================
+ */
+
+/* Start a new line in place of the oldest once the ring is full; lock held */
+static TlDevconLine *tlCon_NewLine( TlDevcon *con )
+{
+	TlDevconLine *line;
+
+	if( ++con->head == con->capacity ) {
+		con->head = 0;
+	}
+
+	if( con->numLines < con->capacity ) {
+		++con->numLines;
+	} else {
+		++con->numLinesDropped;
+	}
+	++con->numLinesTotal;
+
+	/* a view scrolled back stays on the same lines */
+	if( con->curRow > 0 && con->curRow < ( int )con->numLines - 1 ) {
+		++con->curRow;
+	}
+
+	line = &con->lines[ con->head ];
+	line->length = 0;
+	line->numSpans = 0;
+
+	con->lineBreak = FALSE;
+	return line;
+}
+/* Add a character to the end of `line` (NULL to start a new one); lock held */
+static TlDevconLine *tlCon_PutChar( TlDevcon *con, TlDevconLine *line, char c, TlU8 color )
+{
+	TlDevconSpan *span;
+
+	if( !line || line->length == TL_DEVCON_COLUMNS ) {
+		line = tlCon_NewLine( con );
+	}
+
+	/* past the last span a line can hold, the last color carries on */
+	if( !line->numSpans || line->spans[ line->numSpans - 1 ].color != color ) {
+		if( line->numSpans < TL_DEVCON_MAX_SPANS ) {
+			span = &line->spans[ line->numSpans++ ];
+			span->start = line->length;
+			span->color = color;
+		}
+	}
+
+	line->text[ line->length++ ] = c;
+	return line;
+}
+/* Add formatted text, color codes and all; lock held */
+static void tlCon_Write( TlDevcon *con, const char *text )
+{
+	TlDevconLine *line;
+	const char *p;
+	TlU8 color;
+	TlU32 n;
+
+	line = con->lineBreak ? ( TlDevconLine * )0 : &con->lines[ con->head ];
+	color = ( TlU8 )con->curPalette;
+
+	for( p = text; *p != '\0'; ++p ) {
+		if( *p == '^' && p[ 1 ] >= '0' && p[ 1 ] <= '6' ) {
+			color = ( TlU8 )( kTlConColor_Foreground + ( p[ 1 ] - '0' ) );
+			++p;
+			continue;
+		}
+
+		if( *p == '\n' ) {
+			/* an empty line still takes a row */
+			if( !line ) {
+				( void )tlCon_NewLine( con );
+			}
+
+			con->lineBreak = TRUE;
+			line = ( TlDevconLine * )0;
+			continue;
+		}
+
+		if( *p == '\t' ) {
+			n = line ? 4 - line->length%4 : 4;
+			while( n-- > 0 ) {
+				line = tlCon_PutChar( con, line, ' ', color );
+			}
+			continue;
+		}
+
+		if( ( unsigned char )*p < 0x20 ) {
+			continue;
+		}
+
+		line = tlCon_PutChar( con, line, *p, color );
+	}
+}
+
+void tlCon_PrintV(const char *format, va_list args)
+{
+	char buf[ TL_DEVCON_PRINT ];
+	TlDevcon *con;
+	int n;
+
+	if( !tl__g_devconAlive ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+
+	/* formatted before taking the lock so other threads' prints aren't held up */
+	n = vsnprintf( buf, sizeof( buf ), format, args );
+	buf[ sizeof( buf ) - 1 ] = '\0';
+
+	tlSys_LockMutex( &con->lock );
+	if( n < 0 || n >= ( int )sizeof( buf ) ) {
+		++con->numTruncated;
+	}
+	tlCon_Write( con, buf );
+	tlSys_UnlockMutex( &con->lock );
+}
+void tlCon_Print(const char *format, ...)
+{
+	va_list args;
+
+	va_start( args, format );
+	tlCon_PrintV( format, args );
+	va_end( args );
+}
+
+void tlCon_GetStats(TlDevconStats *stats)
+{
+	TlDevcon *con;
+
+	TL_ASSERT( stats != ( TlDevconStats * )0 );
+
+	memset( ( void * )stats, 0, sizeof( *stats ) );
+	if( !tl__g_devconAlive ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+
+	tlSys_LockMutex( &con->lock );
+	stats->capacity = con->capacity;
+	stats->numLines = con->numLines;
+	stats->numLinesTotal = con->numLinesTotal;
+	stats->numLinesDropped = con->numLinesDropped;
+	stats->numTruncated = con->numTruncated;
+	stats->numBytes = con->capacity*sizeof( TlDevconLine );
+	tlSys_UnlockMutex( &con->lock );
+}
+
+/* Scroll back (positive) or forward by `numRows`, keeping a page in view */
+static void tlCon_Scroll( TlDevcon *con, int numRows )
+{
+	int maxRow;
+
+	tlSys_LockMutex( &con->lock );
+
+	maxRow = ( int )con->numLines - ( con->visRows > 0 ? con->visRows : 1 );
+	con->curRow += numRows;
+	if( con->curRow > maxRow ) {
+		con->curRow = maxRow;
+	}
+	if( con->curRow < 0 ) {
+		con->curRow = 0;
+	}
+
+	tlSys_UnlockMutex( &con->lock );
+}
+
+/*
+ * ==========================================================================
+ *
+ *	RENDERING
+ *
+ * ==========================================================================
+ */
+
+static void tlCon_DrawLine( const TlDevcon *con, const TlDevconLine *line, TlS32 x, TlS32 y, TlU32 cellW )
+{
+	const TlDevconSpan *span;
+	TlU32 i, end;
+
+	for( i = 0; i < line->numSpans; ++i ) {
+		span = &line->spans[ i ];
+		end = i + 1 < line->numSpans ? line->spans[ i + 1 ].start : line->length;
+
+		tlR_DrawGlyphs( &line->text[ span->start ], end - span->start,
+			x + ( TlS32 )( span->start*cellW ), y, &con->palette[ span->color ] );
+	}
+}
+
+void tlCon_Render(TlU32 w, TlU32 h)
+{
+	const TlDevconLine *line;
+	TlDevcon *con;
+	TlU32 cellW, cellH;
+	TlU32 height, rows;
+	TlU32 row, index;
+	TlU32 promptLen;
+	TlS32 x, y;
+
+	if( !tlCon_IsVisible() ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+
+	tlR_GetGlyphSize( &cellW, &cellH );
+
+	height = con->height > 0 && ( TlU32 )con->height < h ? ( TlU32 )con->height : h/2;
+	rows = height/cellH;
+	if( rows < 2 ) {
+		return;
+	}
+
+	tlR_DrawRect( 0, 0, w, height, &con->palette[ kTlConColor_Background ] );
+
+	x = ( TlS32 )cellW;
+	y = ( TlS32 )( height - cellH );
+
+	/* edit field along the bottom */
+	promptLen = ( TlU32 )strlen( con->prompt );
+	tlR_DrawGlyphs( con->prompt, promptLen, x, y, &con->palette[ kTlConColor_Prompt ] );
+	tlR_DrawGlyphs( con->command, ( TlU32 )con->curCommand, x + ( TlS32 )( promptLen*cellW ), y,
+		&con->palette[ kTlConColor_EditField ] );
+	tlR_DrawGlyphs( "_", 1, x + ( TlS32 )( ( promptLen + con->curCommand )*cellW ), y,
+		&con->palette[ kTlConColor_Cursor ] );
+
+	/* then the scrollback above it, newest at the bottom; only what fits */
+	tlSys_LockMutex( &con->lock );
+
+	con->visRows = ( int )rows - 1;
+	for( row = 0; row < rows - 1; ++row ) {
+		if( ( TlU32 )con->curRow + row >= con->numLines ) {
+			break;
+		}
+
+		index = ( con->head + con->capacity - ( ( TlU32 )con->curRow + row ) )%con->capacity;
+		line = &con->lines[ index ];
+
+		y -= ( TlS32 )cellH;
+		tlCon_DrawLine( con, line, x, y, cellW );
+	}
+
+	tlSys_UnlockMutex( &con->lock );
+}
+
+/*
+ * ==========================================================================
+ *
+ *	INPUT
+ *
+ * ==========================================================================
+ */
+
+void tlCon_KeyEvent()
+{
+	const TlEvent *ev;
+	TlDevcon *con;
+
+	ev = tlEv_Current();
+	if( !tl__g_devconAlive || !ev ) {
+		return;
+	}
+
+	con = &tl__g_devcon;
+
+	if( ev->type == kTlEv_KeyChar ) {
+		if( ev->utf32Char == TL_DEVCON_KEY ) {
+			con->visible = !con->visible;
+			return;
+		}
+
+		if( !con->visible || ev->utf32Char < 0x20 || ev->utf32Char >= 0x7F ) {
+			return;
+		}
+
+		if( con->curCommand < TL_DEVCON_COMMAND - 1 ) {
+			con->command[ con->curCommand++ ] = ( char )ev->utf32Char;
+			con->command[ con->curCommand ] = '\0';
+		}
+
+		return;
+	}
+
+	if( ev->type != kTlEv_KeyPress || !con->visible ) {
+		return;
+	}
+
+	switch( ev->key ) {
+	case kTlKey_Back:
+		if( con->curCommand > 0 ) {
+			con->command[ --con->curCommand ] = '\0';
+		}
+		break;
+
+	case kTlKey_Return:
+	case kTlKey_NumPadEnter:
+		tlCon_Print( "^3%s^4%s\n", con->prompt, con->command );
+		con->command[ 0 ] = '\0';
+		con->curCommand = 0;
+		tlCon_Scroll( con, -( int )con->capacity );
+		break;
+
+	case kTlKey_Prior:
+		tlCon_Scroll( con, con->visRows > 1 ? con->visRows - 1 : 1 );
+		break;
+	case kTlKey_Next:
+		tlCon_Scroll( con, -( con->visRows > 1 ? con->visRows - 1 : 1 ) );
+		break;
+	case kTlKey_Home:
+		tlCon_Scroll( con, ( int )con->capacity );
+		break;
+	case kTlKey_End:
+		tlCon_Scroll( con, -( int )con->capacity );
+		break;
+
+	case kTlKey_Escape:
+		con->visible = 0;
+		break;
+
+	default:
+		break;
+	}
+}
+void tlCon_MouseEvent()
+{
+	const TlEvent *ev;
+
+	ev = tlEv_Current();
+	if( !tlCon_IsVisible() || !ev || ev->type != kTlEv_MouseWheel ) {
+		return;
+	}
+
+	tlCon_Scroll( &tl__g_devcon, ( int )( ev->delta*CON_WHEEL_LINES ) );
+}
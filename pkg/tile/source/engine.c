@@ -3,6 +3,9 @@
 #include <tile/renderer.h>
 #include <tile/camera.h>
 #include <tile/system.h>
+#include <tile/job.h>
+#include <tile/stream.h>
+#include <tile/console.h>
 
 static TlBool g_isTimingCurrent = FALSE;
 static TlU64 g_currTime = 0;
@@ -11,8 +14,11 @@ static double g_deltaTime = 0.0;
 
 TlBool tlInit(void)
 {
+	tlCon_Init();
+	tlJob_Init(0);
 	tlScr_Init((TlScreen *)0);
 	tlR_Init();
+	tlStream_Init(0);
 
 	tlSetCameraAutoAspect(1280.0/720.0, kTlAspect_Fit);
 	
@@ -25,8 +31,11 @@ TlBool tlInit(void)
 }
 void tlFini(void)
 {
+	tlStream_Fini();
 	tlR_Fini();
 	tlScr_Fini();
+	tlJob_Fini();
+	tlCon_Fini();
 }
 
 static void tlUpdateTiming(void)
@@ -67,6 +76,8 @@ TlBool tlLoop(void)
 	static const TlU64 timeBudgetMicrosec = 16666; /* FIXME: Make configurable */
 	TlU64 deltaMicrosec;
 
+	/* finished loads are uploaded within the budget before drawing */
+	tlStream_Update();
 	tlR_Frame( tlGetDeltaTime() );
 	if( !tlScr_IsOpen() ) {
 		return FALSE;
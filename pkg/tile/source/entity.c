@@ -3,6 +3,8 @@
 #include <tile/surface.h>
 #include <tile/light.h>
 #include <tile/view.h>
+#include <tile/transform.h>
+#include <tile/job.h>
 
 /*
  * ==========================================================================
@@ -12,25 +14,36 @@
  * ==========================================================================
  */
 
-#ifndef ENTITY_DIRTY_GLOBAL_ENABLED
-# define ENTITY_DIRTY_GLOBAL_ENABLED 0
-#endif
+/*
+ * Matrices live in the transform store (see transform.h); an entity only
+ * holds its handle.
+ *
+ * Invariant: if an entity's transform is dirty, so are all of its descendants'.
+ * That lets invalidation stop at the first entity that's already dirty.
+ */
+static TlMat4 *tlEnt_Local(const TlEntity *ent) {
+	return tlXf_Local(ent->xform);
+}
 
 static TlEntity *g_ent_head = (TlEntity *)0;
 static TlEntity *g_ent_tail = (TlEntity *)0;
 
+static TlPool g_ent_pool = TL_POOL_INITIALIZER("entity", TlEntity);
+
+static TlBool g_ent_parallelThink = FALSE;
+/* set while parallel thinks run; invalidation then leaves descendants alone */
+static TlBool g_ent_deferInvalidate = FALSE;
+
 TlEntity *tlNewEntity(TlEntity *prnt) {
 	TlEntity *ent;
 
-	ent = tlAllocStruct(TlEntity);
-
-	tlLoadIdentity(&ent->l_model);
-	tlLoadIdentity(&ent->g_model);
-	tlLoadIdentity(&ent->MVP);
+	ent = (TlEntity *)tlPoolAlloc(&g_ent_pool);
 
-	ent->recalc.gModel = TRUE;
+	ent->xform = tlXf_New(ent, prnt ? prnt->xform : TL_XFORM_NONE);
 
 	ent->Think = (TlThinkFn_t)0;
+	ent->thinkPhase = 0;
+	ent->thinkMode = kTlThink_MainThread;
 
 	ent->s_head = (TlSurface *)0;
 	ent->s_tail = (TlSurface *)0;
@@ -65,6 +78,11 @@ TlEntity *tlDeleteEntity(TlEntity *ent) {
 	while( ent->s_head != (TlSurface *)0 ) {
 		tlDeleteSurface(ent->s_head);
 	}
+	while( ent->l_head != (TlLight *)0 ) {
+		tlDeleteLight(ent->l_head);
+	}
+
+	tlXf_Delete(ent->xform);
 
 	if( ent->prev != (TlEntity *)0 ) {
 		ent->prev->next = ent->next;
@@ -78,7 +96,16 @@ TlEntity *tlDeleteEntity(TlEntity *ent) {
 		*ent->p_tail = ent->prev;
 	}
 
-	return (TlEntity *)tlMemory((void *)ent, 0);
+	return (TlEntity *)tlPoolFree(&g_ent_pool, (void *)ent);
+}
+TlHandle tlGetEntityHandle(const TlEntity *ent) {
+	return tlPoolHandle(&g_ent_pool, (const void *)ent);
+}
+TlEntity *tlEntityFromHandle(TlHandle h) {
+	return (TlEntity *)tlPoolLookup(&g_ent_pool, h);
+}
+void tlGetEntityPoolStats(TlPoolStats *stats) {
+	tlGetPoolStats(&g_ent_pool, stats);
 }
 void tlDeleteAllEntities() {
 	while( g_ent_head != (TlEntity *)0 ) {
@@ -86,54 +113,44 @@ void tlDeleteAllEntities() {
 	}
 }
 void tlResetEntityTransform(TlEntity *ent) {
-	tlLoadIdentity(&ent->l_model);
+	tlLoadIdentity(tlEnt_Local(ent));
 	tlInvalidateEntity(ent);
 }
 void tlInvalidateEntityBranch(const TlEntity *ent) {
-#if ENTITY_DIRTY_GLOBAL_ENABLED
 	TlEntity *chld;
 
 	for(chld=ent->head; chld!=(TlEntity *)0; chld=chld->next) {
-		chld->recalc.gModel = TRUE;
+		/* already dirty means its whole branch is too */
+		if( tlXf_IsDirty(chld->xform) ) {
+			continue;
+		}
 
+		tlXf_MarkDirty(chld->xform);
 		tlInvalidateEntityBranch(chld);
 	}
-#else
-	(void)ent;
-#endif
 }
 void tlInvalidateEntity(TlEntity *ent) {
-#if ENTITY_DIRTY_GLOBAL_ENABLED
-	ent->recalc.gModel = TRUE;
-	tlInvalidateEntityBranch(ent);
-#else
-	(void)ent;
-#endif
-}
-const TlMat4 *tlGetEntityLocalMatrix(TlEntity *ent) {
-	return &ent->l_model;
-}
-const TlMat4 *tlGetEntityGlobalMatrix(TlEntity *ent) {
-	TlEntity *prnt;
-
-	prnt = ent->prnt;
-	if( !prnt ) {
-		return &ent->l_model;
+	if( tlXf_IsDirty(ent->xform) ) {
+		return;
 	}
 
-#if ENTITY_DIRTY_GLOBAL_ENABLED
-	if( !ent->recalc.gModel ) {
-		return &ent->g_model;
+	/* the branch is marked once the phase's parallel thinks are done */
+	if( g_ent_deferInvalidate ) {
+		tlXf_MarkDirtyQuiet(ent->xform);
+		return;
 	}
-#endif
-
-	tlAffineMultiply(&ent->g_model, tlGetEntityGlobalMatrix(prnt), &ent->l_model);
-	ent->recalc.gModel = FALSE;
 
-#if ENTITY_DIRTY_GLOBAL_ENABLED
+	tlXf_MarkDirty(ent->xform);
 	tlInvalidateEntityBranch(ent);
-#endif
-	return &ent->g_model;
+}
+const TlMat4 *tlGetEntityLocalMatrix(TlEntity *ent) {
+	return tlEnt_Local(ent);
+}
+const TlMat4 *tlGetEntityGlobalMatrix(TlEntity *ent) {
+	return tlXf_Global(ent->xform);
+}
+const TlMat4 *tlGetEntityModelViewMatrix(TlEntity *ent) {
+	return tlXf_ModelView(ent->xform);
 }
 void tlProcessEntity(TlEntity *ent) {
 	if( ent->Think != NULL ) {
@@ -148,18 +165,138 @@ void tlProcessEntityChildren(const TlEntity *ent) {
 		tlProcessEntityChildren(chld);
 	}
 }
+
+/*
+ * Parallel Thinking
+ * -----------------
+ * Thinking entities are gathered in hierarchy order into one list per phase
+ * and mode. The lists live in the frame arena, so they're rebuilt every call.
+ */
+typedef struct EntThinkList_s {
+	TlEntity **ents;
+	TlU32 numEnts;
+} EntThinkList;
+
+#define ENT_THINK_GRAIN 32
+
+static void tlEnt_GatherThinks(EntThinkList (*lists)[2], TlEntity *head) {
+	EntThinkList *list;
+	TlEntity *ent;
+
+	for(ent=head; ent!=(TlEntity *)0; ent=ent->next) {
+		if( ent->Think != (TlThinkFn_t)0 ) {
+			list = &lists[ent->thinkPhase][ent->thinkMode];
+			list->ents[list->numEnts++] = ent;
+		}
+
+		tlEnt_GatherThinks(lists, ent->head);
+	}
+}
+static TlU32 tlEnt_CountThinks(EntThinkList (*lists)[2], TlEntity *head) {
+	TlEntity *ent;
+	TlU32 n;
+
+	n = 0;
+	for(ent=head; ent!=(TlEntity *)0; ent=ent->next) {
+		if( ent->Think != (TlThinkFn_t)0 ) {
+			lists[ent->thinkPhase][ent->thinkMode].numEnts++;
+			n++;
+		}
+
+		n += tlEnt_CountThinks(lists, ent->head);
+	}
+
+	return n;
+}
+static void tlEnt_ThinkJob(void *parm, TlU32 first, TlU32 last) {
+	TlEntity **ents;
+	TlU32 i;
+
+	ents = (TlEntity **)parm;
+	for(i=first; i<last; i++) {
+		ents[i]->Think(ents[i]);
+	}
+}
+static void tlEnt_ProcessParallel(void) {
+	EntThinkList lists[TL_MAX_THINK_PHASES][2];
+	EntThinkList *par, *seq;
+	TlEntity **ents;
+	TlEntity *ent;
+	TlU32 i, j;
+
+	memset((void *)lists, 0, sizeof(lists));
+	if( !tlEnt_CountThinks(lists, g_ent_head) ) {
+		return;
+	}
+
+	for(i=0; i<TL_MAX_THINK_PHASES; i++) {
+		for(j=0; j<2; j++) {
+			ents = (TlEntity **)tlFrameAlloc(lists[i][j].numEnts*sizeof(TlEntity *));
+			lists[i][j].ents = ents;
+			lists[i][j].numEnts = 0;
+		}
+	}
+	tlEnt_GatherThinks(lists, g_ent_head);
+
+	for(i=0; i<TL_MAX_THINK_PHASES; i++) {
+		par = &lists[i][kTlThink_Parallel];
+		seq = &lists[i][kTlThink_MainThread];
+
+		if( par->numEnts > 0 ) {
+			g_ent_deferInvalidate = TRUE;
+			tlJob_ParallelFor(&tlEnt_ThinkJob, (void *)par->ents, par->numEnts, ENT_THINK_GRAIN);
+			g_ent_deferInvalidate = FALSE;
+
+			/* finish the invalidations the thinks started */
+			for(j=0; j<par->numEnts; j++) {
+				ent = par->ents[j];
+				if( tlXf_IsDirty(ent->xform) ) {
+					tlXf_MarkDirty(ent->xform);
+					tlInvalidateEntityBranch(ent);
+				}
+			}
+		}
+
+		for(j=0; j<seq->numEnts; j++) {
+			seq->ents[j]->Think(seq->ents[j]);
+		}
+	}
+}
+
 void tlProcessAllEntities() {
 	TlEntity *ent;
 
+	if( g_ent_parallelThink ) {
+		tlEnt_ProcessParallel();
+		return;
+	}
+
 	for(ent=g_ent_head; ent!=(TlEntity *)0; ent=ent->next) {
 		tlProcessEntity(ent);
 		tlProcessEntityChildren(ent);
 	}
 }
+void tlSetEntityThink(TlEntity *ent, TlThinkFn_t fn, TlU32 phase, TlThinkMode_t mode) {
+	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
+	TL_ASSERT( phase < TL_MAX_THINK_PHASES && "Think phase out of range" );
+
+	ent->Think = fn;
+	ent->thinkPhase = (TlU8)( phase < TL_MAX_THINK_PHASES ? phase : TL_MAX_THINK_PHASES - 1 );
+	ent->thinkMode = (TlU8)( mode == kTlThink_Parallel ? kTlThink_Parallel : kTlThink_MainThread );
+}
+void tlEnableParallelThink(void) {
+	g_ent_parallelThink = TRUE;
+}
+void tlDisableParallelThink(void) {
+	g_ent_parallelThink = FALSE;
+}
+TlBool tlIsParallelThinkEnabled(void) {
+	return g_ent_parallelThink;
+}
 void tlSetEntityPosition(TlEntity *ent, float x, float y, float z) {
-	ent->l_model.xw = x;
-	ent->l_model.yw = y;
-	ent->l_model.zw = z;
+	tlEnt_Local(ent)->xw = x;
+	tlEnt_Local(ent)->yw = y;
+	tlEnt_Local(ent)->zw = z;
 
 	tlInvalidateEntity(ent);
 }
@@ -167,24 +304,24 @@ void tlSetEntityPositionVec(TlEntity *ent, const TlVec3 *pos) {
 	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
 	TL_ASSERT( pos != NULL && "Position vector cannot be NULL" );
 
-	ent->l_model.xw = pos->x;
-	ent->l_model.yw = pos->y;
-	ent->l_model.zw = pos->z;
+	tlEnt_Local(ent)->xw = pos->x;
+	tlEnt_Local(ent)->yw = pos->y;
+	tlEnt_Local(ent)->zw = pos->z;
 
 	tlInvalidateEntity(ent);
 }
 void tlSetEntityRotation(TlEntity *ent, float x, float y, float z) {
 	float xyz[3];
 
-	xyz[0] = ent->l_model.xw;
-	xyz[1] = ent->l_model.yw;
-	xyz[2] = ent->l_model.zw;
+	xyz[0] = tlEnt_Local(ent)->xw;
+	xyz[1] = tlEnt_Local(ent)->yw;
+	xyz[2] = tlEnt_Local(ent)->zw;
 
-	tlLoadRotation(&ent->l_model, x, y, z);
+	tlLoadRotation(tlEnt_Local(ent), x, y, z);
 
-	ent->l_model.xw = xyz[0];
-	ent->l_model.yw = xyz[1];
-	ent->l_model.zw = xyz[2];
+	tlEnt_Local(ent)->xw = xyz[0];
+	tlEnt_Local(ent)->yw = xyz[1];
+	tlEnt_Local(ent)->zw = xyz[2];
 
 	tlInvalidateEntity(ent);
 }
@@ -194,27 +331,27 @@ void tlSetEntityRotationVec(TlEntity *ent, const TlVec3 *rot) {
 	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
 	TL_ASSERT( rot != NULL && "Rotation vector cannot be NULL" );
 
-	xyz[0] = ent->l_model.xw;
-	xyz[1] = ent->l_model.yw;
-	xyz[2] = ent->l_model.zw;
+	xyz[0] = tlEnt_Local(ent)->xw;
+	xyz[1] = tlEnt_Local(ent)->yw;
+	xyz[2] = tlEnt_Local(ent)->zw;
 
-	tlLoadRotation(&ent->l_model, rot->x, rot->y, rot->z);
+	tlLoadRotation(tlEnt_Local(ent), rot->x, rot->y, rot->z);
 
-	ent->l_model.xw = xyz[0];
-	ent->l_model.yw = xyz[1];
-	ent->l_model.zw = xyz[2];
+	tlEnt_Local(ent)->xw = xyz[0];
+	tlEnt_Local(ent)->yw = xyz[1];
+	tlEnt_Local(ent)->zw = xyz[2];
 
 	tlInvalidateEntity(ent);
 }
 void tlMoveEntity(TlEntity *ent, float x, float y, float z) {
-	tlApplyTranslation(&ent->l_model, x, y, z);
+	tlApplyTranslation(tlEnt_Local(ent), x, y, z);
 	tlInvalidateEntity(ent);
 }
 void tlMoveEntityVec(TlEntity *ent, const TlVec3 *axes) {
 	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
 	TL_ASSERT( axes != NULL && "Movement vector cannot be NULL" );
 	
-	tlApplyTranslation(&ent->l_model, axes->x, axes->y, axes->z);
+	tlApplyTranslation(tlEnt_Local(ent), axes->x, axes->y, axes->z);
 	tlInvalidateEntity(ent);
 }
 void tlMoveEntityX(TlEntity *ent, float x) {
@@ -227,40 +364,40 @@ void tlMoveEntityZ(TlEntity *ent, float z) {
 	tlMoveEntity(ent, 0, 0, z);
 }
 void tlTurnEntity(TlEntity *ent, float x, float y, float z) {
-	tlApplyRotation(&ent->l_model, x, y, z);
+	tlApplyRotation(tlEnt_Local(ent), x, y, z);
 	tlInvalidateEntity(ent);
 }
 void tlTurnEntityVec(TlEntity *ent, const TlVec3 *axes) {
 	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
 	TL_ASSERT( axes != NULL && "Rotation vector cannot be NULL" );
 	
-	tlApplyRotation(&ent->l_model, axes->x, axes->y, axes->z);
+	tlApplyRotation(tlEnt_Local(ent), axes->x, axes->y, axes->z);
 	tlInvalidateEntity(ent);
 }
 void tlTurnEntityX(TlEntity *ent, float x) {
-	tlApplyXRotation(&ent->l_model, x);
+	tlApplyXRotation(tlEnt_Local(ent), x);
 	tlInvalidateEntity(ent);
 }
 void tlTurnEntityY(TlEntity *ent, float y) {
-	tlApplyYRotation(&ent->l_model, y);
+	tlApplyYRotation(tlEnt_Local(ent), y);
 	tlInvalidateEntity(ent);
 }
 void tlTurnEntityZ(TlEntity *ent, float z) {
-	tlApplyZRotation(&ent->l_model, z);
+	tlApplyZRotation(tlEnt_Local(ent), z);
 	tlInvalidateEntity(ent);
 }
 
 TlVec3 *tlGetEntityPosition(const TlEntity *ent) {
-	return tlVec3(ent->l_model.xw, ent->l_model.yw, ent->l_model.zw);
+	return tlVec3(tlEnt_Local(ent)->xw, tlEnt_Local(ent)->yw, tlEnt_Local(ent)->zw);
 }
 TlVec3 *tlGetEntityAxisX(const TlEntity *ent) {
-	return tlColumnX(&ent->l_model);
+	return tlColumnX(tlEnt_Local(ent));
 }
 TlVec3 *tlGetEntityAxisY(const TlEntity *ent) {
-	return tlColumnY(&ent->l_model);
+	return tlColumnY(tlEnt_Local(ent));
 }
 TlVec3 *tlGetEntityAxisZ(const TlEntity *ent) {
-	return tlColumnZ(&ent->l_model);
+	return tlColumnZ(tlEnt_Local(ent));
 }
 
 void tlEntityLocalToGlobal(TlEntity *ent) {
@@ -270,9 +407,8 @@ void tlEntityLocalToGlobal(TlEntity *ent) {
 		return;
 
 	tlLoadAffineInverse(&ginv, tlGetEntityGlobalMatrix(ent->prnt));
-	tlAffineMultiply(&tmp, &ginv, &ent->l_model);
-	memcpy(&ent->g_model, &ent->l_model, sizeof(TlMat4));
-	memcpy(&ent->l_model, &tmp, sizeof(TlMat4));
+	tlAffineMultiply(&tmp, &ginv, tlEnt_Local(ent));
+	memcpy(tlEnt_Local(ent), &tmp, sizeof(TlMat4));
 
 	tlInvalidateEntity(ent);
 }
@@ -345,10 +481,11 @@ void tlSetEntityParent(TlEntity *ent, TlEntity *prnt) {
 	}
 	*ent->p_tail = ent;
 
+	tlXf_SetParent(ent->xform, prnt ? prnt->xform : TL_XFORM_NONE);
 	tlInvalidateEntity(ent);
 }
 void tlSetEntityParentGlobal(TlEntity *ent, TlEntity *prnt) {
-	memcpy(&ent->l_model, tlGetEntityGlobalMatrix(ent), sizeof(TlMat4));
+	memcpy(tlEnt_Local(ent), tlGetEntityGlobalMatrix(ent), sizeof(TlMat4));
 
 	tlSetEntityParent(ent, prnt);
 	tlEntityLocalToGlobal(ent);
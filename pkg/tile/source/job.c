@@ -0,0 +1,380 @@
+#include <tile/job.h>
+#include <tile/system.h>
+
+/*
+ * ==========================================================================
+ *
+ *	JOB DEQUES
+ *
+ * ==========================================================================
+ */
+
+#define JOB_MAX_THREADS 64
+
+/* must be a power of two; a full deque runs new jobs in place instead */
+#define JOB_DEQUE_SIZE 4096
+#define JOB_DEQUE_MASK ( JOB_DEQUE_SIZE - 1 )
+
+/* spins through the other deques before a worker goes to sleep */
+#define JOB_IDLE_SPINS 64
+
+#if defined( _MSC_VER )
+# define JOB_THREAD_LOCAL __declspec(thread)
+#else
+# define JOB_THREAD_LOCAL __thread
+#endif
+
+/*
+ * Stealers may read a slot the owner is rewriting (when the deque wraps) just
+ * before failing to claim it, so every field is accessed atomically to keep
+ * that from being a data race.
+ */
+typedef struct JobSlot_s {
+	void *volatile fn;
+	void *volatile parm;
+	void *volatile counter;
+	volatile TlU32 first;
+	volatile TlU32 last;
+} JobSlot;
+
+typedef struct Job_s {
+	TlJobFn_t fn;
+	void *parm;
+	TlJobCounter *counter;
+	TlU32 first;
+	TlU32 last;
+} Job;
+
+/*
+ * Chase-Lev deque with a fixed-size ring. Indexes only ever increase (and
+ * wrap); their difference is the number of jobs in the deque. Owner and
+ * stealers work on opposite ends, so each end gets its own cache line.
+ */
+typedef struct JobWorker_s {
+	volatile TlU32 top;
+	TlU8 pad0[ TL_CACHELINE_SIZE - sizeof( TlU32 ) ];
+	volatile TlU32 bottom;
+	TlU8 pad1[ TL_CACHELINE_SIZE - sizeof( TlU32 ) ];
+
+	JobSlot slots[ JOB_DEQUE_SIZE ];
+
+	TlThread *thread;
+} JobWorker;
+
+/* number of job threads (0 until tlJob_Init()); worker 0 is the main thread */
+static TlU32 g_jobNumThreads = 0;
+static JobWorker *g_jobWorkers = ( JobWorker * )0;
+
+/* idle workers sleep here; pushers signal it when anyone is asleep */
+static TlSemaphore g_jobWake;
+static volatile TlU32 g_jobNumSleepers = 0;
+static volatile TlU32 g_jobQuit = 0;
+
+/* one more than the calling thread's worker index; 0 for other threads */
+static JOB_THREAD_LOCAL TlU32 g_jobThreadIndex = 0;
+
+static void tlJob_Store( JobSlot *slot, const Job *job )
+{
+	union { TlJobFn_t fn; void *p; } u;
+
+	u.p = ( void * )0;
+	u.fn = job->fn;
+
+	tlSys_AtomicStorePtrRelaxed( &slot->fn, u.p );
+	tlSys_AtomicStorePtrRelaxed( &slot->parm, job->parm );
+	tlSys_AtomicStorePtrRelaxed( &slot->counter, ( void * )job->counter );
+	tlSys_AtomicStore( &slot->first, job->first );
+	tlSys_AtomicStore( &slot->last, job->last );
+}
+static void tlJob_Load( Job *job, JobSlot *slot )
+{
+	union { TlJobFn_t fn; void *p; } u;
+
+	u.p = tlSys_AtomicLoadPtrRelaxed( &slot->fn );
+	job->fn = u.fn;
+
+	job->parm = tlSys_AtomicLoadPtrRelaxed( &slot->parm );
+	job->counter = ( TlJobCounter * )tlSys_AtomicLoadPtrRelaxed( &slot->counter );
+	job->first = tlSys_AtomicLoad( &slot->first );
+	job->last = tlSys_AtomicLoad( &slot->last );
+}
+
+/* Owner only: push to the bottom; fails if the deque is full */
+static TlBool tlJob_Push( JobWorker *w, const Job *job )
+{
+	TlU32 b, t;
+
+	b = w->bottom;
+	t = tlSys_AtomicLoad( &w->top );
+	if( ( TlS32 )( b - t ) >= JOB_DEQUE_SIZE ) {
+		return FALSE;
+	}
+
+	tlJob_Store( &w->slots[ b & JOB_DEQUE_MASK ], job );
+	tlSys_AtomicStore( &w->bottom, b + 1 );
+
+	return TRUE;
+}
+/* Owner only: pop from the bottom, racing stealers for the last job */
+static TlBool tlJob_Pop( JobWorker *w, Job *job )
+{
+	TlBool got;
+	TlU32 b, t;
+
+	b = w->bottom - 1;
+	tlSys_AtomicStore( &w->bottom, b );
+	tlSys_MemoryFence();
+	t = tlSys_AtomicLoad( &w->top );
+
+	if( ( TlS32 )( b - t ) < 0 ) {
+		tlSys_AtomicStore( &w->bottom, b + 1 );
+		return FALSE;
+	}
+
+	tlJob_Load( job, &w->slots[ b & JOB_DEQUE_MASK ] );
+	if( b != t ) {
+		return TRUE;
+	}
+
+	got = tlSys_AtomicCompareSwap( &w->top, t, t + 1 );
+	tlSys_AtomicStore( &w->bottom, b + 1 );
+
+	return got;
+}
+/* Any thread: take from the top */
+static TlBool tlJob_Steal( JobWorker *w, Job *job )
+{
+	TlU32 b, t;
+
+	t = tlSys_AtomicLoad( &w->top );
+	tlSys_MemoryFence();
+	b = tlSys_AtomicLoad( &w->bottom );
+
+	if( ( TlS32 )( b - t ) <= 0 ) {
+		return FALSE;
+	}
+
+	tlJob_Load( job, &w->slots[ t & JOB_DEQUE_MASK ] );
+	return tlSys_AtomicCompareSwap( &w->top, t, t + 1 );
+}
+
+/*
+ * ==========================================================================
+ *
+ *	SCHEDULING
+ *
+ * ==========================================================================
+ */
+
+static void tlJob_Execute( const Job *job )
+{
+	job->fn( job->parm, job->first, job->last );
+
+	if( job->counter != ( TlJobCounter * )0 ) {
+		tlSys_AtomicSub( &job->counter->pending, 1 );
+	}
+}
+/* Run one job from the calling thread's deque, or else a stolen one */
+static TlBool tlJob_RunOne( void )
+{
+	TlU32 self, i, j;
+	Job job;
+
+	self = g_jobThreadIndex;
+	if( self > 0 && tlJob_Pop( &g_jobWorkers[ self - 1 ], &job ) ) {
+		tlJob_Execute( &job );
+		return TRUE;
+	}
+
+	for( i = 0; i < g_jobNumThreads; i++ ) {
+		j = ( self + i )%g_jobNumThreads;
+		if( j + 1 == self ) {
+			continue;
+		}
+
+		if( tlJob_Steal( &g_jobWorkers[ j ], &job ) ) {
+			tlJob_Execute( &job );
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+/* Wake up to `n` sleeping workers after pushing jobs */
+static void tlJob_WakeWorkers( TlU32 n )
+{
+	TlU32 sleepers;
+
+	/* pairs with the fence in the sleeper's increment; one side sees the other */
+	tlSys_MemoryFence();
+
+	sleepers = tlSys_AtomicLoad( &g_jobNumSleepers );
+	if( sleepers > 0 ) {
+		tlSys_SignalSemaphore( &g_jobWake, n < sleepers ? n : sleepers );
+	}
+}
+
+static void tlJob_WorkerMain( void *parm )
+{
+	TlU32 spins;
+
+	g_jobThreadIndex = ( TlU32 )( size_t )parm;
+
+	spins = 0;
+	while( !tlSys_AtomicLoad( &g_jobQuit ) ) {
+		if( tlJob_RunOne() ) {
+			spins = 0;
+			continue;
+		}
+
+		if( ++spins < JOB_IDLE_SPINS ) {
+			tlSys_Yield();
+			continue;
+		}
+
+		/* announce the sleep, then look once more so a push can't slip past */
+		tlSys_AtomicAdd( &g_jobNumSleepers, 1 );
+		if( !tlJob_RunOne() && !tlSys_AtomicLoad( &g_jobQuit ) ) {
+			tlSys_WaitSemaphore( &g_jobWake );
+		}
+		tlSys_AtomicSub( &g_jobNumSleepers, 1 );
+
+		spins = 0;
+	}
+}
+
+void tlJob_Init( TlU32 numThreads )
+{
+	TlU32 i;
+
+	if( g_jobNumThreads > 0 ) {
+		return;
+	}
+
+	if( !numThreads ) {
+		numThreads = tlSys_NumCPUs();
+	}
+	if( numThreads > JOB_MAX_THREADS ) {
+		numThreads = JOB_MAX_THREADS;
+	}
+
+	g_jobWorkers = ( JobWorker * )tlMemory( ( void * )0, numThreads*sizeof( JobWorker ) );
+	memset( ( void * )g_jobWorkers, 0, numThreads*sizeof( JobWorker ) );
+
+	tlSys_InitSemaphore( &g_jobWake, 0 );
+	g_jobNumSleepers = 0;
+	g_jobQuit = 0;
+
+	g_jobThreadIndex = 1;
+	g_jobNumThreads = numThreads;
+
+	for( i = 1; i < numThreads; i++ ) {
+		g_jobWorkers[ i ].thread = tlSys_NewThread( &tlJob_WorkerMain, ( void * )( size_t )( i + 1 ) );
+	}
+}
+void tlJob_Fini( void )
+{
+	TlU32 i;
+
+	if( !g_jobNumThreads ) {
+		return;
+	}
+
+	tlSys_AtomicStore( &g_jobQuit, 1 );
+	tlSys_SignalSemaphore( &g_jobWake, g_jobNumThreads );
+
+	for( i = 1; i < g_jobNumThreads; i++ ) {
+		tlSys_JoinThread( g_jobWorkers[ i ].thread );
+	}
+
+	tlSys_FiniSemaphore( &g_jobWake );
+	g_jobWorkers = ( JobWorker * )tlMemory( ( void * )g_jobWorkers, 0 );
+
+	g_jobThreadIndex = 0;
+	g_jobNumThreads = 0;
+}
+TlU32 tlJob_NumThreads( void )
+{
+	return g_jobNumThreads > 0 ? g_jobNumThreads : 1;
+}
+
+void tlJob_InitCounter( TlJobCounter *counter )
+{
+	TL_ASSERT( counter != ( TlJobCounter * )0 );
+
+	tlSys_AtomicStore( &counter->pending, 0 );
+}
+void tlJob_Run( TlJobFn_t fn, void *parm, TlU32 first, TlU32 last, TlJobCounter *counter )
+{
+	Job job;
+
+	TL_ASSERT( fn != ( TlJobFn_t )0 );
+
+	job.fn = fn;
+	job.parm = parm;
+	job.counter = counter;
+	job.first = first;
+	job.last = last;
+
+	if( counter != ( TlJobCounter * )0 ) {
+		tlSys_AtomicAdd( &counter->pending, 1 );
+	}
+
+	if( !g_jobThreadIndex || !tlJob_Push( &g_jobWorkers[ g_jobThreadIndex - 1 ], &job ) ) {
+		tlJob_Execute( &job );
+		return;
+	}
+
+	tlJob_WakeWorkers( 1 );
+}
+TlBool tlJob_IsDone( const TlJobCounter *counter )
+{
+	TL_ASSERT( counter != ( const TlJobCounter * )0 );
+
+	return tlSys_AtomicLoad( ( volatile TlU32 * )&counter->pending ) == 0 ? TRUE : FALSE;
+}
+void tlJob_Wait( TlJobCounter *counter )
+{
+	TL_ASSERT( counter != ( TlJobCounter * )0 );
+
+	while( tlSys_AtomicLoad( &counter->pending ) != 0 ) {
+		if( !tlJob_RunOne() ) {
+			tlSys_Yield();
+		}
+	}
+}
+
+void tlJob_ParallelFor( TlJobFn_t fn, void *parm, TlU32 n, TlU32 grain )
+{
+	TlJobCounter counter;
+	TlU32 step, first, numThreads;
+
+	TL_ASSERT( fn != ( TlJobFn_t )0 );
+
+	if( !n ) {
+		return;
+	}
+
+	/* a few ranges per thread so stealing can even out uneven ones */
+	numThreads = tlJob_NumThreads();
+	step = ( n + numThreads*4 - 1 )/( numThreads*4 );
+	if( step < grain ) {
+		step = grain;
+	}
+	if( step < 1 ) {
+		step = 1;
+	}
+
+	if( step >= n || !g_jobThreadIndex ) {
+		fn( parm, 0, n );
+		return;
+	}
+
+	tlJob_InitCounter( &counter );
+	for( first = step; first < n; first += step ) {
+		tlJob_Run( fn, parm, first, n - first > step ? first + step : n, &counter );
+	}
+
+	fn( parm, 0, step );
+	tlJob_Wait( &counter );
+}
@@ -0,0 +1,73 @@
+#include <tile/light.h>
+#include <tile/entity.h>
+
+/*
+ * ==========================================================================
+ *
+ *	LIGHT FUNCTIONS
+ *
+ * ==========================================================================
+ */
+
+static TlPool g_light_pool = TL_POOL_INITIALIZER("light", TlLight);
+
+/* Lights are components of their entity, kept in its l_head/l_tail list */
+TlLight *tlNewLight(TlEntity *ent, TlLightType_t type) {
+	TlLight *light;
+
+	TL_ASSERT( ent != NULL && "Entity cannot be NULL" );
+
+	light = (TlLight *)tlPoolAlloc(&g_light_pool);
+
+	light->type = type;
+	light->xyz.x = 0.0f;
+	light->xyz.y = 0.0f;
+	light->xyz.z = 0.0f;
+	light->dir.x = 0.0f;
+	light->dir.y = 0.0f;
+	light->dir.z = type == kTlLT_Point ? 0.0f : 1.0f;
+	light->radius = 10.0f;
+	light->intensity = 1.0f;
+	light->innerCone = 30.0f;
+	light->outerCone = 45.0f;
+	light->color.r = 1.0f;
+	light->color.g = 1.0f;
+	light->color.b = 1.0f;
+	light->color.a = 1.0f;
+
+	light->ent = ent;
+	light->next = (TlLight *)0;
+	if ((light->prev = ent->l_tail) != (TlLight *)0)
+		ent->l_tail->next = light;
+	else
+		ent->l_head = light;
+	ent->l_tail = light;
+
+	return light;
+}
+TlLight *tlDeleteLight(TlLight *light) {
+	if (!light)
+		return (TlLight *)0;
+
+	if (light->prev)
+		light->prev->next = light->next;
+	else
+		light->ent->l_head = light->next;
+
+	if (light->next)
+		light->next->prev = light->prev;
+	else
+		light->ent->l_tail = light->prev;
+
+	return (TlLight *)tlPoolFree(&g_light_pool, (void *)light);
+}
+
+TlHandle tlGetLightHandle(const TlLight *light) {
+	return tlPoolHandle(&g_light_pool, (const void *)light);
+}
+TlLight *tlLightFromHandle(TlHandle h) {
+	return (TlLight *)tlPoolLookup(&g_light_pool, h);
+}
+void tlGetLightPoolStats(TlPoolStats *stats) {
+	tlGetPoolStats(&g_light_pool, stats);
+}
@@ -11,6 +11,27 @@
 # define TILE_REVERSE_ROTATION_ENABLED 1
 #endif
 
+/*
+ * Vectorized matrix kernels, picked at compile time. The scalar reference
+ * kernels (Math_*_Ref) are always built; they're used when there's no vector
+ * code for the target or TILE_SIMD_ENABLED is 0, and are exported as tl*Ref()
+ * so the vector code can be tested against them. The vector code performs the
+ * same operations in the same order (no fused multiply-add), so results match
+ * the scalar code bit for bit.
+ *
+ * Matrices are column-major, so each column maps onto one 4-wide register.
+ */
+#ifndef TILE_SIMD_ENABLED
+# define TILE_SIMD_ENABLED 1
+#endif
+
+#if TILE_SIMD_ENABLED && ( defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 ) )
+# define MATH_SSE_ENABLED 1
+# include <xmmintrin.h>
+#else
+# define MATH_SSE_ENABLED 0
+#endif
+
 static void Math_LoadIdentity(float *M)
 {
 	M[ 0]=1; M[ 4]=0; M[ 8]=0; M[12]=0;
@@ -202,7 +223,7 @@ static void Math_ApplyRotation(float *M, float x, float y, float z)
 	Math_tlApplyYRotation(M, y);
 }
 
-static void Math_LoadAffineInverse(float *M, const float *P)
+static void Math_LoadAffineInverse_Ref(float *M, const float *P)
 {
 	float x, y, z;
 
@@ -215,7 +236,7 @@ static void Math_LoadAffineInverse(float *M, const float *P)
 	M[ 2]=P[ 8]; M[ 6]=P[ 9]; M[10]=P[10]; M[14]=z;
 	M[ 3]=   0 ; M[ 7]=   0 ; M[11]=   0 ; M[15]=1;
 }
-static void Math_AffineMultiply(float *M, const float *P, const float *Q)
+static void Math_AffineMultiply_Ref(float *M, const float *P, const float *Q)
 {
 	M[ 0]=P[ 0]*Q[ 0] + P[ 4]*Q[ 1] + P[ 8]*Q[ 2];
 	M[ 4]=P[ 0]*Q[ 4] + P[ 4]*Q[ 5] + P[ 8]*Q[ 6];
@@ -237,6 +258,87 @@ static void Math_AffineMultiply(float *M, const float *P, const float *Q)
 	M[11]=0;
 	M[15]=1;
 }
+
+#if MATH_SSE_ENABLED
+/* lanes 0-2 set, lane 3 clear; used to force an affine bottom row of 0,0,0,1 */
+static __m128 Math_SSE_XYZMask(void)
+{
+	union { TlU32 u[4]; __m128 v; } x;
+
+	x.u[0] = 0xFFFFFFFF;
+	x.u[1] = 0xFFFFFFFF;
+	x.u[2] = 0xFFFFFFFF;
+	x.u[3] = 0;
+
+	return x.v;
+}
+static __m128 Math_SSE_Column3(__m128 p0, __m128 p1, __m128 p2, const float *Q)
+{
+	__m128 r;
+
+	r = _mm_mul_ps(p0, _mm_set1_ps(Q[0]));
+	r = _mm_add_ps(r, _mm_mul_ps(p1, _mm_set1_ps(Q[1])));
+	r = _mm_add_ps(r, _mm_mul_ps(p2, _mm_set1_ps(Q[2])));
+
+	return r;
+}
+
+static void Math_LoadAffineInverse(float *M, const float *P)
+{
+	__m128 c0, c1, c2, c3, mask, t;
+
+	c0 = _mm_loadu_ps(&P[ 0]);
+	c1 = _mm_loadu_ps(&P[ 4]);
+	c2 = _mm_loadu_ps(&P[ 8]);
+	c3 = _mm_loadu_ps(&P[12]);
+
+	/* the rotation part transposes into the first three columns */
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	mask = Math_SSE_XYZMask();
+	c0 = _mm_and_ps(c0, mask);
+	c1 = _mm_and_ps(c1, mask);
+	c2 = _mm_and_ps(c2, mask);
+
+	/* c3 now holds P[12], P[13], P[14] in lanes 0-2 */
+	t = _mm_mul_ps(c0, _mm_set1_ps(P[12]));
+	t = _mm_add_ps(t, _mm_mul_ps(c1, _mm_set1_ps(P[13])));
+	t = _mm_add_ps(t, _mm_mul_ps(c2, _mm_set1_ps(P[14])));
+	t = _mm_xor_ps(t, _mm_set1_ps(-0.0f));
+	t = _mm_or_ps(_mm_and_ps(t, mask), _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+
+	_mm_storeu_ps(&M[ 0], c0);
+	_mm_storeu_ps(&M[ 4], c1);
+	_mm_storeu_ps(&M[ 8], c2);
+	_mm_storeu_ps(&M[12], t);
+}
+static void Math_AffineMultiply(float *M, const float *P, const float *Q)
+{
+	__m128 p0, p1, p2, p3, mask;
+	__m128 m0, m1, m2, m3;
+
+	mask = Math_SSE_XYZMask();
+
+	p0 = _mm_loadu_ps(&P[ 0]);
+	p1 = _mm_loadu_ps(&P[ 4]);
+	p2 = _mm_loadu_ps(&P[ 8]);
+	p3 = _mm_loadu_ps(&P[12]);
+
+	m0 = _mm_and_ps(Math_SSE_Column3(p0, p1, p2, &Q[ 0]), mask);
+	m1 = _mm_and_ps(Math_SSE_Column3(p0, p1, p2, &Q[ 4]), mask);
+	m2 = _mm_and_ps(Math_SSE_Column3(p0, p1, p2, &Q[ 8]), mask);
+	m3 = _mm_add_ps(Math_SSE_Column3(p0, p1, p2, &Q[12]), p3);
+	m3 = _mm_or_ps(_mm_and_ps(m3, mask), _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+
+	_mm_storeu_ps(&M[ 0], m0);
+	_mm_storeu_ps(&M[ 4], m1);
+	_mm_storeu_ps(&M[ 8], m2);
+	_mm_storeu_ps(&M[12], m3);
+}
+#else
+# define Math_LoadAffineInverse Math_LoadAffineInverse_Ref
+# define Math_AffineMultiply Math_AffineMultiply_Ref
+#endif
 static void Math_Multiply3(float *M, const float *P, const float *Q)
 {
 	M[ 0]=P[ 0]*Q[ 0] + P[ 4]*Q[ 1] + P[ 8]*Q[ 2];
@@ -259,7 +361,7 @@ static void Math_Multiply3(float *M, const float *P, const float *Q)
 	M[11]=0;
 	M[15]=1;
 }
-static void Math_Multiply4(float *M, const float *P, const float *Q)
+static void Math_Multiply4_Ref(float *M, const float *P, const float *Q)
 {
 	M[ 0]=P[ 0]*Q[ 0] + P[ 4]*Q[ 1] + P[ 8]*Q[ 2] + P[12]*Q[ 3];
 	M[ 4]=P[ 0]*Q[ 4] + P[ 4]*Q[ 5] + P[ 8]*Q[ 6] + P[12]*Q[ 7];
@@ -281,12 +383,39 @@ static void Math_Multiply4(float *M, const float *P, const float *Q)
 	M[11]=P[ 3]*Q[ 8] + P[ 7]*Q[ 9] + P[11]*Q[10] + P[15]*Q[11];
 	M[15]=P[ 3]*Q[12] + P[ 7]*Q[13] + P[11]*Q[14] + P[15]*Q[15];
 }
+#if MATH_SSE_ENABLED
+static void Math_Multiply4(float *M, const float *P, const float *Q)
+{
+	__m128 p0, p1, p2, p3, r;
+	int i;
+
+	p0 = _mm_loadu_ps(&P[ 0]);
+	p1 = _mm_loadu_ps(&P[ 4]);
+	p2 = _mm_loadu_ps(&P[ 8]);
+	p3 = _mm_loadu_ps(&P[12]);
 
+	for( i = 0; i < 4; ++i ) {
+		r = Math_SSE_Column3(p0, p1, p2, &Q[i*4]);
+		r = _mm_add_ps(r, _mm_mul_ps(p3, _mm_set1_ps(Q[i*4 + 3])));
+		_mm_storeu_ps(&M[i*4], r);
+	}
+}
+#else
+# define Math_Multiply4 Math_Multiply4_Ref
+#endif
+
+/* OutV may be P */
 static void Math_PointLocalToGlobal( float *OutV, const float *M, const float *P )
 {
-	OutV[0] = M[ 0]*P[0] + M[ 4]*P[1] + M[ 8]*P[2] + M[12];
-	OutV[1] = M[ 1]*P[0] + M[ 5]*P[1] + M[ 9]*P[2] + M[13];
-	OutV[2] = M[ 2]*P[0] + M[ 6]*P[1] + M[10]*P[2] + M[14];
+	float x, y, z;
+
+	x = M[ 0]*P[0] + M[ 4]*P[1] + M[ 8]*P[2] + M[12];
+	y = M[ 1]*P[0] + M[ 5]*P[1] + M[ 9]*P[2] + M[13];
+	z = M[ 2]*P[0] + M[ 6]*P[1] + M[10]*P[2] + M[14];
+
+	OutV[0] = x;
+	OutV[1] = y;
+	OutV[2] = z;
 }
 static void Math_PointGlobalToLocal( float *OutV, const float *M, const float *P )
 {
@@ -303,9 +432,15 @@ static void Math_PointGlobalToLocal( float *OutV, const float *M, const float *P
 
 static void Math_VectorLocalToGlobal( float *OutV, const float *M, const float *P )
 {
-	OutV[0] = M[ 0]*P[0] + M[ 4]*P[1] + M[ 8]*P[2];
-	OutV[1] = M[ 1]*P[0] + M[ 5]*P[1] + M[ 9]*P[2];
-	OutV[2] = M[ 2]*P[0] + M[ 6]*P[1] + M[10]*P[2];
+	float x, y, z;
+
+	x = M[ 0]*P[0] + M[ 4]*P[1] + M[ 8]*P[2];
+	y = M[ 1]*P[0] + M[ 5]*P[1] + M[ 9]*P[2];
+	z = M[ 2]*P[0] + M[ 6]*P[1] + M[10]*P[2];
+
+	OutV[0] = x;
+	OutV[1] = y;
+	OutV[2] = z;
 }
 static void Math_VectorGlobalToLocal( float *OutV, const float *M, const float *P )
 {
@@ -314,6 +449,45 @@ static void Math_VectorGlobalToLocal( float *OutV, const float *M, const float *
 	OutV[2] = M[ 8]*P[0] + M[ 9]*P[1] + M[10]*P[2];
 }
 
+/* Transform `n` points (w=1) or vectors (w=0) packed as 3 floats each */
+static void Math_TransformArray3_Ref( float *OutV, const float *M, const float *P, size_t n, int w )
+{
+	size_t i;
+
+	for( i = 0; i < n; ++i ) {
+		if( w ) {
+			Math_PointLocalToGlobal( &OutV[i*3], M, &P[i*3] );
+		} else {
+			Math_VectorLocalToGlobal( &OutV[i*3], M, &P[i*3] );
+		}
+	}
+}
+#if MATH_SSE_ENABLED
+static void Math_TransformArray3( float *OutV, const float *M, const float *P, size_t n, int w )
+{
+	__m128 c0, c1, c2, c3, r;
+	size_t i;
+
+	c0 = _mm_loadu_ps(&M[ 0]);
+	c1 = _mm_loadu_ps(&M[ 4]);
+	c2 = _mm_loadu_ps(&M[ 8]);
+	c3 = _mm_loadu_ps(&M[12]);
+
+	for( i = 0; i < n; ++i ) {
+		r = Math_SSE_Column3(c0, c1, c2, &P[i*3]);
+		if( w ) {
+			r = _mm_add_ps(r, c3);
+		}
+
+		/* only 3 lanes are stored, so OutV may be P */
+		_mm_storel_pi((__m64 *)&OutV[i*3], r);
+		_mm_store_ss(&OutV[i*3 + 2], _mm_movehl_ps(r, r));
+	}
+}
+#else
+# define Math_TransformArray3 Math_TransformArray3_Ref
+#endif
+
 static float Math_Dot( const float *P, const float *Q )
 {
 	return P[0]*Q[0] + P[1]*Q[1] + P[2]*Q[2];
@@ -548,6 +722,14 @@ TlMat4 *tlAffineMultiply( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ
 	Math_AffineMultiply( ( float * )pOutM, ( const float * )pInP, ( const float * )pInQ );
 	return pOutM;
 }
+void tlAffineMultiplyArray( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ, size_t n )
+{
+	size_t i;
+
+	for( i = 0; i < n; ++i ) {
+		Math_AffineMultiply( ( float * )&pOutM[ i ], ( const float * )pInP, ( const float * )&pInQ[ i ] );
+	}
+}
 TlMat4 *tlMultiply3( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ )
 {
 	Math_Multiply3( ( float * )pOutM, ( const float * )pInP, ( const float * )pInQ );
@@ -564,6 +746,10 @@ TlVec3 *tlPointLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const Tl
 	Math_PointLocalToGlobal( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInPoint );
 	return pOutV;
 }
+void tlPointsLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoints, size_t n )
+{
+	Math_TransformArray3( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInPoints, n, 1 );
+}
 TlVec3 *tlPointGlobalToLocal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoint )
 {
 	Math_PointGlobalToLocal( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInPoint );
@@ -575,12 +761,48 @@ TlVec3 *tlVectorLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const T
 	Math_VectorLocalToGlobal( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInVector );
 	return pOutV;
 }
+void tlVectorsLocalToGlobal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVectors, size_t n )
+{
+	Math_TransformArray3( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInVectors, n, 0 );
+}
 TlVec3 *tlVectorGlobalToLocal( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVector )
 {
 	Math_VectorGlobalToLocal( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInVector );
 	return pOutV;
 }
 
+const char *tlMathKernelName( void )
+{
+#if MATH_SSE_ENABLED
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+TlMat4 *tlLoadAffineInverseRef( TlMat4 *pOutM, const TlMat4 *pInM )
+{
+	Math_LoadAffineInverse_Ref( ( float * )pOutM, ( const float * )pInM );
+	return pOutM;
+}
+TlMat4 *tlAffineMultiplyRef( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ )
+{
+	Math_AffineMultiply_Ref( ( float * )pOutM, ( const float * )pInP, ( const float * )pInQ );
+	return pOutM;
+}
+TlMat4 *tlMultiply4Ref( TlMat4 *pOutM, const TlMat4 *pInP, const TlMat4 *pInQ )
+{
+	Math_Multiply4_Ref( ( float * )pOutM, ( const float * )pInP, ( const float * )pInQ );
+	return pOutM;
+}
+void tlPointsLocalToGlobalRef( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInPoints, size_t n )
+{
+	Math_TransformArray3_Ref( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInPoints, n, 1 );
+}
+void tlVectorsLocalToGlobalRef( TlVec3 *pOutV, const TlMat4 *pInObjectXf, const TlVec3 *pInVectors, size_t n )
+{
+	Math_TransformArray3_Ref( ( float * )pOutV, ( const float * )pInObjectXf, ( const float * )pInVectors, n, 0 );
+}
+
 float tlDot( const TlVec3 *pInP, const TlVec3 *pInQ )
 {
 	return Math_Dot( ( const float * )pInP, ( const float * )pInQ );
@@ -605,3 +827,121 @@ void tlScreenToProj( float *x, float *y, float w, float h )
 	*x = -1.0f + ( *x*2.0f )/w;
 	*y =  1.0f - ( *y*2.0f )/h;
 }
+
+float tlMaxAxisScale( const TlMat4 *pInM )
+{
+	const float *M;
+	float x, y, z;
+
+	M = ( const float * )pInM;
+
+	x = M[ 0]*M[ 0] + M[ 1]*M[ 1] + M[ 2]*M[ 2];
+	y = M[ 4]*M[ 4] + M[ 5]*M[ 5] + M[ 6]*M[ 6];
+	z = M[ 8]*M[ 8] + M[ 9]*M[ 9] + M[10]*M[10];
+
+	if( y > x ) { x = y; }
+	if( z > x ) { x = z; }
+
+	return tlSqrt( x );
+}
+
+static void Math_SetPlane( TlPlane *pOutP, const float *C, int row, float sign )
+{
+	float x, y, z, d, s;
+
+	x = C[ 3] + sign*C[ 0 + row];
+	y = C[ 7] + sign*C[ 4 + row];
+	z = C[11] + sign*C[ 8 + row];
+	d = C[15] + sign*C[12 + row];
+
+	s = x*x + y*y + z*z;
+	s = s > 0.0f ? 1.0f/tlSqrt( s ) : 0.0f;
+
+	pOutP->x = x*s;
+	pOutP->y = y*s;
+	pOutP->z = z*s;
+	pOutP->d = d*s;
+}
+TlFrustum *tlExtractFrustum( TlFrustum *pOutF, const TlMat4 *pInClip )
+{
+	const float *C;
+
+	C = ( const float * )pInClip;
+
+	/* each plane is the w row plus or minus the x, y, or z row */
+	Math_SetPlane( &pOutF->planes[ 0 ], C, 0,  1.0f );
+	Math_SetPlane( &pOutF->planes[ 1 ], C, 0, -1.0f );
+	Math_SetPlane( &pOutF->planes[ 2 ], C, 1,  1.0f );
+	Math_SetPlane( &pOutF->planes[ 3 ], C, 1, -1.0f );
+	Math_SetPlane( &pOutF->planes[ 4 ], C, 2,  1.0f );
+	Math_SetPlane( &pOutF->planes[ 5 ], C, 2, -1.0f );
+
+	return pOutF;
+}
+TlCullResult_t tlCullSphere( const TlFrustum *pInF, const TlVec3 *pInCenter, float fRadius )
+{
+	TlCullResult_t r;
+	const TlPlane *p;
+	float dist;
+	int i;
+
+	if( fRadius < 0.0f ) {
+		return kTlCull_Outside;
+	}
+
+	r = kTlCull_Inside;
+	for( i = 0; i < 6; ++i ) {
+		p = &pInF->planes[ i ];
+		dist = p->x*pInCenter->x + p->y*pInCenter->y + p->z*pInCenter->z + p->d;
+
+		if( dist < -fRadius ) {
+			return kTlCull_Outside;
+		}
+		if( dist < fRadius ) {
+			r = kTlCull_Intersect;
+		}
+	}
+
+	return r;
+}
+TlCullResult_t tlCullBox( const TlFrustum *pInF, const TlMat4 *pInObjectXf, const TlVec3 *pInMins, const TlVec3 *pInMaxs )
+{
+	TlCullResult_t r;
+	const TlPlane *p;
+	const float *M;
+	float cx, cy, cz, ex, ey, ez;
+	float x, y, z, d, dist, extent;
+	int i;
+
+	M = ( const float * )pInObjectXf;
+
+	cx = 0.5f*( pInMaxs->x + pInMins->x );
+	cy = 0.5f*( pInMaxs->y + pInMins->y );
+	cz = 0.5f*( pInMaxs->z + pInMins->z );
+	ex = 0.5f*( pInMaxs->x - pInMins->x );
+	ey = 0.5f*( pInMaxs->y - pInMins->y );
+	ez = 0.5f*( pInMaxs->z - pInMins->z );
+
+	r = kTlCull_Inside;
+	for( i = 0; i < 6; ++i ) {
+		p = &pInF->planes[ i ];
+
+		/* bring the plane into the box's space rather than the box out of it */
+		x = p->x*M[ 0] + p->y*M[ 1] + p->z*M[ 2] + p->d*M[ 3];
+		y = p->x*M[ 4] + p->y*M[ 5] + p->z*M[ 6] + p->d*M[ 7];
+		z = p->x*M[ 8] + p->y*M[ 9] + p->z*M[10] + p->d*M[11];
+		d = p->x*M[12] + p->y*M[13] + p->z*M[14] + p->d*M[15];
+
+		dist = x*cx + y*cy + z*cz + d;
+		extent = ( x < 0.0f ? -x : x )*ex + ( y < 0.0f ? -y : y )*ey + ( z < 0.0f ? -z : z )*ez;
+
+		if( dist < -extent ) {
+			return kTlCull_Outside;
+		}
+		if( dist < extent ) {
+			r = kTlCull_Intersect;
+		}
+	}
+
+	return r;
+}
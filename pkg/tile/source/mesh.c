@@ -0,0 +1,1119 @@
+#include <tile/mesh.h>
+#include <tile/surface.h>
+#include <tile/math.h>
+
+/*
+ * ==========================================================================
+ *
+ *	WELDING
+ *
+ * ==========================================================================
+ */
+
+#define MESH_EMPTY (~(TlU32)0)
+
+static TlU32 tlMesh_HashVertex(const TlVertex *vert) {
+	const unsigned char *p;
+	TlU32 h;
+	size_t i;
+
+	/* FNV-1a */
+	p = (const unsigned char *)vert;
+	h = 2166136261U;
+	for(i=0; i<sizeof(*vert); i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+TlU32 tlWeldVertices(TlU32 *remap, const TlVertex *verts, TlU32 numVerts) {
+	TlU32 *table, mask, n, i, h, j;
+
+	TL_ASSERT(remap != (TlU32 *)0 || !numVerts);
+
+	/* open addressing, at most half full */
+	mask = 1;
+	while (mask < numVerts*2)
+		mask <<= 1;
+
+	table = (TlU32 *)tlMemory((void *)0, mask*sizeof(TlU32));
+	memset((void *)table, 0xFF, mask*sizeof(TlU32));
+	mask--;
+
+	n = 0;
+	for(i=0; i<numVerts; i++) {
+		h = tlMesh_HashVertex(&verts[i]) & mask;
+
+		for(;;) {
+			j = table[h];
+			if (j == MESH_EMPTY) {
+				table[h] = i;
+				remap[i] = n++;
+				break;
+			}
+
+			if (!memcmp((const void *)&verts[j], (const void *)&verts[i], sizeof(TlVertex))) {
+				remap[i] = remap[j];
+				break;
+			}
+
+			h = (h + 1) & mask;
+		}
+	}
+
+	table = (TlU32 *)tlMemory((void *)table, 0);
+	return n;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	VERTEX CACHE
+ *
+ * ==========================================================================
+ */
+
+/*
+ * Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Each vertex scores
+ * higher the more recently it was used (in a simulated LRU cache) and the
+ * fewer triangles it has left, so lone vertices get finished off. The next
+ * triangle is the best-scoring one touching the cache.
+ */
+#define MESH_LRU_SIZE 32
+#define MESH_MAX_VALENCE 32
+
+typedef struct MeshCacheOpt_s {
+	float cacheScore[MESH_LRU_SIZE];
+	float valenceScore[MESH_MAX_VALENCE];
+
+	/* triangles using each vertex; the live ones come first */
+	TlU32 *triStart;
+	TlU32 *tris;
+	TlU32 *numLive;
+
+	int *cachePos;
+	float *vertScore;
+	float *triScore;
+	TlU8 *emitted;
+} MeshCacheOpt;
+
+static float tlMesh_VertexScore(const MeshCacheOpt *opt, TlU32 v) {
+	float score;
+	TlU32 n;
+
+	if (!(n = opt->numLive[v]))
+		return -1.0f;
+
+	score = opt->cachePos[v] >= 0 ? opt->cacheScore[opt->cachePos[v]] : 0.0f;
+	score += n < MESH_MAX_VALENCE ? opt->valenceScore[n] : 2.0f*tlInvSqrt((float)n);
+
+	return score;
+}
+static void tlMesh_InitScores(MeshCacheOpt *opt) {
+	float f;
+	int i;
+
+	for(i=0; i<MESH_LRU_SIZE; i++) {
+		/* the last triangle's vertices score the same whatever their order */
+		if (i < 3) {
+			opt->cacheScore[i] = 0.75f;
+			continue;
+		}
+
+		f = 1.0f - (float)(i - 3)/(float)(MESH_LRU_SIZE - 3);
+		opt->cacheScore[i] = f*tlSqrt(f);
+	}
+
+	opt->valenceScore[0] = 0.0f;
+	for(i=1; i<MESH_MAX_VALENCE; i++)
+		opt->valenceScore[i] = 2.0f*tlInvSqrt((float)i);
+}
+/* Take triangle `t` out of the live list of vertex `v` */
+static void tlMesh_RemoveLive(MeshCacheOpt *opt, TlU32 v, TlU32 t) {
+	TlU32 *list, i, n;
+
+	list = &opt->tris[opt->triStart[v]];
+	n = opt->numLive[v];
+
+	for(i=0; i<n; i++) {
+		if (list[i] == t) {
+			list[i] = list[n - 1];
+			list[n - 1] = t;
+			opt->numLive[v] = n - 1;
+			return;
+		}
+	}
+
+	TL_ASSERT(0 && "triangle not in vertex's live list");
+}
+
+void tlOptimizeVertexCache(TlU32 *dst, const TlU32 *inds, TlU32 numInds, TlU32 numVerts) {
+	TlU32 cache[MESH_LRU_SIZE + 3], newCache[MESH_LRU_SIZE + 3];
+	TlU32 numTris, numCache, numNewCache, numOut;
+	TlU32 t, best, cursor, i, j, k, v;
+	const TlU32 *tri;
+	MeshCacheOpt opt;
+	float bestScore;
+
+	TL_ASSERT(dst != (TlU32 *)0 || !numInds);
+	TL_ASSERT(dst != inds || !numInds);
+
+	numTris = numInds/3;
+	if (!numTris)
+		return;
+
+	tlMesh_InitScores(&opt);
+
+	opt.triStart = (TlU32 *)tlMemory((void *)0, (numVerts + 1)*sizeof(TlU32));
+	opt.tris = (TlU32 *)tlMemory((void *)0, numTris*3*sizeof(TlU32));
+	opt.numLive = (TlU32 *)tlMemory((void *)0, numVerts*sizeof(TlU32));
+	opt.cachePos = (int *)tlMemory((void *)0, numVerts*sizeof(int));
+	opt.vertScore = (float *)tlMemory((void *)0, numVerts*sizeof(float));
+	opt.triScore = (float *)tlMemory((void *)0, numTris*sizeof(float));
+	opt.emitted = (TlU8 *)tlMemory((void *)0, numTris);
+
+	/* bucket the triangles by vertex */
+	memset((void *)opt.numLive, 0, numVerts*sizeof(TlU32));
+	for(i=0; i<numTris*3; i++) {
+		TL_ASSERT(inds[i] < numVerts);
+		opt.numLive[inds[i]]++;
+	}
+
+	opt.triStart[0] = 0;
+	for(v=0; v<numVerts; v++) {
+		opt.triStart[v + 1] = opt.triStart[v] + opt.numLive[v];
+		opt.numLive[v] = 0;
+	}
+
+	for(t=0; t<numTris; t++) {
+		for(k=0; k<3; k++) {
+			v = inds[t*3 + k];
+			opt.tris[opt.triStart[v] + opt.numLive[v]++] = t;
+		}
+	}
+
+	for(v=0; v<numVerts; v++) {
+		opt.cachePos[v] = -1;
+		opt.vertScore[v] = tlMesh_VertexScore(&opt, v);
+	}
+
+	best = 0;
+	bestScore = -1.0f;
+	for(t=0; t<numTris; t++) {
+		tri = &inds[t*3];
+		opt.triScore[t] = opt.vertScore[tri[0]] + opt.vertScore[tri[1]] + opt.vertScore[tri[2]];
+		opt.emitted[t] = 0;
+
+		if (opt.triScore[t] > bestScore) {
+			bestScore = opt.triScore[t];
+			best = t;
+		}
+	}
+
+	numCache = 0;
+	cursor = 0;
+	for(numOut=0; numOut<numTris; numOut++) {
+		/* nothing touches the cache; carry on from the input order */
+		if (best == MESH_EMPTY) {
+			while (opt.emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+
+		tri = &inds[best*3];
+		dst[numOut*3 + 0] = tri[0];
+		dst[numOut*3 + 1] = tri[1];
+		dst[numOut*3 + 2] = tri[2];
+		opt.emitted[best] = 1;
+
+		/* the triangle's vertices go to the front of the cache */
+		numNewCache = 0;
+		for(k=0; k<3; k++) {
+			tlMesh_RemoveLive(&opt, tri[k], best);
+
+			for(j=0; j<numNewCache; j++) {
+				if (newCache[j] == tri[k])
+					break;
+			}
+			if (j == numNewCache)
+				newCache[numNewCache++] = tri[k];
+		}
+		for(i=0; i<numCache; i++) {
+			v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[numNewCache++] = v;
+		}
+
+		/* anything past the end falls out (but is rescored all the same) */
+		for(i=0; i<numNewCache; i++) {
+			v = newCache[i];
+			opt.cachePos[v] = i < MESH_LRU_SIZE ? (int)i : -1;
+			opt.vertScore[v] = tlMesh_VertexScore(&opt, v);
+		}
+
+		numCache = numNewCache < MESH_LRU_SIZE ? numNewCache : MESH_LRU_SIZE;
+		memcpy((void *)cache, (const void *)newCache, numCache*sizeof(TlU32));
+
+		best = MESH_EMPTY;
+		bestScore = -1.0f;
+		for(i=0; i<numNewCache; i++) {
+			v = newCache[i];
+			for(j=0; j<opt.numLive[v]; j++) {
+				t = opt.tris[opt.triStart[v] + j];
+				tri = &inds[t*3];
+
+				opt.triScore[t] = opt.vertScore[tri[0]] + opt.vertScore[tri[1]] + opt.vertScore[tri[2]];
+				if (opt.triScore[t] > bestScore) {
+					bestScore = opt.triScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	opt.emitted = (TlU8 *)tlMemory((void *)opt.emitted, 0);
+	opt.triScore = (float *)tlMemory((void *)opt.triScore, 0);
+	opt.vertScore = (float *)tlMemory((void *)opt.vertScore, 0);
+	opt.cachePos = (int *)tlMemory((void *)opt.cachePos, 0);
+	opt.numLive = (TlU32 *)tlMemory((void *)opt.numLive, 0);
+	opt.tris = (TlU32 *)tlMemory((void *)opt.tris, 0);
+	opt.triStart = (TlU32 *)tlMemory((void *)opt.triStart, 0);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	OVERDRAW
+ *
+ * ==========================================================================
+ */
+
+/*
+ * FIFO cache simulation. A vertex is cached if fewer than `size` misses have
+ * happened since it was last loaded; bumping the clock past `size` empties it.
+ */
+typedef struct MeshFifo_s {
+	TlU32 *loadedAt;
+	TlU32 clock;
+	TlU32 size;
+} MeshFifo;
+
+static void tlMesh_InitFifo(MeshFifo *fifo, TlU32 numVerts, TlU32 size) {
+	fifo->loadedAt = (TlU32 *)tlMemory((void *)0, numVerts*sizeof(TlU32));
+	memset((void *)fifo->loadedAt, 0, numVerts*sizeof(TlU32));
+	fifo->size = size;
+	fifo->clock = size + 1;
+}
+static void tlMesh_FiniFifo(MeshFifo *fifo) {
+	fifo->loadedAt = (TlU32 *)tlMemory((void *)fifo->loadedAt, 0);
+}
+static void tlMesh_ResetFifo(MeshFifo *fifo) {
+	fifo->clock += fifo->size + 1;
+}
+/* Returns the number of the triangle's vertices that weren't in the cache */
+static TlU32 tlMesh_FifoTriangle(MeshFifo *fifo, const TlU32 *tri) {
+	TlU32 misses, k;
+
+	misses = 0;
+	for(k=0; k<3; k++) {
+		if (fifo->clock - fifo->loadedAt[tri[k]] > fifo->size) {
+			fifo->loadedAt[tri[k]] = fifo->clock++;
+			misses++;
+		}
+	}
+
+	return misses;
+}
+
+typedef struct MeshCluster_s {
+	TlU32 first, last;
+	float key;
+} MeshCluster;
+
+static int tlMesh_CmpClusterStarts(const void *a, const void *b) {
+	const MeshCluster *x, *y;
+
+	x = (const MeshCluster *)a;
+	y = (const MeshCluster *)b;
+
+	return x->first < y->first ? -1 : x->first > y->first ? 1 : 0;
+}
+static int tlMesh_CmpClusters(const void *a, const void *b) {
+	const MeshCluster *x, *y;
+
+	x = (const MeshCluster *)a;
+	y = (const MeshCluster *)b;
+
+	/* facing most outward first; otherwise keep the cache order */
+	if (x->key != y->key)
+		return x->key > y->key ? -1 : 1;
+
+	return x->first < y->first ? -1 : x->first > y->first ? 1 : 0;
+}
+
+/* Area-weighted centroid and normal of triangles [first, last) */
+static void tlMesh_ClusterShape(TlVec3 *centroid, TlVec3 *normal, float *area,
+const TlU32 *inds, TlU32 first, TlU32 last, const TlVertex *verts) {
+	const float *a, *b, *c;
+	float e1[3], e2[3], n[3], w;
+	TlU32 t;
+	int k;
+
+	memset((void *)centroid, 0, sizeof(*centroid));
+	memset((void *)normal, 0, sizeof(*normal));
+	*area = 0.0f;
+
+	for(t=first; t<last; t++) {
+		a = verts[inds[t*3 + 0]].xyz;
+		b = verts[inds[t*3 + 1]].xyz;
+		c = verts[inds[t*3 + 2]].xyz;
+
+		for(k=0; k<3; k++) {
+			e1[k] = b[k] - a[k];
+			e2[k] = c[k] - a[k];
+		}
+
+		n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+		n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+		n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+
+		w = tlSqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+		centroid->x += w*(a[0] + b[0] + c[0])/3.0f;
+		centroid->y += w*(a[1] + b[1] + c[1])/3.0f;
+		centroid->z += w*(a[2] + b[2] + c[2])/3.0f;
+		normal->x += n[0];
+		normal->y += n[1];
+		normal->z += n[2];
+		*area += w;
+	}
+
+	if (*area > 0.0f) {
+		centroid->x /= *area;
+		centroid->y /= *area;
+		centroid->z /= *area;
+	}
+}
+
+void tlOptimizeOverdraw(TlU32 *inds, TlU32 numInds, const TlVertex *verts, TlU32 numVerts,
+float threshold) {
+	TlU32 numTris, numClusters, maxClusters, first, end, t, misses, numRun, n;
+	TlVec3 meshCentroid, centroid, normal;
+	MeshCluster *clusters;
+	float area, limit, len;
+	TlU32 *sorted;
+	MeshFifo fifo;
+	size_t i;
+
+	numTris = numInds/3;
+	if (numTris < 2)
+		return;
+
+	tlMesh_InitFifo(&fifo, numVerts, TL_MESH_DEFAULT_CACHE_SIZE);
+
+	/*
+	 * Cut where the cache order already starts afresh (a triangle missing all
+	 * three vertices), so reordering those pieces costs nothing.
+	 */
+	maxClusters = 64;
+	clusters = (MeshCluster *)tlMemory((void *)0, maxClusters*sizeof(MeshCluster));
+	numClusters = 0;
+	for(t=0; t<numTris; t++) {
+		if (tlMesh_FifoTriangle(&fifo, &inds[t*3]) < 3 && t > 0)
+			continue;
+
+		if (numClusters == maxClusters) {
+			maxClusters *= 2;
+			clusters = (MeshCluster *)tlMemory((void *)clusters, maxClusters*sizeof(MeshCluster));
+		}
+
+		clusters[numClusters++].first = t;
+	}
+
+	/*
+	 * Then cut those further wherever the run so far is already within
+	 * `threshold` of its cluster's cache efficiency.
+	 */
+	n = numClusters;
+	for(i=0; i<n; i++) {
+		first = clusters[i].first;
+		end = i + 1 < n ? clusters[i + 1].first : numTris;
+
+		tlMesh_ResetFifo(&fifo);
+		misses = 0;
+		for(t=first; t<end; t++)
+			misses += tlMesh_FifoTriangle(&fifo, &inds[t*3]);
+
+		limit = threshold*(float)misses/(float)(end - first);
+
+		tlMesh_ResetFifo(&fifo);
+		misses = 0;
+		numRun = 0;
+		for(t=first; t + 1<end; t++) {
+			misses += tlMesh_FifoTriangle(&fifo, &inds[t*3]);
+			numRun++;
+
+			if ((float)misses/(float)numRun > limit)
+				continue;
+
+			if (numClusters == maxClusters) {
+				maxClusters *= 2;
+				clusters = (MeshCluster *)tlMemory((void *)clusters, maxClusters*sizeof(MeshCluster));
+			}
+
+			clusters[numClusters++].first = t + 1;
+
+			tlMesh_ResetFifo(&fifo);
+			misses = 0;
+			numRun = 0;
+		}
+	}
+
+	tlMesh_FiniFifo(&fifo);
+
+	/* the soft cuts were appended; put every cut back in order */
+	qsort((void *)clusters, numClusters, sizeof(MeshCluster), &tlMesh_CmpClusterStarts);
+	for(i=0; i<numClusters; i++)
+		clusters[i].last = i + 1 < numClusters ? clusters[i + 1].first : numTris;
+
+	tlMesh_ClusterShape(&meshCentroid, &normal, &area, inds, 0, numTris, verts);
+
+	for(i=0; i<numClusters; i++) {
+		tlMesh_ClusterShape(&centroid, &normal, &area, inds, clusters[i].first,
+			clusters[i].last, verts);
+
+		len = tlSqrt(normal.x*normal.x + normal.y*normal.y + normal.z*normal.z);
+		if (len > 0.0f)
+			len = 1.0f/len;
+
+		clusters[i].key =
+			((centroid.x - meshCentroid.x)*normal.x +
+			 (centroid.y - meshCentroid.y)*normal.y +
+			 (centroid.z - meshCentroid.z)*normal.z)*len;
+	}
+
+	qsort((void *)clusters, numClusters, sizeof(MeshCluster), &tlMesh_CmpClusters);
+
+	sorted = (TlU32 *)tlMemory((void *)0, numTris*3*sizeof(TlU32));
+	n = 0;
+	for(i=0; i<numClusters; i++) {
+		memcpy((void *)&sorted[n], (const void *)&inds[clusters[i].first*3],
+			(clusters[i].last - clusters[i].first)*3*sizeof(TlU32));
+		n += (clusters[i].last - clusters[i].first)*3;
+	}
+	memcpy((void *)inds, (const void *)sorted, n*sizeof(TlU32));
+
+	sorted = (TlU32 *)tlMemory((void *)sorted, 0);
+	clusters = (MeshCluster *)tlMemory((void *)clusters, 0);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	SIMPLIFICATION
+ *
+ * ==========================================================================
+ */
+
+/*
+ * Garland and Heckbert's quadric error metrics. Edges collapse onto one of
+ * their own vertices rather than a new position, so every level can draw with
+ * the same vertices. Vertices on open borders or attribute seams (sharing a
+ * position with another vertex) never move, keeping outlines and seams whole.
+ */
+typedef struct MeshQuadric_s {
+	double a2, ab, ac, ad;
+	double b2, bc, bd;
+	double c2, cd;
+	double d2;
+	/* total area of the planes, so errors come out as a mean */
+	double w;
+} MeshQuadric;
+
+typedef struct MeshCollapse_s {
+	TlU32 from, to;
+	double cost;
+} MeshCollapse;
+
+#define MESH_EMPTY_EDGE (~(TlU64)0)
+
+static void tlMesh_AddQuadric(MeshQuadric *q, const MeshQuadric *r) {
+	q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+	q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+	q->c2 += r->c2; q->cd += r->cd;
+	q->d2 += r->d2;
+	q->w += r->w;
+}
+static void tlMesh_PlaneQuadric(MeshQuadric *q, const double *n, double d, double w) {
+	q->a2 = w*n[0]*n[0]; q->ab = w*n[0]*n[1]; q->ac = w*n[0]*n[2]; q->ad = w*n[0]*d;
+	q->b2 = w*n[1]*n[1]; q->bc = w*n[1]*n[2]; q->bd = w*n[1]*d;
+	q->c2 = w*n[2]*n[2]; q->cd = w*n[2]*d;
+	q->d2 = w*d*d;
+	q->w = w;
+}
+/* Mean squared distance from `p` to the planes of `q` and `r` together */
+static double tlMesh_CollapseCost(const MeshQuadric *q, const MeshQuadric *r, const float *p) {
+	MeshQuadric s;
+	double x, y, z, e;
+
+	s = *q;
+	tlMesh_AddQuadric(&s, r);
+
+	x = p[0];
+	y = p[1];
+	z = p[2];
+
+	e = s.a2*x*x + 2.0*s.ab*x*y + 2.0*s.ac*x*z + 2.0*s.ad*x +
+	    s.b2*y*y + 2.0*s.bc*y*z + 2.0*s.bd*y +
+	    s.c2*z*z + 2.0*s.cd*z +
+	    s.d2;
+
+	if (e < 0.0 || s.w <= 0.0)
+		return 0.0;
+
+	return e/s.w;
+}
+
+/* Unnormalized normal of triangle (a, b, c); returns its length */
+static double tlMesh_TriNormal(double *n, const float *a, const float *b, const float *c) {
+	double e1[3], e2[3];
+	int k;
+
+	for(k=0; k<3; k++) {
+		e1[k] = (double)b[k] - (double)a[k];
+		e2[k] = (double)c[k] - (double)a[k];
+	}
+
+	n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+	n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+	n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+
+	return sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+}
+
+static TlU32 tlMesh_HashEdge(TlU64 edge) {
+	edge ^= edge >> 33;
+	edge *= 0xFF51AFD7ED558CCDULL;
+	edge ^= edge >> 33;
+
+	return (TlU32)edge;
+}
+/* Insert (or find, if `insert` is FALSE) a directed edge in an open-addressed set */
+static TlBool tlMesh_EdgeSet(TlU64 *table, TlU32 mask, TlU32 a, TlU32 b, TlBool insert) {
+	TlU64 edge;
+	TlU32 h;
+
+	edge = ((TlU64)a << 32) | b;
+	for(h=tlMesh_HashEdge(edge) & mask; table[h]!=MESH_EMPTY_EDGE; h=(h + 1) & mask) {
+		if (table[h] == edge)
+			return TRUE;
+	}
+
+	if (insert)
+		table[h] = edge;
+
+	return FALSE;
+}
+
+/* Lock the vertices of open borders and of seams in position */
+static void tlMesh_LockVertices(TlU8 *locked, const TlU32 *inds, TlU32 numInds,
+const TlVertex *verts, TlU32 numVerts) {
+	TlU32 *table, mask, i, h, j, a, b;
+	TlU64 *edges;
+
+	/* seams: vertices whose position some earlier vertex already has */
+	mask = 1;
+	while (mask < numVerts*2)
+		mask <<= 1;
+
+	table = (TlU32 *)tlMemory((void *)0, mask*sizeof(TlU32));
+	memset((void *)table, 0xFF, mask*sizeof(TlU32));
+	mask--;
+
+	for(i=0; i<numVerts; i++) {
+		h = 2166136261U;
+		for(j=0; j<sizeof(verts[i].xyz); j++) {
+			h ^= ((const unsigned char *)verts[i].xyz)[j];
+			h *= 16777619U;
+		}
+
+		for(h&=mask; table[h]!=MESH_EMPTY; h=(h + 1) & mask) {
+			if (!memcmp((const void *)verts[table[h]].xyz, (const void *)verts[i].xyz, sizeof(verts[i].xyz))) {
+				locked[table[h]] = 1;
+				locked[i] = 1;
+				break;
+			}
+		}
+
+		if (table[h] == MESH_EMPTY)
+			table[h] = i;
+	}
+
+	table = (TlU32 *)tlMemory((void *)table, 0);
+
+	/* borders: edges no triangle runs the other way along */
+	mask = 1;
+	while (mask < numInds*2)
+		mask <<= 1;
+
+	edges = (TlU64 *)tlMemory((void *)0, mask*sizeof(TlU64));
+	memset((void *)edges, 0xFF, mask*sizeof(TlU64));
+	mask--;
+
+	for(i=0; i<numInds; i++) {
+		a = inds[i];
+		b = inds[i - i%3 + (i + 1)%3];
+		tlMesh_EdgeSet(edges, mask, a, b, TRUE);
+	}
+	for(i=0; i<numInds; i++) {
+		a = inds[i];
+		b = inds[i - i%3 + (i + 1)%3];
+		if (!tlMesh_EdgeSet(edges, mask, b, a, FALSE)) {
+			locked[a] = 1;
+			locked[b] = 1;
+		}
+	}
+
+	edges = (TlU64 *)tlMemory((void *)edges, 0);
+}
+
+static int tlMesh_CmpCollapses(const void *a, const void *b) {
+	const MeshCollapse *x, *y;
+
+	x = (const MeshCollapse *)a;
+	y = (const MeshCollapse *)b;
+
+	if (x->cost != y->cost)
+		return x->cost < y->cost ? -1 : 1;
+
+	return x->from < y->from ? -1 : x->from > y->from ? 1 : 0;
+}
+
+/* Whether moving `from` onto `to` would turn any surrounding triangle over */
+static TlBool tlMesh_CollapseFlips(const TlU32 *inds, const TlU32 *triStart, const TlU32 *adj,
+const TlU32 *remap, const TlVertex *verts, TlU32 from, TlU32 to) {
+	const float *p[3], *q[3];
+	double n0[3], n1[3];
+	TlU32 i, k, t, v;
+	TlBool gone;
+
+	for(i=triStart[from]; i<triStart[from + 1]; i++) {
+		t = adj[i];
+
+		gone = FALSE;
+		for(k=0; k<3; k++) {
+			v = remap[inds[t*3 + k]];
+			if (v == to)
+				gone = TRUE;
+
+			p[k] = verts[v].xyz;
+			q[k] = v == from ? verts[to].xyz : verts[v].xyz;
+		}
+
+		/* triangles along the edge collapse away; they can't flip */
+		if (gone)
+			continue;
+
+		tlMesh_TriNormal(n0, p[0], p[1], p[2]);
+		tlMesh_TriNormal(n1, q[0], q[1], q[2]);
+		if (n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2] <= 0.0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+TlU32 tlSimplifyMesh(TlU32 *dst, const TlU32 *inds, TlU32 numInds, const TlVertex *verts,
+TlU32 numVerts, TlU32 targetInds, float *error) {
+	TlU32 *triStart, *adj, *remap;
+	TlU32 numTris, numCollapses, numRemoved, wantRemoved, numDone, t, i, k, a, b, n;
+	MeshQuadric *quadrics, q;
+	MeshCollapse *collapses, *c;
+	double normal[3], len, cab, cba, maxCost;
+	TlU8 *locked, *touched;
+
+	TL_ASSERT(dst != (TlU32 *)0 || !numInds);
+
+	numInds -= numInds%3;
+	memmove((void *)dst, (const void *)inds, numInds*sizeof(TlU32));
+
+	if (error)
+		*error = 0.0f;
+	if (numInds <= targetInds)
+		return numInds;
+
+	quadrics = (MeshQuadric *)tlMemory((void *)0, numVerts*sizeof(MeshQuadric));
+	locked = (TlU8 *)tlMemory((void *)0, numVerts);
+	touched = (TlU8 *)tlMemory((void *)0, numVerts);
+	remap = (TlU32 *)tlMemory((void *)0, numVerts*sizeof(TlU32));
+	triStart = (TlU32 *)tlMemory((void *)0, (numVerts + 1)*sizeof(TlU32));
+	adj = (TlU32 *)tlMemory((void *)0, numInds*sizeof(TlU32));
+	collapses = (MeshCollapse *)tlMemory((void *)0, numInds*sizeof(MeshCollapse));
+
+	memset((void *)quadrics, 0, numVerts*sizeof(MeshQuadric));
+	memset((void *)locked, 0, numVerts);
+	memset((void *)touched, 0, numVerts);
+	for(i=0; i<numVerts; i++)
+		remap[i] = i;
+
+	tlMesh_LockVertices(locked, dst, numInds, verts, numVerts);
+
+	/* each vertex starts with the planes of its triangles, weighted by area */
+	for(t=0; t<numInds/3; t++) {
+		len = tlMesh_TriNormal(normal, verts[dst[t*3 + 0]].xyz, verts[dst[t*3 + 1]].xyz,
+			verts[dst[t*3 + 2]].xyz);
+		if (len <= 0.0)
+			continue;
+
+		for(k=0; k<3; k++)
+			normal[k] /= len;
+
+		tlMesh_PlaneQuadric(&q, normal, -(normal[0]*verts[dst[t*3]].xyz[0] +
+			normal[1]*verts[dst[t*3]].xyz[1] + normal[2]*verts[dst[t*3]].xyz[2]), len*0.5);
+
+		for(k=0; k<3; k++)
+			tlMesh_AddQuadric(&quadrics[dst[t*3 + k]], &q);
+	}
+
+	maxCost = 0.0;
+	while (numInds > targetInds) {
+		numTris = numInds/3;
+
+		/* triangles around each vertex */
+		memset((void *)triStart, 0, (numVerts + 1)*sizeof(TlU32));
+		for(i=0; i<numInds; i++)
+			triStart[dst[i] + 1]++;
+		for(i=0; i<numVerts; i++)
+			triStart[i + 1] += triStart[i];
+		for(t=0; t<numTris; t++) {
+			for(k=0; k<3; k++)
+				adj[triStart[dst[t*3 + k]]++] = t;
+		}
+		for(i=numVerts; i>0; i--)
+			triStart[i] = triStart[i - 1];
+		triStart[0] = 0;
+
+		/* every edge once (interior edges run both ways; borders are locked) */
+		numCollapses = 0;
+		for(i=0; i<numInds; i++) {
+			a = dst[i];
+			b = dst[i - i%3 + (i + 1)%3];
+			if (a > b || (locked[a] && locked[b]))
+				continue;
+
+			cab = locked[a] ? -1.0 : tlMesh_CollapseCost(&quadrics[a], &quadrics[b], verts[b].xyz);
+			cba = locked[b] ? -1.0 : tlMesh_CollapseCost(&quadrics[a], &quadrics[b], verts[a].xyz);
+
+			c = &collapses[numCollapses++];
+			if (cba < 0.0 || (cab >= 0.0 && cab <= cba)) {
+				c->from = a;
+				c->to = b;
+				c->cost = cab;
+			} else {
+				c->from = b;
+				c->to = a;
+				c->cost = cba;
+			}
+		}
+
+		qsort((void *)collapses, numCollapses, sizeof(MeshCollapse), &tlMesh_CmpCollapses);
+
+		/*
+		 * Cheapest first, leaving each vertex to one collapse per pass so the
+		 * costs computed above stay true
+		 */
+		wantRemoved = (numInds - targetInds + 2)/3;
+		numRemoved = 0;
+		numDone = 0;
+		for(i=0; i<numCollapses && numRemoved<wantRemoved; i++) {
+			c = &collapses[i];
+			if (touched[c->from] || touched[c->to])
+				continue;
+
+			if (tlMesh_CollapseFlips(dst, triStart, adj, remap, verts, c->from, c->to))
+				continue;
+
+			for(n=triStart[c->from]; n<triStart[c->from + 1]; n++) {
+				t = adj[n];
+				for(k=0; k<3; k++) {
+					if (remap[dst[t*3 + k]] == c->to) {
+						numRemoved++;
+						break;
+					}
+				}
+			}
+
+			remap[c->from] = c->to;
+			tlMesh_AddQuadric(&quadrics[c->to], &quadrics[c->from]);
+			touched[c->from] = 1;
+			touched[c->to] = 1;
+
+			if (c->cost > maxCost)
+				maxCost = c->cost;
+			numDone++;
+		}
+
+		if (!numDone)
+			break;
+
+		/* apply the collapses and drop what they flattened */
+		n = 0;
+		for(t=0; t<numTris; t++) {
+			for(k=0; k<3; k++)
+				dst[n + k] = remap[dst[t*3 + k]];
+
+			if (dst[n] != dst[n + 1] && dst[n] != dst[n + 2] && dst[n + 1] != dst[n + 2])
+				n += 3;
+		}
+		numInds = n;
+
+		for(i=0; i<numVerts; i++) {
+			remap[i] = i;
+			touched[i] = 0;
+		}
+	}
+
+	collapses = (MeshCollapse *)tlMemory((void *)collapses, 0);
+	adj = (TlU32 *)tlMemory((void *)adj, 0);
+	triStart = (TlU32 *)tlMemory((void *)triStart, 0);
+	remap = (TlU32 *)tlMemory((void *)remap, 0);
+	touched = (TlU8 *)tlMemory((void *)touched, 0);
+	locked = (TlU8 *)tlMemory((void *)locked, 0);
+	quadrics = (MeshQuadric *)tlMemory((void *)quadrics, 0);
+
+	if (error)
+		*error = (float)sqrt(maxCost);
+
+	return numInds;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	VERTEX FETCH
+ *
+ * ==========================================================================
+ */
+
+TlU32 tlOptimizeVertexFetch(TlVertex *dst, TlU32 *inds, TlU32 numInds, const TlVertex *verts,
+TlU32 numVerts) {
+	TlU32 *remap, n, i, v;
+
+	TL_ASSERT(dst != verts || !numVerts);
+
+	remap = (TlU32 *)tlMemory((void *)0, numVerts*sizeof(TlU32));
+	memset((void *)remap, 0xFF, numVerts*sizeof(TlU32));
+
+	n = 0;
+	for(i=0; i<numInds; i++) {
+		v = inds[i];
+		TL_ASSERT(v < numVerts);
+
+		if (remap[v] == MESH_EMPTY) {
+			remap[v] = n;
+			dst[n++] = verts[v];
+		}
+
+		inds[i] = remap[v];
+	}
+
+	remap = (TlU32 *)tlMemory((void *)remap, 0);
+	return n;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	STATISTICS
+ *
+ * ==========================================================================
+ */
+
+void tlGetMeshStats(const TlU32 *inds, TlU32 numInds, TlU32 numVerts, TlU32 cacheSize,
+TlMeshStats *stats) {
+	TlU32 numUsed, t, i;
+	MeshFifo fifo;
+	TlU8 *used;
+
+	TL_ASSERT(stats != (TlMeshStats *)0);
+
+	if (!cacheSize)
+		cacheSize = TL_MESH_DEFAULT_CACHE_SIZE;
+
+	memset((void *)stats, 0, sizeof(*stats));
+	stats->numTris = numInds/3;
+	stats->cacheSize = cacheSize;
+
+	if (!stats->numTris || !numVerts)
+		return;
+
+	tlMesh_InitFifo(&fifo, numVerts, cacheSize);
+	for(t=0; t<stats->numTris; t++)
+		stats->numTransformed += tlMesh_FifoTriangle(&fifo, &inds[t*3]);
+	tlMesh_FiniFifo(&fifo);
+
+	used = (TlU8 *)tlMemory((void *)0, numVerts);
+	memset((void *)used, 0, numVerts);
+	numUsed = 0;
+	for(i=0; i<stats->numTris*3; i++) {
+		if (!used[inds[i]]) {
+			used[inds[i]] = 1;
+			numUsed++;
+		}
+	}
+	used = (TlU8 *)tlMemory((void *)used, 0);
+
+	stats->numVerts = numUsed;
+	stats->acmr = (float)stats->numTransformed/(float)stats->numTris;
+	stats->atvr = (float)stats->numTransformed/(float)numUsed;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	SURFACES
+ *
+ * ==========================================================================
+ */
+
+/* Merge identical vertices and drop the triangles that collapse as a result */
+static void tlMesh_WeldSurface(TlSurface *geom) {
+	TlU32 *remap, n, i, j;
+
+	remap = (TlU32 *)tlMemory((void *)0, geom->numVerts*sizeof(TlU32));
+	n = tlWeldVertices(remap, geom->verts, geom->numVerts);
+
+	/* each vertex moves to its first duplicate's slot, which is never later */
+	for(i=0; i<geom->numVerts; i++)
+		geom->verts[remap[i]] = geom->verts[i];
+	geom->numVerts = n;
+
+	n = 0;
+	for(i=0; i<geom->numInds; i+=3) {
+		for(j=0; j<3; j++)
+			geom->inds[n + j] = remap[geom->inds[i + j]];
+
+		if (geom->inds[n] != geom->inds[n + 1] && geom->inds[n] != geom->inds[n + 2] &&
+		geom->inds[n + 1] != geom->inds[n + 2])
+			n += 3;
+	}
+	geom->numInds = n;
+
+	remap = (TlU32 *)tlMemory((void *)remap, 0);
+}
+
+void tlOptimizeSurface(TlSurface *surf, TlU32 passes) {
+	TlVertex *verts;
+	TlSurface *geom;
+	TlU32 *inds;
+
+	/* every sharer draws the same triangles, so the source can be reordered */
+	geom = tlGetSurfaceGeometry(surf);
+	tlUnmapSurface(geom);
+	if (!geom->numVerts || geom->numInds < 3)
+		return;
+
+	if (passes & TL_OPTIMIZE_WELD)
+		tlMesh_WeldSurface(geom);
+
+	if (passes & TL_OPTIMIZE_VERTEX_CACHE) {
+		inds = (TlU32 *)tlMemory((void *)0, geom->maxInds*sizeof(TlU32));
+		tlOptimizeVertexCache(inds, geom->inds, geom->numInds, geom->numVerts);
+
+		geom->inds = (TlU32 *)tlMemory((void *)geom->inds, 0);
+		geom->inds = inds;
+	}
+
+	if (passes & TL_OPTIMIZE_OVERDRAW)
+		tlOptimizeOverdraw(geom->inds, geom->numInds, geom->verts, geom->numVerts,
+			TL_MESH_OVERDRAW_THRESHOLD);
+
+	if (passes & TL_OPTIMIZE_VERTEX_FETCH) {
+		verts = (TlVertex *)tlMemory((void *)0, geom->maxVerts*sizeof(TlVertex));
+		geom->numVerts = tlOptimizeVertexFetch(verts, geom->inds, geom->numInds, geom->verts,
+			geom->numVerts);
+
+		geom->verts = (TlVertex *)tlMemory((void *)geom->verts, 0);
+		geom->verts = verts;
+	}
+
+	tlInvalidateSurfaceVertices(geom);
+	tlInvalidateSurfaceTriangles(geom);
+}
+unsigned int tlGenerateSurfaceLods(TlSurface *surf, unsigned int maxLods, float ratio) {
+	TlU32 *simplified, *lodInds, target, n;
+	TlSurfaceLod *lod, *prev;
+	TlSurface *geom;
+	float error;
+
+	geom = tlGetSurfaceGeometry(surf);
+	tlUnmapSurface(geom);
+	tlClearSurfaceLods(geom);
+
+	if (!maxLods || maxLods > TL_SURFACE_MAX_LODS)
+		maxLods = TL_SURFACE_MAX_LODS;
+	if (ratio <= 0.0f || ratio >= 1.0f)
+		ratio = TL_MESH_DEFAULT_LOD_RATIO;
+
+	if (maxLods < 2 || geom->numInds < 3)
+		return 1;
+
+	geom->lods[0].firstInd = 0;
+	geom->lods[0].numInds = geom->numInds;
+	geom->lods[0].error = 0.0f;
+	geom->numLods = 1;
+
+	simplified = (TlU32 *)tlMemory((void *)0, geom->numInds*sizeof(TlU32));
+	lodInds = (TlU32 *)tlMemory((void *)0, geom->numInds*sizeof(TlU32));
+
+	while (geom->numLods < maxLods) {
+		prev = &geom->lods[geom->numLods - 1];
+
+		/*
+		 * Always from the full surface, so errors are measured against what
+		 * the level stands in for rather than piling up level upon level
+		 */
+		target = (TlU32)((float)prev->numInds*ratio);
+		target -= target%3;
+		n = tlSimplifyMesh(simplified, geom->inds, geom->numInds, geom->verts, geom->numVerts,
+			target, &error);
+
+		/* not worth a level; the mesh is as simple as its borders allow */
+		if (n < 3 || n > prev->numInds - prev->numInds/10)
+			break;
+
+		lodInds = (TlU32 *)tlMemory((void *)lodInds, (geom->numLodInds + n)*sizeof(TlU32));
+		tlOptimizeVertexCache(&lodInds[geom->numLodInds], simplified, n, geom->numVerts);
+
+		lod = &geom->lods[geom->numLods++];
+		lod->firstInd = geom->numInds + geom->numLodInds;
+		lod->numInds = n;
+		/* coarser levels never claim to be more accurate than finer ones */
+		lod->error = error > prev->error ? error : prev->error;
+
+		geom->numLodInds += n;
+	}
+
+	simplified = (TlU32 *)tlMemory((void *)simplified, 0);
+
+	if (geom->numLods < 2) {
+		lodInds = (TlU32 *)tlMemory((void *)lodInds, 0);
+		geom->numLods = 0;
+		return 1;
+	}
+
+	geom->lodInds = lodInds;
+	geom->gpu.indsDirty = TRUE;
+
+	return geom->numLods;
+}
+void tlGetSurfaceMeshStats(const TlSurface *surf, TlU32 cacheSize, TlMeshStats *stats) {
+	TlSurface *geom;
+
+	/* reading the indices needs them decoded, which doesn't change the surface */
+	geom = tlGetSurfaceGeometry(surf);
+	tlUnmapSurface(geom);
+	tlGetMeshStats(geom->inds, geom->numInds, geom->numVerts, cacheSize, stats);
+}
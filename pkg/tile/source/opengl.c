@@ -34,6 +34,20 @@ void tlGL_RequireExtension(const char *extension) {
 		tlErrorExit("Need GL extension \'%s\'", extension);
 }
 
+/* Like tlGL_Proc(), but returns NULL rather than exiting if `proc` is missing */
+TlFn_t tlGL_TryProc(const char *proc) {
+	TlFnPtr x;
+
+#if GLFW_ENABLED
+	x.fn = ( TlFn_t )glfwGetProcAddress( proc );
+#elif defined( _WIN32 )
+	x.fn = ( TlFn_t )wglGetProcAddress( proc );
+#else
+# error Not implemented
+#endif
+
+	return x.fn;
+}
 TlFn_t tlGL_Proc(const char *proc) {
 	TlFnPtr x;
 
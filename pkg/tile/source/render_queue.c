@@ -7,6 +7,8 @@
 #include <tile/camera.h>
 #include <tile/surface.h>
 #include <tile/brush.h>
+#include <tile/transform.h>
+#include <tile/job.h>
 
 /*
  * ==========================================================================
@@ -15,61 +17,351 @@
  *
  * ==========================================================================
  */
+/*
+ * Draw items live in the frame arena, so they're only valid until the end of
+ * the frame. Each view starts with room for as many items as the last one had.
+ */
 static size_t g_numDrawItems = 0;
 static size_t g_maxDrawItems = 0;
+static size_t g_lastNumDrawItems = 0;
 static TlDrawItem *g_drawItems = (TlDrawItem *)0;
 
 static TlRenderQueueMode_t g_rqMode = kTlRQMode_StateSorted;
+static TlRQStats g_rqStats;
+static TlBool g_rqInstancing = TRUE;
+
+/* depth range of the view currently being queued (for key quantization) */
+static float g_rqDepthNear = 0.0f;
+static float g_rqDepthScale = 0.0f;
+
+/* world-space frustum of the view currently being queued */
+static TlBool g_rqCulling = TRUE;
+static TlFrustum g_rqFrustum;
+static TlRQCullStats g_rqViewCull;
+
+/*
+ * Level of detail selection: pixels covered by one unit of view-space size at
+ * a distance of one (at any distance, for orthographic views) in this view
+ */
+static TlBool g_rqLod = TRUE;
+static float g_rqLodTolerance = 1.0f;
+static float g_rqLodScale = 0.0f;
+static TlBool g_rqLodOrtho = FALSE;
+/*
+ * Whether this view keeps each surface's lodCurrent. Only the first view does;
+ * if every view wrote it, a surface at different distances in two views would
+ * flip its level back and forth each frame and the hysteresis would be lost.
+ */
+static TlBool g_rqLodPrimary = TRUE;
+
+/* per-transform scratch for tlRQ_AddAllEntities(), indexed like the store */
+typedef struct RQSphere_s {
+	TlVec3 center;
+	float radius;
+} RQSphere;
 
 void tlRQ_SetMode(TlRenderQueueMode_t mode)
 {
+	TL_ASSERT( (int)mode >= 0 && mode < kTlNumRQModes );
+
 	g_rqMode = mode;
 }
 TlRenderQueueMode_t tlRQ_GetMode(void)
 {
 	return g_rqMode;
 }
+void tlRQ_EnableInstancing(void)
+{
+	g_rqInstancing = TRUE;
+}
+void tlRQ_DisableInstancing(void)
+{
+	g_rqInstancing = FALSE;
+}
+TlBool tlRQ_IsInstancingEnabled(void)
+{
+	return g_rqInstancing;
+}
+void tlRQ_EnableCulling(void)
+{
+	g_rqCulling = TRUE;
+}
+void tlRQ_DisableCulling(void)
+{
+	g_rqCulling = FALSE;
+}
+TlBool tlRQ_IsCullingEnabled(void)
+{
+	return g_rqCulling;
+}
+void tlRQ_EnableLod(void)
+{
+	g_rqLod = TRUE;
+}
+void tlRQ_DisableLod(void)
+{
+	g_rqLod = FALSE;
+}
+TlBool tlRQ_IsLodEnabled(void)
+{
+	return g_rqLod;
+}
+void tlRQ_SetLodTolerance(float pixels)
+{
+	g_rqLodTolerance = pixels > 0.0f ? pixels : 0.0f;
+}
+float tlRQ_GetLodTolerance(void)
+{
+	return g_rqLodTolerance;
+}
+const char *tlRQ_GetModeName(TlRenderQueueMode_t mode)
+{
+	switch(mode) {
+	case kTlRQMode_BackToFront:  return "BackToFront";
+	case kTlRQMode_FrontToBack:  return "FrontToBack";
+	case kTlRQMode_StateSorted:  return "StateSorted";
+	case kTlRQMode_DepthPrepass: return "DepthPrepass";
+	default:
+		break;
+	}
+
+	return "(unknown)";
+}
+
+void tlRQ_BeginView(TlView *view, const TlMat4 *V) {
+	TlMat4 clip;
+
+	g_rqDepthNear = view->zn;
+	g_rqDepthScale = view->zf > view->zn ? 1.0f/(view->zf - view->zn) : 0.0f;
+
+	tlMultiply4(&clip, tlGetViewMatrix(view), V);
+	tlExtractFrustum(&g_rqFrustum, &clip);
+
+	/* the projection maps y to [-1, 1] across the viewport's height */
+	g_rqLodScale = 0.5f*(float)tlGetViewHeight(view)*tlGetViewMatrix(view)->yy;
+	g_rqLodOrtho = view->isOrtho;
+	g_rqLodPrimary = view == tlFirstView() ? TRUE : FALSE;
+
+	memset((void *)&g_rqViewCull, 0, sizeof(g_rqViewCull));
+	g_rqStats.numViews++;
+
+	g_numDrawItems = 0;
+	g_maxDrawItems = 0;
+	g_drawItems = (TlDrawItem *)0;
+}
 
-TlDrawItem *tlRQ_AddDrawItems(size_t numItems) {
 #define DRAWITEM_GRAN 64
+TlDrawItem *tlRQ_AddDrawItems(size_t numItems) {
+	TlDrawItem *items;
 	size_t n;
 
 	if (g_numDrawItems + numItems > g_maxDrawItems) {
-		g_maxDrawItems  = g_numDrawItems + numItems;
-		g_maxDrawItems -= g_maxDrawItems%DRAWITEM_GRAN;
-		g_maxDrawItems += DRAWITEM_GRAN;
+		/* the old block can't be freed, so grow geometrically to limit waste */
+		n = g_maxDrawItems*2;
+		if (n < g_lastNumDrawItems)
+			n = g_lastNumDrawItems;
+		if (n < g_numDrawItems + numItems)
+			n = g_numDrawItems + numItems;
+		n += DRAWITEM_GRAN - n%DRAWITEM_GRAN;
+
+		items = (TlDrawItem *)tlFrameAlloc(n*sizeof(TlDrawItem));
+		if (g_numDrawItems > 0)
+			memcpy((void *)items, (const void *)g_drawItems, g_numDrawItems*sizeof(TlDrawItem));
 
-		n = g_maxDrawItems*sizeof(TlDrawItem);
-		g_drawItems = (TlDrawItem *)tlMemory((void *)g_drawItems, n);
+		g_drawItems = items;
+		g_maxDrawItems = n;
 	}
 
 	n = g_numDrawItems;
 	g_numDrawItems += numItems;
 
 	return &g_drawItems[n];
+}
 #undef DRAWITEM_GRAN
+
+/* Map a view-space depth to [0, 0xFFFF] across the view's depth range */
+static TlU32 tlRQ_QuantizeDepth(float z) {
+	float t;
+
+	t = (z - g_rqDepthNear)*g_rqDepthScale;
+	if( t < 0.0f ) {
+		return 0;
+	}
+	if( t > 1.0f ) {
+		return 0xFFFF;
+	}
+
+	return (TlU32)(t*65535.0f);
 }
-void tlRQ_AddEntities(TlEntity *ent, const struct TlMat4_s *V) {
-	const TlMat4 *M;
+static TlU64 tlRQ_MakeKey(TlU32 order, const TlBrush *brush, const TlSurface *surf, TlU32 depth) {
+	TlU64 key;
+
+	key  = TL_RQKEY_FIELD(order >> 24, TARGET);
+	key |= TL_RQKEY_FIELD(order & 0xFFFF, PASS);
+
+	/*
+	 * Depth-sorted (translucent) brushes go after everything else in their
+	 * pass, back-to-front, regardless of mode. The mode decides how the
+	 * opaque items are ordered: purely by state, or by depth first.
+	 */
+	if( brush->drawing.zSort ) {
+		key |= TL_RQKEY_FIELD(1, XLUCENT);
+		key |= TL_RQKEY_FIELD(0xFFFF - depth, DEPTH);
+	} else {
+		switch(g_rqMode) {
+		case kTlRQMode_BackToFront:
+			key |= TL_RQKEY_FIELD(0xFFFF - depth, DEPTH);
+			break;
+		case kTlRQMode_FrontToBack:
+			key |= TL_RQKEY_FIELD(depth, DEPTH);
+			break;
+		case kTlRQMode_StateSorted:
+		case kTlRQMode_DepthPrepass:
+		default:
+			break;
+		}
+	}
+
+	key |= TL_RQKEY_FIELD(brush->id, BRUSH);
+	/* surfaces sharing geometry sort together so they can be instanced */
+	key |= TL_RQKEY_FIELD(tlGetSurfaceGeometry(surf)->id, SURFACE);
+
+	return key;
+}
+
+/*
+ * Queue Building
+ * --------------
+ * Entities may be queued by several jobs at once. Each job appends to its own
+ * RQBuild: the calling thread's appends straight to the queue, while each
+ * other's has storage of its own (kept from frame to frame) that's copied into
+ * the queue afterward. Threads take contiguous ranges of the transform store
+ * and their builds are copied in range order, so the queue comes out the same
+ * however many threads built it.
+ */
+typedef struct RQBuild_s {
+	TlBool isWorker;
+
+	TlDrawItem *items;
+	size_t numItems;
+	size_t maxItems;
+
+	TlRQCullStats cull;
+} RQBuild;
+
+static TlDrawItem *tlRQ_BuildItems(RQBuild *b, size_t n) {
+	size_t i;
+
+	if( !b->isWorker ) {
+		return tlRQ_AddDrawItems(n);
+	}
+
+	if( b->numItems + n > b->maxItems ) {
+		b->maxItems = ( b->numItems + n )*2;
+		b->items = (TlDrawItem *)tlMemory((void *)b->items, b->maxItems*sizeof(TlDrawItem));
+	}
+
+	i = b->numItems;
+	b->numItems += n;
+
+	return &b->items[i];
+}
+/* Move a thread's results into the queue and the stats (calling thread only) */
+static void tlRQ_FinishBuild(RQBuild *b) {
+	if( b->isWorker && b->numItems > 0 ) {
+		memcpy((void *)tlRQ_AddDrawItems(b->numItems), (const void *)b->items, b->numItems*sizeof(TlDrawItem));
+	}
+	b->numItems = 0;
+
+	g_rqViewCull.numEntitiesCulled += b->cull.numEntitiesCulled;
+	g_rqViewCull.numSurfacesVisible += b->cull.numSurfacesVisible;
+	g_rqViewCull.numSurfacesCulled += b->cull.numSurfacesCulled;
+
+	g_rqStats.cull.numEntitiesCulled += b->cull.numEntitiesCulled;
+	g_rqStats.cull.numSurfacesVisible += b->cull.numSurfacesVisible;
+	g_rqStats.cull.numSurfacesCulled += b->cull.numSurfacesCulled;
+
+	memset((void *)&b->cull, 0, sizeof(b->cull));
+}
+
+/*
+ * Hysteresis of level of detail selection, as a fraction of the tolerance. A
+ * surface only moves to a coarser level once comfortably within the tolerance
+ * and only leaves its level once comfortably outside it, so it doesn't flicker
+ * between two levels at the distance where they meet.
+ */
+#ifndef RQ_LOD_HYSTERESIS
+# define RQ_LOD_HYSTERESIS 0.25f
+#endif
+
+/*
+ * Pick the level of detail to draw `surf` with, given its model-view matrix and
+ * the largest scale of its global matrix
+ */
+static TlU32 tlRQ_SelectLod(TlSurface *surf, const TlMat4 *MV, float scale) {
+	const TlSurface *geom;
+	const TlBounds *bounds;
+	TlVec3 center;
+	float dist, k, px;
+	TlU32 cur, lod, i;
+
+	geom = tlGetSurfaceGeometry(surf);
+	if( !g_rqLod || geom->numLods < 2 ) {
+		return 0;
+	}
+
+	/* pixels per unit of local-space error, measured at the nearest point */
+	k = g_rqLodScale*scale;
+	if( !g_rqLodOrtho ) {
+		bounds = tlGetSurfaceBounds(surf);
+		tlPointLocalToGlobal(&center, MV, &bounds->center);
+
+		dist = center.z - bounds->radius*scale;
+		if( dist < g_rqDepthNear ) {
+			dist = g_rqDepthNear;
+		}
+		if( dist <= 0.0f ) {
+			return 0;
+		}
+
+		k /= dist;
+	}
+
+	cur = surf->lodCurrent < geom->numLods ? surf->lodCurrent : 0;
+
+	lod = 0;
+	for(i=1; i<geom->numLods; i++) {
+		px = geom->lods[i].error*k;
+		if( px > g_rqLodTolerance*( i > cur ? 1.0f - RQ_LOD_HYSTERESIS : 1.0f + RQ_LOD_HYSTERESIS ) ) {
+			break;
+		}
+		lod = i;
+	}
+
+	/* each surface belongs to one entity, queued by one thread */
+	if( g_rqLodPrimary ) {
+		surf->lodCurrent = lod;
+	}
+	return lod;
+}
+
+/*
+ * Queue the surfaces of one entity, given its global and (already computed)
+ * model-view matrices. Unless the entity is known to be inside the frustum
+ * (`cull` is kTlCull_Inside), each surface is tested before it's queued.
+ */
+static void tlRQ_AddEntity(RQBuild *b, TlEntity *ent, const TlMat4 *M, TlMat4 *MV, TlCullResult_t cull) {
+	const TlBounds *bounds;
 	TlDrawItem *di;
 	TlSurface *surf;
-	TlEntity *chld;
 	TlBrush *brush;
+	TlVec3 center;
+	TlU32 depth, lod;
 	size_t i, n;
+	float scale;
 
-	M = tlGetEntityGlobalMatrix(ent);
-	tlAffineMultiply(&ent->MVP, V, M);
-
-#if 0
-	printf("ent->MVP = [ %3.3f, %3.3f, %3.3f, %3.3f,\n",
-		ent->MVP[ 0], ent->MVP[ 4], ent->MVP[ 8], ent->MVP[12]);
-	printf("             %3.3f, %3.3f, %3.3f, %3.3f,\n",
-		ent->MVP[ 1], ent->MVP[ 5], ent->MVP[ 9], ent->MVP[13]);
-	printf("             %3.3f, %3.3f, %3.3f, %3.3f,\n",
-		ent->MVP[ 2], ent->MVP[ 6], ent->MVP[10], ent->MVP[14]);
-	printf("             %3.3f, %3.3f, %3.3f, %3.3f ];\n\n",
-		ent->MVP[ 3], ent->MVP[ 7], ent->MVP[11], ent->MVP[15]);
-#endif
+	depth = tlRQ_QuantizeDepth(MV->zw);
+	scale = cull != kTlCull_Inside || g_rqLod ? tlMaxAxisScale(M) : 1.0f;
 
 	for(surf=ent->s_head; surf!=(TlSurface *)0; surf=surf->s_next) {
 		n = surf->numPasses;
@@ -77,56 +369,421 @@ void tlRQ_AddEntities(TlEntity *ent, const struct TlMat4_s *V) {
 			continue;
 		}
 
+		if( cull != kTlCull_Inside ) {
+			bounds = tlGetSurfaceBounds(surf);
+			tlPointLocalToGlobal(&center, M, &bounds->center);
+
+			/* the sphere is cheap; the box is tighter for what it lets through */
+			if( tlCullSphere(&g_rqFrustum, &center, bounds->radius*scale) == kTlCull_Outside
+			|| tlCullBox(&g_rqFrustum, M, &bounds->mins, &bounds->maxs) == kTlCull_Outside ) {
+				b->cull.numSurfacesCulled++;
+				continue;
+			}
+		}
+
+		b->cull.numSurfacesVisible++;
+
 #if 0
 		printf("Adding %i pass%s...\n", (int)n, n!=1 ? "es" : "");
 #endif
 
-		di = tlRQ_AddDrawItems(n);
+		lod = tlRQ_SelectLod(surf, MV, scale);
+
+		di = tlRQ_BuildItems(b, n);
 		for(i=0; i<n; i++) {
 			brush = surf->passes[i];
 
 			di[i].order = i;
-			di[i].M = &ent->MVP;
+			di[i].key = tlRQ_MakeKey(di[i].order, brush, surf, depth);
+			di[i].M = MV;
 			di[i].brush = brush;
 			di[i].surf = surf;
+			di[i].lod = lod;
+		}
+	}
+}
+/* Count the drawable surfaces of an entity skipped without testing them */
+static void tlRQ_CountCulled(RQBuild *b, const TlEntity *ent) {
+	const TlSurface *surf;
+
+	b->cull.numEntitiesCulled++;
+
+	for(surf=ent->s_head; surf!=(TlSurface *)0; surf=surf->s_next) {
+		if( surf->numPasses > 0 ) {
+			b->cull.numSurfacesCulled++;
 		}
 	}
+}
+static void tlRQ_AddEntitiesR(RQBuild *b, TlEntity *ent, const TlMat4 *V) {
+	TlEntity *chld;
+	const TlMat4 *M;
+	TlMat4 *MV;
+
+	M = tlGetEntityGlobalMatrix(ent);
+	MV = tlXf_ModelView(ent->xform);
+	tlAffineMultiply(MV, V, M);
+	tlRQ_AddEntity(b, ent, M, MV, g_rqCulling ? kTlCull_Intersect : kTlCull_Inside);
 
 	for(chld=ent->head; chld!=(TlEntity *)0; chld=chld->next) {
-		tlRQ_AddEntities(chld, V);
+		tlRQ_AddEntitiesR(b, chld, V);
 	}
 }
-int tlRQ_CmpFunc(const TlDrawItem *a, const TlDrawItem *b) {
-	if( a->order != b->order ) {
-		return a->order - b->order;
+void tlRQ_AddEntities(TlEntity *ent, const struct TlMat4_s *V) {
+	RQBuild b;
+
+	memset((void *)&b, 0, sizeof(b));
+
+	tlUpdateSurfaceBounds();
+	tlRQ_AddEntitiesR(&b, ent, V);
+
+	tlRQ_FinishBuild(&b);
+}
+
+/*
+ * Parallel Building
+ * -----------------
+ * The transform store is split into one contiguous range per thread, handed
+ * out as jobs; the calling thread takes the first range itself. Each of the
+ * other ranges has a build of its own, reused from frame to frame.
+ */
+#define RQ_MAX_THREADS 16
+/* entities per thread below which splitting the work isn't worth it */
+#define RQ_MIN_ENTITIES_PER_THREAD 256
+
+typedef void(*RQTaskFn_t)(RQBuild *b, TlU32 first, TlU32 last);
+
+static TlU32 g_rqNumThreads = 0;
+static RQTaskFn_t g_rqTaskFn = (RQTaskFn_t)0;
+static RQBuild g_rqBuilds[RQ_MAX_THREADS];
+
+static void tlRQ_TaskJob(void *parm, TlU32 first, TlU32 last) {
+	g_rqTaskFn((RQBuild *)parm, first, last);
+}
+
+void tlRQ_Fini(void) {
+	TlU32 i;
+
+	for(i=0; i<RQ_MAX_THREADS; i++) {
+		g_rqBuilds[i].items = (TlDrawItem *)tlMemory((void *)g_rqBuilds[i].items, 0);
+		g_rqBuilds[i].numItems = 0;
+		g_rqBuilds[i].maxItems = 0;
+	}
+}
+void tlRQ_SetNumThreads(TlU32 n) {
+	g_rqNumThreads = n;
+}
+TlU32 tlRQ_GetNumThreads(void) {
+	TlU32 n;
+
+	n = g_rqNumThreads ? g_rqNumThreads : tlJob_NumThreads();
+	return n < RQ_MAX_THREADS ? n : RQ_MAX_THREADS;
+}
+
+/*
+ * Run `fn` over [0, n) split into contiguous ranges, one per thread, and wait
+ * for all of them. The calling thread's results go to `b`; the others' are
+ * left in g_rqBuilds[1..] for tlRQ_FinishBuild(). Returns the range count.
+ */
+static TlU32 tlRQ_Parallel(RQTaskFn_t fn, RQBuild *b, TlU32 n) {
+	TlJobCounter counter;
+	TlU32 t, i, step;
+
+	t = tlRQ_GetNumThreads();
+	if( t > n/RQ_MIN_ENTITIES_PER_THREAD ) {
+		t = n/RQ_MIN_ENTITIES_PER_THREAD;
+	}
+	if( t <= 1 ) {
+		fn(b, 0, n);
+		return 1;
+	}
+
+	g_rqTaskFn = fn;
+	tlJob_InitCounter(&counter);
+
+	step = n/t;
+	for(i=1; i<t; i++) {
+		g_rqBuilds[i].isWorker = TRUE;
+		tlJob_Run(&tlRQ_TaskJob, (void *)&g_rqBuilds[i], step*i, i + 1 < t ? step*( i + 1 ) : n, &counter);
+	}
+
+	fn(b, 0, step);
+	tlJob_Wait(&counter);
+
+	return t;
+}
+
+/* Grow sphere `a` to enclose sphere `b` as well */
+static void tlRQ_MergeSphere(RQSphere *a, const RQSphere *b) {
+	float dx, dy, dz, d, r, t;
+
+	if( b->radius < 0.0f ) {
+		return;
+	}
+	if( a->radius < 0.0f ) {
+		*a = *b;
+		return;
+	}
+
+	dx = b->center.x - a->center.x;
+	dy = b->center.y - a->center.y;
+	dz = b->center.z - a->center.z;
+	d = tlSqrt(dx*dx + dy*dy + dz*dz);
+
+	if( d + b->radius <= a->radius ) {
+		return;
+	}
+	if( d + a->radius <= b->radius ) {
+		*a = *b;
+		return;
 	}
 
-	if( a->brush->drawing.zSort|b->brush->drawing.zSort ) {
-		if( a->M != b->M ) {
-			return a->M->zw > b->M->zw ? 1 : -1;
+	r = 0.5f*(d + a->radius + b->radius);
+	t = (r - a->radius)/d;
+
+	a->center.x += dx*t;
+	a->center.y += dy*t;
+	a->center.z += dz*t;
+	a->radius = r;
+}
+/* World-space sphere enclosing the surfaces of one entity */
+static void tlRQ_EntitySphere(RQSphere *out, TlEntity *ent, const TlMat4 *M) {
+	const TlBounds *b;
+	TlSurface *surf;
+	RQSphere s;
+	float scale;
+
+	out->center.x = 0.0f;
+	out->center.y = 0.0f;
+	out->center.z = 0.0f;
+	out->radius = -1.0f;
+
+	scale = tlMaxAxisScale(M);
+	for(surf=ent->s_head; surf!=(TlSurface *)0; surf=surf->s_next) {
+		if( !surf->numPasses ) {
+			continue;
+		}
+
+		b = tlGetSurfaceBounds(surf);
+		if( b->radius < 0.0f ) {
+			continue;
 		}
+
+		tlPointLocalToGlobal(&s.center, M, &b->center);
+		s.radius = b->radius*scale;
+		tlRQ_MergeSphere(out, &s);
 	}
+}
 
-	if( a->brush->shader.prog != b->brush->shader.prog ) {
-		return 1;
+/* inputs to the tasks of tlRQ_AddAllEntities(); set before they're started */
+static const TlMat4 *g_rqTaskV = (const TlMat4 *)0;
+static RQSphere *g_rqTaskSpheres = (RQSphere *)0;
+static TlU8 *g_rqTaskResults = (TlU8 *)0;
+
+/* Compute model-view matrices and (when culling) entity spheres for a range */
+static void tlRQ_PrepareTask(RQBuild *b, TlU32 first, TlU32 last) {
+	TlEntity *ent;
+	TlU32 i;
+
+	(void)b;
+
+	if( first == last ) {
+		return;
 	}
 
-	if( a->brush->drawing.zCmpFunc != b->brush->drawing.zCmpFunc ) {
-		return 1;
+	tlAffineMultiplyArray(tlXf_ModelViewAt(first), g_rqTaskV, tlXf_GlobalAt(first), last - first);
+
+	if( !g_rqTaskSpheres ) {
+		return;
 	}
 
-	if( a->surf != b->surf ) {
-		return 1;
+	for(i=first; i<last; i++) {
+		if( ( ent = tlXf_OwnerAt(i) ) != (TlEntity *)0 ) {
+			tlRQ_EntitySphere(&g_rqTaskSpheres[i], ent, tlXf_GlobalAt(i));
+		} else {
+			g_rqTaskSpheres[i].radius = -1.0f;
+		}
+	}
+}
+/* Queue the entities of a range that weren't culled */
+static void tlRQ_QueueTask(RQBuild *b, TlU32 first, TlU32 last) {
+	TlCullResult_t cull;
+	TlEntity *ent;
+	TlU32 i;
+
+	for(i=first; i<last; i++) {
+		if( !( ent = tlXf_OwnerAt(i) ) ) {
+			continue;
+		}
+
+		cull = g_rqTaskResults ? (TlCullResult_t)g_rqTaskResults[i] : kTlCull_Inside;
+		if( cull == kTlCull_Outside ) {
+			if( g_rqTaskSpheres[i].radius >= 0.0f ) {
+				tlRQ_CountCulled(b, ent);
+			}
+			continue;
+		}
+
+		tlRQ_AddEntity(b, ent, tlXf_GlobalAt(i), tlXf_ModelViewAt(i), cull);
+	}
+}
+void tlRQ_AddAllEntities(const struct TlMat4_s *V) {
+	TlCullResult_t cull;
+	RQSphere *spheres;
+	TlU8 *results;
+	TlU32 i, p, n, t;
+	RQBuild b;
+
+	/* the store is in hierarchy order with globals already up to date */
+	tlXf_Update();
+	/* nothing may write to surfaces while the tasks read them */
+	tlUpdateSurfaceBounds();
+
+	n = tlXf_Count();
+	if( !n ) {
+		return;
+	}
+
+	memset((void *)&b, 0, sizeof(b));
+
+	spheres = (RQSphere *)0;
+	results = (TlU8 *)0;
+	if( g_rqCulling ) {
+		spheres = (RQSphere *)tlFrameAlloc(n*sizeof(RQSphere));
+		results = (TlU8 *)tlFrameAlloc(n*sizeof(TlU8));
+	}
+
+	g_rqTaskV = V;
+	g_rqTaskSpheres = spheres;
+	g_rqTaskResults = (TlU8 *)0;
+
+	tlRQ_Parallel(&tlRQ_PrepareTask, &b, n);
+
+	if( g_rqCulling ) {
+		/*
+		 * Fold children into their parents. Children always come after their
+		 * parents, so walking backward finishes every subtree before its root
+		 * is folded into the next level up.
+		 */
+		for(i=n; i-->1;) {
+			if( ( p = tlXf_ParentAt(i) ) != TL_XFORM_NONE ) {
+				tlRQ_MergeSphere(&spheres[p], &spheres[i]);
+			}
+		}
+
+		/* a subtree entirely inside or outside settles all of its descendants */
+		for(i=0; i<n; i++) {
+			p = tlXf_ParentAt(i);
+
+			if( p != TL_XFORM_NONE && results[p] != kTlCull_Intersect ) {
+				cull = (TlCullResult_t)results[p];
+			} else {
+				cull = tlCullSphere(&g_rqFrustum, &spheres[i].center, spheres[i].radius);
+			}
+			results[i] = (TlU8)cull;
+		}
+
+		g_rqTaskResults = results;
 	}
 
-	if( a->M != b->M ) {
-		return a->M->zw < b->M->zw ? 1 : -1;
+	t = tlRQ_Parallel(&tlRQ_QueueTask, &b, n);
+	g_rqStats.numBuildThreads = t > g_rqStats.numBuildThreads ? t : g_rqStats.numBuildThreads;
+
+	/* the calling thread had the first range; the rest follow in order */
+	tlRQ_FinishBuild(&b);
+	for(i=1; i<t; i++) {
+		tlRQ_FinishBuild(&g_rqBuilds[i]);
+	}
+
+	g_rqTaskV = (const TlMat4 *)0;
+	g_rqTaskSpheres = (RQSphere *)0;
+	g_rqTaskResults = (TlU8 *)0;
+}
+int tlRQ_CmpFunc(const TlDrawItem *a, const TlDrawItem *b) {
+	if( a->key != b->key ) {
+		return a->key < b->key ? -1 : 1;
 	}
 
 	return 0;
 }
+
+/*
+ * Stable LSD radix sort on the 64-bit key, one byte per pass. Each pass
+ * scatters from `src` into `dst`, then the two swap roles. Passes where every
+ * key has the same byte are skipped. Returns whichever buffer holds the result.
+ */
+static TlDrawItem *tlRQ_RadixSort(TlDrawItem *src, TlDrawItem *dst, size_t n) {
+	size_t hist[8][256];
+	size_t i, sum, t;
+	unsigned int pass, shift, b;
+	TlDrawItem *tmp;
+	TlU64 key;
+
+	memset((void *)hist, 0, sizeof(hist));
+
+	for(i=0; i<n; i++) {
+		key = src[i].key;
+		for(pass=0; pass<8; pass++) {
+			hist[pass][(key >> (pass*8)) & 0xFF]++;
+		}
+	}
+
+	for(pass=0; pass<8; pass++) {
+		shift = pass*8;
+
+		if( hist[pass][(src[0].key >> shift) & 0xFF] == n ) {
+			continue;
+		}
+
+		sum = 0;
+		for(b=0; b<256; b++) {
+			t = hist[pass][b];
+			hist[pass][b] = sum;
+			sum += t;
+		}
+
+		for(i=0; i<n; i++) {
+			b = (unsigned int)((src[i].key >> shift) & 0xFF);
+			dst[hist[pass][b]++] = src[i];
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	return src;
+}
+/* Stable insertion sort; cheaper than the radix sort's histograms for tiny queues */
+static void tlRQ_InsertionSort(TlDrawItem *items, size_t n) {
+	TlDrawItem x;
+	size_t i, j;
+
+	for(i=1; i<n; i++) {
+		x = items[i];
+		for(j=i; j>0 && items[j - 1].key > x.key; j--) {
+			items[j] = items[j - 1];
+		}
+		items[j] = x;
+	}
+}
 void tlRQ_Sort() {
-	qsort((void *)g_drawItems, g_numDrawItems, sizeof(TlDrawItem), (int(*)(const void *,const void *))tlRQ_CmpFunc);
+#define RADIX_SORT_THRESHOLD 32
+	TlDrawItem *scratch, *sorted;
+
+	if( g_numDrawItems < RADIX_SORT_THRESHOLD ) {
+		tlRQ_InsertionSort(g_drawItems, g_numDrawItems);
+		return;
+	}
+
+	scratch = (TlDrawItem *)tlFrameAlloc(g_numDrawItems*sizeof(TlDrawItem));
+
+	sorted = tlRQ_RadixSort(g_drawItems, scratch, g_numDrawItems);
+	if( sorted != g_drawItems ) {
+		/* nothing more is added once sorted, so the scratch can take over */
+		g_drawItems = sorted;
+		g_maxDrawItems = g_numDrawItems;
+	}
+#undef RADIX_SORT_THRESHOLD
 }
 size_t tlRQ_Count() {
 	return g_numDrawItems;
@@ -134,53 +791,225 @@ size_t tlRQ_Count() {
 size_t tlRQ_Capacity() {
 	return g_maxDrawItems;
 }
-void tlRQ_Draw() {
-	const void *inds;
-	TlDrawItem *di;
-	TlVertex *verts;
-	size_t i;
+TlDrawItem *tlRQ_Items() {
+	return g_drawItems;
+}
+/*
+ * Per-call GL error checks inside the draw loop cost a glGetError() round
+ * trip each; they're only compiled in when explicitly requested. The rest of
+ * tlRQ_Draw() still checks once per call in debug builds.
+ */
+#ifndef RQ_CHECK_GL_ERRORS_ENABLED
+# define RQ_CHECK_GL_ERRORS_ENABLED 0
+#endif
 
-	/*
-	 * NOTE: This function is purposely NOT optimized
-	 */
+#if RQ_CHECK_GL_ERRORS_ENABLED
+# define tlRQ_CheckError() tlGL_CheckError()
+#else
+# define tlRQ_CheckError()
+#endif
 
-	tlGL_CheckError();
+/*
+ * Pass flags for tlRQ_ApplyState()
+ */
+#define RQ_PASS_DEPTHONLY  0x01 /* prepass: no color writes */
+#define RQ_PASS_DEPTHEQUAL 0x02 /* shading after a prepass: GL_EQUAL, no depth writes */
+#define RQ_PASS_INSTANCED  0x04 /* drawing a run with the instancing program */
 
-	glMatrixMode(GL_PROJECTION);
-	tlGL_CheckError();
+/*
+ * Runs shorter than this are drawn an item at a time; below a handful of
+ * instances the extra attribute setup costs more than it saves
+ */
+#ifndef RQ_MIN_INSTANCES
+# define RQ_MIN_INSTANCES 4
+#endif
 
-	glLoadMatrixf((const float *)tlGetViewMatrix(tlGetCameraEntity()->view));
-	tlGL_CheckError();
+/*
+ * A run of consecutive draw items sharing geometry, level of detail and brush,
+ * drawn as one instanced draw. Their model-view matrices start at `base` in the instance
+ * buffer.
+ */
+typedef struct RQRun_s {
+	size_t first;
+	size_t count;
+	size_t base;
+} RQRun;
 
-	glMatrixMode(GL_MODELVIEW);
-	tlGL_CheckError();
-	glEnable(GL_DEPTH_TEST);
-	tlGL_CheckError();
+/* runs and their matrices are in the frame arena; rebuilt by each tlRQ_Draw() */
+static size_t g_numRuns = 0;
+static RQRun *g_runs = (RQRun *)0;
 
-	for(i=0; i<g_numDrawItems; i++) {
-		di = &g_drawItems[i];
+static size_t g_numInstances = 0;
+static TlMat4 *g_instances = (TlMat4 *)0;
+static GLuint g_instanceBuffer = 0;
 
-		if( !di->brush->drawing.isVisible ) {
-			continue;
+/*
+ * Constant buffers (see "Constants" in renderer.h), unused without uniform
+ * buffers. Each brush's material sits at its id times the stride and is only
+ * written when the brush has changed. The draw constants of the whole queue
+ * are written before anything is drawn; g_drawOffsets (in the frame arena)
+ * has each item's offset into them, or RQ_NO_CONSTANTS.
+ */
+#define RQ_NO_CONSTANTS ((size_t)-1)
+
+static GLuint g_viewConstants = 0;
+static GLuint g_materialConstants = 0;
+static TlU32 g_materialCapacity = 0;
+static GLuint g_drawConstants = 0;
+static size_t *g_drawOffsets = (size_t *)0;
+
+/*
+ * Shadow of the GL state last applied by the render queue. Anything else may
+ * change GL state between frames (text, the tile map, user code), so the cache
+ * is invalidated at the start of each tlRQ_Draw().
+ */
+typedef struct RQState_s {
+	TlBool valid;
+
+	TlBool isLit;
+	TlCullMode_t cullMode;
+	GLenum depthFunc;
+	TlBool zTest;
+	TlBool zWrite;
+	TlBool colorWrite;
+	GLuint prog;
+
+	const TlSurface *surf;
+	const TlMat4 *M;
+	/* the loaded matrix includes the dequantization of surf's positions */
+	TlBool dequantized;
+
+	/* id + 1 of the brush whose material is bound, or 0 */
+	TlU32 material;
+	/* offset of the bound draw constants (if drawBound) */
+	TlBool drawBound;
+	size_t drawOffset;
+} RQState;
+static RQState g_rqState;
+
+/* Record whether a state change was needed; returns TRUE if it was */
+static TlBool tlRQ_Filter(TlBool differs) {
+	if( differs ) {
+		++g_rqStats.numStateCalls;
+		return TRUE;
+	}
+
+	++g_rqStats.numStateCallsFiltered;
+	return FALSE;
+}
+
+/* Whether the depth prepass can lay down depth for a brush */
+static TlBool tlRQ_IsPrepassable(const TlBrush *brush) {
+	if( brush->drawing.zSort || !brush->drawing.zTest || !brush->drawing.zWrite ) {
+		return FALSE;
+	}
+
+	return brush->drawing.zCmpFunc==kTlCF_Less || brush->drawing.zCmpFunc==kTlCF_LessEqual;
+}
+static GLenum tlRQ_DepthFunc(TlCmpFunc_t cmpFunc) {
+	switch(cmpFunc) {
+	case kTlCF_Never:			return GL_NEVER;
+	case kTlCF_Less:			return GL_LESS;
+	case kTlCF_LessEqual:		return GL_LEQUAL;
+	case kTlCF_Equal:			return GL_EQUAL;
+	case kTlCF_NotEqual:		return GL_NOTEQUAL;
+	case kTlCF_GreaterEqual:	return GL_GEQUAL;
+	case kTlCF_Greater:		return GL_GREATER;
+	case kTlCF_Always:		return GL_ALWAYS;
+	default:
+		break;
+	}
+
+	return GL_LESS;
+}
+/* Fill in the constants of a brush's material */
+static void tlRQ_PackMaterial(TlMaterialConstants *mtl, const TlBrush *brush) {
+	static const TlColor none = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	mtl->diffuse = brush->lighting.useDiffuse ? brush->lighting.diffuse : none;
+	mtl->ambient = brush->lighting.useAmbient ? brush->lighting.ambient : none;
+	mtl->emissive = brush->lighting.useEmissive ? brush->lighting.emissive : none;
+	mtl->specular = brush->lighting.useSpecular ? brush->lighting.specular : none;
+	mtl->shininess = brush->lighting.shininess;
+	mtl->isLit = brush->lighting.isLit ? 1.0f : 0.0f;
+	mtl->reserved[0] = 0.0f;
+	mtl->reserved[1] = 0.0f;
+}
+/* Bind a brush's material constants, writing them first if it has changed */
+static void tlRQ_BindMaterial(TlBrush *brush) {
+	TlMaterialConstants mtl;
+	TlBrush *other;
+	size_t stride;
+	TlU32 capacity;
+
+	stride = tlR_ConstantStride(sizeof(TlMaterialConstants));
+
+	if( !g_materialConstants ) {
+		tlR_GenBuffers(1, &g_materialConstants);
+	}
+	tlR_BindBuffer(GL_UNIFORM_BUFFER, g_materialConstants);
+
+	if( brush->id >= g_materialCapacity ) {
+		capacity = g_materialCapacity ? g_materialCapacity : 64;
+		while( capacity <= brush->id ) {
+			capacity *= 2;
 		}
 
-		verts = di->surf->verts;
-		inds = (const void *)di->surf->inds;
-		if( !verts || !inds ) {
-			continue;
+		tlR_BufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)(capacity*stride), (const void *)0, GL_DYNAMIC_DRAW);
+		g_materialCapacity = capacity;
+
+		/* the old contents went with the old store */
+		for( other=tlFirstBrush(); other!=(TlBrush *)0; other=tlBrushAfter(other) ) {
+			other->lighting.isDirty = TRUE;
 		}
+	}
 
-		if( di->brush->lighting.isLit ) {
+	if( brush->lighting.isDirty ) {
+		tlRQ_PackMaterial(&mtl, brush);
+		tlR_UploadBufferData(GL_UNIFORM_BUFFER, (GLintptr)(brush->id*stride), sizeof(mtl), (const void *)&mtl);
+		brush->lighting.isDirty = FALSE;
+
+		++g_rqStats.numMaterialUploads;
+	}
+
+	tlR_BindConstants(TL_R_BLOCK_MATERIAL, g_materialConstants, (GLintptr)(brush->id*stride), sizeof(TlMaterialConstants));
+}
+/* Apply the state needed to draw with `brush` in the given pass; returns TRUE if anything changed */
+static TlBool tlRQ_ApplyState(TlBrush *brush, unsigned int passFlags) {
+	RQState want;
+	TlBool changed;
+
+	want.isLit = brush->lighting.isLit && !( passFlags & RQ_PASS_DEPTHONLY );
+	want.cullMode = brush->drawing.cullMode;
+	want.depthFunc = ( passFlags & RQ_PASS_DEPTHEQUAL ) ? GL_EQUAL : tlRQ_DepthFunc(brush->drawing.zCmpFunc);
+	/*di->brush->drawing.zTest = TRUE;*/ /*HACK*/
+	want.zTest = brush->drawing.zTest;
+	want.zWrite = brush->drawing.zWrite && !( passFlags & RQ_PASS_DEPTHEQUAL );
+	want.colorWrite = !( passFlags & RQ_PASS_DEPTHONLY );
+	/*
+	 * The prepass keeps the brush's program so that vertex positions match
+	 * exactly in the GL_EQUAL pass (runs are instanced in both passes)
+	 */
+	want.prog = ( passFlags & RQ_PASS_INSTANCED ) ? tlR_InstancingProgram() : brush->shader.prog;
+
+	changed = FALSE;
+
+	if( tlRQ_Filter( !g_rqState.valid || want.isLit != g_rqState.isLit ) ) {
+		if( want.isLit ) {
 			glEnable(GL_LIGHTING);
 		} else {
 			glDisable(GL_LIGHTING);
 		}
-		tlGL_CheckError();
+		tlRQ_CheckError();
+
+		g_rqState.isLit = want.isLit;
+		changed = TRUE;
+	}
 
-		switch(di->brush->drawing.cullMode) {
+	if( tlRQ_Filter( !g_rqState.valid || want.cullMode != g_rqState.cullMode ) ) {
+		switch(want.cullMode) {
 		case kTlCM_None:
 			glDisable(GL_CULL_FACE);
-			glCullFace(GL_NONE);
 			break;
 		case kTlCM_Front:
 			glEnable(GL_CULL_FACE);
@@ -197,57 +1026,514 @@ void tlRQ_Draw() {
 		default:
 			break;
 		}
-		tlGL_CheckError();
-
-		switch(di->brush->drawing.zCmpFunc) {
-		case kTlCF_Never:			glDepthFunc(GL_NEVER);    break;
-		case kTlCF_Less:			glDepthFunc(GL_LESS);     break;
-		case kTlCF_LessEqual:		glDepthFunc(GL_LEQUAL);   break;
-		case kTlCF_Equal:			glDepthFunc(GL_EQUAL);    break;
-		case kTlCF_NotEqual:		glDepthFunc(GL_NOTEQUAL); break;
-		case kTlCF_GreaterEqual:	glDepthFunc(GL_GEQUAL);   break;
-		case kTlCF_Greater:		glDepthFunc(GL_GREATER);  break;
-		case kTlCF_Always:		glDepthFunc(GL_ALWAYS);   break;
-		default:
-			break;
-		}
-		tlGL_CheckError();
+		tlRQ_CheckError();
+
+		g_rqState.cullMode = want.cullMode;
+		changed = TRUE;
+	}
 
-		/*di->brush->drawing.zTest = TRUE;*/ /*HACK*/
-		if( di->brush->drawing.zTest ) {
+	if( tlRQ_Filter( !g_rqState.valid || want.depthFunc != g_rqState.depthFunc ) ) {
+		glDepthFunc(want.depthFunc);
+		tlRQ_CheckError();
+
+		g_rqState.depthFunc = want.depthFunc;
+		changed = TRUE;
+	}
+
+	if( tlRQ_Filter( !g_rqState.valid || want.zTest != g_rqState.zTest ) ) {
+		if( want.zTest ) {
 			glEnable(GL_DEPTH_TEST);
 		} else {
 			glDisable(GL_DEPTH_TEST);
 		}
-		tlGL_CheckError();
+		tlRQ_CheckError();
+
+		g_rqState.zTest = want.zTest;
+		changed = TRUE;
+	}
+
+	if( tlRQ_Filter( !g_rqState.valid || want.zWrite != g_rqState.zWrite ) ) {
+		glDepthMask(want.zWrite ? GL_TRUE : GL_FALSE);
+		tlRQ_CheckError();
+
+		g_rqState.zWrite = want.zWrite;
+		changed = TRUE;
+	}
+
+	if( tlRQ_Filter( !g_rqState.valid || want.colorWrite != g_rqState.colorWrite ) ) {
+		if( want.colorWrite ) {
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		} else {
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		}
+		tlRQ_CheckError();
+
+		g_rqState.colorWrite = want.colorWrite;
+		changed = TRUE;
+	}
+
+	if( tlRQ_Filter( !g_rqState.valid || want.prog != g_rqState.prog ) ) {
+		tlR_UseProgram(want.prog);
+		tlRQ_CheckError();
+
+		g_rqState.prog = want.prog;
+		changed = TRUE;
+	}
+
+	/* only the brush's own program reads its material */
+	if( want.prog == brush->shader.prog && ( brush->shader.blocks & TL_R_BLOCK_BIT(TL_R_BLOCK_MATERIAL) ) ) {
+		if( tlRQ_Filter( brush->lighting.isDirty || g_rqState.material != brush->id + 1 ) ) {
+			tlRQ_BindMaterial(brush);
+			tlRQ_CheckError();
+
+			g_rqState.material = brush->id + 1;
+			changed = TRUE;
+		}
+	}
+
+	g_rqState.valid = TRUE;
+	return changed;
+}
+/* Range of the bound index buffer drawing level `lod` of `geom` */
+static void tlRQ_LodRange(const TlSurface *geom, TlU32 lod, GLsizei *count, const void **offset) {
+	size_t indexSize;
+
+	indexSize = geom->gpu.indexType == GL_UNSIGNED_INT ? sizeof(TlU32) : sizeof(TlU16);
+
+	/* the levels may have been thrown away since the item was queued */
+	if( lod == 0 || lod >= geom->numLods ) {
+		*count = (GLsizei)geom->numInds;
+		*offset = (const void *)0;
+		return;
+	}
+
+	*count = (GLsizei)geom->lods[lod].numInds;
+	*offset = (const void *)(geom->lods[lod].firstInd*indexSize);
+}
+static void tlRQ_DrawSurface(const TlDrawItem *di) {
+	const void *offset;
+	TlSurface *geom;
+	GLsizei count;
+	TlMat4 D, MD;
+
+	geom = tlGetSurfaceGeometry(di->surf);
+
+	/* repacks the vertices if the brush reads attributes they don't have */
+	tlRequireSurfaceVertexAttribs(geom, tlGetBrushVertexAttribs(di->brush));
+
+	/*
+	 * Uploading (if the surface was modified) binds the surface's buffers,
+	 * after which the pointers are offsets into them.
+	 */
+	if( tlRQ_Filter( geom != g_rqState.surf || geom->gpu.vertsDirty ) ) {
+		tlUploadSurface(geom);
+		tlRQ_CheckError();
+
+		tlBindVertexLayout(&geom->gpu.layout);
+		tlRQ_CheckError();
+
+		/* the dequantization is per surface (and changes with its bounds) */
+		if( geom->gpu.layout.quantized || g_rqState.dequantized ) {
+			g_rqState.M = (const TlMat4 *)0;
+		}
+
+		g_rqState.surf = geom;
+	}
+
+	/* programs reading TlDrawBlock take the matrix from the draw constants */
+	if( g_drawOffsets && g_drawOffsets[di - g_drawItems] != RQ_NO_CONSTANTS ) {
+		if( tlRQ_Filter( !g_rqState.drawBound || g_drawOffsets[di - g_drawItems] != g_rqState.drawOffset ) ) {
+			g_rqState.drawOffset = g_drawOffsets[di - g_drawItems];
+			g_rqState.drawBound = TRUE;
+
+			tlR_BindConstants(TL_R_BLOCK_DRAW, g_drawConstants, (GLintptr)g_rqState.drawOffset, sizeof(TlDrawConstants));
+			tlRQ_CheckError();
+		}
+	} else if( tlRQ_Filter( di->M != g_rqState.M ) ) {
+		if( geom->gpu.layout.quantized ) {
+			tlAffineMultiply(&MD, di->M, tlLoadVertexDequantize(&D, &geom->gpu.layout));
+			glLoadMatrixf((const float *)&MD);
+		} else {
+			glLoadMatrixf((const float *)di->M);
+		}
+		tlRQ_CheckError();
+
+		g_rqState.M = di->M;
+		g_rqState.dequantized = geom->gpu.layout.quantized;
+	}
+
+	/* after the upload, which settles the index type */
+	tlRQ_LodRange(geom, di->lod, &count, &offset);
+	glDrawElements(GL_TRIANGLES, count, geom->gpu.indexType, offset);
+	tlRQ_CheckError();
+
+	++g_rqStats.numDraws;
+}
+static void tlRQ_DrawRun(const RQRun *run) {
+	const TlDrawItem *di;
+	TlSurface *geom;
+	const TlVertexLayout *layout;
+	const void *indOffset;
+	GLsizei indCount;
+	size_t offset;
+	GLuint i;
+
+	di = &g_drawItems[run->first];
+	geom = tlGetSurfaceGeometry(di->surf);
+
+	tlRequireSurfaceVertexAttribs(geom, tlGetBrushVertexAttribs(di->brush));
+	tlUploadSurface(geom);
+	tlRQ_CheckError();
+
+	/* runs never have quantized positions (see tlRQ_FindRuns) */
+	layout = &geom->gpu.layout;
+	tlR_VertexAttribPointer(TL_INSTANCED_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, (GLsizei)layout->stride, (const void *)(size_t)layout->position);
+	tlR_VertexAttribPointer(TL_INSTANCED_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, (GLsizei)layout->stride, (const void *)(size_t)layout->color);
+	tlR_EnableVertexAttribArray(TL_INSTANCED_ATTRIB_POSITION);
+	tlR_EnableVertexAttribArray(TL_INSTANCED_ATTRIB_COLOR);
+	tlRQ_CheckError();
+
+	/* one matrix column per attribute, advancing once per instance */
+	tlR_BindBuffer(GL_ARRAY_BUFFER, g_instanceBuffer);
+	offset = run->base*sizeof(TlMat4);
+	for(i=0; i<4; i++) {
+		tlR_VertexAttribPointer(TL_INSTANCED_ATTRIB_MODELVIEW + i, 4, GL_FLOAT, GL_FALSE, sizeof(TlMat4), (const void *)(offset + i*4*sizeof(float)));
+		tlR_EnableVertexAttribArray(TL_INSTANCED_ATTRIB_MODELVIEW + i);
+		tlR_VertexAttribDivisor(TL_INSTANCED_ATTRIB_MODELVIEW + i, 1);
+	}
+	tlRQ_CheckError();
+
+	tlRQ_LodRange(geom, di->lod, &indCount, &indOffset);
+	tlR_DrawElementsInstanced(GL_TRIANGLES, indCount, geom->gpu.indexType, indOffset, (GLsizei)run->count);
+	tlRQ_CheckError();
+
+	/*
+	 * Generic attribute 0 may alias the fixed-function vertex array, so none
+	 * of these can stay enabled for the per-item draws that follow
+	 */
+	for(i=0; i<4; i++) {
+		tlR_VertexAttribDivisor(TL_INSTANCED_ATTRIB_MODELVIEW + i, 0);
+		tlR_DisableVertexAttribArray(TL_INSTANCED_ATTRIB_MODELVIEW + i);
+	}
+	tlR_DisableVertexAttribArray(TL_INSTANCED_ATTRIB_COLOR);
+	tlR_DisableVertexAttribArray(TL_INSTANCED_ATTRIB_POSITION);
+	tlRQ_CheckError();
+
+	/* the buffer bindings no longer match the fixed-function pointers */
+	g_rqState.surf = (const TlSurface *)0;
+
+	++g_rqStats.numDraws;
+	++g_rqStats.numInstancedDraws;
+	g_rqStats.numInstances += (TlU32)run->count;
+}
+static TlBool tlRQ_IsDrawable(const TlDrawItem *di) {
+	const TlSurface *geom;
+
+	geom = tlGetSurfaceGeometry(di->surf);
+	/* geometry loaded from a scene file has no CPU copy until it's needed */
+	return di->brush->drawing.isVisible && geom->numVerts > 0 && geom->numInds > 0 &&
+		!geom->gpu.isDeferred;
+}
+/* Whether the instancing program can stand in for a brush */
+static TlBool tlRQ_IsInstanceable(const TlBrush *brush) {
+	return brush->shader.prog == 0 && !brush->lighting.isLit;
+}
+/*
+ * Find the runs of items sharing geometry, level and brush that are worth
+ * drawing instanced, and upload all of their matrices in one go
+ */
+static void tlRQ_FindRuns(void) {
+	const TlSurface *geom;
+	const TlDrawItem *di;
+	size_t i, j, n;
+	RQRun *run;
+
+	g_numRuns = 0;
+	g_runs = (RQRun *)0;
+	g_numInstances = 0;
+	g_instances = (TlMat4 *)0;
+
+	if( !g_rqInstancing || !tlR_InstancingProgram() ) {
+		return;
+	}
+
+	for(i=0; i<g_numDrawItems; i=j) {
+		di = &g_drawItems[i];
+		geom = tlGetSurfaceGeometry(di->surf);
+
+		for(j=i + 1; j<g_numDrawItems; j++) {
+			if( g_drawItems[j].brush != di->brush || tlGetSurfaceGeometry(g_drawItems[j].surf) != geom || g_drawItems[j].lod != di->lod ) {
+				break;
+			}
+		}
+
+		n = j - i;
+		if( n < RQ_MIN_INSTANCES || !tlRQ_IsDrawable(di) || !tlRQ_IsInstanceable(di->brush) || geom->gpu.quantize ) {
+			continue;
+		}
+
+		/* every run has at least RQ_MIN_INSTANCES items, which bounds both */
+		if( !g_runs ) {
+			g_runs = (RQRun *)tlFrameAlloc(( g_numDrawItems/RQ_MIN_INSTANCES )*sizeof(RQRun));
+			g_instances = (TlMat4 *)tlFrameAlloc(( g_numDrawItems - i )*sizeof(TlMat4));
+		}
+
+		run = &g_runs[g_numRuns++];
+		run->first = i;
+		run->count = n;
+		run->base = g_numInstances;
+
+		for(; i<j; i++) {
+			g_instances[g_numInstances++] = *g_drawItems[i].M;
+		}
+	}
+
+	if( !g_numRuns ) {
+		return;
+	}
+
+	if( !g_instanceBuffer ) {
+		tlR_GenBuffers(1, &g_instanceBuffer);
+	}
+
+	/* respecifying the whole store orphans last frame's matrices */
+	tlR_BindBuffer(GL_ARRAY_BUFFER, g_instanceBuffer);
+	tlR_BufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(g_numInstances*sizeof(TlMat4)), (const void *)g_instances, GL_STREAM_DRAW);
+	tlGL_CheckError();
+}
+/* Write the view's constants and bind them for the whole queue */
+static void tlRQ_SetViewConstants(const TlMat4 *P) {
+	TlViewConstants view;
+
+	if( !tlR_ConstantStride(sizeof(TlViewConstants)) ) {
+		return;
+	}
+
+	if( !g_viewConstants ) {
+		tlR_GenBuffers(1, &g_viewConstants);
+	}
+
+	view.projection = *P;
+
+	tlR_BindBuffer(GL_UNIFORM_BUFFER, g_viewConstants);
+	tlR_BufferData(GL_UNIFORM_BUFFER, sizeof(view), (const void *)&view, GL_STREAM_DRAW);
+	tlR_BindConstants(TL_R_BLOCK_VIEW, g_viewConstants, 0, sizeof(view));
+	tlGL_CheckError();
+}
+/*
+ * Write the model-view matrices of every item drawn with a program that reads
+ * TlDrawBlock into the draw constant buffer, one block each (shared by
+ * consecutive items with the same matrix and geometry), in one upload
+ */
+static void tlRQ_PackDrawConstants(void) {
+	const TlSurface *lastGeom;
+	const TlMat4 *lastM;
+	TlDrawConstants *dc;
+	TlDrawItem *di;
+	TlSurface *geom;
+	size_t stride, n, i;
+	TlU8 *blocks;
+	TlMat4 D;
+
+	g_drawOffsets = (size_t *)0;
+
+	if( !( stride = tlR_ConstantStride(sizeof(TlDrawConstants)) ) ) {
+		return;
+	}
+
+	blocks = (TlU8 *)0;
+	lastGeom = (const TlSurface *)0;
+	lastM = (const TlMat4 *)0;
+	n = 0;
+
+	for(i=0; i<g_numDrawItems; i++) {
+		di = &g_drawItems[i];
+
+		if( !( di->brush->shader.blocks & TL_R_BLOCK_BIT(TL_R_BLOCK_DRAW) ) || !tlRQ_IsDrawable(di) ) {
+			continue;
+		}
 
-		glDepthMask(di->brush->drawing.zWrite);
-		tlGL_CheckError();
+		if( !g_drawOffsets ) {
+			g_drawOffsets = (size_t *)tlFrameAlloc(g_numDrawItems*sizeof(size_t));
+			for(n=0; n<g_numDrawItems; n++) {
+				g_drawOffsets[n] = RQ_NO_CONSTANTS;
+			}
+			n = 0;
+
+			blocks = (TlU8 *)tlFrameAlloc(( g_numDrawItems - i )*stride);
+		}
 
-		tlR_UseProgram(di->brush->shader.prog);
-		tlGL_CheckError();
+		geom = tlGetSurfaceGeometry(di->surf);
+		if( di->M == lastM && geom == lastGeom ) {
+			g_drawOffsets[i] = ( n - 1 )*stride;
+			continue;
+		}
 
-		glLoadMatrixf((const float *)di->M);
-		tlGL_CheckError();
+		/* uploading settles the layout, and so the dequantization */
+		tlRequireSurfaceVertexAttribs(geom, tlGetBrushVertexAttribs(di->brush));
+		tlUploadSurface(geom);
 
-		glEnableClientState(GL_VERTEX_ARRAY);
-		tlGL_CheckError();
-		glEnableClientState(GL_COLOR_ARRAY);
-		tlGL_CheckError();
+		dc = (TlDrawConstants *)( blocks + n*stride );
+		if( geom->gpu.layout.quantized ) {
+			tlAffineMultiply(&dc->modelView, di->M, tlLoadVertexDequantize(&D, &geom->gpu.layout));
+		} else {
+			dc->modelView = *di->M;
+		}
 
-		glVertexPointer(3, GL_FLOAT, sizeof(TlVertex), &verts->xyz);
-		tlGL_CheckError();
-		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(TlVertex), &verts->color);
-		tlGL_CheckError();
-		glNormalPointer(GL_FLOAT, sizeof(TlVertex), &verts->norm);
-		tlGL_CheckError();
-		glTexCoordPointer(2, GL_FLOAT, sizeof(TlVertex), &verts->st);
-		tlGL_CheckError();
+		g_drawOffsets[i] = n*stride;
+		++n;
 
-		glDrawElements(GL_TRIANGLES, di->surf->numInds, GL_UNSIGNED_SHORT, inds);
-		tlGL_CheckError();
+		lastGeom = geom;
+		lastM = di->M;
 	}
 
+	if( !n ) {
+		return;
+	}
+
+	if( !g_drawConstants ) {
+		tlR_GenBuffers(1, &g_drawConstants);
+	}
+
+	/* respecifying the whole store orphans last frame's constants */
+	tlR_BindBuffer(GL_UNIFORM_BUFFER, g_drawConstants);
+	tlR_BufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)(n*stride), (const void *)blocks, GL_STREAM_DRAW);
+	tlGL_CheckError();
+
+	g_rqStats.numDrawConstants += (TlU32)n;
+}
+void tlRQ_Draw() {
+	unsigned int passFlags;
+	const RQRun *run;
+	TlDrawItem *di;
+	TlBool isRun;
+	size_t i;
+
+	tlGL_CheckError();
+
+	glMatrixMode(GL_PROJECTION);
+	tlGL_CheckError();
+
+	glLoadMatrixf((const float *)tlGetViewMatrix(tlGetCameraEntity()->view));
+	tlGL_CheckError();
+
+	tlRQ_SetViewConstants(tlGetViewMatrix(tlGetCameraEntity()->view));
+
+	glMatrixMode(GL_MODELVIEW);
+	tlGL_CheckError();
+
+	/* the client arrays never change within the queue; enable them once */
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	tlGL_CheckError();
+
+	memset((void *)&g_rqState, 0, sizeof(g_rqState));
+
+	g_rqStats.mode = g_rqMode;
+	g_rqStats.numItems += (TlU32)g_numDrawItems;
+
+	tlRQ_FindRuns();
+	tlRQ_PackDrawConstants();
+
+	/* lay down depth for everything opaque before shading anything */
+	if( g_rqMode == kTlRQMode_DepthPrepass ) {
+		run = g_runs;
+		for(i=0; i<g_numDrawItems; i++) {
+			di = &g_drawItems[i];
+
+			isRun = run < &g_runs[g_numRuns] && run->first == i;
+			if( isRun ) {
+				i += run->count - 1;
+			}
+
+			if( !tlRQ_IsDrawable(di) || !tlRQ_IsPrepassable(di->brush) ) {
+				run += isRun;
+				continue;
+			}
+
+			passFlags = RQ_PASS_DEPTHONLY | ( isRun ? RQ_PASS_INSTANCED : 0 );
+			if( tlRQ_ApplyState(di->brush, passFlags) ) {
+				++g_rqStats.numStateChanges;
+			}
+
+			if( isRun ) {
+				tlRQ_DrawRun(run++);
+			} else {
+				tlRQ_DrawSurface(di);
+			}
+
+			++g_rqStats.numPrepassDraws;
+		}
+	}
+
+	run = g_runs;
+	for(i=0; i<g_numDrawItems; i++) {
+		di = &g_drawItems[i];
+
+		isRun = run < &g_runs[g_numRuns] && run->first == i;
+		if( isRun ) {
+			i += run->count - 1;
+		}
+
+		if( !tlRQ_IsDrawable(di) ) {
+			run += isRun;
+			continue;
+		}
+
+		if( di->lod > 0 ) {
+			g_rqStats.numLodItems += isRun ? (TlU32)run->count : 1;
+		}
+
+		passFlags = isRun ? RQ_PASS_INSTANCED : 0;
+		if( g_rqMode == kTlRQMode_DepthPrepass && tlRQ_IsPrepassable(di->brush) ) {
+			passFlags |= RQ_PASS_DEPTHEQUAL;
+		}
+
+		if( tlRQ_ApplyState(di->brush, passFlags) ) {
+			++g_rqStats.numStateChanges;
+		}
+
+		if( isRun ) {
+			tlRQ_DrawRun(run++);
+		} else {
+			tlRQ_DrawSurface(di);
+		}
+	}
+	tlGL_CheckError();
+
+	/* the queue only ever leaves the position and color arrays enabled */
+	tlResetVertexArrays();
+
+	/* anything drawn after the queue may still use client-side arrays */
+	tlR_BindBuffer(GL_ARRAY_BUFFER, 0);
+	tlR_BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	/* leave the masks writable so the next clear works */
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	tlGL_CheckError();
+
+	/* the arena is reset at the end of the frame; don't hold on to it */
+	g_lastNumDrawItems = g_numDrawItems;
 	g_numDrawItems = 0;
+	g_maxDrawItems = 0;
+	g_drawItems = (TlDrawItem *)0;
+	g_numRuns = 0;
+	g_runs = (RQRun *)0;
+	g_instances = (TlMat4 *)0;
+	g_drawOffsets = (size_t *)0;
+}
+void tlRQ_ResetStats(void) {
+	memset((void *)&g_rqStats, 0, sizeof(g_rqStats));
+	g_rqStats.mode = g_rqMode;
 }
+void tlRQ_GetStats(TlRQStats *stats) {
+	TL_ASSERT( stats != (TlRQStats *)0 );
 
+	*stats = g_rqStats;
+}
+void tlRQ_GetViewCullStats(TlRQCullStats *stats) {
+	TL_ASSERT( stats != (TlRQCullStats *)0 );
+
+	*stats = g_rqViewCull;
+}
@@ -3,11 +3,15 @@
 #include <tile/render_queue.h>
 #include <tile/opengl.h>
 #include <tile/entity.h>
+#include <tile/transform.h>
 #include <tile/camera.h>
 #include <tile/brush.h>
+#include <tile/surface.h>
 #include <tile/view.h>
 #include <tile/window.h>
 #include <tile/event.h>
+#include <tile/system.h>
+#include <tile/console.h>
 
 #if GLFW_ENABLED
 extern GLFWwindow *tl__g_window;
@@ -67,8 +71,54 @@ static const char *g_tileMap_fragSrc =
 	"{\n"
 	"	gl_FragColor = SampleTile( fTexCoord );\n"
 	"}\n";
+
+static const char *g_instanced_vertSrc =
+	"#version 120\n"
+	"\n"
+	"attribute vec3 vPosition;\n"
+	"attribute vec4 vColor;\n"
+	"attribute mat4 iModelView;\n"
+	"\n"
+	"varying vec4 fColor;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = gl_ProjectionMatrix*( iModelView*vec4( vPosition, 1.0 ) );\n"
+	"	fColor = vColor;\n"
+	"}\n";
+static const char *g_instanced_fragSrc =
+	"#version 120\n"
+	"\n"
+	"varying vec4 fColor;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = fColor;\n"
+	"}\n";
+
+static const TlShaderAttrib g_tileMap_attribs[] = {
+	{ 0, "vPosition" },
+	{ 1, "vTexCoord" }
+};
+static const TlShaderAttrib g_instanced_attribs[] = {
+	{ TL_INSTANCED_ATTRIB_POSITION, "vPosition" },
+	{ TL_INSTANCED_ATTRIB_COLOR, "vColor" },
+	{ TL_INSTANCED_ATTRIB_MODELVIEW, "iModelView" }
+};
 #endif
 
+static void tlR_FiniShaderCache( void );
+
+static void tlR_InitStaging( void );
+static void tlR_FiniStaging( void );
+static void tlR_FenceStaging( void );
+static void tlR_InitText( void );
+static void tlR_FiniText( void );
+static void tlR_FlushText( int w, int h );
+/* font cell filled in solid; the printable characters only use the ones before it */
+#define RTEXT_SOLID_CELL 0x60
+static void tlR_InitConstants( void );
+
 void tlR_Init( void )
 {
 	TlBrush *brush;
@@ -164,6 +214,31 @@ void tlR_Init( void )
 	P(VertexAttribPointer);
 #undef P
 
+	/* optional; the render queue falls back to a draw per item without these */
+#define Q(x_,ext_) *(TlFn_t *)&R.x_ = tlGL_TryProc("gl" #x_);\
+	if(!R.x_) *(TlFn_t *)&R.x_ = tlGL_TryProc("gl" #x_ #ext_)
+	Q(DrawElementsInstanced, ARB);
+	Q(VertexAttribDivisor, ARB);
+#undef Q
+
+	/* core-only names; without all of them uploads use BufferSubData */
+#define Q(x_) *(TlFn_t *)&R.x_ = tlGL_TryProc("gl" #x_)
+	Q(BufferStorage);
+	Q(MapBufferRange);
+	Q(CopyBufferSubData);
+	Q(FenceSync);
+	Q(ClientWaitSync);
+	Q(DeleteSync);
+	Q(GetProgramBinary);
+	Q(ProgramBinary);
+	Q(ProgramParameteri);
+	Q(GetUniformBlockIndex);
+	Q(UniformBlockBinding);
+	Q(BindBufferRange);
+#undef Q
+	tlR_InitStaging();
+	tlR_InitConstants();
+
 	R.conFontResX = 128;
 	R.conFontResY = 128;
 	R.conFontCellResX = 8;
@@ -181,18 +256,32 @@ void tlR_Init( void )
 				temp[ y*R.conFontResX*2 + x*2 + 1 ] = tl__g_devconFont[ y*R.conFontResX + x ];
 			}
 		}
+		/* the cell after the last glyph is solid, for tlR_DrawRect() */
+		for( y = 0; y < R.conFontCellResY; ++y ) {
+			TlU8 *row;
+
+			row = &temp[ ( ( RTEXT_SOLID_CELL/16 )*R.conFontCellResY + y )*R.conFontResX*2 + ( RTEXT_SOLID_CELL%16 )*R.conFontCellResX*2 ];
+			memset( ( void * )row, 0xFF, R.conFontCellResX*2 );
+		}
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, R.conFontResX, R.conFontResY, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, ( void * )temp);
 		tlMemory( ( void * )temp, 0 );
 	}
+	tlR_InitText();
 
 #if SHADERS_ENABLED
-	R.tileMap_vert = tlR_LoadGLSL( GL_VERTEX_SHADER, g_tileMap_vertSrc );
-	R.tileMap_frag = tlR_LoadGLSL( GL_FRAGMENT_SHADER, g_tileMap_fragSrc );
-	R.tileMap_prog = tlR_LinkGLSL( R.tileMap_vert, R.tileMap_frag );
+	R.tileMap_prog = tlR_AcquireProgram( g_tileMap_vertSrc, g_tileMap_fragSrc, g_tileMap_attribs,
+		sizeof( g_tileMap_attribs )/sizeof( g_tileMap_attribs[ 0 ] ) );
 
 	if( !R.tileMap_prog ) {
 		exit( EXIT_FAILURE );
 	}
+
+	/* a failure just disables instancing */
+	R.instanced_prog = 0;
+	if( R.DrawElementsInstanced && R.VertexAttribDivisor ) {
+		R.instanced_prog = tlR_AcquireProgram( g_instanced_vertSrc, g_instanced_fragSrc,
+			g_instanced_attribs, sizeof( g_instanced_attribs )/sizeof( g_instanced_attribs[ 0 ] ) );
+	}
 #endif
 
 	brush = tlNewBrush();
@@ -211,7 +300,11 @@ void tlR_Fini( void )
 	if (!g_didInit)
 		return;
 
+	tlRQ_Fini();
 	tlDeleteAllEntities();
+	tlR_FiniStaging();
+	tlR_FiniShaderCache();
+	tlR_FiniText();
 	g_defcam = ( TlEntity * )0;
 	g_didInit = FALSE;
 }
@@ -220,11 +313,6 @@ TlEntity *tlR_DefaultCamera( void )
 	return g_defcam;
 }
 
-/*
- * -------------------------------
- * TODO: Frustum-culling of sorts.
- * -------------------------------
- */
 void tlR_DrawView(TlView *view) {
 	GLbitfield clearBits;
 	TlMat4 V;
@@ -276,14 +364,9 @@ void tlR_DrawView(TlView *view) {
 
 	}
 
-	/* add the entities specified to the render queue */
-	{
-		TlEntity *ent;
-
-		for(ent=tlFirstRootEntity(); ent!=(TlEntity *)0; ent=ent->next) {
-			tlRQ_AddEntities(ent, &V);
-		}
-	}
+	/* add the entities specified to the render queue; only those in view */
+	tlRQ_BeginView(view, &V);
+	tlRQ_AddAllEntities(&V);
 
 	/* sort then draw the entities within the queue */
 	tlRQ_Sort();
@@ -298,6 +381,11 @@ void tlR_Frame(double deltaTime) {
 	/*deltaTime will later be used for animations*/
 	if(deltaTime){/*unused*/}
 
+	tlRQ_ResetStats();
+
+	/* bring every global matrix up to date in one pass before any view uses them */
+	tlXf_Update();
+
 #if GLFW_ENABLED
 	glfwGetFramebufferSize( tl__g_window, &w, &h );
 #elif defined( _WIN32 )
@@ -340,12 +428,13 @@ void tlR_Frame(double deltaTime) {
 
 	/* ### DEBUG DATA ### */
 	#if 1
-	glViewport( 0, 0, w, h );
-	glDisable(GL_SCISSOR_TEST);
 	{
 		static int lastmmx = 0, lastmmy = 0;
 		int mmx, mmy;
-		char buf[ 512 ];
+		char buf[ 1024 ];
+		TlRQStats rqs;
+		TlArenaStats as;
+		TlPoolStats eps, sps, bps;
 
 		mmx = tlMouseMoveX();
 		mmy = tlMouseMoveY();
@@ -358,19 +447,47 @@ void tlR_Frame(double deltaTime) {
 			mmy = lastmmy;
 		}
 
-		sprintf( buf, "Mouse: %i, %i\nMouseMove: %i, %i", tlMouseX(), tlMouseY(), mmx, mmy );
+		tlRQ_GetStats( &rqs );
+		tlGetFrameArenaStats( &as, ( TlArenaStats * )0 );
+		tlGetEntityPoolStats( &eps );
+		tlGetSurfacePoolStats( &sps );
+		tlGetBrushPoolStats( &bps );
+
+		snprintf( buf, sizeof( buf ), "Mouse: %i, %i\nMouseMove: %i, %i\nRQ: %s, %u items, %u draws (%u prepass), %u state changes\n%u GL state calls (%u filtered)\n%u instances in %u instanced draws\n%u surfaces visible, %u culled (%u entities)\nFrame arena: %uK used (%uK peak), %u heap calls\nLive (peak): %u (%u) entities, %u (%u) surfaces, %u (%u) brushes",
+			tlMouseX(), tlMouseY(), mmx, mmy, tlRQ_GetModeName( rqs.mode ),
+			( unsigned )rqs.numItems, ( unsigned )rqs.numDraws, ( unsigned )rqs.numPrepassDraws,
+			( unsigned )rqs.numStateChanges, ( unsigned )rqs.numStateCalls,
+			( unsigned )rqs.numStateCallsFiltered, ( unsigned )rqs.numInstances,
+			( unsigned )rqs.numInstancedDraws, ( unsigned )rqs.cull.numSurfacesVisible,
+			( unsigned )rqs.cull.numSurfacesCulled, ( unsigned )rqs.cull.numEntitiesCulled,
+			( unsigned )( as.lastUsed/1024 ), ( unsigned )( as.highWater/1024 ), ( unsigned )as.lastHeapCalls,
+			( unsigned )eps.numLive, ( unsigned )eps.peakLive, ( unsigned )sps.numLive,
+			( unsigned )sps.peakLive, ( unsigned )bps.numLive, ( unsigned )bps.peakLive );
 		tlR_DrawText( buf, 5, 5, 300, 300 );
 	}
-	glDisable(GL_TEXTURE_2D);
 	#endif
 
-	/* get rid of unprocessed events */
+	/* the developer console goes over everything else, in the same draw as the text */
+	tlCon_Render( ( TlU32 )w, ( TlU32 )h );
+
+	/* all of the frame's text in one draw */
+	glViewport( 0, 0, w, h );
+	glDisable(GL_SCISSOR_TEST);
+	tlR_FlushText( w, h );
+
+	/* get rid of unprocessed events, letting the console see them first */
 	while( tlEv_Pending() ) {
 		( void )tlEv_Next();
+		tlCon_KeyEvent();
+		tlCon_MouseEvent();
 	}
 	tlClearMouseMove();
 	tlClearMouseWheel();
 
+	/* everything allocated for this frame is done with */
+	tlResetFrameArenas();
+	tlR_FenceStaging();
+
 	/* sync */
 #if GLFW_ENABLED
 	glfwSwapBuffers( tl__g_window );
@@ -383,31 +500,134 @@ void tlR_Frame(double deltaTime) {
 #endif
 }
 
-static void GetCharTexMap(float tc[4], TlS32 c)
+/*
+ * ==========================================================================
+ *
+ *	TEXT
+ *
+ * ==========================================================================
+ */
+
+/*
+ * Text is laid out into quads as it's drawn and kept until tlR_Frame() draws
+ * all of the frame's text at once, with one upload and one draw call
+ */
+typedef struct RTextVertex_s
 {
-	c -= 0x20;
+	float x, y;
+	float s, t;
+	TlU8 color[ 4 ];
+} RTextVertex;
+
+static RTextVertex *g_textVerts = ( RTextVertex * )0;
+static TlU32 g_numTextVerts = 0;
+static TlU32 g_maxTextVerts = 0;
+static GLuint g_textBuffer = 0;
+
+/* texture coordinates of each printable character's cell: left, top, right, bottom */
+static float g_glyphTexCoords[ 0x60 ][ 4 ];
+/* texture coordinates of the middle of the solid cell */
+static float g_solidTexCoords[ 2 ];
+
+/* Set up the font's texture state and glyph cells; the font must be bound */
+static void tlR_InitText( void )
+{
+	float cellS, cellT;
+	TlU32 c;
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	if (*(unsigned int *)&c >= 0x7F)
+	cellS = ( float )R.conFontCellResX/( float )R.conFontResX;
+	cellT = ( float )R.conFontCellResY/( float )R.conFontResY;
+
+	for( c = 0; c < 0x60; ++c ) {
+		g_glyphTexCoords[ c ][ 0 ] = ( float )( c%16 )*cellS;
+		g_glyphTexCoords[ c ][ 1 ] = ( float )( c/16 )*cellT;
+		g_glyphTexCoords[ c ][ 2 ] = g_glyphTexCoords[ c ][ 0 ] + cellS;
+		g_glyphTexCoords[ c ][ 3 ] = g_glyphTexCoords[ c ][ 1 ] + cellT;
+	}
+
+	g_solidTexCoords[ 0 ] = ( ( float )( RTEXT_SOLID_CELL%16 ) + 0.5f )*cellS;
+	g_solidTexCoords[ 1 ] = ( ( float )( RTEXT_SOLID_CELL/16 ) + 0.5f )*cellT;
+}
+static void tlR_FiniText( void )
+{
+	g_textVerts = ( RTextVertex * )tlMemory( ( void * )g_textVerts, 0 );
+	g_numTextVerts = 0;
+	g_maxTextVerts = 0;
+}
+
+/* Make room for `numGlyphs` more quads; returns where the first goes */
+static RTextVertex *tlR_ReserveText( size_t numGlyphs )
+{
+	size_t n;
+
+	n = g_numTextVerts + numGlyphs*4;
+	if( n > g_maxTextVerts ) {
+		g_maxTextVerts = g_maxTextVerts ? g_maxTextVerts : 4096;
+		while( g_maxTextVerts < n ) {
+			g_maxTextVerts *= 2;
+		}
+
+		g_textVerts = ( RTextVertex * )tlMemory( ( void * )g_textVerts, g_maxTextVerts*sizeof( RTextVertex ) );
+	}
+
+	return &g_textVerts[ g_numTextVerts ];
+}
+static RTextVertex *tlR_PutGlyph( RTextVertex *v, TlS32 x, TlS32 y, TlS32 c, const TlU8 color[ 4 ] )
+{
+	const float *tc;
+	float l, t, r, b;
+
+	c -= 0x20;
+	if( ( TlU32 )c >= 0x60 ) {
 		c = 0; /*use blank space for non-printable characters*/
+	}
+	tc = g_glyphTexCoords[ c ];
+
+	l = ( float )x + 0.5f;
+	t = ( float )y + 0.5f;
+	r = l + ( float )R.conFontCellResX;
+	b = t + ( float )R.conFontCellResY;
+
+	v[ 0 ].x = l; v[ 0 ].y = t; v[ 0 ].s = tc[ 0 ]; v[ 0 ].t = tc[ 1 ];
+	v[ 1 ].x = r; v[ 1 ].y = t; v[ 1 ].s = tc[ 2 ]; v[ 1 ].t = tc[ 1 ];
+	v[ 2 ].x = r; v[ 2 ].y = b; v[ 2 ].s = tc[ 2 ]; v[ 2 ].t = tc[ 3 ];
+	v[ 3 ].x = l; v[ 3 ].y = b; v[ 3 ].s = tc[ 0 ]; v[ 3 ].t = tc[ 3 ];
 
-	tc[0] = ((float)((c%16)))*((float)R.conFontCellResX)/( float )R.conFontResX;
-	tc[1] = ((float)((c/16)))*((float)R.conFontCellResY)/( float )R.conFontResY;
-	tc[2] = tc[0] + ((float)R.conFontCellResX)/( float )R.conFontResX;
-	tc[3] = tc[1] + ((float)R.conFontCellResY)/( float )R.conFontResY;
+	memcpy( ( void * )v[ 0 ].color, ( const void * )color, 4 );
+	memcpy( ( void * )v[ 1 ].color, ( const void * )color, 4 );
+	memcpy( ( void * )v[ 2 ].color, ( const void * )color, 4 );
+	memcpy( ( void * )v[ 3 ].color, ( const void * )color, 4 );
+
+	return v + 4;
+}
+static void tlR_PackColor( TlU8 out[ 4 ], const TlColor *color )
+{
+	const float *f;
+	TlU32 i;
+
+	f = &color->r;
+	for( i = 0; i < 4; ++i ) {
+		out[ i ] = f[ i ] <= 0.0f ? 0 : f[ i ] >= 1.0f ? 255 : ( TlU8 )( f[ i ]*255.0f + 0.5f );
+	}
 }
 
-static void BindConsoleFont(void)
+/* Draw everything queued since the last flush, in pixel coordinates of a `w` by `h` target */
+static void tlR_FlushText( int w, int h )
 {
-	/* set the texture */
+	if( !g_numTextVerts ) {
+		return;
+	}
+
 	glEnable(GL_TEXTURE_2D);
 	glBindTexture(GL_TEXTURE_2D, R.conFontImage);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	/* overwrite the matrices to avoid weird rendering */
+	/* the quads are already in pixels */
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
+	glOrtho( 0.0, ( double )w, ( double )h, 0.0, -1.0, 1.0 );
 
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
@@ -415,59 +635,59 @@ static void BindConsoleFont(void)
 	/* disable stuff that shouldn't affect the text */
 	glDisable(GL_LIGHTING);
 	glDisable(GL_DEPTH_TEST);
+	R.UseProgram( 0 );
 
-	/* enable blending for translucency */
+	/* enable blending for translucency, and alpha testing */
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	/* enable alpha testing */
 	glEnable(GL_ALPHA_TEST);
 	glAlphaFunc(GL_GREATER, 0.1f);
-}
 
-static void DrawChar(TlS32 x, TlS32 y, TlS32 charIndex, float screenResX, float screenResY)
-{
-	float tl[ 2 ], br[ 2 ];
-	float tc[ 4 ];
+	if( !g_textBuffer ) {
+		R.GenBuffers( 1, &g_textBuffer );
+	}
+
+	/* respecifying the whole store orphans last frame's text */
+	R.BindBuffer( GL_ARRAY_BUFFER, g_textBuffer );
+	R.BufferData( GL_ARRAY_BUFFER, ( GLsizeiptr )( g_numTextVerts*sizeof( RTextVertex ) ), ( const void * )g_textVerts, GL_STREAM_DRAW );
 
-	GetCharTexMap(tc, charIndex);
+	glVertexPointer( 2, GL_FLOAT, sizeof( RTextVertex ), ( const void * )offsetof( RTextVertex, x ) );
+	glTexCoordPointer( 2, GL_FLOAT, sizeof( RTextVertex ), ( const void * )offsetof( RTextVertex, s ) );
+	glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof( RTextVertex ), ( const void * )offsetof( RTextVertex, color ) );
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
 
-	tl[ 0 ] = ( float )x + 0.5f;
-	tl[ 1 ] = ( float )y + 0.5f;
-	br[ 0 ] = tl[ 0 ] + R.conFontCellResX;
-	br[ 1 ] = tl[ 1 ] + R.conFontCellResY;
+	glDrawArrays( GL_QUADS, 0, ( GLsizei )g_numTextVerts );
 
-	tlScreenToProj( &tl[ 0 ], &tl[ 1 ], screenResX, screenResY );
-	tlScreenToProj( &br[ 0 ], &br[ 1 ], screenResX, screenResY );
+	/* the render queue expects only the position and color arrays enabled */
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	R.BindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_TEXTURE_2D);
+	tlGL_CheckError();
 
-	glTexCoord2f(tc[0], tc[1]); glVertex2f(tl[0], tl[1]);
-	glTexCoord2f(tc[2], tc[1]); glVertex2f(br[0], tl[1]);
-	glTexCoord2f(tc[2], tc[3]); glVertex2f(br[0], br[1]);
-	glTexCoord2f(tc[0], tc[3]); glVertex2f(tl[0], br[1]);
+	g_numTextVerts = 0;
 }
 
-static void DrawTextOnly(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32 h)
+void tlR_DrawTextColor(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32 h, const TlColor *color)
 {
+	RTextVertex *v;
 	const char *p;
-	float swf, shf;
-	int sw, sh;
 	TlS32 basex, basey;
 	TlS32 currx, curry;
+	TlU8 rgba[ 4 ];
 
 	if( !asciitext || *asciitext == '\0' ) {
 		return;
 	}
 
-#if GLFW_ENABLED
-	glfwGetFramebufferSize( tl__g_window, &sw, &sh );
-#elif defined( _WIN32 )
-	sw = tlWin_ResX();
-	sh = tlWin_ResY();
-#else
-# error Not implemented
-#endif
-	swf = ( float )sw;
-	shf = ( float )sh;
+	tlR_PackColor( rgba, color );
+
+	/* at most one glyph per character */
+	v = tlR_ReserveText( strlen( asciitext ) );
 
 	basex = x;
 	basey = y;
@@ -506,7 +726,7 @@ static void DrawTextOnly(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32
 			continue;
 		}
 
-		DrawChar( currx, curry, +*p, swf, shf );
+		v = tlR_PutGlyph( v, currx, curry, +*p, rgba );
 
 		currx += R.conFontCellResX;
 		if( currx + R.conFontCellResX > basex + w ) {
@@ -517,14 +737,74 @@ static void DrawTextOnly(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32
 			}
 		}
 	}
+
+	g_numTextVerts = ( TlU32 )( v - g_textVerts );
 }
 void tlR_DrawText(const char *asciitext, TlS32 x, TlS32 y, TlU32 w, TlU32 h)
 {
-	BindConsoleFont();
-	glBegin(GL_QUADS);
-	glColor4f( 1.0f, 1.0f, 1.0f, 1.0f );
-	DrawTextOnly(asciitext, x, y, w, h);
-	glEnd();
+	static const TlColor white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	tlR_DrawTextColor( asciitext, x, y, w, h, &white );
+}
+void tlR_DrawGlyphs(const char *chars, TlU32 numChars, TlS32 x, TlS32 y, const TlColor *color)
+{
+	RTextVertex *v;
+	TlU8 rgba[ 4 ];
+	TlU32 i;
+
+	if( !numChars ) {
+		return;
+	}
+
+	tlR_PackColor( rgba, color );
+
+	v = tlR_ReserveText( numChars );
+	for( i = 0; i < numChars; ++i ) {
+		v = tlR_PutGlyph( v, x, y, +chars[ i ], rgba );
+		x += R.conFontCellResX;
+	}
+
+	g_numTextVerts = ( TlU32 )( v - g_textVerts );
+}
+void tlR_DrawRect(TlS32 x, TlS32 y, TlU32 w, TlU32 h, const TlColor *color)
+{
+	RTextVertex *v;
+	float l, t, r, b;
+	TlU32 i;
+
+	if( !w || !h ) {
+		return;
+	}
+
+	v = tlR_ReserveText( 1 );
+
+	l = ( float )x;
+	t = ( float )y;
+	r = l + ( float )w;
+	b = t + ( float )h;
+
+	v[ 0 ].x = l; v[ 0 ].y = t;
+	v[ 1 ].x = r; v[ 1 ].y = t;
+	v[ 2 ].x = r; v[ 2 ].y = b;
+	v[ 3 ].x = l; v[ 3 ].y = b;
+
+	tlR_PackColor( v[ 0 ].color, color );
+	for( i = 0; i < 4; ++i ) {
+		v[ i ].s = g_solidTexCoords[ 0 ];
+		v[ i ].t = g_solidTexCoords[ 1 ];
+		memcpy( ( void * )v[ i ].color, ( const void * )v[ 0 ].color, 4 );
+	}
+
+	g_numTextVerts += 4;
+}
+void tlR_GetGlyphSize(TlU32 *w, TlU32 *h)
+{
+	if( w != ( TlU32 * )0 ) {
+		*w = R.conFontCellResX;
+	}
+	if( h != ( TlU32 * )0 ) {
+		*h = R.conFontCellResY;
+	}
 }
 
 GLuint tlR_LoadGLSL( GLuint shaderType, const char *pszSourceCode )
@@ -596,6 +876,518 @@ GLuint tlR_LinkGLSL( GLuint vertShader, GLuint fragShader )
 	return program;
 }
 
+/*
+ * ==========================================================================
+ *
+ *	SHADER CACHE
+ *
+ * ==========================================================================
+ */
+
+#ifndef GL_INVALID_INDEX
+# define GL_INVALID_INDEX 0xFFFFFFFFU
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+# define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+# define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+# define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#define R_PROGRAM_BINARY_MAGIC   0x42504C54 /* "TLPB" */
+#define R_PROGRAM_BINARY_VERSION 2
+
+typedef struct RProgram_s {
+	TlU64 hash;
+	/* what was hashed (see tlR_ProgramKey); a matching hash must match this too */
+	TlU8 *key;
+	TlU32 keySize;
+	GLuint prog;
+	TlU32 refs;
+	/* TL_R_BLOCK_BIT()s of the constant blocks it reads */
+	TlU32 blocks;
+} RProgram;
+
+/* what a binary file starts with; the program's key, then the driver's blob, follow */
+typedef struct RProgramBinaryHeader_s {
+	TlU32 magic;
+	TlU32 version;
+	TlU64 hash;
+	TlU64 driverHash;
+	TlU32 format;
+	TlU32 length;
+	TlU32 keySize;
+	TlU32 reserved;
+} RProgramBinaryHeader;
+
+static RProgram *g_rPrograms = ( RProgram * )0;
+static TlU32 g_rNumPrograms = 0;
+static TlU32 g_rMaxPrograms = 0;
+
+static char *g_rShaderCacheDir = ( char * )0;
+/* 0 until the GL's strings have been hashed */
+static TlU64 g_rDriverHash = 0;
+
+static TlShaderCacheStats g_rShaderStats;
+
+/* 64-bit FNV-1a, continuing from `h` */
+static TlU64 tlR_HashBytes( TlU64 h, const void *p, size_t n )
+{
+	const TlU8 *bytes;
+	size_t i;
+
+	bytes = ( const TlU8 * )p;
+	for( i = 0; i < n; ++i ) {
+		h ^= bytes[ i ];
+		h *= 0x100000001B3ULL;
+	}
+
+	return h;
+}
+/* Hash a string with its terminator, so consecutive strings can't run together */
+static TlU64 tlR_HashString( TlU64 h, const char *s )
+{
+	static const TlU8 none = 0xFF;
+
+	if( !s ) {
+		return tlR_HashBytes( h, ( const void * )&none, 1 );
+	}
+
+	return tlR_HashBytes( h, ( const void * )s, strlen( s ) + 1 );
+}
+/* Append `n` bytes at `key[ size ]` (unless `key` is null, to measure); returns the new size */
+static size_t tlR_KeyBytes( TlU8 *key, size_t size, const void *p, size_t n )
+{
+	if( key != ( TlU8 * )0 ) {
+		memcpy( ( void * )( key + size ), p, n );
+	}
+
+	return size + n;
+}
+/* A string with its terminator, or 0xFF for none, as tlR_HashString() sees it */
+static size_t tlR_KeyString( TlU8 *key, size_t size, const char *s )
+{
+	static const TlU8 none = 0xFF;
+
+	if( !s ) {
+		return tlR_KeyBytes( key, size, ( const void * )&none, 1 );
+	}
+
+	return tlR_KeyBytes( key, size, ( const void * )s, strlen( s ) + 1 );
+}
+/*
+ * Write everything that makes a program what it is into `key` (or just measure
+ * it, if `key` is null): both sources, then each attribute's index and name.
+ * Its hash names the program; the bytes themselves tell apart programs whose
+ * hashes collide. Returns the size.
+ */
+static size_t tlR_ProgramKey( TlU8 *key, const char *vertSrc, const char *fragSrc,
+const TlShaderAttrib *attribs, TlU32 numAttribs )
+{
+	size_t size;
+	TlU32 i;
+
+	size = tlR_KeyString( key, 0, vertSrc );
+	size = tlR_KeyString( key, size, fragSrc );
+
+	for( i = 0; i < numAttribs; ++i ) {
+		size = tlR_KeyBytes( key, size, ( const void * )&attribs[ i ].index, sizeof( attribs[ i ].index ) );
+		size = tlR_KeyString( key, size, attribs[ i ].name );
+	}
+
+	return size;
+}
+
+/* Whether binaries can be kept; hashes the driver's strings the first time */
+static TlBool tlR_CanCacheBinaries( void )
+{
+	GLint numFormats;
+
+	if( !g_rShaderCacheDir || !R.GetProgramBinary || !R.ProgramBinary || !R.ProgramParameteri ) {
+		return FALSE;
+	}
+
+	if( !g_rDriverHash ) {
+		numFormats = 0;
+		glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats );
+		if( numFormats <= 0 ) {
+			R.GetProgramBinary = NULL;
+			return FALSE;
+		}
+
+		g_rDriverHash = 0xCBF29CE484222325ULL;
+		g_rDriverHash = tlR_HashString( g_rDriverHash, ( const char * )glGetString( GL_VENDOR ) );
+		g_rDriverHash = tlR_HashString( g_rDriverHash, ( const char * )glGetString( GL_RENDERER ) );
+		g_rDriverHash = tlR_HashString( g_rDriverHash, ( const char * )glGetString( GL_VERSION ) );
+		g_rDriverHash |= 1;
+	}
+
+	return TRUE;
+}
+static void tlR_ProgramBinaryPath( char *buf, size_t n, TlU64 hash )
+{
+	TlU64 key;
+
+	key = tlR_HashBytes( hash, ( const void * )&g_rDriverHash, sizeof( g_rDriverHash ) );
+	snprintf( buf, n, "%s/%08X%08X.glbin", g_rShaderCacheDir,
+		( unsigned int )( key >> 32 ), ( unsigned int )( key & 0xFFFFFFFF ) );
+}
+
+/*
+ * Create a program from a cached binary; 0 if there's none, it was written for
+ * another program or it's refused
+ */
+static GLuint tlR_LoadProgramBinary( TlU64 hash, const TlU8 *key, TlU32 keySize )
+{
+	RProgramBinaryHeader header;
+	char path[ 1024 ];
+	GLuint program;
+	GLint status;
+	long fileSize;
+	void *blob;
+	FILE *fp;
+
+	tlR_ProgramBinaryPath( path, sizeof( path ), hash );
+	if( !( fp = fopen( path, "rb" ) ) ) {
+		return 0;
+	}
+
+	/* the header's length is only believed if the file is that long */
+	fileSize = -1;
+	if( fseek( fp, 0, SEEK_END ) == 0 ) {
+		fileSize = ftell( fp );
+	}
+	rewind( fp );
+
+	blob = ( void * )0;
+	program = 0;
+
+	if( fileSize >= ( long )sizeof( header ) && fread( ( void * )&header, sizeof( header ), 1, fp ) == 1
+	&& header.magic == R_PROGRAM_BINARY_MAGIC && header.version == R_PROGRAM_BINARY_VERSION
+	&& header.hash == hash && header.driverHash == g_rDriverHash && header.keySize == keySize
+	&& header.length > 0
+	&& ( TlU64 )header.length + keySize <= ( TlU64 )fileSize - sizeof( header ) ) {
+		blob = tlMemory( ( void * )0, keySize > header.length ? keySize : header.length );
+		if( fread( blob, keySize, 1, fp ) == 1 && memcmp( blob, ( const void * )key, keySize ) == 0
+		&& fread( blob, header.length, 1, fp ) == 1 ) {
+			program = R.CreateProgram();
+			R.ProgramBinary( program, ( GLenum )header.format, ( const GLvoid * )blob, ( GLsizei )header.length );
+
+			R.GetProgramiv( program, GL_LINK_STATUS, &status );
+			if( !status ) {
+				R.DeleteProgram( program );
+				program = 0;
+			}
+		}
+	}
+
+	fclose( fp );
+	tlMemory( blob, 0 );
+
+	/* stale or damaged; compiled and written again */
+	if( !program ) {
+		++g_rShaderStats.numRejected;
+	}
+
+	return program;
+}
+/* Write a linked program's binary, replacing any older one */
+static void tlR_SaveProgramBinary( TlU64 hash, const TlU8 *key, TlU32 keySize, GLuint program )
+{
+	RProgramBinaryHeader header;
+	char path[ 1024 ], temp[ 1040 ];
+	GLint length;
+	GLenum format;
+	void *blob;
+	FILE *fp;
+	TlBool ok;
+
+	length = 0;
+	R.GetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+	if( length <= 0 ) {
+		return;
+	}
+
+	blob = tlMemory( ( void * )0, ( size_t )length );
+	format = 0;
+	R.GetProgramBinary( program, length, &length, &format, ( GLvoid * )blob );
+
+	memset( ( void * )&header, 0, sizeof( header ) );
+	header.magic = R_PROGRAM_BINARY_MAGIC;
+	header.version = R_PROGRAM_BINARY_VERSION;
+	header.hash = hash;
+	header.driverHash = g_rDriverHash;
+	header.format = ( TlU32 )format;
+	header.length = ( TlU32 )length;
+	header.keySize = keySize;
+
+	/* written aside then renamed, so a crash never leaves half a binary */
+	tlR_ProgramBinaryPath( path, sizeof( path ), hash );
+	snprintf( temp, sizeof( temp ), "%s.tmp", path );
+
+	ok = FALSE;
+	if( ( fp = fopen( temp, "wb" ) ) != ( FILE * )0 ) {
+		ok = fwrite( ( const void * )&header, sizeof( header ), 1, fp ) == 1;
+		ok = ok && fwrite( ( const void * )key, keySize, 1, fp ) == 1;
+		ok = ok && fwrite( ( const void * )blob, ( size_t )length, 1, fp ) == 1;
+		ok = fclose( fp ) == 0 && ok;
+
+		remove( path );
+		if( !ok || rename( temp, path ) != 0 ) {
+			remove( temp );
+			ok = FALSE;
+		}
+	}
+
+	if( !ok ) {
+		tlWarnFile( path, 0, "couldn't write program binary" );
+	}
+
+	tlMemory( blob, 0 );
+}
+
+/* Compile and link; the shader objects are let go once the program has them */
+static GLuint tlR_CompileProgram( const char *vertSrc, const char *fragSrc,
+const TlShaderAttrib *attribs, TlU32 numAttribs, TlBool retrievable )
+{
+	GLuint program, vert, frag;
+	GLint status;
+	TlU32 i;
+
+	vert = 0;
+	frag = 0;
+
+	if( vertSrc && !( vert = tlR_LoadGLSL( GL_VERTEX_SHADER, vertSrc ) ) ) {
+		return 0;
+	}
+	if( fragSrc && !( frag = tlR_LoadGLSL( GL_FRAGMENT_SHADER, fragSrc ) ) ) {
+		if( vert ) {
+			R.DeleteShader( vert );
+		}
+		return 0;
+	}
+
+	program = R.CreateProgram();
+
+	if( vert ) {
+		R.AttachShader( program, vert );
+	}
+	if( frag ) {
+		R.AttachShader( program, frag );
+	}
+	for( i = 0; i < numAttribs; ++i ) {
+		R.BindAttribLocation( program, attribs[ i ].index, attribs[ i ].name );
+	}
+	if( retrievable ) {
+		R.ProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+	}
+
+	R.LinkProgram( program );
+
+	if( vert ) {
+		R.DetachShader( program, vert );
+		R.DeleteShader( vert );
+	}
+	if( frag ) {
+		R.DetachShader( program, frag );
+		R.DeleteShader( frag );
+	}
+
+	R.GetProgramiv( program, GL_LINK_STATUS, &status );
+	if( !status ) {
+		char buf[ 4096 ];
+		GLsizei length;
+
+		R.GetProgramInfoLog( program, sizeof( buf ), &length, buf );
+		R.DeleteProgram( program );
+
+		if( length < ( GLsizei )sizeof( buf ) && length >= 0 ) {
+			buf[ length ] = '\0';
+		} else {
+			buf[ sizeof( buf ) - 1 ] = '\0';
+		}
+
+		/* a missing binary may have left errno set */
+		errno = 0;
+		tlErrorMessage( "LinkGLSL tlError: %s\n", buf );
+		return 0;
+	}
+
+	return program;
+}
+
+/* Point the program's constant blocks at their binding points; returns which it has */
+static TlU32 tlR_BindProgramBlocks( GLuint program )
+{
+	static const char *const names[] = {
+		"TlViewBlock",     /* TL_R_BLOCK_VIEW */
+		"TlMaterialBlock", /* TL_R_BLOCK_MATERIAL */
+		"TlDrawBlock"      /* TL_R_BLOCK_DRAW */
+	};
+	GLuint index;
+	TlU32 blocks;
+	TlU32 i;
+
+	if( !R.constantAlignment ) {
+		return 0;
+	}
+
+	blocks = 0;
+	for( i = 0; i < sizeof( names )/sizeof( names[ 0 ] ); ++i ) {
+		index = R.GetUniformBlockIndex( program, names[ i ] );
+		if( index == GL_INVALID_INDEX ) {
+			continue;
+		}
+
+		R.UniformBlockBinding( program, index, i );
+		blocks |= TL_R_BLOCK_BIT( i );
+	}
+
+	return blocks;
+}
+
+void tlR_SetShaderCacheDir(const char *dir) {
+	size_t n;
+
+	g_rShaderCacheDir = ( char * )tlMemory( ( void * )g_rShaderCacheDir, 0 );
+
+	if( dir != ( const char * )0 && *dir != '\0' ) {
+		n = strlen( dir ) + 1;
+		g_rShaderCacheDir = ( char * )tlMemory( ( void * )0, n );
+		memcpy( ( void * )g_rShaderCacheDir, ( const void * )dir, n );
+	}
+}
+
+GLuint tlR_AcquireProgram(const char *vertSrc, const char *fragSrc,
+const TlShaderAttrib *attribs, TlU32 numAttribs) {
+	TlBool cacheBinaries;
+	GLuint program;
+	TlU64 hash, start;
+	TlU32 i, keySize;
+	TlU8 *key;
+
+	if( !vertSrc && !fragSrc ) {
+		return 0;
+	}
+
+	keySize = ( TlU32 )tlR_ProgramKey( ( TlU8 * )0, vertSrc, fragSrc, attribs, numAttribs );
+	key = ( TlU8 * )tlMemory( ( void * )0, keySize );
+	tlR_ProgramKey( key, vertSrc, fragSrc, attribs, numAttribs );
+
+	hash = tlR_HashBytes( 0xCBF29CE484222325ULL, ( const void * )key, keySize );
+
+	for( i = 0; i < g_rNumPrograms; ++i ) {
+		if( g_rPrograms[ i ].hash == hash && g_rPrograms[ i ].keySize == keySize
+		&& memcmp( ( const void * )g_rPrograms[ i ].key, ( const void * )key, keySize ) == 0 ) {
+			tlMemory( ( void * )key, 0 );
+
+			++g_rPrograms[ i ].refs;
+			++g_rShaderStats.numShared;
+			return g_rPrograms[ i ].prog;
+		}
+	}
+
+	cacheBinaries = tlR_CanCacheBinaries();
+	program = 0;
+
+	if( cacheBinaries ) {
+		start = tlSys_Microtime();
+		if( ( program = tlR_LoadProgramBinary( hash, key, keySize ) ) != 0 ) {
+			++g_rShaderStats.numLoaded;
+		}
+		g_rShaderStats.loadMicrosecs += tlSys_Microtime() - start;
+	}
+
+	if( !program ) {
+		start = tlSys_Microtime();
+		program = tlR_CompileProgram( vertSrc, fragSrc, attribs, numAttribs, cacheBinaries );
+		g_rShaderStats.compileMicrosecs += tlSys_Microtime() - start;
+
+		if( !program ) {
+			tlMemory( ( void * )key, 0 );
+			return 0;
+		}
+
+		++g_rShaderStats.numCompiled;
+		if( cacheBinaries ) {
+			tlR_SaveProgramBinary( hash, key, keySize, program );
+		}
+	}
+
+	if( g_rNumPrograms == g_rMaxPrograms ) {
+		g_rMaxPrograms = g_rMaxPrograms ? g_rMaxPrograms*2 : 32;
+		g_rPrograms = ( RProgram * )tlMemory( ( void * )g_rPrograms, g_rMaxPrograms*sizeof( RProgram ) );
+	}
+
+	g_rPrograms[ g_rNumPrograms ].hash = hash;
+	g_rPrograms[ g_rNumPrograms ].key = key;
+	g_rPrograms[ g_rNumPrograms ].keySize = keySize;
+	g_rPrograms[ g_rNumPrograms ].prog = program;
+	g_rPrograms[ g_rNumPrograms ].refs = 1;
+	g_rPrograms[ g_rNumPrograms ].blocks = tlR_BindProgramBlocks( program );
+	++g_rNumPrograms;
+
+	return program;
+}
+void tlR_ReleaseProgram(GLuint program) {
+	TlU32 i;
+
+	if( !program ) {
+		return;
+	}
+
+	for( i = 0; i < g_rNumPrograms; ++i ) {
+		if( g_rPrograms[ i ].prog != program ) {
+			continue;
+		}
+
+		if( --g_rPrograms[ i ].refs > 0 ) {
+			return;
+		}
+
+		R.DeleteProgram( program );
+		tlMemory( ( void * )g_rPrograms[ i ].key, 0 );
+		g_rPrograms[ i ] = g_rPrograms[ --g_rNumPrograms ];
+		return;
+	}
+}
+TlU32 tlR_GetProgramBlocks(GLuint program) {
+	TlU32 i;
+
+	for( i = 0; i < g_rNumPrograms; ++i ) {
+		if( g_rPrograms[ i ].prog == program ) {
+			return g_rPrograms[ i ].blocks;
+		}
+	}
+
+	return 0;
+}
+void tlR_GetShaderCacheStats(TlShaderCacheStats *stats) {
+	TL_ASSERT( stats != ( TlShaderCacheStats * )0 );
+
+	*stats = g_rShaderStats;
+	stats->numPrograms = g_rNumPrograms;
+}
+
+/* Delete every program, whoever still holds it; the GL is going away */
+static void tlR_FiniShaderCache( void )
+{
+	TlU32 i;
+
+	for( i = 0; i < g_rNumPrograms; ++i ) {
+		R.DeleteProgram( g_rPrograms[ i ].prog );
+		tlMemory( ( void * )g_rPrograms[ i ].key, 0 );
+	}
+
+	g_rPrograms = ( RProgram * )tlMemory( ( void * )g_rPrograms, 0 );
+	g_rNumPrograms = 0;
+	g_rMaxPrograms = 0;
+	g_rDriverHash = 0;
+}
+
 GLuint tlR_CreateShader(GLenum shaderType) {
 	return R.CreateShader(shaderType);
 }
@@ -612,6 +1404,9 @@ GLuint tlR_CreateProgram() {
 void tlR_AttachObject(GLuint program, GLuint shader) {
 	R.AttachShader(program, shader);
 }
+void tlR_BindAttribLocation(GLuint program, GLuint index, const char *name) {
+	R.BindAttribLocation(program, index, name);
+}
 void tlR_LinkProgram(GLuint program) {
 	R.LinkProgram(program);
 }
@@ -635,3 +1430,230 @@ void tlR_DeleteProgram(GLuint program) {
 	R.DeleteProgram(program);
 }
 
+void tlR_GenBuffers(GLsizei n, GLuint *buffers) {
+	R.GenBuffers(n, buffers);
+}
+void tlR_DeleteBuffers(GLsizei n, const GLuint *buffers) {
+	R.DeleteBuffers(n, buffers);
+}
+void tlR_BindBuffer(GLenum target, GLuint buffer) {
+	R.BindBuffer(target, buffer);
+}
+void tlR_BufferData(GLenum target, GLsizeiptr size, const void *data,
+GLenum usage) {
+	R.BufferData(target, size, data, usage);
+}
+void tlR_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+const void *data) {
+	R.BufferSubData(target, offset, size, data);
+}
+void *tlR_MapBuffer(GLenum target, GLenum access) {
+	return R.MapBuffer(target, access);
+}
+GLboolean tlR_UnmapBuffer(GLenum target) {
+	return R.UnmapBuffer(target);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	STAGING
+ *
+ * ==========================================================================
+ */
+
+#ifndef GL_COPY_READ_BUFFER
+# define GL_COPY_READ_BUFFER 0x8F36
+#endif
+#ifndef GL_MAP_WRITE_BIT
+# define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+# define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+# define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+# define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+# define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_WAIT_FAILED
+# define GL_WAIT_FAILED 0x911D
+#endif
+
+/* copies into the ring stay 16-byte aligned */
+#define R_STAGING_ALIGN 16
+
+static void tlR_InitStaging( void )
+{
+	GLbitfield flags;
+	size_t size;
+
+	R.staging = 0;
+	R.stagingMem = ( TlU8 * )0;
+	R.stagingSegment = 0;
+	R.stagingUsed = 0;
+	memset( ( void * )R.stagingFences, 0, sizeof( R.stagingFences ) );
+
+	if( !R.BufferStorage || !R.MapBufferRange || !R.CopyBufferSubData
+	|| !R.FenceSync || !R.ClientWaitSync || !R.DeleteSync ) {
+		return;
+	}
+
+	/* coherent, so writes land without explicit flushes */
+	flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	size = TL_R_STAGING_SEGMENTS*TL_R_STAGING_SEGMENT_SIZE;
+
+	R.GenBuffers( 1, &R.staging );
+	R.BindBuffer( GL_COPY_READ_BUFFER, R.staging );
+	R.BufferStorage( GL_COPY_READ_BUFFER, ( GLsizeiptr )size, ( const GLvoid * )0, flags );
+	R.stagingMem = ( TlU8 * )R.MapBufferRange( GL_COPY_READ_BUFFER, 0, ( GLsizeiptr )size, flags );
+	R.BindBuffer( GL_COPY_READ_BUFFER, 0 );
+
+	if( !R.stagingMem ) {
+		tlWarnMessage( "Couldn't map the staging buffer; uploading with BufferSubData" );
+		R.DeleteBuffers( 1, &R.staging );
+		R.staging = 0;
+	}
+	tlGL_CheckError();
+}
+static void tlR_FiniStaging( void )
+{
+	TlU32 i;
+
+	if( !R.staging ) {
+		return;
+	}
+
+	for( i = 0; i < TL_R_STAGING_SEGMENTS; ++i ) {
+		if( R.stagingFences[ i ] != ( void * )0 ) {
+			R.DeleteSync( R.stagingFences[ i ] );
+			R.stagingFences[ i ] = ( void * )0;
+		}
+	}
+
+	/* deleting the buffer unmaps it */
+	R.DeleteBuffers( 1, &R.staging );
+	R.staging = 0;
+	R.stagingMem = ( TlU8 * )0;
+}
+/* Fence the copies issued out of this frame's segment, then move to the next */
+static void tlR_FenceStaging( void )
+{
+	if( !R.staging || !R.stagingUsed ) {
+		return;
+	}
+
+	R.stagingFences[ R.stagingSegment ] = R.FenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	R.stagingSegment = ( R.stagingSegment + 1 )%TL_R_STAGING_SEGMENTS;
+	R.stagingUsed = 0;
+}
+
+void tlR_UploadBufferData(GLenum target, GLintptr offset, GLsizeiptr size,
+const void *data) {
+	void *fence;
+	size_t at;
+
+	if( !R.staging || ( size_t )size > TL_R_STAGING_SEGMENT_SIZE - R.stagingUsed ) {
+		R.BufferSubData(target, offset, size, data);
+		return;
+	}
+
+	/* the segment was last written frames ago; its copies are almost surely done */
+	if( ( fence = R.stagingFences[ R.stagingSegment ] ) != ( void * )0 ) {
+		if( R.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~( TlU64 )0) == GL_WAIT_FAILED ) {
+			tlGL_CheckError();
+		}
+		R.DeleteSync(fence);
+		R.stagingFences[ R.stagingSegment ] = ( void * )0;
+	}
+
+	at = R.stagingSegment*TL_R_STAGING_SEGMENT_SIZE + R.stagingUsed;
+	memcpy( ( void * )( R.stagingMem + at ), data, ( size_t )size );
+
+	R.BindBuffer(GL_COPY_READ_BUFFER, R.staging);
+	R.CopyBufferSubData(GL_COPY_READ_BUFFER, target, ( GLintptr )at, offset, size);
+	R.BindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	R.stagingUsed += ( ( size_t )size + ( R_STAGING_ALIGN - 1 ) ) & ~( size_t )( R_STAGING_ALIGN - 1 );
+	if( R.stagingUsed > TL_R_STAGING_SEGMENT_SIZE ) {
+		R.stagingUsed = TL_R_STAGING_SEGMENT_SIZE;
+	}
+}
+TlBool tlR_IsStagingPersistent(void) {
+	return R.staging != 0;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	CONSTANTS
+ *
+ * ==========================================================================
+ */
+
+#ifndef GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+# define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+#endif
+
+static void tlR_InitConstants( void )
+{
+	GLint alignment;
+
+	R.constantAlignment = 0;
+
+	if( !R.GetUniformBlockIndex || !R.UniformBlockBinding || !R.BindBufferRange ) {
+		return;
+	}
+
+	alignment = 0;
+	glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+	if( alignment <= 0 ) {
+		return;
+	}
+
+	/* a TlMat4 is read straight out of the buffer; keep them 16-byte aligned */
+	R.constantAlignment = alignment < 16 ? 16 : ( TlU32 )alignment;
+}
+
+size_t tlR_ConstantStride(size_t size) {
+	size_t align;
+
+	if( !( align = R.constantAlignment ) ) {
+		return 0;
+	}
+
+	return ( size + align - 1 )/align*align;
+}
+void tlR_BindConstants(TlU32 block, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+	R.BindBufferRange(GL_UNIFORM_BUFFER, block, buffer, offset, size);
+}
+
+void tlR_EnableVertexAttribArray(GLuint index) {
+	R.EnableVertexAttribArray(index);
+}
+void tlR_DisableVertexAttribArray(GLuint index) {
+	R.DisableVertexAttribArray(index);
+}
+void tlR_VertexAttribPointer(GLuint index, GLint size, GLenum type,
+GLboolean normalized, GLsizei stride, const void *pointer) {
+	R.VertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+GLuint tlR_InstancingProgram(void) {
+#if SHADERS_ENABLED
+	return R.instanced_prog;
+#else
+	return 0;
+#endif
+}
+void tlR_VertexAttribDivisor(GLuint index, GLuint divisor) {
+	R.VertexAttribDivisor(index, divisor);
+}
+void tlR_DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+const void *indices, GLsizei primcount) {
+	R.DrawElementsInstanced(mode, count, type, indices, primcount);
+}
@@ -0,0 +1,730 @@
+#include <tile.h>
+
+/*
+ * ==========================================================================
+ *
+ *	FILES
+ *
+ * ==========================================================================
+ */
+
+/* A mapped scene file, kept until the last surface drawing from it lets go */
+struct TlSceneFile_s {
+	const void *data;
+	size_t size;
+	TlU32 refs;
+};
+
+void tlReleaseSceneFile(TlSceneFile *file) {
+	TL_ASSERT( file->refs > 0 );
+
+	if (--file->refs > 0)
+		return;
+
+	tlSys_UnmapFile(file->data, file->size);
+	tlMemory((void *)file, 0);
+}
+
+static TlU64 tlScene_Align(TlU64 n) {
+	return (n + (TL_SCENE_ALIGNMENT - 1)) & ~(TlU64)(TL_SCENE_ALIGNMENT - 1);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	BRUSHES
+ *
+ * ==========================================================================
+ */
+
+static void tlScene_PackBrush(TlSceneBrush *rec, const TlBrush *brush) {
+	memset((void *)rec, 0, sizeof(*rec));
+
+	rec->diffuse = brush->lighting.diffuse;
+	rec->ambient = brush->lighting.ambient;
+	rec->emissive = brush->lighting.emissive;
+	rec->specular = brush->lighting.specular;
+	rec->shininess = brush->lighting.shininess;
+
+	rec->flags |= brush->lighting.isLit ? TL_SCENE_BRUSH_LIT : 0;
+	rec->flags |= brush->lighting.useDiffuse ? TL_SCENE_BRUSH_USE_DIFFUSE : 0;
+	rec->flags |= brush->lighting.useAmbient ? TL_SCENE_BRUSH_USE_AMBIENT : 0;
+	rec->flags |= brush->lighting.useEmissive ? TL_SCENE_BRUSH_USE_EMISSIVE : 0;
+	rec->flags |= brush->lighting.useSpecular ? TL_SCENE_BRUSH_USE_SPECULAR : 0;
+	rec->flags |= brush->drawing.isVisible ? TL_SCENE_BRUSH_VISIBLE : 0;
+	rec->flags |= brush->drawing.usesBinorm ? TL_SCENE_BRUSH_BINORMAL : 0;
+	rec->flags |= brush->drawing.usesTangent ? TL_SCENE_BRUSH_TANGENT : 0;
+	rec->flags |= brush->drawing.zTest ? TL_SCENE_BRUSH_Z_TEST : 0;
+	rec->flags |= brush->drawing.zWrite ? TL_SCENE_BRUSH_Z_WRITE : 0;
+	rec->flags |= brush->drawing.zSort ? TL_SCENE_BRUSH_Z_SORT : 0;
+
+	rec->cullMode = brush->drawing.cullMode;
+	rec->zFunc = brush->drawing.zCmpFunc;
+}
+static TlBrush *tlScene_UnpackBrush(const TlSceneBrush *rec) {
+	TlBrush *brush;
+
+	brush = tlNewBrush();
+
+	brush->lighting.diffuse = rec->diffuse;
+	brush->lighting.ambient = rec->ambient;
+	brush->lighting.emissive = rec->emissive;
+	brush->lighting.specular = rec->specular;
+	brush->lighting.shininess = rec->shininess;
+
+	brush->lighting.isLit = (rec->flags & TL_SCENE_BRUSH_LIT) ? TRUE : FALSE;
+	brush->lighting.useDiffuse = (rec->flags & TL_SCENE_BRUSH_USE_DIFFUSE) ? TRUE : FALSE;
+	brush->lighting.useAmbient = (rec->flags & TL_SCENE_BRUSH_USE_AMBIENT) ? TRUE : FALSE;
+	brush->lighting.useEmissive = (rec->flags & TL_SCENE_BRUSH_USE_EMISSIVE) ? TRUE : FALSE;
+	brush->lighting.useSpecular = (rec->flags & TL_SCENE_BRUSH_USE_SPECULAR) ? TRUE : FALSE;
+	brush->drawing.isVisible = (rec->flags & TL_SCENE_BRUSH_VISIBLE) ? TRUE : FALSE;
+	brush->drawing.usesBinorm = (rec->flags & TL_SCENE_BRUSH_BINORMAL) ? TRUE : FALSE;
+	brush->drawing.usesTangent = (rec->flags & TL_SCENE_BRUSH_TANGENT) ? TRUE : FALSE;
+	brush->drawing.zTest = (rec->flags & TL_SCENE_BRUSH_Z_TEST) ? TRUE : FALSE;
+	brush->drawing.zWrite = (rec->flags & TL_SCENE_BRUSH_Z_WRITE) ? TRUE : FALSE;
+	brush->drawing.zSort = (rec->flags & TL_SCENE_BRUSH_Z_SORT) ? TRUE : FALSE;
+
+	brush->drawing.cullMode = rec->cullMode & 3;
+	brush->drawing.zCmpFunc = rec->zFunc & 7;
+
+	return tlInternBrush(brush);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	WRITING
+ *
+ * ==========================================================================
+ */
+
+/* Pointer to index map for finding what's been written already */
+typedef struct SceneMap_s {
+	const void **keys;
+	TlU32 *values;
+	TlU32 mask;
+} SceneMap;
+
+static void tlScene_InitMap(SceneMap *map, TlU32 maxKeys) {
+	map->mask = 16;
+	while (map->mask < maxKeys*2)
+		map->mask <<= 1;
+
+	map->keys = (const void **)tlMemory((void *)0, map->mask*sizeof(void *));
+	map->values = (TlU32 *)tlMemory((void *)0, map->mask*sizeof(TlU32));
+	memset((void *)map->keys, 0, map->mask*sizeof(void *));
+	map->mask--;
+}
+static void tlScene_FiniMap(SceneMap *map) {
+	map->keys = (const void **)tlMemory((void *)map->keys, 0);
+	map->values = (TlU32 *)tlMemory((void *)map->values, 0);
+}
+/* Index of `key`, giving it `next` if it's new */
+static TlU32 tlScene_MapIndex(SceneMap *map, const void *key, TlU32 next) {
+	size_t h;
+
+	h = (size_t)key;
+	h ^= h >> 16;
+	h *= 0x45D9F3B;
+	h ^= h >> 16;
+
+	for(h&=map->mask; map->keys[h]!=(const void *)0; h=(h + 1) & map->mask) {
+		if (map->keys[h] == key)
+			return map->values[h];
+	}
+
+	map->keys[h] = key;
+	map->values[h] = next;
+
+	return next;
+}
+
+typedef struct SceneWriter_s {
+	TlSceneEntity *entities;
+	TlU32 numEntities, maxEntities;
+
+	TlSurface **surfaces;
+	TlU32 numSurfaces, maxSurfaces;
+	TlU32 numPasses;
+} SceneWriter;
+
+/* Add `ent` and its descendants, parents first */
+static void tlScene_CollectR(SceneWriter *w, TlEntity *ent, TlU32 parent, const TlMat4 *local) {
+	TlSceneEntity *rec;
+	TlSurface *surf;
+	TlEntity *chld;
+	TlU32 index;
+
+	if (w->numEntities == w->maxEntities) {
+		w->maxEntities = w->maxEntities ? w->maxEntities*2 : 64;
+		w->entities = (TlSceneEntity *)tlMemory((void *)w->entities,
+			w->maxEntities*sizeof(TlSceneEntity));
+	}
+
+	index = w->numEntities++;
+	rec = &w->entities[index];
+
+	memset((void *)rec, 0, sizeof(*rec));
+	rec->local = *local;
+	rec->parent = parent;
+	rec->firstSurface = w->numSurfaces;
+
+	for(surf=ent->s_head; surf!=(TlSurface *)0; surf=surf->s_next) {
+		if (w->numSurfaces == w->maxSurfaces) {
+			w->maxSurfaces = w->maxSurfaces ? w->maxSurfaces*2 : 64;
+			w->surfaces = (TlSurface **)tlMemory((void *)w->surfaces,
+				w->maxSurfaces*sizeof(TlSurface *));
+		}
+
+		w->surfaces[w->numSurfaces++] = surf;
+		w->numPasses += surf->numPasses;
+	}
+	rec->numSurfaces = w->numSurfaces - rec->firstSurface;
+
+	for(chld=ent->head; chld!=(TlEntity *)0; chld=chld->next)
+		tlScene_CollectR(w, chld, index, tlXf_Local(chld->xform));
+}
+
+/* Describe `geom`'s geometry, packed the way it would be uploaded */
+static void tlScene_InitGeometry(TlSceneGeometry *rec, TlVertexLayout *layout, TlSurface *geom) {
+	TlBool isLong;
+
+	memset((void *)rec, 0, sizeof(*rec));
+
+	/* already packed; written back out as it is */
+	if (geom->mapped.file) {
+		*layout = geom->mapped.layout;
+		isLong = geom->mapped.indexType == GL_UNSIGNED_INT;
+	} else {
+		tlInitVertexLayout(layout, geom->gpu.attribs | TL_VERTEX_COLOR, geom->gpu.quantize,
+			tlGetSurfaceBounds(geom));
+		isLong = geom->numVerts > TL_SURFACE_MAX_SHORT_VERTS;
+	}
+
+	rec->bounds = *tlGetSurfaceBounds(geom);
+
+	rec->numVerts = geom->numVerts;
+	rec->numInds = geom->numInds;
+	rec->numLodInds = geom->numLodInds;
+	rec->numLods = geom->numLods;
+	memcpy((void *)rec->lods, (const void *)geom->lods, sizeof(rec->lods));
+
+	rec->attribs = layout->attribs;
+	rec->flags |= layout->quantized ? TL_SCENE_GEOMETRY_QUANTIZED : 0;
+	rec->flags |= layout->halfTexCoords ? TL_SCENE_GEOMETRY_HALF_TEXCOORDS : 0;
+	rec->flags |= isLong ? TL_SCENE_GEOMETRY_32BIT_INDICES : 0;
+	rec->stride = layout->stride;
+	rec->position = layout->position;
+	rec->normal = layout->normal;
+	rec->texCoord = layout->texCoord;
+	rec->binormal = layout->binormal;
+	rec->tangent = layout->tangent;
+	rec->color = layout->color;
+	rec->scale = layout->scale;
+	rec->bias = layout->bias;
+}
+
+/* Write `n` bytes at `*pos`, first padding with zeros up to `offset` */
+static TlBool tlScene_Write(FILE *fp, TlU64 *pos, TlU64 offset, const void *data, size_t n) {
+	static const unsigned char zeros[TL_SCENE_ALIGNMENT] = { 0 };
+
+	TL_ASSERT( offset >= *pos && offset - *pos <= sizeof(zeros) );
+
+	if (offset > *pos && fwrite((const void *)zeros, (size_t)(offset - *pos), 1, fp) != 1)
+		return FALSE;
+
+	*pos = offset + n;
+
+	return !n || fwrite(data, n, 1, fp) == 1;
+}
+
+TlBool tlSaveScene(const char *filename, TlEntity *ent) {
+	TlSceneGeometry *geometries;
+	TlVertexLayout *layouts;
+	TlSceneSurface *surfaces;
+	TlSceneBrush *brushes;
+	TlSurface **geoms, *geom, *surf;
+	TlSceneHeader header;
+	SceneMap geomMap, brushMap;
+	SceneWriter w;
+	TlU32 *passes, *inds, i, j, g, n;
+	TlU64 pos, offset;
+	TlU16 *shortInds;
+	size_t maxScratch, size;
+	void *scratch;
+	TlBool ok;
+	FILE *fp;
+
+	TL_ASSERT( filename != (const char *)0 );
+
+	memset((void *)&w, 0, sizeof(w));
+
+	if (ent) {
+		tlScene_CollectR(&w, ent, TL_SCENE_NONE, tlGetEntityGlobalMatrix(ent));
+	} else {
+		for(ent=tlFirstRootEntity(); ent!=(TlEntity *)0; ent=tlEntityAfter(ent))
+			tlScene_CollectR(&w, ent, TL_SCENE_NONE, tlXf_Local(ent->xform));
+	}
+
+	surfaces = (TlSceneSurface *)tlMemory((void *)0, (w.numSurfaces + 1)*sizeof(TlSceneSurface));
+	geometries = (TlSceneGeometry *)tlMemory((void *)0, (w.numSurfaces + 1)*sizeof(TlSceneGeometry));
+	layouts = (TlVertexLayout *)tlMemory((void *)0, (w.numSurfaces + 1)*sizeof(TlVertexLayout));
+	geoms = (TlSurface **)tlMemory((void *)0, (w.numSurfaces + 1)*sizeof(TlSurface *));
+	brushes = (TlSceneBrush *)tlMemory((void *)0, (w.numPasses + 1)*sizeof(TlSceneBrush));
+	passes = (TlU32 *)tlMemory((void *)0, (w.numPasses + 1)*sizeof(TlU32));
+
+	memset((void *)&header, 0, sizeof(header));
+	header.magic = TL_SCENE_MAGIC;
+	header.version = TL_SCENE_VERSION;
+	header.headerSize = sizeof(header);
+	header.numEntities = w.numEntities;
+	header.numSurfaces = w.numSurfaces;
+
+	/* each geometry once, however many surfaces share it; likewise brushes */
+	tlScene_InitMap(&geomMap, w.numSurfaces);
+	tlScene_InitMap(&brushMap, w.numPasses);
+
+	for(i=0; i<w.numSurfaces; i++) {
+		surf = w.surfaces[i];
+		geom = tlGetSurfaceGeometry(surf);
+
+		surfaces[i].geometry = tlScene_MapIndex(&geomMap, (const void *)geom, header.numGeometries);
+		surfaces[i].firstPass = header.numPasses;
+		surfaces[i].numPasses = (TlU32)surf->numPasses;
+		surfaces[i].usage = surf->gpu.usage;
+
+		if (surfaces[i].geometry == header.numGeometries) {
+			geoms[header.numGeometries] = geom;
+			tlScene_InitGeometry(&geometries[header.numGeometries], &layouts[header.numGeometries], geom);
+			header.numGeometries++;
+		}
+
+		for(j=0; j<(TlU32)surf->numPasses; j++) {
+			if (surf->passes[j] == tlFirstBrush()) {
+				passes[header.numPasses++] = TL_SCENE_NONE;
+				continue;
+			}
+
+			n = tlScene_MapIndex(&brushMap, (const void *)surf->passes[j], header.numBrushes);
+			passes[header.numPasses++] = n;
+
+			if (n == header.numBrushes) {
+				if (tlIsBrushShaderAttached(surf->passes[j]))
+					tlWarnFile(filename, 0, "brush shaders aren't saved in scene files");
+
+				tlScene_PackBrush(&brushes[header.numBrushes++], surf->passes[j]);
+			}
+		}
+	}
+
+	tlScene_FiniMap(&brushMap);
+	tlScene_FiniMap(&geomMap);
+
+	/* lay out the tables, then the blobs */
+	offset = tlScene_Align(sizeof(header));
+	header.entities = offset;
+	offset = tlScene_Align(offset + header.numEntities*sizeof(TlSceneEntity));
+	header.surfaces = offset;
+	offset = tlScene_Align(offset + header.numSurfaces*sizeof(TlSceneSurface));
+	header.geometries = offset;
+	offset = tlScene_Align(offset + header.numGeometries*sizeof(TlSceneGeometry));
+	header.brushes = offset;
+	offset = tlScene_Align(offset + header.numBrushes*sizeof(TlSceneBrush));
+	header.passes = offset;
+	offset = offset + header.numPasses*sizeof(TlU32);
+
+	maxScratch = 0;
+	for(g=0; g<header.numGeometries; g++) {
+		geometries[g].vertices = tlScene_Align(offset);
+		offset = geometries[g].vertices + (TlU64)geometries[g].numVerts*geometries[g].stride;
+
+		n = geometries[g].numInds + geometries[g].numLodInds;
+		size = (geometries[g].flags & TL_SCENE_GEOMETRY_32BIT_INDICES) ? sizeof(TlU32) : sizeof(TlU16);
+
+		geometries[g].indices = tlScene_Align(offset);
+		offset = geometries[g].indices + (TlU64)n*size;
+
+		size = geometries[g].numVerts*geometries[g].stride;
+		if (size < n*sizeof(TlU32))
+			size = n*sizeof(TlU32);
+		if (size > maxScratch)
+			maxScratch = size;
+	}
+	header.fileSize = offset;
+
+	if (!(fp = fopen(filename, "wb"))) {
+		tlErrorFile(filename, 0, "couldn't open scene file for writing");
+		ok = FALSE;
+		goto done;
+	}
+
+	pos = 0;
+	ok = tlScene_Write(fp, &pos, 0, (const void *)&header, sizeof(header));
+	ok = ok && tlScene_Write(fp, &pos, header.entities, (const void *)w.entities,
+		header.numEntities*sizeof(TlSceneEntity));
+	ok = ok && tlScene_Write(fp, &pos, header.surfaces, (const void *)surfaces,
+		header.numSurfaces*sizeof(TlSceneSurface));
+	ok = ok && tlScene_Write(fp, &pos, header.geometries, (const void *)geometries,
+		header.numGeometries*sizeof(TlSceneGeometry));
+	ok = ok && tlScene_Write(fp, &pos, header.brushes, (const void *)brushes,
+		header.numBrushes*sizeof(TlSceneBrush));
+	ok = ok && tlScene_Write(fp, &pos, header.passes, (const void *)passes,
+		header.numPasses*sizeof(TlU32));
+
+	scratch = tlMemory((void *)0, maxScratch ? maxScratch : 1);
+	for(g=0; g<header.numGeometries && ok; g++) {
+		geom = geoms[g];
+		n = geometries[g].numInds + geometries[g].numLodInds;
+
+		if (geom->mapped.file) {
+			ok = tlScene_Write(fp, &pos, geometries[g].vertices, geom->mapped.verts,
+				geometries[g].numVerts*geometries[g].stride);
+			size = (geometries[g].flags & TL_SCENE_GEOMETRY_32BIT_INDICES) ? sizeof(TlU32) : sizeof(TlU16);
+			ok = ok && tlScene_Write(fp, &pos, geometries[g].indices, geom->mapped.inds, n*size);
+			continue;
+		}
+
+		tlPackVertices(&layouts[g], scratch, geom->verts, geom->numVerts);
+		ok = tlScene_Write(fp, &pos, geometries[g].vertices, scratch,
+			geometries[g].numVerts*geometries[g].stride);
+
+		/* the full index list, then the levels of detail */
+		if (geometries[g].flags & TL_SCENE_GEOMETRY_32BIT_INDICES) {
+			inds = (TlU32 *)scratch;
+			memcpy((void *)inds, (const void *)geom->inds, geom->numInds*sizeof(TlU32));
+			memcpy((void *)&inds[geom->numInds], (const void *)geom->lodInds,
+				geom->numLodInds*sizeof(TlU32));
+			ok = ok && tlScene_Write(fp, &pos, geometries[g].indices, scratch, n*sizeof(TlU32));
+		} else {
+			shortInds = (TlU16 *)scratch;
+			for(i=0; i<geom->numInds; i++)
+				shortInds[i] = (TlU16)geom->inds[i];
+			for(i=0; i<geom->numLodInds; i++)
+				shortInds[geom->numInds + i] = (TlU16)geom->lodInds[i];
+			ok = ok && tlScene_Write(fp, &pos, geometries[g].indices, scratch, n*sizeof(TlU16));
+		}
+	}
+	scratch = tlMemory(scratch, 0);
+
+	if (fclose(fp) != 0)
+		ok = FALSE;
+
+	if (!ok) {
+		tlErrorFile(filename, 0, "couldn't write scene file");
+		remove(filename);
+	}
+
+done:
+	passes = (TlU32 *)tlMemory((void *)passes, 0);
+	brushes = (TlSceneBrush *)tlMemory((void *)brushes, 0);
+	geoms = (TlSurface **)tlMemory((void *)geoms, 0);
+	layouts = (TlVertexLayout *)tlMemory((void *)layouts, 0);
+	geometries = (TlSceneGeometry *)tlMemory((void *)geometries, 0);
+	surfaces = (TlSceneSurface *)tlMemory((void *)surfaces, 0);
+	w.surfaces = (TlSurface **)tlMemory((void *)w.surfaces, 0);
+	w.entities = (TlSceneEntity *)tlMemory((void *)w.entities, 0);
+
+	return ok;
+}
+
+/*
+ * ==========================================================================
+ *
+ *	LOADING
+ *
+ * ==========================================================================
+ */
+
+/* Whether `n` items of `size` bytes at `offset` lie within the file */
+static TlBool tlScene_InFile(const TlSceneHeader *header, TlU64 offset, TlU64 n, TlU64 size) {
+	if (offset % TL_SCENE_ALIGNMENT != 0 || offset > header->fileSize)
+		return FALSE;
+	if (size && n > (header->fileSize - offset)/size)
+		return FALSE;
+
+	return TRUE;
+}
+/*
+ * Check a geometry's counts and ranges, and that every index names one of its
+ * vertices (the GPU would otherwise read past the vertex buffer)
+ */
+static TlBool tlScene_IsGeometryValid(const TlSceneHeader *header, const TlSceneGeometry *rec) {
+	const TlU16 *inds16;
+	const TlU32 *inds32;
+	TlU32 i, n, attribSize;
+
+	n = rec->numInds + rec->numLodInds;
+	if (n < rec->numInds || rec->numInds%3 != 0 || rec->numLods > TL_SURFACE_MAX_LODS)
+		return FALSE;
+
+	for(i=0; i<rec->numLods; i++) {
+		if (rec->lods[i].firstInd > n || rec->lods[i].numInds > n - rec->lods[i].firstInd)
+			return FALSE;
+		if (rec->lods[i].numInds%3 != 0)
+			return FALSE;
+	}
+
+	/* positions are the only attribute every layout has */
+	if (!(rec->attribs & TL_VERTEX_POSITION))
+		return FALSE;
+
+	attribSize = (rec->flags & TL_SCENE_GEOMETRY_QUANTIZED) ? 8 : 12;
+	if (rec->position > rec->stride || attribSize > rec->stride - rec->position)
+		return FALSE;
+
+	attribSize = (rec->flags & TL_SCENE_GEOMETRY_HALF_TEXCOORDS) ? 4 : 8;
+	if ((rec->attribs & TL_VERTEX_TEXCOORD) && (rec->texCoord > rec->stride || attribSize > rec->stride - rec->texCoord))
+		return FALSE;
+	if ((rec->attribs & TL_VERTEX_NORMAL) && (rec->normal > rec->stride || 4 > rec->stride - rec->normal))
+		return FALSE;
+	if ((rec->attribs & TL_VERTEX_BINORMAL) && (rec->binormal > rec->stride || 4 > rec->stride - rec->binormal))
+		return FALSE;
+	if ((rec->attribs & TL_VERTEX_TANGENT) && (rec->tangent > rec->stride || 4 > rec->stride - rec->tangent))
+		return FALSE;
+	if ((rec->attribs & TL_VERTEX_COLOR) && (rec->color > rec->stride || 4 > rec->stride - rec->color))
+		return FALSE;
+
+	if (!tlScene_InFile(header, rec->vertices, rec->numVerts, rec->stride)
+	|| !tlScene_InFile(header, rec->indices, n,
+		(rec->flags & TL_SCENE_GEOMETRY_32BIT_INDICES) ? sizeof(TlU32) : sizeof(TlU16)))
+		return FALSE;
+
+	if (rec->flags & TL_SCENE_GEOMETRY_32BIT_INDICES) {
+		inds32 = (const TlU32 *)((const char *)header + rec->indices);
+		for(i=0; i<n; i++) {
+			if (inds32[i] >= rec->numVerts)
+				return FALSE;
+		}
+	} else {
+		inds16 = (const TlU16 *)((const char *)header + rec->indices);
+		for(i=0; i<n; i++) {
+			if (inds16[i] >= rec->numVerts)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+/* Check everything the loader follows before it creates anything */
+static const char *tlScene_Validate(const TlSceneHeader *header, size_t size) {
+	const TlSceneEntity *entities;
+	const TlSceneSurface *surfaces;
+	const TlSceneGeometry *geometries;
+	const TlU32 *passes;
+	const char *base;
+	TlU32 i;
+
+	if (size < sizeof(*header) || header->magic != TL_SCENE_MAGIC)
+		return "not a scene file (or written with the other byte order)";
+	if (header->version != TL_SCENE_VERSION || header->headerSize < sizeof(*header))
+		return "unsupported scene file version";
+	if (header->fileSize != size)
+		return "scene file is truncated";
+
+	if (!tlScene_InFile(header, header->entities, header->numEntities, sizeof(TlSceneEntity))
+	|| !tlScene_InFile(header, header->surfaces, header->numSurfaces, sizeof(TlSceneSurface))
+	|| !tlScene_InFile(header, header->geometries, header->numGeometries, sizeof(TlSceneGeometry))
+	|| !tlScene_InFile(header, header->brushes, header->numBrushes, sizeof(TlSceneBrush))
+	|| !tlScene_InFile(header, header->passes, header->numPasses, sizeof(TlU32)))
+		return "scene file table out of range";
+
+	base = (const char *)header;
+	entities = (const TlSceneEntity *)(base + header->entities);
+	surfaces = (const TlSceneSurface *)(base + header->surfaces);
+	geometries = (const TlSceneGeometry *)(base + header->geometries);
+	passes = (const TlU32 *)(base + header->passes);
+
+	for(i=0; i<header->numEntities; i++) {
+		if (entities[i].parent != TL_SCENE_NONE && entities[i].parent >= i)
+			return "scene file entity comes before its parent";
+		if (entities[i].firstSurface > header->numSurfaces
+		|| entities[i].numSurfaces > header->numSurfaces - entities[i].firstSurface)
+			return "scene file entity has surfaces out of range";
+	}
+
+	for(i=0; i<header->numSurfaces; i++) {
+		if (surfaces[i].geometry >= header->numGeometries)
+			return "scene file surface has geometry out of range";
+		if (surfaces[i].firstPass > header->numPasses
+		|| surfaces[i].numPasses > header->numPasses - surfaces[i].firstPass)
+			return "scene file surface has passes out of range";
+		if (surfaces[i].usage > (TlU32)kTlBU_Stream)
+			return "scene file surface has an unknown buffer usage";
+	}
+
+	for(i=0; i<header->numPasses; i++) {
+		if (passes[i] != TL_SCENE_NONE && passes[i] >= header->numBrushes)
+			return "scene file pass has a brush out of range";
+	}
+
+	for(i=0; i<header->numGeometries; i++) {
+		if (!tlScene_IsGeometryValid(header, &geometries[i]))
+			return "scene file geometry is malformed";
+	}
+
+	return (const char *)0;
+}
+
+/* Point a new surface at geometry in the mapped file */
+static void tlScene_MapGeometry(TlSurface *surf, TlSceneFile *file, const TlSceneGeometry *rec) {
+	const char *base;
+	TlVertexLayout *layout;
+
+	base = (const char *)file->data;
+
+	surf->numVerts = rec->numVerts;
+	surf->numInds = rec->numInds;
+	surf->numLodInds = rec->numLodInds;
+	surf->numLods = rec->numLods;
+	memcpy((void *)surf->lods, (const void *)rec->lods, sizeof(surf->lods));
+
+	/* the bounds are in the file; they only need recomputing after changes */
+	surf->bounds = rec->bounds;
+
+	layout = &surf->mapped.layout;
+	layout->attribs = rec->attribs;
+	layout->quantized = (rec->flags & TL_SCENE_GEOMETRY_QUANTIZED) ? TRUE : FALSE;
+	layout->halfTexCoords = (rec->flags & TL_SCENE_GEOMETRY_HALF_TEXCOORDS) ? TRUE : FALSE;
+	layout->stride = rec->stride;
+	layout->position = rec->position;
+	layout->normal = rec->normal;
+	layout->texCoord = rec->texCoord;
+	layout->binormal = rec->binormal;
+	layout->tangent = rec->tangent;
+	layout->color = rec->color;
+	layout->scale = rec->scale;
+	layout->bias = rec->bias;
+
+	surf->mapped.file = file;
+	surf->mapped.verts = (const void *)(base + rec->vertices);
+	surf->mapped.inds = (const void *)(base + rec->indices);
+	surf->mapped.indexType = (rec->flags & TL_SCENE_GEOMETRY_32BIT_INDICES) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	file->refs++;
+
+	surf->gpu.quantize = layout->quantized;
+	surf->gpu.attribs = layout->attribs;
+	surf->gpu.vertsDirty = TRUE;
+	surf->gpu.indsDirty = TRUE;
+}
+
+TlSceneFile *tlOpenSceneFile(const char *filename) {
+	TlSceneFile *file;
+	const char *error;
+	const void *data;
+	size_t size;
+
+	TL_ASSERT( filename != (const char *)0 );
+
+	if (!(data = tlSys_MapFile(filename, &size))) {
+		tlErrorFile(filename, 0, "couldn't map scene file");
+		return (TlSceneFile *)0;
+	}
+
+	if ((error = tlScene_Validate((const TlSceneHeader *)data, size)) != (const char *)0) {
+		errno = 0;
+		tlErrorFile(filename, 0, "%s", error);
+		tlSys_UnmapFile(data, size);
+		return (TlSceneFile *)0;
+	}
+
+	file = tlAllocStruct(TlSceneFile);
+	file->data = data;
+	file->size = size;
+	file->refs = 1;
+
+	return file;
+}
+void tlPrefetchSceneFile(const TlSceneFile *file) {
+	tlSys_PrefetchFile(file->data, file->size);
+}
+size_t tlGetSceneFileSize(const TlSceneFile *file) {
+	return file->size;
+}
+
+TlEntity *tlInstantiateScene(TlSceneFile *file, TlEntity *prnt) {
+	const TlSceneHeader *header;
+	const TlSceneEntity *entities;
+	const TlSceneSurface *surfaces;
+	const TlSceneGeometry *geometries;
+	const TlSceneBrush *brushRecs;
+	const TlU32 *passes;
+	const char *base;
+	TlSurface **owners, *surf;
+	TlEntity **ents, *first;
+	TlBrush **brushes;
+	TlU32 i, j, k, s;
+
+	base = (const char *)file->data;
+	header = (const TlSceneHeader *)base;
+	entities = (const TlSceneEntity *)(base + header->entities);
+	surfaces = (const TlSceneSurface *)(base + header->surfaces);
+	geometries = (const TlSceneGeometry *)(base + header->geometries);
+	brushRecs = (const TlSceneBrush *)(base + header->brushes);
+	passes = (const TlU32 *)(base + header->passes);
+
+	brushes = (TlBrush **)tlMemory((void *)0, (header->numBrushes + 1)*sizeof(TlBrush *));
+	ents = (TlEntity **)tlMemory((void *)0, (header->numEntities + 1)*sizeof(TlEntity *));
+	owners = (TlSurface **)tlMemory((void *)0, (header->numGeometries + 1)*sizeof(TlSurface *));
+	memset((void *)owners, 0, (header->numGeometries + 1)*sizeof(TlSurface *));
+
+	for(i=0; i<header->numBrushes; i++)
+		brushes[i] = tlScene_UnpackBrush(&brushRecs[i]);
+
+	first = (TlEntity *)0;
+	for(i=0; i<header->numEntities; i++) {
+		ents[i] = tlNewEntity(entities[i].parent != TL_SCENE_NONE ? ents[entities[i].parent] : prnt);
+		if (!first)
+			first = ents[i];
+
+		*tlXf_Local(ents[i]->xform) = entities[i].local;
+		tlInvalidateEntity(ents[i]);
+
+		for(j=0; j<entities[i].numSurfaces; j++) {
+			s = entities[i].firstSurface + j;
+			surf = tlNewSurface(ents[i]);
+
+			/* the first surface with each geometry holds it; the rest share it */
+			if (owners[surfaces[s].geometry]) {
+				tlShareSurfaceGeometry(surf, owners[surfaces[s].geometry]);
+			} else {
+				tlScene_MapGeometry(surf, file, &geometries[surfaces[s].geometry]);
+				owners[surfaces[s].geometry] = surf;
+			}
+
+			tlSetSurfaceUsage(surf, (TlBufferUsage_t)surfaces[s].usage);
+
+			for(k=0; k<surfaces[s].numPasses; k++) {
+				if (passes[surfaces[s].firstPass + k] == TL_SCENE_NONE)
+					tlAddSurfacePass(surf, tlFirstBrush());
+				else
+					tlAddSurfacePass(surf, brushes[passes[surfaces[s].firstPass + k]]);
+			}
+		}
+	}
+
+	owners = (TlSurface **)tlMemory((void *)owners, 0);
+	ents = (TlEntity **)tlMemory((void *)ents, 0);
+	brushes = (TlBrush **)tlMemory((void *)brushes, 0);
+
+	return first;
+}
+
+TlEntity *tlLoadScene(const char *filename, TlEntity *prnt) {
+	TlSceneFile *file;
+	TlEntity *first;
+
+	if (!(file = tlOpenSceneFile(filename)))
+		return (TlEntity *)0;
+
+	first = tlInstantiateScene(file, prnt);
+
+	/* unmapped now unless some surface draws from it */
+	tlReleaseSceneFile(file);
+
+	if (!first) {
+		errno = 0;
+		tlErrorFile(filename, 0, "scene file holds no entities");
+	}
+
+	return first;
+}
@@ -3,6 +3,7 @@
 #include <tile/math.h>
 #include <tile/brush.h>
 #include <tile/surface.h>
+#include <tile/mesh.h>
 
 /*
  * ==========================================================================
@@ -11,15 +12,58 @@
  *
  * ==========================================================================
  */
-TlEntity *tlNewTriangle(TlBrush *brush) {
-	unsigned short *tri;
+
+/*
+ * Each primitive keeps the geometry of the last one it built in an
+ * entity-less surface. New primitives with the same dimensions share it rather
+ * than building their own, so the render queue can draw them as instances.
+ * (Writing to a primitive's vertices gives it a private copy.)
+ */
+typedef struct ShapeCache_s {
+	TlSurface *geom;
+	float params[3];
+} ShapeCache;
+static ShapeCache g_triangleCache = { (TlSurface *)0, { 0.0f, 0.0f, 0.0f } };
+static ShapeCache g_planeCache = { (TlSurface *)0, { 0.0f, 0.0f, 0.0f } };
+static ShapeCache g_boxCache = { (TlSurface *)0, { 0.0f, 0.0f, 0.0f } };
+
+/* Retrieve cached geometry for the given parameters; NULL if it needs building */
+static TlSurface *FindCachedShape(ShapeCache *cache, float a, float b, float c) {
+	if( cache->geom && cache->params[0]==a && cache->params[1]==b && cache->params[2]==c ) {
+		return cache->geom;
+	}
+
+	return (TlSurface *)0;
+}
+/* Replace the cached geometry with a new, empty surface for the given parameters */
+static TlSurface *NewCachedShape(ShapeCache *cache, float a, float b, float c) {
+	tlDeleteSurface(cache->geom);
+
+	cache->geom = tlNewSurface((TlEntity *)0);
+	cache->params[0] = a;
+	cache->params[1] = b;
+	cache->params[2] = c;
+
+	return cache->geom;
+}
+/* Create an entity with a single surface drawing the given geometry */
+static TlEntity *NewShapeEntity(TlSurface *geom, TlBrush *brush) {
 	TlSurface *surf;
 	TlEntity *ent;
-	TlVertex *verts;
 
 	ent = tlNewEntity((TlEntity *)0);
 	surf = tlNewSurface(ent);
 
+	tlShareSurfaceGeometry(surf, geom);
+	tlAddSurfacePass(surf, brush);
+
+	return ent;
+}
+
+static void BuildTriangle(TlSurface *surf) {
+	TlU32 *tri;
+	TlVertex *verts;
+
 	verts = tlAddSurfaceVertices(surf, 3);
 	tri = tlAddSurfaceTriangles(surf, 1);
 
@@ -38,22 +82,23 @@ TlEntity *tlNewTriangle(TlBrush *brush) {
 	tri[0] = 0;
 	tri[1] = 1;
 	tri[2] = 2;
+}
+TlEntity *tlNewTriangle(TlBrush *brush) {
+	TlSurface *geom;
 
-	tlAddSurfacePass(surf, brush);
+	if( !( geom = FindCachedShape(&g_triangleCache, 0.0f, 0.0f, 0.0f) ) ) {
+		geom = NewCachedShape(&g_triangleCache, 0.0f, 0.0f, 0.0f);
+		BuildTriangle(geom);
+	}
 
-	return ent;
+	return NewShapeEntity(geom, brush);
 }
 
-TlEntity *tlNewPlane(TlBrush *brush, float w,float h) {
-	unsigned short *tris;
-	TlSurface *surf;
-	TlEntity *ent;
+static void BuildPlane(TlSurface *surf, float w,float h) {
+	TlU32 *tris;
 	TlVertex *verts;
 	float x,y;
 
-	ent = tlNewEntity((TlEntity *)0);
-	surf = tlNewSurface(ent);
-
 	verts = tlAddSurfaceVertices(surf, 4);
 	tris = tlAddSurfaceTriangles(surf, 2);
 
@@ -87,10 +132,16 @@ TlEntity *tlNewPlane(TlBrush *brush, float w,float h) {
 	*tris++ = 0;
 	*tris++ = 2;
 	*tris++ = 3;
+}
+TlEntity *tlNewPlane(TlBrush *brush, float w,float h) {
+	TlSurface *geom;
 
-	tlAddSurfacePass(surf, brush);
+	if( !( geom = FindCachedShape(&g_planeCache, w, h, 0.0f) ) ) {
+		geom = NewCachedShape(&g_planeCache, w, h, 0.0f);
+		BuildPlane(geom, w, h);
+	}
 
-	return ent;
+	return NewShapeEntity(geom, brush);
 }
 
 static void SetCorner(TlVertex *verts, TlUInt A, TlUInt B, TlUInt C, float x, float y, float z) {
@@ -114,7 +165,7 @@ static void SetFaceNormal(TlVertex *verts, float x, float y, float z) {
 	tlSetVertexNormal(&verts[2], x,y,z);
 	tlSetVertexNormal(&verts[3], x,y,z);
 }
-TlEntity *tlNewBox(TlBrush *brush, float w, float h, float d) {
+static void BuildBox(TlSurface *surf, float w, float h, float d) {
 #define F_FRONT		0
 #define F_LEFT		1
 #define F_TOP		2
@@ -127,9 +178,7 @@ TlEntity *tlNewBox(TlBrush *brush, float w, float h, float d) {
 #define I_RIGHT		(F_RIGHT*4)
 #define I_BACK		(F_BACK*4)
 #define I_BOTTOM	(F_BOTTOM*4)
-	unsigned short *tris;
-	TlSurface *surf;
-	TlEntity *ent;
+	TlU32 *tris;
 	TlVertex *verts;
 	float x,y,z;
 	TlUInt i;
@@ -147,9 +196,6 @@ TlEntity *tlNewBox(TlBrush *brush, float w, float h, float d) {
 	
 	*/
 
-	ent = tlNewEntity((TlEntity *)0);
-	surf = tlNewSurface(ent);
-
 	verts = tlAddSurfaceVertices(surf, 24);
 	tris = tlAddSurfaceTriangles(surf, 12);
 
@@ -186,10 +232,17 @@ TlEntity *tlNewBox(TlBrush *brush, float w, float h, float d) {
 		*tris++ = i*4 + 2;
 		*tris++ = i*4 + 3;
 	}
+}
+TlEntity *tlNewBox(TlBrush *brush, float w, float h, float d) {
+	TlSurface *geom;
 
-	tlAddSurfacePass(surf, brush);
+	if( !( geom = FindCachedShape(&g_boxCache, w, h, d) ) ) {
+		geom = NewCachedShape(&g_boxCache, w, h, d);
+		BuildBox(geom, w, h, d);
+		tlOptimizeSurface(geom, TL_OPTIMIZE_ALL);
+	}
 
-	return ent;
+	return NewShapeEntity(geom, brush);
 }
 TlEntity *tlNewCube(TlBrush *brush, float r) {
 	return tlNewBox(brush, r, r, r);
@@ -215,7 +268,7 @@ static void figureEightTorus_f(float *xyz, float c, float u, float v) {
 }
 
 TlEntity *tlNewFigureEightTorus(TlBrush *brush, float c, TlUInt segs) {
-	unsigned short *tris, idx;
+	TlU32 *tris, idx;
 	TlSurface *surf;
 	TlEntity *ent;
 	TlVertex *verts;
@@ -280,6 +333,11 @@ TlEntity *tlNewFigureEightTorus(TlBrush *brush, float c, TlUInt segs) {
 		}
 	}
 
+	/* neighboring quads share their edges' vertices once welded */
+	tlOptimizeSurface(surf, TL_OPTIMIZE_ALL);
+	/* finely tessellated; far away, a fraction of the triangles will do */
+	tlGenerateSurfaceLods(surf, 0, 0.0f);
+
 	tlAddSurfacePass(surf, brush);
 
 	return ent;
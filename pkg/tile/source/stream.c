@@ -0,0 +1,398 @@
+#include <tile/stream.h>
+#include <tile/scene.h>
+#include <tile/entity.h>
+#include <tile/surface.h>
+#include <tile/system.h>
+
+/*
+ * ==========================================================================
+ *
+ *	REQUESTS
+ *
+ * ==========================================================================
+ */
+
+#define STREAM_MAX_THREADS 16
+
+typedef struct StreamRequest_s {
+	char *filename;
+	/* parent of the new roots; TL_HANDLE_NONE for root entities */
+	TlHandle prnt;
+	TlBool hasPrnt;
+
+	TlStreamFn_t fn;
+	void *parm;
+
+	/* set by the loader; NULL if the file couldn't be loaded */
+	TlSceneFile *file;
+
+	/* main thread: the first new root and the surfaces left to upload */
+	TlHandle first;
+	TlHandle *surfaces;
+	TlU32 numSurfaces;
+	TlU32 maxSurfaces;
+	TlU32 nextSurface;
+
+	struct StreamRequest_s *next;
+} StreamRequest;
+
+typedef struct StreamList_s {
+	StreamRequest *head;
+	StreamRequest *tail;
+} StreamList;
+
+/* requests waiting for a loader, and those loaded; both under the lock */
+static TlMutex g_strmLock;
+static StreamList g_strmQueue = { ( StreamRequest * )0, ( StreamRequest * )0 };
+static StreamList g_strmLoaded = { ( StreamRequest * )0, ( StreamRequest * )0 };
+
+/* loaders sleep here; each request queued signals it once */
+static TlSemaphore g_strmWake;
+static TlThread *g_strmThreads[ STREAM_MAX_THREADS ];
+static TlU32 g_strmNumThreads = 0;
+
+/* main thread only: requests being uploaded, in the order they were loaded */
+static StreamList g_strmActive = { ( StreamRequest * )0, ( StreamRequest * )0 };
+
+static size_t g_strmByteBudget = TL_STREAM_DEFAULT_BYTE_BUDGET;
+static TlU32 g_strmTimeBudget = TL_STREAM_DEFAULT_TIME_BUDGET;
+static TlStreamStats g_strmStats;
+
+static void tlStream_Append( StreamList *list, StreamRequest *req )
+{
+	req->next = ( StreamRequest * )0;
+
+	if( list->tail != ( StreamRequest * )0 ) {
+		list->tail->next = req;
+	} else {
+		list->head = req;
+	}
+	list->tail = req;
+}
+static StreamRequest *tlStream_PopFront( StreamList *list )
+{
+	StreamRequest *req;
+
+	if( !( req = list->head ) ) {
+		return ( StreamRequest * )0;
+	}
+
+	list->head = req->next;
+	if( !list->head ) {
+		list->tail = ( StreamRequest * )0;
+	}
+
+	req->next = ( StreamRequest * )0;
+	return req;
+}
+
+static void tlStream_FreeRequest( StreamRequest *req )
+{
+	if( req->file != ( TlSceneFile * )0 ) {
+		tlReleaseSceneFile( req->file );
+	}
+
+	tlMemory( ( void * )req->surfaces, 0 );
+	tlMemory( ( void * )req->filename, 0 );
+	tlMemory( ( void * )req, 0 );
+}
+/* Run the callback and let go of the request */
+static void tlStream_Finish( StreamRequest *req )
+{
+	TlEntity *first;
+
+	first = tlEntityFromHandle( req->first );
+	if( req->fn != ( TlStreamFn_t )0 ) {
+		req->fn( req->parm, first );
+	}
+
+	--g_strmStats.numPending;
+	tlStream_FreeRequest( req );
+}
+
+/*
+ * ==========================================================================
+ *
+ *	LOADERS
+ *
+ * ==========================================================================
+ */
+
+/* Any thread: map and check the file, then read it in ahead of the uploads */
+static void tlStream_Load( StreamRequest *req )
+{
+	if( ( req->file = tlOpenSceneFile( req->filename ) ) != ( TlSceneFile * )0 ) {
+		tlPrefetchSceneFile( req->file );
+	}
+}
+
+static void tlStream_LoaderThread( void *parm )
+{
+	StreamRequest *req;
+
+	( void )parm;
+
+	for(;;) {
+		tlSys_WaitSemaphore( &g_strmWake );
+
+		tlSys_LockMutex( &g_strmLock );
+		req = tlStream_PopFront( &g_strmQueue );
+		tlSys_UnlockMutex( &g_strmLock );
+
+		/* quitting signals once per thread, after the last request */
+		if( !req ) {
+			break;
+		}
+
+		tlStream_Load( req );
+
+		tlSys_LockMutex( &g_strmLock );
+		tlStream_Append( &g_strmLoaded, req );
+		tlSys_UnlockMutex( &g_strmLock );
+	}
+}
+
+void tlStream_Init( TlU32 numThreads )
+{
+	TlU32 i;
+
+	if( g_strmNumThreads > 0 ) {
+		return;
+	}
+
+	if( !numThreads ) {
+		numThreads = TL_STREAM_DEFAULT_THREADS;
+	}
+	if( numThreads > STREAM_MAX_THREADS ) {
+		numThreads = STREAM_MAX_THREADS;
+	}
+
+	tlSys_InitMutex( &g_strmLock );
+	tlSys_InitSemaphore( &g_strmWake, 0 );
+
+	for( i = 0; i < numThreads; ++i ) {
+		g_strmThreads[ i ] = tlSys_NewThread( &tlStream_LoaderThread, ( void * )0 );
+	}
+	g_strmNumThreads = numThreads;
+}
+void tlStream_Fini( void )
+{
+	StreamRequest *req;
+	TlSurface *surf;
+	TlU32 i;
+
+	if( g_strmNumThreads > 0 ) {
+		tlSys_LockMutex( &g_strmLock );
+		while( ( req = tlStream_PopFront( &g_strmQueue ) ) != ( StreamRequest * )0 ) {
+			--g_strmStats.numPending;
+			tlStream_FreeRequest( req );
+		}
+		tlSys_UnlockMutex( &g_strmLock );
+
+		tlSys_SignalSemaphore( &g_strmWake, g_strmNumThreads );
+		for( i = 0; i < g_strmNumThreads; ++i ) {
+			tlSys_JoinThread( g_strmThreads[ i ] );
+			g_strmThreads[ i ] = ( TlThread * )0;
+		}
+		g_strmNumThreads = 0;
+
+		tlSys_FiniSemaphore( &g_strmWake );
+		tlSys_FiniMutex( &g_strmLock );
+	}
+
+	while( ( req = tlStream_PopFront( &g_strmLoaded ) ) != ( StreamRequest * )0 ) {
+		--g_strmStats.numPending;
+		tlStream_FreeRequest( req );
+	}
+
+	while( ( req = tlStream_PopFront( &g_strmActive ) ) != ( StreamRequest * )0 ) {
+		for( ; req->nextSurface < req->numSurfaces; ++req->nextSurface ) {
+			if( ( surf = tlSurfaceFromHandle( req->surfaces[ req->nextSurface ] ) ) != ( TlSurface * )0 ) {
+				while( tlUploadSurfacePart( surf, ~( size_t )0 ) > 0 ) {
+					( void )0;
+				}
+			}
+		}
+
+		tlStream_Finish( req );
+	}
+}
+
+void tlStreamScene( const char *filename, TlEntity *prnt, TlStreamFn_t fn, void *parm )
+{
+	StreamRequest *req;
+	size_t n;
+
+	TL_ASSERT( filename != ( const char * )0 );
+
+	req = tlAllocStruct( StreamRequest );
+	memset( ( void * )req, 0, sizeof( *req ) );
+
+	n = strlen( filename ) + 1;
+	req->filename = ( char * )tlMemory( ( void * )0, n );
+	memcpy( ( void * )req->filename, ( const void * )filename, n );
+
+	/* the parent may be deleted before the file is loaded */
+	req->prnt = prnt != ( TlEntity * )0 ? tlGetEntityHandle( prnt ) : TL_HANDLE_NONE;
+	req->hasPrnt = prnt != ( TlEntity * )0;
+	req->fn = fn;
+	req->parm = parm;
+
+	++g_strmStats.numPending;
+
+	if( !g_strmNumThreads ) {
+		tlStream_Load( req );
+		tlStream_Append( &g_strmLoaded, req );
+		return;
+	}
+
+	tlSys_LockMutex( &g_strmLock );
+	tlStream_Append( &g_strmQueue, req );
+	tlSys_UnlockMutex( &g_strmLock );
+
+	tlSys_SignalSemaphore( &g_strmWake, 1 );
+}
+
+/*
+ * ==========================================================================
+ *
+ *	UPLOADS
+ *
+ * ==========================================================================
+ */
+
+/* Defer the uploads of the surfaces holding geometry under `ent` */
+static void tlStream_CollectR( StreamRequest *req, TlEntity *ent )
+{
+	TlSurface *surf;
+	TlEntity *chld;
+
+	for( surf = ent->s_head; surf != ( TlSurface * )0; surf = surf->s_next ) {
+		/* sharers are drawn once the surface they share with is uploaded */
+		if( tlGetSurfaceGeometry( surf ) != surf ) {
+			continue;
+		}
+
+		if( req->numSurfaces == req->maxSurfaces ) {
+			req->maxSurfaces = req->maxSurfaces ? req->maxSurfaces*2 : 16;
+			req->surfaces = ( TlHandle * )tlMemory( ( void * )req->surfaces,
+				req->maxSurfaces*sizeof( TlHandle ) );
+		}
+
+		tlDeferSurfaceUpload( surf );
+		req->surfaces[ req->numSurfaces++ ] = tlGetSurfaceHandle( surf );
+	}
+
+	for( chld = ent->head; chld != ( TlEntity * )0; chld = chld->next ) {
+		tlStream_CollectR( req, chld );
+	}
+}
+/* Create a loaded file's entities; returns FALSE if the request is finished */
+static TlBool tlStream_Instantiate( StreamRequest *req )
+{
+	TlEntity *prnt, *first, *ent;
+
+	if( !req->file ) {
+		return FALSE;
+	}
+
+	prnt = ( TlEntity * )0;
+	if( req->hasPrnt && !( prnt = tlEntityFromHandle( req->prnt ) ) ) {
+		return FALSE;
+	}
+
+	/* the surfaces hold the file from here on */
+	first = tlInstantiateScene( req->file, prnt );
+	tlReleaseSceneFile( req->file );
+	req->file = ( TlSceneFile * )0;
+
+	if( !first ) {
+		errno = 0;
+		tlErrorFile( req->filename, 0, "scene file holds no entities" );
+		return FALSE;
+	}
+
+	/* new roots are added after every existing one */
+	req->first = tlGetEntityHandle( first );
+	for( ent = first; ent != ( TlEntity * )0; ent = ent->next ) {
+		tlStream_CollectR( req, ent );
+	}
+
+	return TRUE;
+}
+
+void tlStream_Update( void )
+{
+	StreamRequest *loaded, *req;
+	TlSurface *surf;
+	TlU64 start, now;
+	size_t budget, n;
+
+	start = tlSys_Microtime();
+	g_strmStats.numBytesLastUpdate = 0;
+
+	if( g_strmNumThreads > 0 ) {
+		tlSys_LockMutex( &g_strmLock );
+		loaded = g_strmLoaded.head;
+		g_strmLoaded.head = ( StreamRequest * )0;
+		g_strmLoaded.tail = ( StreamRequest * )0;
+		tlSys_UnlockMutex( &g_strmLock );
+	} else {
+		loaded = g_strmLoaded.head;
+		g_strmLoaded.head = ( StreamRequest * )0;
+		g_strmLoaded.tail = ( StreamRequest * )0;
+	}
+
+	/* creating entities does no per-vertex work; only the uploads are budgeted */
+	while( ( req = loaded ) != ( StreamRequest * )0 ) {
+		loaded = req->next;
+
+		if( tlStream_Instantiate( req ) ) {
+			tlStream_Append( &g_strmActive, req );
+		} else {
+			tlStream_Finish( req );
+		}
+	}
+
+	budget = g_strmByteBudget;
+	while( ( req = g_strmActive.head ) != ( StreamRequest * )0 ) {
+		if( req->nextSurface == req->numSurfaces ) {
+			tlStream_Finish( tlStream_PopFront( &g_strmActive ) );
+			continue;
+		}
+
+		if( !budget ) {
+			break;
+		}
+		now = tlSys_Microtime();
+		if( now - start >= g_strmTimeBudget ) {
+			break;
+		}
+
+		/* a deleted surface, or one that's done, moves on to the next */
+		surf = tlSurfaceFromHandle( req->surfaces[ req->nextSurface ] );
+		if( !surf || !( n = tlUploadSurfacePart( surf, budget ) ) ) {
+			++req->nextSurface;
+			continue;
+		}
+
+		budget = n < budget ? budget - n : 0;
+		g_strmStats.numBytesLastUpdate += n;
+		g_strmStats.numBytesTotal += n;
+	}
+
+	g_strmStats.lastUpdateMicrosecs = ( TlU32 )( tlSys_Microtime() - start );
+}
+
+void tlStream_SetBudget( size_t numBytes, TlU32 microsecs )
+{
+	g_strmByteBudget = numBytes > 0 ? numBytes : TL_STREAM_DEFAULT_BYTE_BUDGET;
+	g_strmTimeBudget = microsecs > 0 ? microsecs : TL_STREAM_DEFAULT_TIME_BUDGET;
+}
+
+void tlStream_GetStats( TlStreamStats *stats )
+{
+	TL_ASSERT( stats != ( TlStreamStats * )0 );
+
+	*stats = g_strmStats;
+}
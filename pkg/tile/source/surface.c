@@ -8,10 +8,65 @@
  * ==========================================================================
  */
 
+static TlU32 g_surf_nextId = 0;
+static TlPool g_surf_pool = TL_POOL_INITIALIZER("surface", TlSurface);
+
+/*
+ * Surfaces whose bounds need recomputing. Keeping a list lets the render queue
+ * bring them all up to date before its worker threads read them.
+ */
+static size_t g_surf_numDirty = 0;
+static size_t g_surf_maxDirty = 0;
+static TlSurface **g_surf_dirty = (TlSurface **)0;
+
+static void tlSurf_DirtyBounds(TlSurface *surf) {
+	if (surf->boundsDirty)
+		return;
+
+	if (g_surf_numDirty == g_surf_maxDirty) {
+		g_surf_maxDirty = g_surf_maxDirty ? g_surf_maxDirty*2 : 64;
+		g_surf_dirty = (TlSurface **)tlMemory((void *)g_surf_dirty,
+			g_surf_maxDirty*sizeof(TlSurface *));
+	}
+
+	surf->boundsDirty = TRUE;
+	surf->boundsIndex = g_surf_numDirty;
+	g_surf_dirty[g_surf_numDirty++] = surf;
+}
+static void tlSurf_UndirtyBounds(TlSurface *surf) {
+	TlSurface *last;
+
+	if (!surf->boundsDirty)
+		return;
+
+	last = g_surf_dirty[--g_surf_numDirty];
+	g_surf_dirty[surf->boundsIndex] = last;
+	last->boundsIndex = surf->boundsIndex;
+
+	surf->boundsDirty = FALSE;
+}
+
+static void tlSurf_DeleteBuffers(GLuint *buffers) {
+	int i;
+
+	for(i=0; i<TL_SURFACE_MAX_BUFFERS; i++) {
+		if (buffers[i]) {
+			tlR_DeleteBuffers(1, &buffers[i]);
+			buffers[i] = 0;
+		}
+	}
+}
+
+/*
+ * Surfaces without an entity aren't drawn; they only hold geometry for other
+ * surfaces to share (see the shape caches in shapes.c)
+ */
 TlSurface *tlNewSurface(TlEntity *ent) {
 	TlSurface *surf;
 
-	surf = tlAllocStruct(TlSurface);
+	surf = (TlSurface *)tlPoolAlloc(&g_surf_pool);
+
+	surf->id = g_surf_nextId++;
 
 	surf->numVerts = 0;
 	surf->maxVerts = 0;
@@ -19,14 +74,40 @@ TlSurface *tlNewSurface(TlEntity *ent) {
 
 	surf->numInds = 0;
 	surf->maxInds = 0;
-	surf->inds = (unsigned short *)0;
+	surf->inds = (TlU32 *)0;
+
+	surf->numLods = 0;
+	surf->lodInds = (TlU32 *)0;
+	surf->numLodInds = 0;
+	surf->lodCurrent = 0;
 
 	surf->numPasses = 0;
 	surf->passes = (TlBrush **)0;
 
+	surf->geomSrc = (TlSurface *)0;
+	surf->geomRefs = 0;
+	surf->isOrphaned = FALSE;
+
+	memset((void *)&surf->bounds, 0, sizeof(surf->bounds));
+	surf->bounds.radius = -1.0f;
+	surf->boundsDirty = FALSE;
+	surf->boundsIndex = 0;
+
+	memset((void *)&surf->gpu, 0, sizeof(surf->gpu));
+	surf->gpu.usage = kTlBU_Static;
+	surf->gpu.vertsDirty = TRUE;
+	surf->gpu.indsDirty = TRUE;
+	surf->gpu.indexType = GL_UNSIGNED_SHORT;
+
+	memset((void *)&surf->mapped, 0, sizeof(surf->mapped));
+
 	surf->ent = ent;
 
+	surf->s_prev = (TlSurface *)0;
 	surf->s_next = (TlSurface *)0;
+	if (!ent)
+		return surf;
+
 	if ((surf->s_prev = ent->s_tail) != (TlSurface *)0)
 		ent->s_tail->s_next = surf;
 	else
@@ -35,37 +116,174 @@ TlSurface *tlNewSurface(TlEntity *ent) {
 
 	return surf;
 }
+static void tlSurf_FreeLods(TlSurface *surf) {
+	surf->lodInds = (TlU32 *)tlMemory((void *)surf->lodInds, 0);
+	surf->numLodInds = 0;
+	surf->numLods = 0;
+	surf->lodCurrent = 0;
+}
+static void tlSurf_ReleaseMapping(TlSurface *surf) {
+	if (!surf->mapped.file)
+		return;
+
+	tlReleaseSceneFile(surf->mapped.file);
+	memset((void *)&surf->mapped, 0, sizeof(surf->mapped));
+}
+static void tlSurf_ReleaseGeometry(TlSurface *src) {
+	TL_ASSERT( src->geomRefs > 0 );
+
+	if (--src->geomRefs == 0 && src->isOrphaned)
+		tlDeleteSurface(src);
+}
 TlSurface *tlDeleteSurface(TlSurface *surf) {
 	int i;
 
 	if (!surf)
 		return (TlSurface *)0;
 
-	surf->verts = (TlVertex *)tlMemory((void *)surf->verts, 0);
-	surf->inds = (unsigned short *)tlMemory((void *)surf->inds, 0);
-
 	for(i=0; i<surf->numPasses; i++)
 		tlDeleteBrush(surf->passes[i]);
 
 	surf->passes = (TlBrush **)tlMemory((void *)surf->passes, 0);
+	surf->numPasses = 0;
+
+	if (surf->ent) {
+		if (surf->s_prev)
+			surf->s_prev->s_next = surf->s_next;
+		if (surf->s_next)
+			surf->s_next->s_prev = surf->s_prev;
+
+		if (surf->ent->s_head==surf)
+			surf->ent->s_head = surf->s_next;
+		if (surf->ent->s_tail==surf)
+			surf->ent->s_tail = surf->s_prev;
+
+		surf->ent = (TlEntity *)0;
+		surf->s_prev = (TlSurface *)0;
+		surf->s_next = (TlSurface *)0;
+	}
+
+	/* other surfaces still draw with this one's geometry; keep it around */
+	if (surf->geomRefs > 0) {
+		surf->isOrphaned = TRUE;
+		return (TlSurface *)0;
+	}
+
+	if (surf->geomSrc)
+		tlSurf_ReleaseGeometry(surf->geomSrc);
+
+	tlSurf_UndirtyBounds(surf);
+
+	tlSurf_DeleteBuffers(surf->gpu.vbo);
+	tlSurf_DeleteBuffers(surf->gpu.ibo);
+
+	surf->verts = (TlVertex *)tlMemory((void *)surf->verts, 0);
+	surf->inds = (TlU32 *)tlMemory((void *)surf->inds, 0);
+	tlSurf_FreeLods(surf);
+	tlSurf_ReleaseMapping(surf);
+
+	return (TlSurface *)tlPoolFree(&g_surf_pool, (void *)surf);
+}
+
+TlHandle tlGetSurfaceHandle(const TlSurface *surf) {
+	return tlPoolHandle(&g_surf_pool, (const void *)surf);
+}
+TlSurface *tlSurfaceFromHandle(TlHandle h) {
+	return (TlSurface *)tlPoolLookup(&g_surf_pool, h);
+}
+void tlGetSurfacePoolStats(TlPoolStats *stats) {
+	tlGetPoolStats(&g_surf_pool, stats);
+}
+
+void tlShareSurfaceGeometry(TlSurface *surf, TlSurface *src) {
+	src = tlGetSurfaceGeometry(src);
+	if (src == tlGetSurfaceGeometry(surf))
+		return;
+
+	TL_ASSERT( surf->geomRefs == 0 ); /* others can't share a sharer */
+
+	src->geomRefs++;
+	if (surf->geomSrc)
+		tlSurf_ReleaseGeometry(surf->geomSrc);
+	surf->geomSrc = src;
+
+	tlSurf_DeleteBuffers(surf->gpu.vbo);
+	tlSurf_DeleteBuffers(surf->gpu.ibo);
+	memset((void *)surf->gpu.vboSize, 0, sizeof(surf->gpu.vboSize));
+	memset((void *)surf->gpu.iboSize, 0, sizeof(surf->gpu.iboSize));
+
+	surf->verts = (TlVertex *)tlMemory((void *)surf->verts, 0);
+	surf->inds = (TlU32 *)tlMemory((void *)surf->inds, 0);
+	surf->numVerts = 0;
+	surf->maxVerts = 0;
+	surf->numInds = 0;
+	surf->maxInds = 0;
+	tlSurf_FreeLods(surf);
+	tlSurf_ReleaseMapping(surf);
+}
+TlSurface *tlGetSurfaceGeometry(const TlSurface *surf) {
+	return surf->geomSrc ? surf->geomSrc : (TlSurface *)surf;
+}
+
+/*
+ * Give a surface sharing another's geometry (or still drawing from a scene
+ * file) its own copy, prior to writing
+ */
+static void tlSurf_Unshare(TlSurface *surf) {
+	TlSurface *src;
+	size_t n;
+
+	if (!(src = surf->geomSrc)) {
+		tlUnmapSurface(surf);
+		return;
+	}
+
+	tlUnmapSurface(src);
+
+	surf->numVerts = src->numVerts;
+	surf->maxVerts = src->numVerts;
+	n = surf->maxVerts*sizeof(TlVertex);
+	if (n) {
+		surf->verts = (TlVertex *)tlMemory((void *)0, n);
+		memcpy((void *)surf->verts, (const void *)src->verts, n);
+	}
+
+	surf->numInds = src->numInds;
+	surf->maxInds = src->numInds;
+	n = surf->maxInds*sizeof(TlU32);
+	if (n) {
+		surf->inds = (TlU32 *)tlMemory((void *)0, n);
+		memcpy((void *)surf->inds, (const void *)src->inds, n);
+	}
+
+	surf->numLods = src->numLods;
+	memcpy((void *)surf->lods, (const void *)src->lods, sizeof(surf->lods));
+	surf->numLodInds = src->numLodInds;
+	n = surf->numLodInds*sizeof(TlU32);
+	if (n) {
+		surf->lodInds = (TlU32 *)tlMemory((void *)0, n);
+		memcpy((void *)surf->lodInds, (const void *)src->lodInds, n);
+	}
 
-	if (surf->s_prev)
-		surf->s_prev->s_next = surf->s_next;
-	if (surf->s_next)
-		surf->s_next->s_prev = surf->s_prev;
+	surf->gpu.quantize = src->gpu.quantize;
+	surf->gpu.attribs |= src->gpu.attribs;
 
-	if (surf->ent->s_head==surf)
-		surf->ent->s_head = surf->s_next;
-	if (surf->ent->s_tail==surf)
-		surf->ent->s_tail = surf->s_prev;
+	surf->geomSrc = (TlSurface *)0;
+	tlSurf_ReleaseGeometry(src);
 
-	return (TlSurface *)tlMemory((void *)surf, 0);
+	surf->gpu.vertsDirty = TRUE;
+	surf->gpu.indsDirty = TRUE;
+	tlSurf_DirtyBounds(surf);
 }
 
-TlVertex *tlAddSurfaceVertices(TlSurface *surf, unsigned short numVerts) {
+TlVertex *tlAddSurfaceVertices(TlSurface *surf, unsigned int numVerts) {
 #define VERT_GRAN 8
 	size_t n;
 
+	tlSurf_Unshare(surf);
+
+	TL_ASSERT( surf->numVerts + numVerts >= surf->numVerts ); /* overflow */
+
 	if (surf->numVerts + numVerts > surf->maxVerts) {
 		surf->maxVerts  = surf->numVerts + numVerts;
 		surf->maxVerts -= surf->maxVerts%VERT_GRAN;
@@ -76,32 +294,42 @@ TlVertex *tlAddSurfaceVertices(TlSurface *surf, unsigned short numVerts) {
 		surf->verts = (TlVertex *)tlMemory((void *)surf->verts, n);
 	}
 
+	/* zeroed so attributes nobody sets don't differ (see tlWeldVertices) */
 	n = surf->numVerts;
+	memset((void *)&surf->verts[n], 0, numVerts*sizeof(TlVertex));
 	surf->numVerts += numVerts;
 
+	surf->gpu.vertsDirty = TRUE;
+	tlSurf_DirtyBounds(surf);
+
 	return &surf->verts[n];
 #undef VERT_GRAN
 }
-unsigned short *tlAddSurfaceTriangles(TlSurface *surf, unsigned int numTris) {
+TlU32 *tlAddSurfaceTriangles(TlSurface *surf, unsigned int numTris) {
 #define IND_GRAN 16
+	unsigned int numInds;
 	size_t n;
-	int numInds;
+
+	tlSurf_Unshare(surf);
 
 	numInds = numTris*3;
 
 	if (surf->numInds + numInds > surf->maxInds) {
 		surf->maxInds  = surf->numInds + numInds;
-		surf->maxInds -= surf->numInds%IND_GRAN;
+		surf->maxInds -= surf->maxInds%IND_GRAN;
 		surf->maxInds += IND_GRAN;
 
-		n = surf->maxInds*sizeof(unsigned short);
+		n = surf->maxInds*sizeof(TlU32);
 
-		surf->inds = (unsigned short *)tlMemory((void *)surf->inds, n);
+		surf->inds = (TlU32 *)tlMemory((void *)surf->inds, n);
 	}
 
 	n = surf->numInds;
 	surf->numInds += numInds;
 
+	tlClearSurfaceLods(surf);
+	surf->gpu.indsDirty = TRUE;
+
 	return &surf->inds[n];
 #undef IND_GRAN
 }
@@ -118,6 +346,591 @@ void tlAddSurfacePass(TlSurface *surf, TlBrush *brush) {
 
 	surf->passes[surf->numPasses++] = brush;
 	brush->refCnt++;
+
+	tlRequireSurfaceVertexAttribs(surf, tlGetBrushVertexAttribs(brush));
+}
+
+/* Where one piece of a split surface starts, and how big it is */
+typedef struct SurfPiece_s {
+	unsigned int firstTri, numTris;
+	unsigned int numVerts;
+} SurfPiece;
+
+/* Count the distinct vertices of `tri` not yet stamped with `stamp` */
+static unsigned int tlSurf_CountNewVerts(const TlU32 *owner, const TlU32 *tri,
+TlU32 stamp) {
+	unsigned int n;
+
+	n = 0;
+	if (owner[tri[0]] != stamp)
+		n++;
+	if (owner[tri[1]] != stamp && tri[1] != tri[0])
+		n++;
+	if (owner[tri[2]] != stamp && tri[2] != tri[0] && tri[2] != tri[1])
+		n++;
+
+	return n;
+}
+/* New surface with the same passes and settings as `surf`, minus geometry */
+static TlSurface *tlSurf_NewPiece(TlSurface *surf) {
+	TlSurface *piece;
+	int i;
+
+	piece = tlNewSurface(surf->ent);
+
+	for(i=0; i<surf->numPasses; i++)
+		tlAddSurfacePass(piece, surf->passes[i]);
+
+	tlSetSurfaceUsage(piece, (TlBufferUsage_t)surf->gpu.usage);
+	piece->gpu.quantize = surf->gpu.quantize;
+	piece->gpu.attribs |= surf->gpu.attribs;
+
+	return piece;
+}
+
+unsigned int tlSplitSurface(TlSurface *surf, unsigned int maxVerts) {
+	unsigned int numPieces, maxPieces, numTris, numNew, t, p, k, n;
+	TlVertex *oldVerts, *verts;
+	TlU32 *oldInds, *inds;
+	TlU32 *owner, *local;
+	SurfPiece *pieces;
+	TlSurface *dst;
+	size_t size;
+	TlU32 v;
+
+	if (!maxVerts)
+		maxVerts = TL_SURFACE_MAX_SHORT_VERTS;
+
+	TL_ASSERT( maxVerts >= 3 );
+	TL_ASSERT( !surf->geomSrc && !surf->geomRefs ); /* shared geometry */
+
+	if (surf->numVerts <= maxVerts || surf->geomSrc || surf->geomRefs)
+		return 1;
+
+	tlUnmapSurface(surf);
+
+	numTris = surf->numInds/3;
+
+	/* per vertex: piece number (plus one) that last used it, and its index there */
+	size = surf->numVerts*sizeof(TlU32);
+	owner = (TlU32 *)tlMemory((void *)0, size);
+	local = (TlU32 *)tlMemory((void *)0, size);
+	memset((void *)owner, 0, size);
+
+	/* find where each piece starts, keeping the triangles in order */
+	numPieces = 0;
+	maxPieces = 0;
+	pieces = (SurfPiece *)0;
+	for(t=0; t<numTris; t++) {
+		inds = &surf->inds[t*3];
+
+		numNew = tlSurf_CountNewVerts(owner, inds, numPieces);
+		if (!numPieces || pieces[numPieces - 1].numVerts + numNew > maxVerts) {
+			if (numPieces == maxPieces) {
+				maxPieces = maxPieces ? maxPieces*2 : 8;
+				pieces = (SurfPiece *)tlMemory((void *)pieces,
+					maxPieces*sizeof(SurfPiece));
+			}
+
+			pieces[numPieces].firstTri = t;
+			pieces[numPieces].numTris = 0;
+			pieces[numPieces].numVerts = 0;
+			numPieces++;
+
+			numNew = tlSurf_CountNewVerts(owner, inds, numPieces);
+		}
+
+		for(k=0; k<3; k++)
+			owner[inds[k]] = numPieces;
+
+		pieces[numPieces - 1].numVerts += numNew;
+		pieces[numPieces - 1].numTris++;
+	}
+
+	/* take the old geometry; the first piece goes back into `surf` */
+	oldVerts = surf->verts;
+	oldInds = surf->inds;
+	surf->verts = (TlVertex *)0;
+	surf->inds = (TlU32 *)0;
+	surf->numVerts = 0;
+	surf->maxVerts = 0;
+	surf->numInds = 0;
+	surf->maxInds = 0;
+
+	memset((void *)owner, 0, size);
+
+	for(p=0; p<numPieces; p++) {
+		dst = p > 0 ? tlSurf_NewPiece(surf) : surf;
+
+		verts = tlAddSurfaceVertices(dst, pieces[p].numVerts);
+		inds = tlAddSurfaceTriangles(dst, pieces[p].numTris);
+
+		n = 0;
+		for(t=pieces[p].firstTri; t<pieces[p].firstTri + pieces[p].numTris; t++) {
+			for(k=0; k<3; k++) {
+				v = oldInds[t*3 + k];
+				if (owner[v] != p + 1) {
+					owner[v] = p + 1;
+					local[v] = n;
+					verts[n++] = oldVerts[v];
+				}
+
+				*inds++ = local[v];
+			}
+		}
+
+		TL_ASSERT( n == pieces[p].numVerts );
+	}
+
+	pieces = (SurfPiece *)tlMemory((void *)pieces, 0);
+	local = (TlU32 *)tlMemory((void *)local, 0);
+	owner = (TlU32 *)tlMemory((void *)owner, 0);
+	oldInds = (TlU32 *)tlMemory((void *)oldInds, 0);
+	oldVerts = (TlVertex *)tlMemory((void *)oldVerts, 0);
+
+	return numPieces;
+}
+
+void tlSetSurfaceUsage(TlSurface *surf, TlBufferUsage_t usage) {
+	if (surf->gpu.usage == (unsigned)usage)
+		return;
+
+	/* storage allocated under the old hint would be reused as-is otherwise */
+	tlSurf_DeleteBuffers(surf->gpu.vbo);
+	tlSurf_DeleteBuffers(surf->gpu.ibo);
+	memset((void *)surf->gpu.vboSize, 0, sizeof(surf->gpu.vboSize));
+	memset((void *)surf->gpu.iboSize, 0, sizeof(surf->gpu.iboSize));
+
+	surf->gpu.usage = usage;
+	surf->gpu.vertsDirty = TRUE;
+	surf->gpu.indsDirty = TRUE;
+}
+TlBufferUsage_t tlGetSurfaceUsage(const TlSurface *surf) {
+	return (TlBufferUsage_t)surf->gpu.usage;
+}
+
+void tlSetSurfaceVertexQuantization(TlSurface *surf, TlBool quantize) {
+	surf = tlGetSurfaceGeometry(surf);
+	if (surf->gpu.quantize == (quantize ? TRUE : FALSE))
+		return;
+
+	surf->gpu.quantize = quantize ? TRUE : FALSE;
+	surf->gpu.vertsDirty = TRUE;
+}
+TlBool tlIsSurfaceVertexQuantized(const TlSurface *surf) {
+	return tlGetSurfaceGeometry(surf)->gpu.quantize;
+}
+
+void tlRequireSurfaceVertexAttribs(TlSurface *surf, TlU32 attribs) {
+	surf = tlGetSurfaceGeometry(surf);
+	if (!(attribs & ~surf->gpu.attribs))
+		return;
+
+	surf->gpu.attribs |= attribs;
+	surf->gpu.vertsDirty = TRUE;
+}
+const TlVertexLayout *tlGetSurfaceVertexLayout(const TlSurface *surf) {
+	return &tlGetSurfaceGeometry(surf)->gpu.layout;
+}
+
+void tlInvalidateSurfaceVertices(TlSurface *surf) {
+	tlUnmapSurface(surf);
+	surf->gpu.vertsDirty = TRUE;
+	tlSurf_DirtyBounds(surf);
+}
+void tlInvalidateSurfaceTriangles(TlSurface *surf) {
+	tlUnmapSurface(surf);
+	tlClearSurfaceLods(surf);
+	surf->gpu.indsDirty = TRUE;
+}
+
+void tlClearSurfaceLods(TlSurface *surf) {
+	surf = tlGetSurfaceGeometry(surf);
+
+	if (surf->numLods)
+		surf->gpu.indsDirty = TRUE;
+
+	tlSurf_FreeLods(surf);
+}
+unsigned int tlGetSurfaceLodCount(const TlSurface *surf) {
+	surf = tlGetSurfaceGeometry(surf);
+
+	return surf->numLods ? surf->numLods : 1;
+}
+const TlSurfaceLod *tlGetSurfaceLod(const TlSurface *surf, unsigned int i) {
+	static TlSurfaceLod full;
+
+	surf = tlGetSurfaceGeometry(surf);
+	if (i < surf->numLods)
+		return &surf->lods[i];
+
+	TL_ASSERT( i == 0 );
+
+	/* no levels generated; the whole surface is the only one */
+	full.firstInd = 0;
+	full.numInds = surf->numInds;
+	full.error = 0.0f;
+
+	return &full;
+}
+
+static void tlSurf_UnpackIndices(TlU32 *dst, const void *src, GLenum indexType, size_t n) {
+	const TlU16 *p;
+	size_t i;
+
+	if (indexType == GL_UNSIGNED_INT) {
+		memcpy((void *)dst, src, n*sizeof(TlU32));
+		return;
+	}
+
+	p = (const TlU16 *)src;
+	for(i=0; i<n; i++)
+		dst[i] = p[i];
+}
+void tlUnmapSurface(TlSurface *surf) {
+	size_t indexSize;
+
+	surf = tlGetSurfaceGeometry(surf);
+	if (!surf->mapped.file)
+		return;
+
+	/* the GPU copies stay valid; they hold exactly what's decoded here */
+	surf->maxVerts = surf->numVerts;
+	if (surf->numVerts) {
+		surf->verts = (TlVertex *)tlMemory((void *)0, surf->numVerts*sizeof(TlVertex));
+		tlUnpackVertices(&surf->mapped.layout, surf->verts, surf->mapped.verts, surf->numVerts);
+	}
+
+	indexSize = surf->mapped.indexType == GL_UNSIGNED_INT ? sizeof(TlU32) : sizeof(TlU16);
+
+	surf->maxInds = surf->numInds;
+	if (surf->numInds) {
+		surf->inds = (TlU32 *)tlMemory((void *)0, surf->numInds*sizeof(TlU32));
+		tlSurf_UnpackIndices(surf->inds, surf->mapped.inds, surf->mapped.indexType, surf->numInds);
+	}
+	if (surf->numLodInds) {
+		surf->lodInds = (TlU32 *)tlMemory((void *)0, surf->numLodInds*sizeof(TlU32));
+		tlSurf_UnpackIndices(surf->lodInds, (const void *)((const char *)surf->mapped.inds +
+			surf->numInds*indexSize), surf->mapped.indexType, surf->numLodInds);
+	}
+
+	tlSurf_ReleaseMapping(surf);
+}
+/* Whether the vertices packed in the scene file can be drawn as they are */
+static TlBool tlSurf_MappingFits(const TlSurface *surf) {
+	TlVertexLayout want;
+
+	if ((surf->gpu.attribs | TL_VERTEX_COLOR) & ~surf->mapped.layout.attribs)
+		return FALSE;
+	if ((surf->gpu.quantize ? TRUE : FALSE) != (surf->mapped.layout.quantized ? TRUE : FALSE))
+		return FALSE;
+
+	/* half float texture coordinates need the GL to read them */
+	if (surf->mapped.layout.halfTexCoords) {
+		tlInitVertexLayout(&want, TL_VERTEX_TEXCOORD, FALSE, (const TlBounds *)0);
+		if (!want.halfTexCoords)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Write `size` bytes of `data` into the buffer `*buf` bound to `target`,
+ * creating it (or growing its storage) as needed.
+ */
+static void tlSurf_Upload(GLenum target, GLuint *buf, size_t *bufSize,
+const void *data, size_t size, TlBufferUsage_t usage) {
+	void *p;
+
+	if (!*buf)
+		tlR_GenBuffers(1, buf);
+
+	tlR_BindBuffer(target, *buf);
+	tlGL_CheckError();
+
+	switch(usage) {
+	case kTlBU_Static:
+		if (size > *bufSize) {
+			tlR_BufferData(target, (GLsizeiptr)size, data, GL_STATIC_DRAW);
+			*bufSize = size;
+		} else {
+			tlR_BufferSubData(target, 0, (GLsizeiptr)size, data);
+		}
+		break;
+
+	case kTlBU_Dynamic:
+		/*
+		 * Orphan the old storage so the driver can hand us fresh memory
+		 * rather than wait for draws still reading from it
+		 */
+		if (size > *bufSize)
+			*bufSize = size;
+
+		tlR_BufferData(target, (GLsizeiptr)*bufSize, (const void *)0, GL_DYNAMIC_DRAW);
+		if ((p = tlR_MapBuffer(target, GL_WRITE_ONLY)) != (void *)0) {
+			memcpy(p, data, size);
+			tlR_UnmapBuffer(target);
+		} else {
+			tlR_BufferSubData(target, 0, (GLsizeiptr)size, data);
+		}
+		break;
+
+	case kTlBU_Stream:
+		/* the caller has already moved on to the next buffer in the ring */
+		tlR_BufferData(target, (GLsizeiptr)size, data, GL_STREAM_DRAW);
+		*bufSize = size;
+		break;
+	}
+	tlGL_CheckError();
+}
+void tlUploadSurface(TlSurface *surf) {
+	TlBufferUsage_t usage;
+	GLenum indexType;
+	TlU16 *shortInds;
+	TlU32 *longInds;
+	unsigned int i;
+	size_t size, j, n;
+	void *packed;
+
+	usage = (TlBufferUsage_t)surf->gpu.usage;
+
+	/* geometry from a scene file is uploaded straight from the mapping */
+	if (surf->mapped.file && surf->gpu.vertsDirty && !tlSurf_MappingFits(surf))
+		tlUnmapSurface(surf);
+
+	/* 16-bit indices whenever they can address every vertex */
+	indexType = surf->numVerts > TL_SURFACE_MAX_SHORT_VERTS ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	if (surf->mapped.file)
+		indexType = surf->mapped.indexType;
+	if (indexType != surf->gpu.indexType)
+		surf->gpu.indsDirty = TRUE;
+
+	if (surf->gpu.vertsDirty && surf->mapped.file) {
+		if (usage == kTlBU_Stream)
+			surf->gpu.vboCurrent = (surf->gpu.vboCurrent + 1)%TL_SURFACE_MAX_BUFFERS;
+
+		surf->gpu.layout = surf->mapped.layout;
+
+		i = surf->gpu.vboCurrent;
+		tlSurf_Upload(GL_ARRAY_BUFFER, &surf->gpu.vbo[i], &surf->gpu.vboSize[i],
+			surf->mapped.verts, surf->numVerts*surf->gpu.layout.stride, usage);
+
+		surf->gpu.vertsDirty = FALSE;
+	} else if (surf->gpu.vertsDirty && surf->verts) {
+		if (usage == kTlBU_Stream)
+			surf->gpu.vboCurrent = (surf->gpu.vboCurrent + 1)%TL_SURFACE_MAX_BUFFERS;
+
+		/* only what the passes read goes to the GPU, in the smallest types */
+		tlInitVertexLayout(&surf->gpu.layout, surf->gpu.attribs | TL_VERTEX_COLOR,
+			surf->gpu.quantize, surf->gpu.quantize ? tlGetSurfaceBounds(surf) : (const TlBounds *)0);
+
+		size = surf->numVerts*surf->gpu.layout.stride;
+		packed = tlFrameAlloc(size);
+		tlPackVertices(&surf->gpu.layout, packed, surf->verts, surf->numVerts);
+
+		i = surf->gpu.vboCurrent;
+		tlSurf_Upload(GL_ARRAY_BUFFER, &surf->gpu.vbo[i], &surf->gpu.vboSize[i],
+			(const void *)packed, size, usage);
+
+		surf->gpu.vertsDirty = FALSE;
+	} else {
+		tlR_BindBuffer(GL_ARRAY_BUFFER, surf->gpu.vbo[surf->gpu.vboCurrent]);
+	}
+
+	if (surf->gpu.indsDirty && (surf->inds || surf->mapped.file)) {
+		if (usage == kTlBU_Stream)
+			surf->gpu.iboCurrent = (surf->gpu.iboCurrent + 1)%TL_SURFACE_MAX_BUFFERS;
+
+		/* the levels of detail follow the full index list */
+		n = surf->numInds + surf->numLodInds;
+
+		if (surf->mapped.file) {
+			size = n*(indexType == GL_UNSIGNED_INT ? sizeof(TlU32) : sizeof(TlU16));
+			packed = (void *)surf->mapped.inds;
+		} else if (indexType == GL_UNSIGNED_SHORT) {
+			size = n*sizeof(TlU16);
+			shortInds = (TlU16 *)tlFrameAlloc(size);
+			for(j=0; j<surf->numInds; j++)
+				shortInds[j] = (TlU16)surf->inds[j];
+			for(j=0; j<surf->numLodInds; j++)
+				shortInds[surf->numInds + j] = (TlU16)surf->lodInds[j];
+			packed = (void *)shortInds;
+		} else if (surf->numLodInds > 0) {
+			size = n*sizeof(TlU32);
+			longInds = (TlU32 *)tlFrameAlloc(size);
+			memcpy((void *)longInds, (const void *)surf->inds, surf->numInds*sizeof(TlU32));
+			memcpy((void *)&longInds[surf->numInds], (const void *)surf->lodInds,
+				surf->numLodInds*sizeof(TlU32));
+			packed = (void *)longInds;
+		} else {
+			size = n*sizeof(TlU32);
+			packed = (void *)surf->inds;
+		}
+
+		i = surf->gpu.iboCurrent;
+		tlSurf_Upload(GL_ELEMENT_ARRAY_BUFFER, &surf->gpu.ibo[i], &surf->gpu.iboSize[i],
+			(const void *)packed, size, usage);
+
+		surf->gpu.indexType = indexType;
+		surf->gpu.indsDirty = FALSE;
+	} else {
+		tlR_BindBuffer(GL_ELEMENT_ARRAY_BUFFER, surf->gpu.ibo[surf->gpu.iboCurrent]);
+	}
+}
+
+void tlDeferSurfaceUpload(TlSurface *surf) {
+	surf = tlGetSurfaceGeometry(surf);
+
+	surf->gpu.isDeferred = TRUE;
+	surf->gpu.partOffset = 0;
+}
+
+/* Make sure `*buf` is bound with room for `size` bytes, keeping its contents */
+static void tlSurf_Reserve(GLenum target, GLuint *buf, size_t *bufSize, size_t size) {
+	if (!*buf)
+		tlR_GenBuffers(1, buf);
+
+	tlR_BindBuffer(target, *buf);
+
+	if (size > *bufSize) {
+		tlR_BufferData(target, (GLsizeiptr)size, (const void *)0, GL_STATIC_DRAW);
+		*bufSize = size;
+	}
+	tlGL_CheckError();
+}
+size_t tlUploadSurfacePart(TlSurface *surf, size_t maxBytes) {
+	size_t vertSize, indSize, offset, n;
+	const TlU8 *src;
+	unsigned int i;
+
+	surf = tlGetSurfaceGeometry(surf);
+
+	if (!surf->gpu.vertsDirty && !surf->gpu.indsDirty) {
+		surf->gpu.isDeferred = FALSE;
+		surf->gpu.partOffset = 0;
+		return 0;
+	}
+
+	/* the buffers only take pieces when they're filled once, straight from the file */
+	if (!surf->mapped.file || surf->gpu.usage != kTlBU_Static || !tlSurf_MappingFits(surf)) {
+		tlUploadSurface(surf);
+		surf->gpu.isDeferred = FALSE;
+		surf->gpu.partOffset = 0;
+		return surf->numVerts*surf->gpu.layout.stride +
+			(surf->numInds + surf->numLodInds)*(surf->gpu.indexType == GL_UNSIGNED_INT ? sizeof(TlU32) : sizeof(TlU16));
+	}
+
+	vertSize = surf->numVerts*surf->mapped.layout.stride;
+	indSize = (surf->numInds + surf->numLodInds)*
+		(surf->mapped.indexType == GL_UNSIGNED_INT ? sizeof(TlU32) : sizeof(TlU16));
+
+	offset = surf->gpu.partOffset;
+	while (maxBytes > 0 && offset < vertSize + indSize) {
+		if (offset < vertSize) {
+			i = surf->gpu.vboCurrent;
+			tlSurf_Reserve(GL_ARRAY_BUFFER, &surf->gpu.vbo[i], &surf->gpu.vboSize[i], vertSize);
+
+			n = vertSize - offset < maxBytes ? vertSize - offset : maxBytes;
+			src = (const TlU8 *)surf->mapped.verts + offset;
+			tlR_UploadBufferData(GL_ARRAY_BUFFER, (GLintptr)offset, (GLsizeiptr)n, (const void *)src);
+		} else {
+			i = surf->gpu.iboCurrent;
+			tlSurf_Reserve(GL_ELEMENT_ARRAY_BUFFER, &surf->gpu.ibo[i], &surf->gpu.iboSize[i], indSize);
+
+			n = vertSize + indSize - offset < maxBytes ? vertSize + indSize - offset : maxBytes;
+			src = (const TlU8 *)surf->mapped.inds + (offset - vertSize);
+			tlR_UploadBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)(offset - vertSize), (GLsizeiptr)n,
+				(const void *)src);
+		}
+		tlGL_CheckError();
+
+		offset += n;
+		maxBytes -= n;
+	}
+
+	n = offset - surf->gpu.partOffset;
+	surf->gpu.partOffset = offset;
+
+	if (offset == vertSize + indSize) {
+		surf->gpu.layout = surf->mapped.layout;
+		surf->gpu.indexType = surf->mapped.indexType;
+		surf->gpu.vertsDirty = FALSE;
+		surf->gpu.indsDirty = FALSE;
+		surf->gpu.isDeferred = FALSE;
+		surf->gpu.partOffset = 0;
+	}
+
+	return n;
+}
+
+static void tlSurf_CalcBounds(TlSurface *surf) {
+	TlBounds *b;
+	const float *p;
+	float x, y, z, r;
+	unsigned int i;
+
+	b = &surf->bounds;
+
+	if (!surf->numVerts) {
+		memset((void *)b, 0, sizeof(*b));
+		b->radius = -1.0f;
+		return;
+	}
+
+	p = surf->verts[0].xyz;
+	b->mins.x = b->maxs.x = p[0];
+	b->mins.y = b->maxs.y = p[1];
+	b->mins.z = b->maxs.z = p[2];
+
+	for(i=1; i<surf->numVerts; i++) {
+		p = surf->verts[i].xyz;
+
+		if (p[0] < b->mins.x) b->mins.x = p[0];
+		if (p[1] < b->mins.y) b->mins.y = p[1];
+		if (p[2] < b->mins.z) b->mins.z = p[2];
+		if (p[0] > b->maxs.x) b->maxs.x = p[0];
+		if (p[1] > b->maxs.y) b->maxs.y = p[1];
+		if (p[2] > b->maxs.z) b->maxs.z = p[2];
+	}
+
+	b->center.x = 0.5f*(b->mins.x + b->maxs.x);
+	b->center.y = 0.5f*(b->mins.y + b->maxs.y);
+	b->center.z = 0.5f*(b->mins.z + b->maxs.z);
+
+	/* sphere around the box's center; tighter than the box's half-diagonal */
+	r = 0.0f;
+	for(i=0; i<surf->numVerts; i++) {
+		p = surf->verts[i].xyz;
+
+		x = p[0] - b->center.x;
+		y = p[1] - b->center.y;
+		z = p[2] - b->center.z;
+
+		if (x*x + y*y + z*z > r)
+			r = x*x + y*y + z*z;
+	}
+	b->radius = tlSqrt(r);
+}
+const TlBounds *tlGetSurfaceBounds(TlSurface *surf) {
+	surf = tlGetSurfaceGeometry(surf);
+
+	if (surf->boundsDirty) {
+		tlSurf_CalcBounds(surf);
+		tlSurf_UndirtyBounds(surf);
+	}
+
+	return &surf->bounds;
+}
+void tlUpdateSurfaceBounds(void) {
+	size_t i;
+
+	for(i=0; i<g_surf_numDirty; i++) {
+		tlSurf_CalcBounds(g_surf_dirty[i]);
+		g_surf_dirty[i]->boundsDirty = FALSE;
+	}
+
+	g_surf_numDirty = 0;
 }
 
 TlSurface *tlSurfaceBefore(const TlSurface *surf) {
@@ -133,23 +946,31 @@ TlSurface *tlLastSurface(const TlEntity *ent) {
 	return ent->s_tail;
 }
 
-unsigned short tlGetSurfaceVertexCount(const TlSurface *surf) {
-	return surf->numVerts;
+unsigned int tlGetSurfaceVertexCount(const TlSurface *surf) {
+	return tlGetSurfaceGeometry(surf)->numVerts;
 }
-unsigned short tlGetSurfaceVertexCapacity(const TlSurface *surf) {
+unsigned int tlGetSurfaceVertexCapacity(const TlSurface *surf) {
 	return surf->maxVerts;
 }
-TlVertex *tlGetSurfaceVertex(const TlSurface *surf, unsigned short i) {
+TlVertex *tlGetSurfaceVertex(TlSurface *surf, unsigned int i) {
+	/* the caller may write through the pointer */
+	tlSurf_Unshare(surf);
+	surf->gpu.vertsDirty = TRUE;
+	tlSurf_DirtyBounds(surf);
 	return &surf->verts[i];
 }
 
 unsigned int tlGetSurfaceTriangleCount(const TlSurface *surf) {
-	return surf->numInds*3;
+	return tlGetSurfaceGeometry(surf)->numInds/3;
 }
 unsigned int tlGetSurfaceTriangleCapacity(const TlSurface *surf) {
-	return surf->maxInds*3;
+	return surf->maxInds/3;
 }
-unsigned short *tlGetSurfaceTriangle(const TlSurface *surf, unsigned int i) {
+TlU32 *tlGetSurfaceTriangle(TlSurface *surf, unsigned int i) {
+	/* the caller may write through the pointer */
+	tlSurf_Unshare(surf);
+	tlClearSurfaceLods(surf);
+	surf->gpu.indsDirty = TRUE;
 	return &surf->inds[i*3];
 }
 
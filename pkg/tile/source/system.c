@@ -1,5 +1,12 @@
 #include <tile/system.h>
 
+#ifndef _WIN32
+# include <sched.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
 #define TL_TIME_NANOSECS  1000000000
 #define TL_TIME_MICROSECS 1000000
 #define TL_TIME_MILLISECS 1000
@@ -92,3 +99,382 @@ TlU64 tlSys_Microtime( void )
 {
 	return tlConvFreq( tlQueryTime(), TL_TIME_MICROSECS );
 }
+
+TlU32 tlSys_NumCPUs( void )
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo( &si );
+	return si.dwNumberOfProcessors > 0 ? ( TlU32 )si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n;
+
+	n = sysconf( _SC_NPROCESSORS_ONLN );
+	return n > 0 ? ( TlU32 )n : 1;
+#else
+	return 1;
+#endif
+}
+
+/*
+ * ==========================================================================
+ *
+ *	THREADS
+ *
+ * ==========================================================================
+ */
+struct TlThread_s {
+#if defined(_WIN32)
+	HANDLE handle;
+#else
+	pthread_t thread;
+#endif
+	TlThreadFn_t fn;
+	void *parm;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI tlSys_ThreadMain( LPVOID parm )
+{
+	TlThread *thread;
+
+	thread = ( TlThread * )parm;
+	thread->fn( thread->parm );
+
+	return 0;
+}
+#else
+static void *tlSys_ThreadMain( void *parm )
+{
+	TlThread *thread;
+
+	thread = ( TlThread * )parm;
+	thread->fn( thread->parm );
+
+	return NULL;
+}
+#endif
+
+TlThread *tlSys_NewThread( TlThreadFn_t fn, void *parm )
+{
+	TlThread *thread;
+
+	thread = tlAllocStruct( TlThread );
+	thread->fn = fn;
+	thread->parm = parm;
+
+#if defined(_WIN32)
+	thread->handle = CreateThread( NULL, 0, &tlSys_ThreadMain, ( LPVOID )thread, 0, NULL );
+	if( !thread->handle ) {
+		tlErrorExit( "Failed to create thread" );
+	}
+#else
+	if( pthread_create( &thread->thread, NULL, &tlSys_ThreadMain, ( void * )thread ) != 0 ) {
+		tlErrorExit( "Failed to create thread" );
+	}
+#endif
+
+	return thread;
+}
+void tlSys_JoinThread( TlThread *thread )
+{
+	if( !thread ) {
+		return;
+	}
+
+#if defined(_WIN32)
+	WaitForSingleObject( thread->handle, INFINITE );
+	CloseHandle( thread->handle );
+#else
+	pthread_join( thread->thread, NULL );
+#endif
+
+	tlMemory( ( void * )thread, 0 );
+}
+
+void tlSys_InitMutex( TlMutex *mutex )
+{
+#if defined(_WIN32)
+	InitializeCriticalSection( &mutex->cs );
+#else
+	pthread_mutex_init( &mutex->mutex, NULL );
+#endif
+}
+void tlSys_FiniMutex( TlMutex *mutex )
+{
+#if defined(_WIN32)
+	DeleteCriticalSection( &mutex->cs );
+#else
+	pthread_mutex_destroy( &mutex->mutex );
+#endif
+}
+void tlSys_LockMutex( TlMutex *mutex )
+{
+#if defined(_WIN32)
+	EnterCriticalSection( &mutex->cs );
+#else
+	pthread_mutex_lock( &mutex->mutex );
+#endif
+}
+void tlSys_UnlockMutex( TlMutex *mutex )
+{
+#if defined(_WIN32)
+	LeaveCriticalSection( &mutex->cs );
+#else
+	pthread_mutex_unlock( &mutex->mutex );
+#endif
+}
+
+void tlSys_InitSemaphore( TlSemaphore *sem, TlU32 count )
+{
+#if defined(_WIN32)
+	sem->handle = CreateSemaphoreA( NULL, ( LONG )count, 0x7FFFFFFF, NULL );
+	if( !sem->handle ) {
+		tlErrorExit( "Failed to create semaphore" );
+	}
+#else
+	pthread_mutex_init( &sem->mutex, NULL );
+	pthread_cond_init( &sem->cond, NULL );
+	sem->count = count;
+#endif
+}
+void tlSys_FiniSemaphore( TlSemaphore *sem )
+{
+#if defined(_WIN32)
+	CloseHandle( sem->handle );
+#else
+	pthread_cond_destroy( &sem->cond );
+	pthread_mutex_destroy( &sem->mutex );
+#endif
+}
+void tlSys_WaitSemaphore( TlSemaphore *sem )
+{
+#if defined(_WIN32)
+	WaitForSingleObject( sem->handle, INFINITE );
+#else
+	pthread_mutex_lock( &sem->mutex );
+	while( !sem->count ) {
+		pthread_cond_wait( &sem->cond, &sem->mutex );
+	}
+	sem->count--;
+	pthread_mutex_unlock( &sem->mutex );
+#endif
+}
+void tlSys_SignalSemaphore( TlSemaphore *sem, TlU32 n )
+{
+	if( !n ) {
+		return;
+	}
+
+#if defined(_WIN32)
+	ReleaseSemaphore( sem->handle, ( LONG )n, NULL );
+#else
+	pthread_mutex_lock( &sem->mutex );
+	sem->count += n;
+	if( n == 1 ) {
+		pthread_cond_signal( &sem->cond );
+	} else {
+		pthread_cond_broadcast( &sem->cond );
+	}
+	pthread_mutex_unlock( &sem->mutex );
+#endif
+}
+
+void tlSys_Yield( void )
+{
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+/*
+ * ==========================================================================
+ *
+ *	ATOMICS
+ *
+ * ==========================================================================
+ */
+
+#if defined(_MSC_VER)
+TlU32 tlSys_AtomicLoad( volatile TlU32 *p )
+{
+	TlU32 v;
+
+	v = *p;
+	_ReadWriteBarrier();
+	return v;
+}
+void tlSys_AtomicStore( volatile TlU32 *p, TlU32 v )
+{
+	_ReadWriteBarrier();
+	*p = v;
+}
+TlU32 tlSys_AtomicAdd( volatile TlU32 *p, TlU32 n )
+{
+	return ( TlU32 )InterlockedExchangeAdd( ( volatile LONG * )p, ( LONG )n ) + n;
+}
+TlU32 tlSys_AtomicSub( volatile TlU32 *p, TlU32 n )
+{
+	return ( TlU32 )InterlockedExchangeAdd( ( volatile LONG * )p, -( LONG )n ) - n;
+}
+TlBool tlSys_AtomicCompareSwap( volatile TlU32 *p, TlU32 expected, TlU32 desired )
+{
+	return ( TlU32 )InterlockedCompareExchange( ( volatile LONG * )p, ( LONG )desired, ( LONG )expected ) == expected;
+}
+void *tlSys_AtomicLoadPtrRelaxed( void *volatile *p )
+{
+	return *p;
+}
+void tlSys_AtomicStorePtrRelaxed( void *volatile *p, void *v )
+{
+	*p = v;
+}
+void tlSys_MemoryFence( void )
+{
+	MemoryBarrier();
+}
+#else
+TlU32 tlSys_AtomicLoad( volatile TlU32 *p )
+{
+	return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+void tlSys_AtomicStore( volatile TlU32 *p, TlU32 v )
+{
+	__atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+TlU32 tlSys_AtomicAdd( volatile TlU32 *p, TlU32 n )
+{
+	return __atomic_add_fetch( p, n, __ATOMIC_SEQ_CST );
+}
+TlU32 tlSys_AtomicSub( volatile TlU32 *p, TlU32 n )
+{
+	return __atomic_sub_fetch( p, n, __ATOMIC_SEQ_CST );
+}
+TlBool tlSys_AtomicCompareSwap( volatile TlU32 *p, TlU32 expected, TlU32 desired )
+{
+	return __atomic_compare_exchange_n( p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) ? TRUE : FALSE;
+}
+void *tlSys_AtomicLoadPtrRelaxed( void *volatile *p )
+{
+	return __atomic_load_n( p, __ATOMIC_RELAXED );
+}
+void tlSys_AtomicStorePtrRelaxed( void *volatile *p, void *v )
+{
+	__atomic_store_n( p, v, __ATOMIC_RELAXED );
+}
+void tlSys_MemoryFence( void )
+{
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+#endif
+
+/*
+ * ==========================================================================
+ *
+ *	MAPPED FILES
+ *
+ * ==========================================================================
+ */
+
+const void *tlSys_MapFile( const char *filename, size_t *size )
+{
+#if defined(_WIN32)
+	LARGE_INTEGER fileSize;
+	HANDLE file, mapping;
+	void *p;
+
+	TL_ASSERT( size != NULL );
+	*size = 0;
+
+	file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if( file == INVALID_HANDLE_VALUE ) {
+		return NULL;
+	}
+
+	if( !GetFileSizeEx( file, &fileSize ) || fileSize.QuadPart == 0 || ( TlU64 )fileSize.QuadPart > ( TlU64 )( ~( size_t )0 ) ) {
+		CloseHandle( file );
+		return NULL;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if( !mapping ) {
+		return NULL;
+	}
+
+	/* the view keeps the mapping (and file) open by itself */
+	p = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	if( !p ) {
+		return NULL;
+	}
+
+	*size = ( size_t )fileSize.QuadPart;
+	return p;
+#else
+	struct stat st;
+	void *p;
+	int fd;
+
+	TL_ASSERT( size != NULL );
+	*size = 0;
+
+	fd = open( filename, O_RDONLY );
+	if( fd == -1 ) {
+		return NULL;
+	}
+
+	if( fstat( fd, &st ) != 0 || st.st_size <= 0 || ( TlU64 )st.st_size > ( TlU64 )( ~( size_t )0 ) ) {
+		close( fd );
+		return NULL;
+	}
+
+	p = mmap( NULL, ( size_t )st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( p == MAP_FAILED ) {
+		return NULL;
+	}
+
+# ifdef MADV_WILLNEED
+	/* the whole file is about to be read front to back; start paging it in */
+	madvise( p, ( size_t )st.st_size, MADV_WILLNEED );
+# endif
+
+	*size = ( size_t )st.st_size;
+	return p;
+#endif
+}
+void tlSys_UnmapFile( const void *p, size_t size )
+{
+	if( !p ) {
+		return;
+	}
+
+#if defined(_WIN32)
+	( void )size;
+	UnmapViewOfFile( p );
+#else
+	munmap( ( void * )p, size );
+#endif
+}
+void tlSys_PrefetchFile( const void *p, size_t size )
+{
+	const volatile TlU8 *bytes;
+	size_t i;
+	TlU8 sum;
+
+	/* one read per page faults the whole range in */
+	bytes = ( const volatile TlU8 * )p;
+	sum = 0;
+	for( i = 0; i < size; i += 4096 ) {
+		sum ^= bytes[ i ];
+	}
+	if( size > 0 ) {
+		sum ^= bytes[ size - 1 ];
+	}
+
+	( void )sum;
+}
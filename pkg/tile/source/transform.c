@@ -0,0 +1,307 @@
+#include <tile/transform.h>
+#include <tile/entity.h>
+
+/*
+ * ==========================================================================
+ *
+ *	TRANSFORM STORE
+ *
+ * ==========================================================================
+ */
+
+#define XF_NONE 0xFFFFFFFF
+
+/* parallel arrays, indexed by position in the (depth-sorted) store */
+static TlU32 g_xfCount = 0;
+static TlU32 g_xfCapacity = 0;
+static TlMat4 *g_xfLocal = (TlMat4 *)0;
+static TlMat4 *g_xfGlobal = (TlMat4 *)0;
+static TlMat4 *g_xfModelView = (TlMat4 *)0;
+static TlU32 *g_xfParent = (TlU32 *)0;
+static TlU32 *g_xfHandle = (TlU32 *)0;
+static TlEntity **g_xfOwner = (TlEntity **)0;
+static TlU8 *g_xfDirty = (TlU8 *)0;
+
+/* handle -> index, plus released handles available for reuse */
+static TlU32 g_xfNumHandles = 0;
+static TlU32 g_xfMaxHandles = 0;
+static TlU32 *g_xfIndex = (TlU32 *)0;
+static TlU32 g_xfNumFree = 0;
+static TlU32 *g_xfFree = (TlU32 *)0;
+
+/* set when some parent may come after its child (or holes need removing) */
+static TlBool g_xfUnsorted = FALSE;
+/* set when tlXf_Update() has dirty globals to sweep */
+static TlBool g_xfAnyDirty = FALSE;
+
+static void tlXf_Reserve(TlU32 n) {
+#define XF_GRAN 256
+	if( n <= g_xfCapacity ) {
+		return;
+	}
+
+	g_xfCapacity  = n + n/2;
+	g_xfCapacity -= g_xfCapacity%XF_GRAN;
+	g_xfCapacity += XF_GRAN;
+
+	g_xfLocal = (TlMat4 *)tlMemory((void *)g_xfLocal, g_xfCapacity*sizeof(TlMat4));
+	g_xfGlobal = (TlMat4 *)tlMemory((void *)g_xfGlobal, g_xfCapacity*sizeof(TlMat4));
+	g_xfModelView = (TlMat4 *)tlMemory((void *)g_xfModelView, g_xfCapacity*sizeof(TlMat4));
+	g_xfParent = (TlU32 *)tlMemory((void *)g_xfParent, g_xfCapacity*sizeof(TlU32));
+	g_xfHandle = (TlU32 *)tlMemory((void *)g_xfHandle, g_xfCapacity*sizeof(TlU32));
+	g_xfOwner = (TlEntity **)tlMemory((void *)g_xfOwner, g_xfCapacity*sizeof(TlEntity *));
+	g_xfDirty = (TlU8 *)tlMemory((void *)g_xfDirty, g_xfCapacity*sizeof(TlU8));
+#undef XF_GRAN
+}
+static TlU32 tlXf_AllocHandle(void) {
+	if( g_xfNumFree > 0 ) {
+		return g_xfFree[--g_xfNumFree];
+	}
+
+	if( g_xfNumHandles == g_xfMaxHandles ) {
+		g_xfMaxHandles = g_xfMaxHandles ? g_xfMaxHandles*2 : 256;
+		g_xfIndex = (TlU32 *)tlMemory((void *)g_xfIndex, g_xfMaxHandles*sizeof(TlU32));
+		g_xfFree = (TlU32 *)tlMemory((void *)g_xfFree, g_xfMaxHandles*sizeof(TlU32));
+	}
+
+	return g_xfNumHandles++;
+}
+
+TlXform tlXf_New(TlEntity *owner, TlXform prnt) {
+	TlU32 h, i;
+
+	h = tlXf_AllocHandle();
+
+	tlXf_Reserve(g_xfCount + 1);
+	i = g_xfCount++;
+
+	tlLoadIdentity(&g_xfLocal[i]);
+	tlLoadIdentity(&g_xfGlobal[i]);
+	tlLoadIdentity(&g_xfModelView[i]);
+	g_xfParent[i] = prnt != TL_XFORM_NONE ? g_xfIndex[prnt] : XF_NONE;
+	g_xfHandle[i] = h;
+	g_xfOwner[i] = owner;
+	g_xfDirty[i] = 1;
+
+	g_xfIndex[h] = i;
+	g_xfAnyDirty = TRUE;
+
+	/* appending keeps the order valid; the parent already exists */
+	return (TlXform)h;
+}
+void tlXf_Delete(TlXform xf) {
+	TlU32 i;
+
+	if( xf == TL_XFORM_NONE ) {
+		return;
+	}
+
+	/* leave a hole; the next sort removes it */
+	i = g_xfIndex[xf];
+	g_xfOwner[i] = (TlEntity *)0;
+	g_xfParent[i] = XF_NONE;
+	g_xfDirty[i] = 0;
+
+	g_xfIndex[xf] = XF_NONE;
+	g_xfFree[g_xfNumFree++] = xf;
+
+	g_xfUnsorted = TRUE;
+}
+void tlXf_SetParent(TlXform xf, TlXform prnt) {
+	TlU32 i;
+
+	i = g_xfIndex[xf];
+	g_xfParent[i] = prnt != TL_XFORM_NONE ? g_xfIndex[prnt] : XF_NONE;
+
+	if( g_xfParent[i] != XF_NONE && g_xfParent[i] > i ) {
+		g_xfUnsorted = TRUE;
+	}
+}
+
+TlMat4 *tlXf_Local(TlXform xf) {
+	return &g_xfLocal[g_xfIndex[xf]];
+}
+static const TlMat4 *tlXf_GlobalIndex(TlU32 i) {
+	TlU32 p;
+
+	if( !g_xfDirty[i] ) {
+		return &g_xfGlobal[i];
+	}
+
+	p = g_xfParent[i];
+	if( p == XF_NONE ) {
+		g_xfGlobal[i] = g_xfLocal[i];
+	} else {
+		tlAffineMultiply(&g_xfGlobal[i], tlXf_GlobalIndex(p), &g_xfLocal[i]);
+	}
+	g_xfDirty[i] = 0;
+
+	return &g_xfGlobal[i];
+}
+const TlMat4 *tlXf_Global(TlXform xf) {
+	return tlXf_GlobalIndex(g_xfIndex[xf]);
+}
+TlMat4 *tlXf_ModelView(TlXform xf) {
+	return &g_xfModelView[g_xfIndex[xf]];
+}
+
+TlBool tlXf_IsDirty(TlXform xf) {
+	return g_xfDirty[g_xfIndex[xf]] ? TRUE : FALSE;
+}
+void tlXf_MarkDirty(TlXform xf) {
+	g_xfDirty[g_xfIndex[xf]] = 1;
+	g_xfAnyDirty = TRUE;
+}
+void tlXf_MarkDirtyQuiet(TlXform xf) {
+	g_xfDirty[g_xfIndex[xf]] = 1;
+}
+
+/*
+ * Move entry i of `array` (`n` items of `size` bytes) to order[i], dropping
+ * those with no new position; `scratch` must hold the whole array
+ */
+static void tlXf_Permute(void *array, size_t size, TlU32 n, const TlU32 *order, void *scratch) {
+	const TlU8 *src;
+	TlU8 *dst;
+	TlU32 i;
+
+	memcpy(scratch, (const void *)array, n*size);
+
+	src = (const TlU8 *)scratch;
+	dst = (TlU8 *)array;
+	for(i=0; i<n; i++) {
+		if( order[i] != XF_NONE ) {
+			memcpy((void *)( dst + order[i]*size ), (const void *)( src + i*size ), size);
+		}
+	}
+}
+
+/*
+ * Reorder the store by hierarchy depth (stable counting sort), dropping holes
+ * left by deleted transforms. The arrays are rearranged in place through frame
+ * arena scratch, so this never calls the heap (deleting an entity every frame
+ * makes it run every frame).
+ */
+static void tlXf_Sort(void) {
+	TlU32 *depth, *order, *stack, *count;
+	TlU32 i, j, p, n, d, maxDepth, top;
+	void *scratch;
+
+	/* the scratch arrays only live as long as this call */
+	n = g_xfCount;
+	depth = (TlU32 *)tlFrameAlloc(( n + 1 )*sizeof(TlU32));
+	order = (TlU32 *)tlFrameAlloc(( n + 1 )*sizeof(TlU32));
+	stack = (TlU32 *)tlFrameAlloc(( n + 1 )*sizeof(TlU32));
+
+	/* depth of each live transform, walking up only as far as a known depth */
+	for(i=0; i<n; i++) {
+		depth[i] = XF_NONE;
+	}
+	maxDepth = 0;
+	for(i=0; i<n; i++) {
+		if( !g_xfOwner[i] || depth[i] != XF_NONE ) {
+			continue;
+		}
+
+		top = 0;
+		for(j=i; j!=XF_NONE && depth[j]==XF_NONE; j=g_xfParent[j]) {
+			stack[top++] = j;
+		}
+
+		d = j != XF_NONE ? depth[j] + 1 : 0;
+		while( top > 0 ) {
+			depth[stack[--top]] = d++;
+		}
+
+		if( d - 1 > maxDepth ) {
+			maxDepth = d - 1;
+		}
+	}
+
+	count = (TlU32 *)tlFrameAlloc(( maxDepth + 2 )*sizeof(TlU32));
+	memset((void *)count, 0, ( maxDepth + 2 )*sizeof(TlU32));
+
+	for(i=0; i<n; i++) {
+		if( g_xfOwner[i] ) {
+			count[depth[i] + 1]++;
+		}
+	}
+	for(d=0; d<=maxDepth; d++) {
+		count[d + 1] += count[d];
+	}
+	/* order[i] = new position of old entry i */
+	for(i=0; i<n; i++) {
+		order[i] = g_xfOwner[i] ? count[depth[i]]++ : XF_NONE;
+	}
+
+	/* point the parents and handles at the new positions before anything moves */
+	for(i=0; i<n; i++) {
+		if( ( j = order[i] ) == XF_NONE ) {
+			continue;
+		}
+
+		p = g_xfParent[i];
+		g_xfParent[i] = p != XF_NONE ? order[p] : XF_NONE;
+
+		g_xfIndex[g_xfHandle[i]] = j;
+	}
+
+	/* big enough for the largest array */
+	scratch = tlFrameAlloc(( n + 1 )*sizeof(TlMat4));
+
+	tlXf_Permute((void *)g_xfLocal, sizeof(TlMat4), n, order, scratch);
+	tlXf_Permute((void *)g_xfGlobal, sizeof(TlMat4), n, order, scratch);
+	tlXf_Permute((void *)g_xfModelView, sizeof(TlMat4), n, order, scratch);
+	tlXf_Permute((void *)g_xfParent, sizeof(TlU32), n, order, scratch);
+	tlXf_Permute((void *)g_xfHandle, sizeof(TlU32), n, order, scratch);
+	tlXf_Permute((void *)g_xfOwner, sizeof(TlEntity *), n, order, scratch);
+	tlXf_Permute((void *)g_xfDirty, sizeof(TlU8), n, order, scratch);
+
+	g_xfCount = count[maxDepth];
+
+	g_xfUnsorted = FALSE;
+}
+void tlXf_Update(void) {
+	TlU32 i, p;
+
+	if( g_xfUnsorted ) {
+		tlXf_Sort();
+	}
+
+	if( !g_xfAnyDirty ) {
+		return;
+	}
+
+	/* parents come first, so theirs are always up to date by the time it matters */
+	for(i=0; i<g_xfCount; i++) {
+		if( !g_xfDirty[i] ) {
+			continue;
+		}
+
+		p = g_xfParent[i];
+		if( p == XF_NONE ) {
+			g_xfGlobal[i] = g_xfLocal[i];
+		} else {
+			tlAffineMultiply(&g_xfGlobal[i], &g_xfGlobal[p], &g_xfLocal[i]);
+		}
+		g_xfDirty[i] = 0;
+	}
+
+	g_xfAnyDirty = FALSE;
+}
+
+TlU32 tlXf_Count(void) {
+	return g_xfCount;
+}
+TlEntity *tlXf_OwnerAt(TlU32 i) {
+	return g_xfOwner[i];
+}
+const TlMat4 *tlXf_GlobalAt(TlU32 i) {
+	return &g_xfGlobal[i];
+}
+TlU32 tlXf_ParentAt(TlU32 i) {
+	return g_xfParent[i] != XF_NONE ? g_xfParent[i] : (TlU32)TL_XFORM_NONE;
+}
+TlMat4 *tlXf_ModelViewAt(TlU32 i) {
+	return &g_xfModelView[i];
+}
@@ -0,0 +1,399 @@
+#include <tile.h>
+
+#ifndef GL_HALF_FLOAT_ARB
+# define GL_HALF_FLOAT_ARB 0x140B
+#endif
+
+/*
+ * ==========================================================================
+ *
+ *	VERTEX LAYOUT FUNCTIONS
+ *
+ * ==========================================================================
+ */
+
+/* attributes with arrays beyond position and color */
+#define VTX_OPTIONAL_ATTRIBS (TL_VERTEX_NORMAL | TL_VERTEX_TEXCOORD | \
+	TL_VERTEX_BINORMAL | TL_VERTEX_TANGENT)
+
+/* -1 until checked (needs a GL context) */
+static int g_vtx_halfTexCoords = -1;
+/* optional arrays currently enabled (see tlBindVertexLayout) */
+static TlU32 g_vtx_enabled = 0;
+
+static TlBool tlVtx_HalfTexCoords(void) {
+	if (g_vtx_halfTexCoords < 0)
+		g_vtx_halfTexCoords = tlGL_IsExtensionSupported("GL_ARB_half_float_vertex") ? 1 : 0;
+
+	return g_vtx_halfTexCoords ? TRUE : FALSE;
+}
+
+TlU32 tlGetBrushVertexAttribs(const TlBrush *brush) {
+	TlU32 attribs;
+
+	attribs = TL_VERTEX_POSITION | TL_VERTEX_COLOR;
+
+	if (brush->lighting.isLit)
+		attribs |= TL_VERTEX_NORMAL;
+
+	/* there's no telling what a shader reads, short of the brush saying so */
+	if (brush->shader.prog) {
+		attribs |= TL_VERTEX_NORMAL | TL_VERTEX_TEXCOORD;
+
+		if (brush->drawing.usesBinorm)
+			attribs |= TL_VERTEX_BINORMAL;
+		if (brush->drawing.usesTangent)
+			attribs |= TL_VERTEX_TANGENT;
+	}
+
+	return attribs;
+}
+
+static TlU32 tlVtx_Place(TlVertexLayout *layout, TlU32 attrib, TlU32 size) {
+	TlU32 offset;
+
+	if (!(layout->attribs & attrib))
+		return 0;
+
+	offset = layout->stride;
+	layout->stride += size;
+
+	return offset;
+}
+static void tlVtx_QuantizeAxis(float *scale, float *bias, float lo, float hi) {
+	*bias = (lo + hi)*0.5f;
+	*scale = (hi - lo)*0.5f/32767.0f;
+
+	/* flat along this axis; every position quantizes to zero */
+	if (*scale <= 0.0f)
+		*scale = 1.0f;
+}
+
+void tlInitVertexLayout(TlVertexLayout *layout, TlU32 attribs, TlBool quantize,
+const TlBounds *bounds) {
+	TL_ASSERT(layout != (TlVertexLayout *)0);
+
+	memset((void *)layout, 0, sizeof(*layout));
+
+	layout->attribs = attribs | TL_VERTEX_POSITION;
+	layout->quantized = quantize;
+	layout->halfTexCoords = (attribs & TL_VERTEX_TEXCOORD) ? tlVtx_HalfTexCoords() : FALSE;
+
+	layout->scale.x = 1.0f;
+	layout->scale.y = 1.0f;
+	layout->scale.z = 1.0f;
+
+	if (quantize && bounds && bounds->radius >= 0.0f) {
+		tlVtx_QuantizeAxis(&layout->scale.x, &layout->bias.x, bounds->mins.x, bounds->maxs.x);
+		tlVtx_QuantizeAxis(&layout->scale.y, &layout->bias.y, bounds->mins.y, bounds->maxs.y);
+		tlVtx_QuantizeAxis(&layout->scale.z, &layout->bias.z, bounds->mins.z, bounds->maxs.z);
+	}
+
+	/* everything stays four-byte aligned; three shorts or bytes get padded */
+	layout->position = tlVtx_Place(layout, TL_VERTEX_POSITION, quantize ? 8 : 12);
+	layout->normal = tlVtx_Place(layout, TL_VERTEX_NORMAL, 4);
+	layout->texCoord = tlVtx_Place(layout, TL_VERTEX_TEXCOORD, layout->halfTexCoords ? 4 : 8);
+	layout->binormal = tlVtx_Place(layout, TL_VERTEX_BINORMAL, 4);
+	layout->tangent = tlVtx_Place(layout, TL_VERTEX_TANGENT, 4);
+	layout->color = tlVtx_Place(layout, TL_VERTEX_COLOR, 4);
+}
+
+static short tlVtx_Quantize(float x, float bias, float invScale) {
+	float q;
+
+	q = (x - bias)*invScale;
+	q = q < 0.0f ? q - 0.5f : q + 0.5f;
+
+	if (q < -32767.0f)
+		return -32767;
+	if (q > 32767.0f)
+		return 32767;
+
+	return (short)q;
+}
+static void tlVtx_PackSnorm3(signed char *dst, const float *src) {
+	float f;
+	int i;
+
+	for(i=0; i<3; i++) {
+		f = src[i] < -1.0f ? -1.0f : src[i] > 1.0f ? 1.0f : src[i];
+		f *= 127.0f;
+		dst[i] = (signed char)(f < 0.0f ? f - 0.5f : f + 0.5f);
+	}
+
+	dst[3] = 0;
+}
+
+void tlPackVertices(const TlVertexLayout *layout, void *dst, const TlVertex *src,
+size_t n) {
+	unsigned char *p;
+	TlVec3 invScale;
+	TlU16 *h;
+	short *q;
+	size_t i;
+
+	TL_ASSERT(layout != (const TlVertexLayout *)0);
+	TL_ASSERT(dst != (void *)0 || !n);
+
+	invScale.x = 1.0f/layout->scale.x;
+	invScale.y = 1.0f/layout->scale.y;
+	invScale.z = 1.0f/layout->scale.z;
+
+	p = (unsigned char *)dst;
+	for(i=0; i<n; i++, p += layout->stride) {
+		if (layout->quantized) {
+			q = (short *)(p + layout->position);
+			q[0] = tlVtx_Quantize(src[i].xyz[0], layout->bias.x, invScale.x);
+			q[1] = tlVtx_Quantize(src[i].xyz[1], layout->bias.y, invScale.y);
+			q[2] = tlVtx_Quantize(src[i].xyz[2], layout->bias.z, invScale.z);
+			q[3] = 0;
+		} else
+			memcpy((void *)(p + layout->position), (const void *)src[i].xyz, sizeof(src[i].xyz));
+
+		if (layout->attribs & TL_VERTEX_NORMAL)
+			tlVtx_PackSnorm3((signed char *)(p + layout->normal), src[i].norm);
+
+		if (layout->attribs & TL_VERTEX_TEXCOORD) {
+			if (layout->halfTexCoords) {
+				h = (TlU16 *)(p + layout->texCoord);
+				h[0] = tlFloatToHalf(src[i].st[0]);
+				h[1] = tlFloatToHalf(src[i].st[1]);
+			} else
+				memcpy((void *)(p + layout->texCoord), (const void *)src[i].st, sizeof(src[i].st));
+		}
+
+		if (layout->attribs & TL_VERTEX_BINORMAL)
+			tlVtx_PackSnorm3((signed char *)(p + layout->binormal), src[i].binorm);
+		if (layout->attribs & TL_VERTEX_TANGENT)
+			tlVtx_PackSnorm3((signed char *)(p + layout->tangent), src[i].tangent);
+
+		if (layout->attribs & TL_VERTEX_COLOR)
+			memcpy((void *)(p + layout->color), (const void *)src[i].color, sizeof(src[i].color));
+	}
+}
+
+TlMat4 *tlLoadVertexDequantize(TlMat4 *pOutM, const TlVertexLayout *layout) {
+	TL_ASSERT(pOutM != (TlMat4 *)0);
+	TL_ASSERT(layout != (const TlVertexLayout *)0);
+
+	if (!layout->quantized)
+		return tlLoadIdentity(pOutM);
+
+	tlLoadScaling(pOutM, layout->scale.x, layout->scale.y, layout->scale.z);
+	pOutM->xw = layout->bias.x;
+	pOutM->yw = layout->bias.y;
+	pOutM->zw = layout->bias.z;
+
+	return pOutM;
+}
+
+static void tlVtx_UnpackSnorm3(float *dst, const signed char *src) {
+	int i;
+
+	for(i=0; i<3; i++)
+		dst[i] = src[i] < -127 ? -1.0f : (float)src[i]/127.0f;
+}
+void tlUnpackVertices(const TlVertexLayout *layout, TlVertex *dst, const void *src,
+size_t n) {
+	const unsigned char *p;
+	const short *q;
+	const TlU16 *h;
+	size_t i;
+
+	TL_ASSERT(layout != (const TlVertexLayout *)0);
+	TL_ASSERT(dst != (TlVertex *)0 || !n);
+
+	/* attributes the layout doesn't have come out zeroed */
+	memset((void *)dst, 0, n*sizeof(*dst));
+
+	p = (const unsigned char *)src;
+	for(i=0; i<n; i++, p += layout->stride) {
+		if (layout->quantized) {
+			q = (const short *)(p + layout->position);
+			dst[i].xyz[0] = layout->bias.x + (float)q[0]*layout->scale.x;
+			dst[i].xyz[1] = layout->bias.y + (float)q[1]*layout->scale.y;
+			dst[i].xyz[2] = layout->bias.z + (float)q[2]*layout->scale.z;
+		} else
+			memcpy((void *)dst[i].xyz, (const void *)(p + layout->position), sizeof(dst[i].xyz));
+
+		if (layout->attribs & TL_VERTEX_NORMAL)
+			tlVtx_UnpackSnorm3(dst[i].norm, (const signed char *)(p + layout->normal));
+
+		if (layout->attribs & TL_VERTEX_TEXCOORD) {
+			if (layout->halfTexCoords) {
+				h = (const TlU16 *)(p + layout->texCoord);
+				dst[i].st[0] = tlHalfToFloat(h[0]);
+				dst[i].st[1] = tlHalfToFloat(h[1]);
+			} else
+				memcpy((void *)dst[i].st, (const void *)(p + layout->texCoord), sizeof(dst[i].st));
+		}
+
+		if (layout->attribs & TL_VERTEX_BINORMAL)
+			tlVtx_UnpackSnorm3(dst[i].binorm, (const signed char *)(p + layout->binormal));
+		if (layout->attribs & TL_VERTEX_TANGENT)
+			tlVtx_UnpackSnorm3(dst[i].tangent, (const signed char *)(p + layout->tangent));
+
+		if (layout->attribs & TL_VERTEX_COLOR)
+			memcpy((void *)dst[i].color, (const void *)(p + layout->color), sizeof(dst[i].color));
+	}
+}
+
+static void tlVtx_EnableArrays(TlU32 want) {
+	TlU32 change;
+
+	want &= VTX_OPTIONAL_ATTRIBS;
+	change = want ^ g_vtx_enabled;
+	if (!change)
+		return;
+
+	if (change & TL_VERTEX_NORMAL) {
+		if (want & TL_VERTEX_NORMAL)
+			glEnableClientState(GL_NORMAL_ARRAY);
+		else
+			glDisableClientState(GL_NORMAL_ARRAY);
+	}
+	if (change & TL_VERTEX_TEXCOORD) {
+		if (want & TL_VERTEX_TEXCOORD)
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		else
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	if (change & TL_VERTEX_BINORMAL) {
+		if (want & TL_VERTEX_BINORMAL)
+			tlR_EnableVertexAttribArray(TL_VERTEX_ATTRIB_BINORMAL);
+		else
+			tlR_DisableVertexAttribArray(TL_VERTEX_ATTRIB_BINORMAL);
+	}
+	if (change & TL_VERTEX_TANGENT) {
+		if (want & TL_VERTEX_TANGENT)
+			tlR_EnableVertexAttribArray(TL_VERTEX_ATTRIB_TANGENT);
+		else
+			tlR_DisableVertexAttribArray(TL_VERTEX_ATTRIB_TANGENT);
+	}
+
+	g_vtx_enabled = want;
+}
+
+#define VTX_OFFSET(x) ((const void *)(size_t)(x))
+
+void tlBindVertexLayout(const TlVertexLayout *layout) {
+	GLsizei stride;
+
+	TL_ASSERT(layout != (const TlVertexLayout *)0);
+
+	stride = (GLsizei)layout->stride;
+
+	glVertexPointer(3, layout->quantized ? GL_SHORT : GL_FLOAT, stride,
+		VTX_OFFSET(layout->position));
+	if (layout->attribs & TL_VERTEX_COLOR)
+		glColorPointer(4, GL_UNSIGNED_BYTE, stride, VTX_OFFSET(layout->color));
+
+	if (layout->attribs & TL_VERTEX_NORMAL)
+		glNormalPointer(GL_BYTE, stride, VTX_OFFSET(layout->normal));
+	if (layout->attribs & TL_VERTEX_TEXCOORD)
+		glTexCoordPointer(2, layout->halfTexCoords ? GL_HALF_FLOAT_ARB : GL_FLOAT,
+			stride, VTX_OFFSET(layout->texCoord));
+	if (layout->attribs & TL_VERTEX_BINORMAL)
+		tlR_VertexAttribPointer(TL_VERTEX_ATTRIB_BINORMAL, 3, GL_BYTE, GL_TRUE,
+			stride, VTX_OFFSET(layout->binormal));
+	if (layout->attribs & TL_VERTEX_TANGENT)
+		tlR_VertexAttribPointer(TL_VERTEX_ATTRIB_TANGENT, 3, GL_BYTE, GL_TRUE,
+			stride, VTX_OFFSET(layout->tangent));
+
+	tlVtx_EnableArrays(layout->attribs);
+}
+void tlResetVertexArrays(void) {
+	tlVtx_EnableArrays(0);
+}
+
+/*
+ * ==========================================================================
+ *
+ *	HALF FLOATS
+ *
+ * ==========================================================================
+ */
+
+typedef union {
+	float f;
+	TlU32 u;
+} VtxFloatBits;
+
+/* Round to nearest, ties to even; too large becomes infinity */
+TlU16 tlFloatToHalf(float f) {
+	TlU32 sign, exp, mant, shift, rem, half, h;
+	VtxFloatBits v;
+
+	v.f = f;
+
+	sign = (v.u >> 16) & 0x8000;
+	exp = (v.u >> 23) & 0xFF;
+	mant = v.u & 0x7FFFFF;
+
+	/* infinity or NaN (keeping NaNs quiet) */
+	if (exp == 0xFF)
+		return (TlU16)(sign | 0x7C00 | (mant ? 0x200 : 0));
+
+	/* 2^16 and up */
+	if (exp > 127 + 15)
+		return (TlU16)(sign | 0x7C00);
+
+	/* below 2^-14: subnormal, or zero below half of the smallest subnormal */
+	if (exp < 127 - 14) {
+		if (exp < 127 - 25)
+			return (TlU16)sign;
+
+		mant |= 0x800000;
+		shift = 126 - exp;
+
+		h = mant >> shift;
+		rem = mant & ((1U << shift) - 1);
+		half = 1U << (shift - 1);
+		if (rem > half || (rem == half && (h & 1)))
+			h++;
+
+		return (TlU16)(sign | h);
+	}
+
+	/* a carry out of the mantissa bumps the exponent (up to infinity) */
+	h = ((exp - 112) << 10) | (mant >> 13);
+	rem = mant & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+
+	return (TlU16)(sign | h);
+}
+float tlHalfToFloat(TlU16 h) {
+	TlU32 sign, exp, mant;
+	VtxFloatBits v;
+
+	sign = ((TlU32)h & 0x8000) << 16;
+	exp = ((TlU32)h >> 10) & 0x1F;
+	mant = (TlU32)h & 0x3FF;
+
+	if (exp == 0x1F) {
+		v.u = sign | 0x7F800000 | (mant << 13);
+		return v.f;
+	}
+
+	if (!exp) {
+		if (!mant) {
+			v.u = sign;
+			return v.f;
+		}
+
+		/* subnormal; normalize it */
+		exp = 127 - 14;
+		while (!(mant & 0x400)) {
+			mant <<= 1;
+			exp--;
+		}
+		mant &= 0x3FF;
+
+		v.u = sign | (exp << 23) | (mant << 13);
+		return v.f;
+	}
+
+	v.u = sign | ((exp + 112) << 23) | (mant << 13);
+	return v.f;
+}
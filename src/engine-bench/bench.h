@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <tile.h>
+
+/*
+===============================================================================
+
+	ENGINE BENCHMARKS
+
+	Each benchmark times one engine subsystem on synthetic data and checks the
+	results against a straightforward reference, so a run doubles as a test.
+	Benchmarks return FALSE if a check failed. None of them open a window; any
+	files they write go in the working directory and are removed afterward.
+
+===============================================================================
+*/
+
+/* seconds since an arbitrary point */
+double bench_seconds( void );
+
+/* deterministic pseudo-random numbers (xorshift64*) */
+void bench_seed( TlU64 seed );
+TlU64 bench_rand( void );
+/* in [lo, hi) */
+float bench_randf( float lo, float hi );
+
+/* report a failed check */
+void bench_fail( const char *name, const char *format, ... );
+
+TlBool bench_sort( void );
+TlBool bench_xform( void );
+TlBool bench_math( void );
+TlBool bench_scene( void );
+
+#endif
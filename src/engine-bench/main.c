@@ -0,0 +1,91 @@
+#include "bench.h"
+
+typedef struct benchEntry_s
+{
+	const char *name;
+	TlBool( *fn )( void );
+} benchEntry_t;
+
+static const benchEntry_t g_benches[] = {
+	{ "sort", &bench_sort },
+	{ "xform", &bench_xform },
+	{ "math", &bench_math },
+	{ "scene", &bench_scene }
+};
+#define NUM_BENCHES ( sizeof( g_benches )/sizeof( g_benches[ 0 ] ) )
+
+static TlU64 g_rand = 1;
+
+double bench_seconds( void )
+{
+	return ( double )tlSys_Microtime()/1000000.0;
+}
+
+void bench_seed( TlU64 seed )
+{
+	g_rand = seed ? seed : 1;
+}
+TlU64 bench_rand( void )
+{
+	g_rand ^= g_rand >> 12;
+	g_rand ^= g_rand << 25;
+	g_rand ^= g_rand >> 27;
+
+	return g_rand*( TlU64 )0x2545F4914F6CDD1DULL;
+}
+float bench_randf( float lo, float hi )
+{
+	return lo + ( hi - lo )*( float )( bench_rand() >> 40 )/( float )( 1 << 24 );
+}
+
+void bench_fail( const char *name, const char *format, ... )
+{
+	va_list args;
+
+	fprintf( stderr, "FAIL %s: ", name );
+
+	va_start( args, format );
+	vfprintf( stderr, format, args );
+	va_end( args );
+
+	fprintf( stderr, "\n" );
+}
+
+/*
+----------------
+main
+
+Runs the benchmarks named on the command line, or all of them. Exits with a
+nonzero status if any check failed.
+----------------
+*/
+int main( int argc, char **argv )
+{
+	TlBool passed, ran;
+	size_t i;
+	int j;
+
+	passed = TRUE;
+
+	for( i = 0; i < NUM_BENCHES; ++i ) {
+		ran = argc < 2;
+		for( j = 1; j < argc; ++j ) {
+			if( strcmp( argv[ j ], g_benches[ i ].name ) == 0 ) {
+				ran = TRUE;
+			}
+		}
+		if( !ran ) {
+			continue;
+		}
+
+		printf( "== %s ==\n", g_benches[ i ].name );
+		fflush( stdout );
+
+		if( !g_benches[ i ].fn() ) {
+			passed = FALSE;
+		}
+	}
+
+	printf( "%s\n", passed ? "PASS" : "FAIL" );
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,199 @@
+#include "bench.h"
+
+/*
+===============================================================================
+
+	MATRIX KERNELS
+
+	Checks the vectorized matrix functions against their scalar references
+	(tl*Ref) on random input; the results have to match bit for bit. Then
+	times both over large batches.
+
+===============================================================================
+*/
+
+#define MATH_NUM_CHECKS  100000
+#define MATH_NUM_BATCH   1000000
+#define MATH_NUM_REPS    5
+
+static void math_randAffine( TlMat4 *M )
+{
+	float *f;
+
+	tlLoadRotation( M, bench_randf( -180.0f, 180.0f ), bench_randf( -180.0f, 180.0f ), bench_randf( -180.0f, 180.0f ) );
+
+	f = ( float * )M;
+	f[ 0 ] *= bench_randf( 0.5f, 2.0f );
+	f[ 5 ] *= bench_randf( 0.5f, 2.0f );
+	f[ 12 ] = bench_randf( -100.0f, 100.0f );
+	f[ 13 ] = bench_randf( -100.0f, 100.0f );
+	f[ 14 ] = bench_randf( -100.0f, 100.0f );
+}
+static void math_randMatrix( TlMat4 *M )
+{
+	float *f;
+	int i;
+
+	f = ( float * )M;
+	for( i = 0; i < 16; ++i ) {
+		f[ i ] = bench_randf( -10.0f, 10.0f );
+	}
+}
+static void math_randVecs( TlVec3 *v, size_t n )
+{
+	size_t i;
+
+	for( i = 0; i < n; ++i ) {
+		v[ i ].x = bench_randf( -100.0f, 100.0f );
+		v[ i ].y = bench_randf( -100.0f, 100.0f );
+		v[ i ].z = bench_randf( -100.0f, 100.0f );
+	}
+}
+
+static TlBool math_check( void )
+{
+	TlMat4 P, Q, M, R;
+	TlVec3 in[ 16 ], out[ 16 ], ref[ 16 ];
+	int i;
+
+	for( i = 0; i < MATH_NUM_CHECKS; ++i ) {
+		math_randAffine( &P );
+		math_randAffine( &Q );
+
+		tlAffineMultiply( &M, &P, &Q );
+		tlAffineMultiplyRef( &R, &P, &Q );
+		if( memcmp( &M, &R, sizeof( M ) ) != 0 ) {
+			bench_fail( "math", "tlAffineMultiply differs from the reference (case %i)", i );
+			return FALSE;
+		}
+
+		tlLoadAffineInverse( &M, &P );
+		tlLoadAffineInverseRef( &R, &P );
+		if( memcmp( &M, &R, sizeof( M ) ) != 0 ) {
+			bench_fail( "math", "tlLoadAffineInverse differs from the reference (case %i)", i );
+			return FALSE;
+		}
+
+		math_randMatrix( &P );
+		math_randMatrix( &Q );
+		tlMultiply4( &M, &P, &Q );
+		tlMultiply4Ref( &R, &P, &Q );
+		if( memcmp( &M, &R, sizeof( M ) ) != 0 ) {
+			bench_fail( "math", "tlMultiply4 differs from the reference (case %i)", i );
+			return FALSE;
+		}
+
+		/* odd counts, and in place, to catch stores past the third lane */
+		math_randAffine( &P );
+		math_randVecs( in, 16 );
+		out[ 15 ] = in[ 15 ];
+		tlPointsLocalToGlobal( out, &P, in, 15 );
+		tlPointsLocalToGlobalRef( ref, &P, in, 15 );
+		if( memcmp( out, ref, 15*sizeof( TlVec3 ) ) != 0 || memcmp( &out[ 15 ], &in[ 15 ], sizeof( TlVec3 ) ) != 0 ) {
+			bench_fail( "math", "tlPointsLocalToGlobal differs from the reference (case %i)", i );
+			return FALSE;
+		}
+
+		tlVectorsLocalToGlobalRef( ref, &P, in, 15 );
+		tlVectorsLocalToGlobal( in, &P, in, 15 );
+		if( memcmp( in, ref, 15*sizeof( TlVec3 ) ) != 0 ) {
+			bench_fail( "math", "tlVectorsLocalToGlobal in place differs from the reference (case %i)", i );
+			return FALSE;
+		}
+	}
+
+	printf( "%i cases match the scalar reference (%s kernels)\n", MATH_NUM_CHECKS, tlMathKernelName() );
+	return TRUE;
+}
+
+static void math_report( const char *name, double best, double bestRef )
+{
+	printf( "%-24s %8.1f M/s (reference %8.1f M/s, %.2fx)\n", name, MATH_NUM_BATCH/best/1e6,
+		MATH_NUM_BATCH/bestRef/1e6, bestRef/best );
+}
+
+static void math_time( void )
+{
+	TlMat4 *mats, *outs, P;
+	TlVec3 *vecs, *vecOuts;
+	double t0, t, best, bestRef;
+	size_t i;
+	int rep;
+
+	mats = ( TlMat4 * )tlMemory( ( void * )0, MATH_NUM_BATCH*sizeof( TlMat4 ) );
+	outs = ( TlMat4 * )tlMemory( ( void * )0, MATH_NUM_BATCH*sizeof( TlMat4 ) );
+	vecs = ( TlVec3 * )tlMemory( ( void * )0, MATH_NUM_BATCH*sizeof( TlVec3 ) );
+	vecOuts = ( TlVec3 * )tlMemory( ( void * )0, MATH_NUM_BATCH*sizeof( TlVec3 ) );
+
+	for( i = 0; i < MATH_NUM_BATCH; ++i ) {
+		math_randAffine( &mats[ i ] );
+	}
+	math_randVecs( vecs, MATH_NUM_BATCH );
+	math_randAffine( &P );
+
+	/* parent times each child, as the transform update does */
+	best = bestRef = 1e9;
+	for( rep = 0; rep < MATH_NUM_REPS; ++rep ) {
+		t0 = bench_seconds();
+		tlAffineMultiplyArray( outs, &P, mats, MATH_NUM_BATCH );
+		t = bench_seconds() - t0;
+		best = t < best ? t : best;
+
+		t0 = bench_seconds();
+		for( i = 0; i < MATH_NUM_BATCH; ++i ) {
+			tlAffineMultiplyRef( &outs[ i ], &P, &mats[ i ] );
+		}
+		t = bench_seconds() - t0;
+		bestRef = t < bestRef ? t : bestRef;
+	}
+	math_report( "tlAffineMultiplyArray", best, bestRef );
+
+	best = bestRef = 1e9;
+	for( rep = 0; rep < MATH_NUM_REPS; ++rep ) {
+		t0 = bench_seconds();
+		for( i = 0; i < MATH_NUM_BATCH; ++i ) {
+			tlMultiply4( &outs[ i ], &P, &mats[ i ] );
+		}
+		t = bench_seconds() - t0;
+		best = t < best ? t : best;
+
+		t0 = bench_seconds();
+		for( i = 0; i < MATH_NUM_BATCH; ++i ) {
+			tlMultiply4Ref( &outs[ i ], &P, &mats[ i ] );
+		}
+		t = bench_seconds() - t0;
+		bestRef = t < bestRef ? t : bestRef;
+	}
+	math_report( "tlMultiply4", best, bestRef );
+
+	best = bestRef = 1e9;
+	for( rep = 0; rep < MATH_NUM_REPS; ++rep ) {
+		t0 = bench_seconds();
+		tlPointsLocalToGlobal( vecOuts, &P, vecs, MATH_NUM_BATCH );
+		t = bench_seconds() - t0;
+		best = t < best ? t : best;
+
+		t0 = bench_seconds();
+		tlPointsLocalToGlobalRef( vecOuts, &P, vecs, MATH_NUM_BATCH );
+		t = bench_seconds() - t0;
+		bestRef = t < bestRef ? t : bestRef;
+	}
+	math_report( "tlPointsLocalToGlobal", best, bestRef );
+
+	tlMemory( ( void * )vecOuts, 0 );
+	tlMemory( ( void * )vecs, 0 );
+	tlMemory( ( void * )outs, 0 );
+	tlMemory( ( void * )mats, 0 );
+}
+
+TlBool bench_math( void )
+{
+	bench_seed( 8 );
+
+	if( !math_check() ) {
+		return FALSE;
+	}
+
+	math_time();
+	return TRUE;
+}
@@ -0,0 +1,455 @@
+#include "bench.h"
+
+/*
+===============================================================================
+
+	SCENE FILES
+
+	Builds a scene of a little over 100MB (grids of 16- and 32-bit indexed,
+	quantized and float geometry, some with levels of detail, some shared
+	between surfaces), saves it, loads it back and saves that again. The two
+	files must match byte for byte, and every loaded entity and surface must
+	match the one it came from, down to each decoded vertex and index.
+
+	Then a small scene is damaged a few ways; each must fail to open.
+
+===============================================================================
+*/
+
+#define SCENE_FILE_A       "bench-scene-a.tlsc"
+#define SCENE_FILE_B       "bench-scene-b.tlsc"
+#define SCENE_FILE_DAMAGED "bench-scene-damaged.tlsc"
+
+#define SCENE_NUM_GRIDS   84
+#define SCENE_GRID_SIZE   180
+/* one grid has too many vertices for 16-bit indices */
+#define SCENE_LONG_GRID   300
+#define SCENE_CHAIN_DEPTH 4
+
+/* Fill `surf` with a bumpy grid of `size`x`size` vertices */
+static void scene_addGrid( TlSurface *surf, TlU32 size, float x0 )
+{
+	TlVertex *verts;
+	TlU32 *tris;
+	TlU32 x, z, i;
+
+	verts = tlAddSurfaceVertices( surf, size*size );
+	for( z = 0; z < size; ++z ) {
+		for( x = 0; x < size; ++x ) {
+			i = z*size + x;
+			tlSetVertexPosition( &verts[ i ], x0 + ( float )x*0.1f, bench_randf( 0.0f, 0.5f ), ( float )z*0.1f );
+			tlSetVertexNormal( &verts[ i ], bench_randf( -0.2f, 0.2f ), 1.0f, bench_randf( -0.2f, 0.2f ) );
+			tlSetVertexTexCoord( &verts[ i ], ( float )x/( float )size, ( float )z/( float )size );
+			verts[ i ].color[ 0 ] = ( unsigned char )bench_rand();
+			verts[ i ].color[ 1 ] = ( unsigned char )bench_rand();
+			verts[ i ].color[ 2 ] = ( unsigned char )bench_rand();
+			verts[ i ].color[ 3 ] = 255;
+		}
+	}
+
+	tris = tlAddSurfaceTriangles( surf, ( size - 1 )*( size - 1 )*2 );
+	for( z = 0; z + 1 < size; ++z ) {
+		for( x = 0; x + 1 < size; ++x ) {
+			i = z*size + x;
+			tris[ 0 ] = i;
+			tris[ 1 ] = i + size;
+			tris[ 2 ] = i + 1;
+			tris[ 3 ] = i + 1;
+			tris[ 4 ] = i + size;
+			tris[ 5 ] = i + size + 1;
+			tris += 6;
+		}
+	}
+}
+
+/* Returns the root of the new scene */
+static TlEntity *scene_build( TlBrush **brushes, TlU32 numBrushes )
+{
+	TlEntity *root, *ent, *prev, *sharer;
+	TlSurface *surf, *copy;
+	TlU32 i;
+
+	root = tlNewEntity( ( TlEntity * )0 );
+
+	prev = root;
+	for( i = 0; i < SCENE_NUM_GRIDS; ++i ) {
+		ent = tlNewEntity( i%SCENE_CHAIN_DEPTH != 0 ? prev : root );
+		tlSetEntityPosition( ent, bench_randf( -10.0f, 10.0f ), 0.0f, bench_randf( -10.0f, 10.0f ) );
+		tlTurnEntity( ent, 0.0f, bench_randf( 0.0f, 360.0f ), 0.0f );
+		prev = ent;
+
+		surf = tlNewSurface( ent );
+		scene_addGrid( surf, i == 0 ? SCENE_LONG_GRID : SCENE_GRID_SIZE, ( float )i );
+
+		tlAddSurfacePass( surf, brushes[ i%numBrushes ] );
+		if( i%5 == 0 ) {
+			tlAddSurfacePass( surf, brushes[ ( i + 1 )%numBrushes ] );
+		}
+		tlRequireSurfaceVertexAttribs( surf, i%2 ? TL_VERTEX_NORMAL | TL_VERTEX_TEXCOORD : TL_VERTEX_TEXCOORD );
+		tlSetSurfaceVertexQuantization( surf, i%3 == 1 ? TRUE : FALSE );
+		tlSetSurfaceUsage( surf, ( TlBufferUsage_t )( i%3 ) );
+
+		if( i%16 == 3 ) {
+			tlGenerateSurfaceLods( surf, 0, 0.0f );
+		}
+
+		/* a couple more surfaces drawing the same grid, on a child */
+		if( i%7 == 2 ) {
+			sharer = tlNewEntity( ent );
+			tlMoveEntity( sharer, 0.0f, 1.0f, 0.0f );
+
+			copy = tlNewSurface( sharer );
+			tlShareSurfaceGeometry( copy, surf );
+			tlAddSurfacePass( copy, brushes[ ( i + 2 )%numBrushes ] );
+
+			copy = tlNewSurface( sharer );
+			tlShareSurfaceGeometry( copy, surf );
+			tlAddSurfacePass( copy, brushes[ 0 ] );
+		}
+	}
+
+	return root;
+}
+
+static TlBool scene_sameBrush( TlBrush *a, TlBrush *b )
+{
+	if( a == tlFirstBrush() || b == tlFirstBrush() ) {
+		return a == b ? TRUE : FALSE;
+	}
+
+	return tlGetBrushDiffuseR( a ) == tlGetBrushDiffuseR( b )
+		&& tlGetBrushDiffuseG( a ) == tlGetBrushDiffuseG( b )
+		&& tlGetBrushDiffuseB( a ) == tlGetBrushDiffuseB( b )
+		&& tlGetBrushDiffuseA( a ) == tlGetBrushDiffuseA( b )
+		&& tlIsBrushLightingEnabled( a ) == tlIsBrushLightingEnabled( b ) ? TRUE : FALSE;
+}
+
+/*
+ * Compare the geometry of a surface as built against the same surface loaded
+ * back. The vertices are expected as packing and unpacking the originals with
+ * the layout the saver picks would leave them.
+ */
+static const char *scene_compareGeometry( TlSurface *orig, TlSurface *loaded )
+{
+	TlVertexLayout layout;
+	TlVertex *expected;
+	void *packed;
+	TlU32 i;
+	TlBool same;
+
+	if( tlGetSurfaceVertexCount( orig ) != tlGetSurfaceVertexCount( loaded )
+	|| tlGetSurfaceTriangleCount( orig ) != tlGetSurfaceTriangleCount( loaded ) ) {
+		return "vertex or triangle counts differ";
+	}
+	if( tlGetSurfaceLodCount( orig ) != tlGetSurfaceLodCount( loaded ) ) {
+		return "level of detail counts differ";
+	}
+	for( i = 0; i < tlGetSurfaceLodCount( orig ); ++i ) {
+		if( memcmp( ( const void * )tlGetSurfaceLod( orig, i ), ( const void * )tlGetSurfaceLod( loaded, i ),
+			sizeof( TlSurfaceLod ) ) != 0 ) {
+			return "levels of detail differ";
+		}
+	}
+
+	tlInitVertexLayout( &layout, orig->gpu.attribs | TL_VERTEX_COLOR, orig->gpu.quantize,
+		tlGetSurfaceBounds( orig ) );
+
+	packed = tlMemory( ( void * )0, orig->numVerts*layout.stride );
+	expected = ( TlVertex * )tlMemory( ( void * )0, orig->numVerts*sizeof( TlVertex ) );
+	tlPackVertices( &layout, packed, orig->verts, orig->numVerts );
+	tlUnpackVertices( &layout, expected, packed, orig->numVerts );
+
+	tlUnmapSurface( loaded );
+	same = memcmp( ( const void * )expected, ( const void * )loaded->verts, orig->numVerts*sizeof( TlVertex ) ) == 0;
+
+	tlMemory( ( void * )expected, 0 );
+	tlMemory( packed, 0 );
+
+	if( !same ) {
+		return "decoded vertices differ";
+	}
+
+	if( memcmp( ( const void * )orig->inds, ( const void * )loaded->inds, orig->numInds*sizeof( TlU32 ) ) != 0
+	|| memcmp( ( const void * )orig->lodInds, ( const void * )loaded->lodInds, orig->numLodInds*sizeof( TlU32 ) ) != 0 ) {
+		return "indices differ";
+	}
+
+	return ( const char * )0;
+}
+
+/* Walk both hierarchies together; they must have the same shape */
+static const char *scene_compareR( TlEntity *orig, TlEntity *loaded, TlU32 *numEnts, TlU32 *numSurfs )
+{
+	TlSurface *os, *ls;
+	TlEntity *oc, *lc;
+	const char *error;
+	TlU32 i;
+
+	++*numEnts;
+
+	if( memcmp( ( const void * )tlGetEntityLocalMatrix( orig ), ( const void * )tlGetEntityLocalMatrix( loaded ),
+		sizeof( TlMat4 ) ) != 0 ) {
+		return "entity local matrices differ";
+	}
+
+	for( os = orig->s_head, ls = loaded->s_head; os && ls; os = os->s_next, ls = ls->s_next ) {
+		++*numSurfs;
+
+		if( tlGetSurfaceUsage( os ) != tlGetSurfaceUsage( ls ) ) {
+			return "surface usage differs";
+		}
+		if( tlGetSurfacePassCount( os ) != tlGetSurfacePassCount( ls ) ) {
+			return "surface pass counts differ";
+		}
+		for( i = 0; i < tlGetSurfacePassCount( os ); ++i ) {
+			if( !scene_sameBrush( tlGetSurfacePass( os, i ), tlGetSurfacePass( ls, i ) ) ) {
+				return "surface pass brushes differ";
+			}
+		}
+
+		if( ( tlGetSurfaceGeometry( os ) == os ) != ( tlGetSurfaceGeometry( ls ) == ls ) ) {
+			return "geometry sharing differs";
+		}
+		if( tlGetSurfaceGeometry( os ) == os && ( error = scene_compareGeometry( os, ls ) ) != ( const char * )0 ) {
+			return error;
+		}
+	}
+	if( os || ls ) {
+		return "surface counts differ";
+	}
+
+	for( oc = orig->head, lc = loaded->head; oc && lc; oc = oc->next, lc = lc->next ) {
+		if( ( error = scene_compareR( oc, lc, numEnts, numSurfs ) ) != ( const char * )0 ) {
+			return error;
+		}
+	}
+	if( oc || lc ) {
+		return "child entity counts differ";
+	}
+
+	return ( const char * )0;
+}
+
+static TlBool scene_sameFiles( const char *a, const char *b )
+{
+	const void *p, *q;
+	size_t m, n;
+	TlBool same;
+
+	if( !( p = tlSys_MapFile( a, &m ) ) ) {
+		return FALSE;
+	}
+	if( !( q = tlSys_MapFile( b, &n ) ) ) {
+		tlSys_UnmapFile( p, m );
+		return FALSE;
+	}
+
+	same = m == n && memcmp( p, q, m ) == 0 ? TRUE : FALSE;
+
+	tlSys_UnmapFile( q, n );
+	tlSys_UnmapFile( p, m );
+
+	return same;
+}
+
+static TlBool scene_roundTrip( void )
+{
+	static const float colors[][ 4 ] = {
+		{ 1.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 0.5f }, { 0.2f, 0.4f, 0.6f, 1.0f }
+	};
+	TlBrush *brushes[ 4 ];
+	TlEntity *orig, *loaded;
+	TlSceneFile *file;
+	const char *error;
+	double t0, saveTime, openTime, instTime, resaveTime, checkTime;
+	size_t size, i;
+	TlU32 numEnts, numSurfs;
+	TlBool passed;
+
+	brushes[ 0 ] = tlFirstBrush();
+	for( i = 0; i < 3; ++i ) {
+		brushes[ i + 1 ] = tlNewBrush();
+		tlSetBrushDiffuse( brushes[ i + 1 ], colors[ i ][ 0 ], colors[ i ][ 1 ], colors[ i ][ 2 ], colors[ i ][ 3 ] );
+		if( i == 1 ) {
+			tlEnableBrushLighting( brushes[ i + 1 ] );
+		}
+	}
+
+	bench_seed( 19 );
+	orig = scene_build( brushes, 4 );
+
+	t0 = bench_seconds();
+	if( !tlSaveScene( SCENE_FILE_A, orig ) ) {
+		bench_fail( "scene", "couldn't save %s", SCENE_FILE_A );
+		return FALSE;
+	}
+	saveTime = bench_seconds() - t0;
+
+	t0 = bench_seconds();
+	if( !( file = tlOpenSceneFile( SCENE_FILE_A ) ) ) {
+		bench_fail( "scene", "couldn't open %s", SCENE_FILE_A );
+		remove( SCENE_FILE_A );
+		return FALSE;
+	}
+	openTime = bench_seconds() - t0;
+	size = tlGetSceneFileSize( file );
+
+	t0 = bench_seconds();
+	loaded = tlInstantiateScene( file, ( TlEntity * )0 );
+	tlReleaseSceneFile( file );
+	instTime = bench_seconds() - t0;
+
+	/* mapped geometry is written back out as it was read */
+	t0 = bench_seconds();
+	passed = tlSaveScene( SCENE_FILE_B, loaded );
+	resaveTime = bench_seconds() - t0;
+
+	if( !passed ) {
+		bench_fail( "scene", "couldn't save %s", SCENE_FILE_B );
+	} else if( !scene_sameFiles( SCENE_FILE_A, SCENE_FILE_B ) ) {
+		bench_fail( "scene", "saving the loaded scene didn't reproduce the file" );
+		passed = FALSE;
+	}
+
+	numEnts = 0;
+	numSurfs = 0;
+
+	t0 = bench_seconds();
+	if( passed && ( error = scene_compareR( orig, loaded, &numEnts, &numSurfs ) ) != ( const char * )0 ) {
+		bench_fail( "scene", "entity %u, surface %u: %s", ( unsigned )numEnts, ( unsigned )numSurfs, error );
+		passed = FALSE;
+	}
+	checkTime = bench_seconds() - t0;
+
+	if( passed ) {
+		printf( "%.1f MB, %u entities, %u surfaces\n", ( double )size/( 1024.0*1024.0 ), ( unsigned )numEnts,
+			( unsigned )numSurfs );
+		printf( "save %8.3f ms (%.0f MB/s)\n", saveTime*1000.0, ( double )size/( 1024.0*1024.0 )/saveTime );
+		printf( "open %8.3f ms (map and validate)\n", openTime*1000.0 );
+		printf( "instantiate %8.3f ms\n", instTime*1000.0 );
+		printf( "save again %8.3f ms (from the mapping)\n", resaveTime*1000.0 );
+		printf( "decode and compare %8.3f ms\n", checkTime*1000.0 );
+	}
+
+	tlDeleteEntity( loaded );
+	tlDeleteEntity( orig );
+	for( i = 1; i < 4; ++i ) {
+		tlDeleteBrush( brushes[ i ] );
+	}
+
+	remove( SCENE_FILE_B );
+	remove( SCENE_FILE_A );
+
+	return passed;
+}
+
+/*
+===============================================================================
+
+	DAMAGED FILES
+
+===============================================================================
+*/
+
+typedef enum {
+	kSceneDamage_None,
+	kSceneDamage_Index,
+	kSceneDamage_LodIndexCount,
+	kSceneDamage_Usage
+} SceneDamage_t;
+
+/* Write a copy of `data` with one thing broken; returns whether it opened */
+static TlBool scene_opensDamaged( const void *data, size_t size, SceneDamage_t damage )
+{
+	const TlSceneHeader *header;
+	TlSceneGeometry *geom;
+	TlSceneSurface *surf;
+	TlSceneFile *file;
+	char *copy;
+	FILE *fp;
+	TlBool opened;
+
+	copy = ( char * )tlMemory( ( void * )0, size );
+	memcpy( ( void * )copy, data, size );
+
+	header = ( const TlSceneHeader * )copy;
+	geom = ( TlSceneGeometry * )( copy + header->geometries );
+	surf = ( TlSceneSurface * )( copy + header->surfaces );
+
+	switch( damage ) {
+	case kSceneDamage_None:
+		break;
+	case kSceneDamage_Index:
+		( ( TlU16 * )( copy + geom->indices ) )[ 4 ] = ( TlU16 )geom->numVerts;
+		break;
+	case kSceneDamage_LodIndexCount:
+		geom->numLods = 1;
+		geom->lods[ 0 ].firstInd = 0;
+		geom->lods[ 0 ].numInds = geom->numInds - 1;
+		break;
+	case kSceneDamage_Usage:
+		surf->usage = 3;
+		break;
+	}
+
+	opened = FALSE;
+	if( ( fp = fopen( SCENE_FILE_DAMAGED, "wb" ) ) != ( FILE * )0 ) {
+		if( fwrite( ( const void * )copy, size, 1, fp ) == 1 && fclose( fp ) == 0 ) {
+			if( ( file = tlOpenSceneFile( SCENE_FILE_DAMAGED ) ) != ( TlSceneFile * )0 ) {
+				tlReleaseSceneFile( file );
+				opened = TRUE;
+			}
+		}
+		remove( SCENE_FILE_DAMAGED );
+	}
+
+	tlMemory( ( void * )copy, 0 );
+	return opened;
+}
+
+static TlBool scene_damaged( void )
+{
+	static const char *const names[] = { "undamaged", "index", "LOD index count", "usage" };
+	TlEntity *ent;
+	const void *data;
+	size_t size;
+	TlBool passed;
+	int damage;
+
+	ent = tlNewEntity( ( TlEntity * )0 );
+	scene_addGrid( tlNewSurface( ent ), 4, 0.0f );
+
+	passed = tlSaveScene( SCENE_FILE_A, ent );
+	tlDeleteEntity( ent );
+
+	if( !passed || !( data = tlSys_MapFile( SCENE_FILE_A, &size ) ) ) {
+		bench_fail( "scene", "couldn't save %s", SCENE_FILE_A );
+		remove( SCENE_FILE_A );
+		return FALSE;
+	}
+
+	/* the damaged files are reported as they're rejected */
+	printf( "opening damaged files (errors expected):\n" );
+	fflush( stdout );
+
+	for( damage = kSceneDamage_None; damage <= kSceneDamage_Usage; ++damage ) {
+		if( scene_opensDamaged( data, size, ( SceneDamage_t )damage ) != ( damage == kSceneDamage_None ) ) {
+			bench_fail( "scene", damage == kSceneDamage_None ? "the %s file didn't open" : "file with a bad %s opened",
+				names[ damage ] );
+			passed = FALSE;
+		}
+	}
+
+	tlSys_UnmapFile( data, size );
+	remove( SCENE_FILE_A );
+
+	return passed;
+}
+
+TlBool bench_scene( void )
+{
+	TlBool passed;
+
+	passed = scene_roundTrip();
+	return scene_damaged() && passed;
+}
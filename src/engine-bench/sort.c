@@ -0,0 +1,109 @@
+#include "bench.h"
+
+/*
+===============================================================================
+
+	RENDER QUEUE SORT
+
+	Times tlRQ_Sort() on 10k, 100k and 1M draw items with random keys, against
+	qsort() on the same items. The sort must be stable, so the result has to
+	match qsort() ordering by key, then by queue order.
+
+===============================================================================
+*/
+
+static int sort_cmpKeyOrder( const void *a, const void *b )
+{
+	const TlDrawItem *x = ( const TlDrawItem * )a;
+	const TlDrawItem *y = ( const TlDrawItem * )b;
+
+	if( x->key != y->key ) {
+		return x->key < y->key ? -1 : 1;
+	}
+	if( x->order != y->order ) {
+		return x->order < y->order ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* A key shaped like the queue's: a handful of layers and brushes, many depths */
+static TlU64 sort_randKey( void )
+{
+	TlU64 r;
+
+	r = bench_rand();
+	return TL_RQKEY_FIELD( ( r >> 8 )&0x3, PASS )
+		| TL_RQKEY_FIELD( r >> 16, DEPTH )
+		| TL_RQKEY_FIELD( ( r >> 32 )%200, BRUSH )
+		| TL_RQKEY_FIELD( ( r >> 40 )%5000, SURFACE );
+}
+
+TlBool bench_sort( void )
+{
+	static const size_t sizes[] = { 10000, 100000, 1000000 };
+	TlDrawItem *items, *ref;
+	TlEntity *camera;
+	TlView *view;
+	TlMat4 V;
+	double t0, radixBest, qsortBest;
+	size_t s, i, n;
+	int rep, numReps;
+
+	camera = tlNewEntity( ( TlEntity * )0 );
+	view = tlNewView( camera );
+	tlLoadIdentity( &V );
+
+	bench_seed( 1 );
+
+	for( s = 0; s < sizeof( sizes )/sizeof( sizes[ 0 ] ); ++s ) {
+		n = sizes[ s ];
+		numReps = n >= 1000000 ? 3 : n >= 100000 ? 10 : 50;
+
+		ref = ( TlDrawItem * )tlMemory( ( void * )0, n*sizeof( TlDrawItem ) );
+
+		radixBest = 1e9;
+		qsortBest = 1e9;
+		for( rep = 0; rep < numReps; ++rep ) {
+			tlRQ_BeginView( view, &V );
+
+			items = tlRQ_AddDrawItems( n );
+			memset( ( void * )items, 0, n*sizeof( TlDrawItem ) );
+			for( i = 0; i < n; ++i ) {
+				items[ i ].key = sort_randKey();
+				items[ i ].order = ( TlU32 )i;
+			}
+			memcpy( ( void * )ref, ( const void * )items, n*sizeof( TlDrawItem ) );
+
+			t0 = bench_seconds();
+			tlRQ_Sort();
+			t0 = bench_seconds() - t0;
+			radixBest = t0 < radixBest ? t0 : radixBest;
+
+			t0 = bench_seconds();
+			qsort( ( void * )ref, n, sizeof( TlDrawItem ), &sort_cmpKeyOrder );
+			t0 = bench_seconds() - t0;
+			qsortBest = t0 < qsortBest ? t0 : qsortBest;
+
+			items = tlRQ_Items();
+			for( i = 0; i < n; ++i ) {
+				if( items[ i ].key != ref[ i ].key || items[ i ].order != ref[ i ].order ) {
+					bench_fail( "sort", "%u items: item %u out of order", ( unsigned )n, ( unsigned )i );
+					tlMemory( ( void * )ref, 0 );
+					return FALSE;
+				}
+			}
+
+			tlResetFrameArenas();
+		}
+
+		printf( "%8u items: tlRQ_Sort %8.3f ms, qsort %8.3f ms (best of %i)\n", ( unsigned )n,
+			radixBest*1000.0, qsortBest*1000.0, numReps );
+
+		tlMemory( ( void * )ref, 0 );
+	}
+
+	tlDeleteView( view );
+	tlDeleteEntity( camera );
+	return TRUE;
+}
@@ -0,0 +1,162 @@
+#include "bench.h"
+
+/*
+===============================================================================
+
+	ENTITY TRANSFORMS
+
+	100k entities in chains of depth 1, 8 and 64. Each frame turns 1% of them
+	and replaces another 1% worth of short-lived leaf entities ("shots", like
+	projectiles despawning), then reads every global matrix the way the render
+	queue does. After a few frames of warm-up, frames must make no heap calls.
+	Afterward each global matrix is checked against one composed from the
+	locals.
+
+===============================================================================
+*/
+
+#define XFORM_NUM_ENTITIES 100000
+#define XFORM_NUM_SHOTS    ( XFORM_NUM_ENTITIES/100 )
+#define XFORM_NUM_FRAMES   50
+#define XFORM_WARMUP       5
+
+static TlBool xform_closeEnough( const TlMat4 *a, const TlMat4 *b )
+{
+	const float *p, *q;
+	float d;
+	int i;
+
+	p = &a->xx;
+	q = &b->xx;
+	for( i = 0; i < 16; ++i ) {
+		d = p[ i ] - q[ i ];
+		if( d < -1e-3f || d > 1e-3f ) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Delete last frame's shots and fire new ones from random entities */
+static void xform_fire( TlEntity **ents, TlEntity **shots )
+{
+	TlU32 i;
+
+	for( i = 0; i < XFORM_NUM_SHOTS; ++i ) {
+		if( shots[ i ] != ( TlEntity * )0 ) {
+			tlDeleteEntity( shots[ i ] );
+		}
+
+		shots[ i ] = tlNewEntity( ents[ bench_rand()%XFORM_NUM_ENTITIES ] );
+		tlSetEntityPosition( shots[ i ], 0.0f, 0.0f, bench_randf( 1.0f, 10.0f ) );
+	}
+}
+
+static TlBool xform_run( TlEntity **ents, TlEntity **shots, TlMat4 *ref, TlU32 depth )
+{
+	double t0, updateTime, walkTime;
+	TlU32 i, f, n, heapCalls;
+	TlMat4 shot;
+	float checksum;
+
+	/* chains are created root first, so ents[ i - 1 ] is the parent unless i starts a chain */
+	for( i = 0; i < XFORM_NUM_ENTITIES; ++i ) {
+		ents[ i ] = tlNewEntity( i%depth != 0 ? ents[ i - 1 ] : ( TlEntity * )0 );
+		tlSetEntityPosition( ents[ i ], bench_randf( -1.0f, 1.0f ), bench_randf( -1.0f, 1.0f ), 1.0f );
+		tlTurnEntity( ents[ i ], bench_randf( 0.0f, 90.0f ), bench_randf( 0.0f, 90.0f ), 0.0f );
+	}
+	memset( ( void * )shots, 0, XFORM_NUM_SHOTS*sizeof( *shots ) );
+	tlXf_Update();
+	tlResetFrameArenas();
+
+	updateTime = 0.0;
+	walkTime = 0.0;
+	checksum = 0.0f;
+	heapCalls = 0;
+
+	for( f = 0; f < XFORM_NUM_FRAMES; ++f ) {
+		if( f == XFORM_WARMUP ) {
+			heapCalls = tlGetHeapCallCount();
+		}
+
+		xform_fire( ents, shots );
+		for( n = 0; n < XFORM_NUM_ENTITIES/100; ++n ) {
+			tlTurnEntityY( ents[ bench_rand()%XFORM_NUM_ENTITIES ], 1.0f );
+		}
+
+		t0 = bench_seconds();
+		tlXf_Update();
+		updateTime += bench_seconds() - t0;
+
+		t0 = bench_seconds();
+		for( i = 0; i < XFORM_NUM_ENTITIES; ++i ) {
+			checksum += tlGetEntityGlobalMatrix( ents[ i ] )->xw;
+		}
+		walkTime += bench_seconds() - t0;
+
+		tlResetFrameArenas();
+	}
+
+	heapCalls = tlGetHeapCallCount() - heapCalls;
+
+	printf( "depth %2u: update %6.3f ms/frame, walk %6.3f ms/frame, %u heap calls after warm-up (checksum %g)\n",
+		( unsigned )depth, updateTime*1000.0/XFORM_NUM_FRAMES, walkTime*1000.0/XFORM_NUM_FRAMES, ( unsigned )heapCalls,
+		( double )checksum );
+
+	if( heapCalls != 0 ) {
+		bench_fail( "xform", "depth %u: %u heap calls in steady-state frames", ( unsigned )depth, ( unsigned )heapCalls );
+		return FALSE;
+	}
+
+	for( i = 0; i < XFORM_NUM_ENTITIES; ++i ) {
+		if( i%depth != 0 ) {
+			tlAffineMultiply( &ref[ i ], &ref[ i - 1 ], tlGetEntityLocalMatrix( ents[ i ] ) );
+		} else {
+			ref[ i ] = *tlGetEntityLocalMatrix( ents[ i ] );
+		}
+
+		if( !xform_closeEnough( tlGetEntityGlobalMatrix( ents[ i ] ), &ref[ i ] ) ) {
+			bench_fail( "xform", "depth %u: entity %u has a stale global matrix", ( unsigned )depth, ( unsigned )i );
+			return FALSE;
+		}
+	}
+
+	for( i = 0; i < XFORM_NUM_SHOTS; ++i ) {
+		tlAffineMultiply( &shot, tlGetEntityGlobalMatrix( tlGetEntityParent( shots[ i ] ) ),
+			tlGetEntityLocalMatrix( shots[ i ] ) );
+		if( !xform_closeEnough( tlGetEntityGlobalMatrix( shots[ i ] ), &shot ) ) {
+			bench_fail( "xform", "depth %u: shot %u has a stale global matrix", ( unsigned )depth, ( unsigned )i );
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+TlBool bench_xform( void )
+{
+	static const TlU32 depths[] = { 1, 8, 64 };
+	TlEntity **ents, **shots;
+	TlMat4 *ref;
+	TlBool passed;
+	size_t d;
+
+	ents = ( TlEntity ** )tlMemory( ( void * )0, XFORM_NUM_ENTITIES*sizeof( *ents ) );
+	shots = ( TlEntity ** )tlMemory( ( void * )0, XFORM_NUM_SHOTS*sizeof( *shots ) );
+	ref = ( TlMat4 * )tlMemory( ( void * )0, XFORM_NUM_ENTITIES*sizeof( *ref ) );
+
+	bench_seed( 6 );
+
+	passed = TRUE;
+	for( d = 0; d < sizeof( depths )/sizeof( depths[ 0 ] ) && passed; ++d ) {
+		passed = xform_run( ents, shots, ref, depths[ d ] );
+		tlDeleteAllEntities();
+	}
+
+	tlMemory( ( void * )ref, 0 );
+	tlMemory( ( void * )shots, 0 );
+	tlMemory( ( void * )ents, 0 );
+
+	return passed;
+}
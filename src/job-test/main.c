@@ -0,0 +1,271 @@
+#include <tile.h>
+
+/*
+===============================================================================
+
+	JOB SYSTEM TEST
+
+	Runs the job system through every thread count from 1 up to one per
+	processor (or the count given on the command line). At each count it
+	checks that:
+	- a burst of independent jobs (more than a deque holds) all run once
+	- tlJob_ParallelFor() covers every index exactly once, for awkward sizes
+	- jobs that submit and wait on jobs of their own, several levels deep,
+	  and parallel-fors nested in parallel-fors, all finish
+	then times a fixed parallel-for workload to show how it scales.
+
+===============================================================================
+*/
+
+#define TEST_NUM_BURST_JOBS  20000
+#define TEST_TREE_DEPTH      12
+#define TEST_NESTED_OUTER    64
+#define TEST_NESTED_INNER    1000
+#define TEST_SCALE_ITEMS     ( 1U << 20 )
+#define TEST_SCALE_REPS      5
+
+static volatile TlU32 g_count = 0;
+
+static TlBool test_check( TlBool cond, TlU32 numThreads, const char *what, TlU32 got, TlU32 expected )
+{
+	if( !cond ) {
+		fprintf( stderr, "FAIL (%u threads): %s: got %u, expected %u\n", ( unsigned )numThreads, what,
+			( unsigned )got, ( unsigned )expected );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+===============================================================================
+
+	BURST
+
+===============================================================================
+*/
+
+static void test_countJob( void *parm, TlU32 first, TlU32 last )
+{
+	( void )parm;
+
+	tlSys_AtomicAdd( &g_count, last - first );
+}
+
+static TlBool test_burst( TlU32 numThreads )
+{
+	TlJobCounter counter;
+	TlU32 i;
+
+	tlSys_AtomicStore( &g_count, 0 );
+
+	tlJob_InitCounter( &counter );
+	for( i = 0; i < TEST_NUM_BURST_JOBS; ++i ) {
+		tlJob_Run( &test_countJob, ( void * )0, i, i + 1, &counter );
+	}
+	tlJob_Wait( &counter );
+
+	return test_check( tlSys_AtomicLoad( &g_count ) == TEST_NUM_BURST_JOBS, numThreads, "burst jobs run",
+		tlSys_AtomicLoad( &g_count ), TEST_NUM_BURST_JOBS );
+}
+
+/*
+===============================================================================
+
+	PARALLEL-FOR
+
+===============================================================================
+*/
+
+static void test_markJob( void *parm, TlU32 first, TlU32 last )
+{
+	TlU32 *marks;
+	TlU32 i;
+
+	marks = ( TlU32 * )parm;
+	for( i = first; i < last; ++i ) {
+		++marks[ i ];
+	}
+}
+
+static TlBool test_parallelFor( TlU32 numThreads )
+{
+	static const TlU32 sizes[] = { 0, 1, 2, 7, 63, 64, 65, 1000, 4099, 100003 };
+	static const TlU32 grains[] = { 0, 1, 16, 1000 };
+	TlU32 *marks;
+	size_t s, g;
+	TlU32 i;
+
+	marks = ( TlU32 * )tlMemory( ( void * )0, 100003*sizeof( *marks ) );
+
+	for( s = 0; s < sizeof( sizes )/sizeof( sizes[ 0 ] ); ++s ) {
+		for( g = 0; g < sizeof( grains )/sizeof( grains[ 0 ] ); ++g ) {
+			memset( ( void * )marks, 0, sizes[ s ]*sizeof( *marks ) );
+
+			tlJob_ParallelFor( &test_markJob, ( void * )marks, sizes[ s ], grains[ g ] );
+
+			for( i = 0; i < sizes[ s ]; ++i ) {
+				if( !test_check( marks[ i ] == 1, numThreads, "parallel-for visits of an index", marks[ i ], 1 ) ) {
+					fprintf( stderr, "  (index %u of %u, grain %u)\n", ( unsigned )i, ( unsigned )sizes[ s ],
+						( unsigned )grains[ g ] );
+					tlMemory( ( void * )marks, 0 );
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	tlMemory( ( void * )marks, 0 );
+	return TRUE;
+}
+
+/*
+===============================================================================
+
+	NESTED WAITS
+
+===============================================================================
+*/
+
+/* Each job below the leaves submits two children to its own counter and waits on them */
+static void test_treeJob( void *parm, TlU32 first, TlU32 last )
+{
+	TlJobCounter counter;
+
+	( void )parm;
+	( void )last;
+
+	if( !first ) {
+		tlSys_AtomicAdd( &g_count, 1 );
+		return;
+	}
+
+	tlJob_InitCounter( &counter );
+	tlJob_Run( &test_treeJob, ( void * )0, first - 1, 0, &counter );
+	tlJob_Run( &test_treeJob, ( void * )0, first - 1, 0, &counter );
+	tlJob_Wait( &counter );
+}
+
+static void test_outerJob( void *parm, TlU32 first, TlU32 last )
+{
+	TlU32 i;
+
+	( void )parm;
+
+	for( i = first; i < last; ++i ) {
+		tlJob_ParallelFor( &test_countJob, ( void * )0, TEST_NESTED_INNER, 16 );
+	}
+}
+
+static TlBool test_nested( TlU32 numThreads )
+{
+	TlJobCounter counter;
+
+	tlSys_AtomicStore( &g_count, 0 );
+
+	tlJob_InitCounter( &counter );
+	tlJob_Run( &test_treeJob, ( void * )0, TEST_TREE_DEPTH, 0, &counter );
+	tlJob_Wait( &counter );
+
+	if( !test_check( tlSys_AtomicLoad( &g_count ) == 1U << TEST_TREE_DEPTH, numThreads, "job tree leaves",
+		tlSys_AtomicLoad( &g_count ), 1U << TEST_TREE_DEPTH ) ) {
+		return FALSE;
+	}
+
+	tlSys_AtomicStore( &g_count, 0 );
+
+	tlJob_ParallelFor( &test_outerJob, ( void * )0, TEST_NESTED_OUTER, 1 );
+
+	return test_check( tlSys_AtomicLoad( &g_count ) == TEST_NESTED_OUTER*TEST_NESTED_INNER, numThreads,
+		"nested parallel-for items", tlSys_AtomicLoad( &g_count ), TEST_NESTED_OUTER*TEST_NESTED_INNER );
+}
+
+/*
+===============================================================================
+
+	SCALING
+
+===============================================================================
+*/
+
+/* Enough arithmetic per item that the work, not the scheduling, dominates */
+static void test_workJob( void *parm, TlU32 first, TlU32 last )
+{
+	float *out;
+	float x;
+	TlU32 i;
+	int k;
+
+	out = ( float * )parm;
+	for( i = first; i < last; ++i ) {
+		x = ( float )i;
+		for( k = 0; k < 64; ++k ) {
+			x = x*0.999f + 1.0f;
+		}
+		out[ i ] = x;
+	}
+}
+
+static double test_scaling( void )
+{
+	float *out;
+	TlU64 t0, best;
+	int rep;
+
+	out = ( float * )tlMemory( ( void * )0, TEST_SCALE_ITEMS*sizeof( *out ) );
+
+	best = ~( TlU64 )0;
+	for( rep = 0; rep < TEST_SCALE_REPS; ++rep ) {
+		t0 = tlSys_Microtime();
+		tlJob_ParallelFor( &test_workJob, ( void * )out, TEST_SCALE_ITEMS, 1024 );
+		t0 = tlSys_Microtime() - t0;
+
+		best = t0 < best ? t0 : best;
+	}
+
+	tlMemory( ( void * )out, 0 );
+	return ( double )best/1000.0;
+}
+
+/*
+----------------
+main
+
+Usage: job-test [maxThreads]
+----------------
+*/
+int main( int argc, char **argv )
+{
+	TlU32 maxThreads, numThreads;
+	double ms, baseMs;
+	TlBool passed;
+
+	maxThreads = argc > 1 ? ( TlU32 )atoi( argv[ 1 ] ) : 0;
+	if( !maxThreads ) {
+		maxThreads = tlSys_NumCPUs();
+	}
+
+	passed = TRUE;
+	baseMs = 0.0;
+
+	for( numThreads = 1; numThreads <= maxThreads && passed; ++numThreads ) {
+		tlJob_Init( numThreads );
+
+		passed = test_burst( numThreads ) && test_parallelFor( numThreads ) && test_nested( numThreads );
+		if( passed ) {
+			ms = test_scaling();
+			if( numThreads == 1 ) {
+				baseMs = ms;
+			}
+
+			printf( "%2u threads: %8.3f ms (%.2fx)\n", ( unsigned )tlJob_NumThreads(), ms,
+				ms > 0.0 ? baseMs/ms : 0.0 );
+			fflush( stdout );
+		}
+
+		tlJob_Fini();
+	}
+
+	printf( "%s\n", passed ? "PASS" : "FAIL" );
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}